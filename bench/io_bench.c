@@ -0,0 +1,123 @@
+/*
+benchmark for reading ahead of a scan: a scan reading every leaf from a cold file - dropped from the OS page cache
+first - through a pool too small to keep it, with each leaf read as the scan gets to it, the leaves after each miss
+read together through io_uring (`pager_prefetch`, `--io uring`), or the OS asked to read the file ahead of the scan
+(`btree_read_ahead`), the leaves being in order in it.
+on a fast disk, or one cached below the OS (a virtual machine's), there's little to win: each read is over about as
+soon as it's asked for.
+reports ms per scan for each.
+build & run: `make bench`, or `gcc bench/io_bench.c -o bench/io_bench -fms-extensions -std=c23 -pthread -O3`
+usage: io_bench [rows]
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+
+#include <time.h>
+
+
+#define RUNS 5
+#define SCAN_FRAMES 256
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+typedef struct {
+    const char* name;
+    bool use_ring;
+    bool read_ahead;
+} Mode;
+
+static void build(const char* filename, uint32_t num_rows) {
+    unlink(filename);
+    Pager* pager = pager_open(filename, num_rows / 16 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+    for (uint32_t i = 1; i <= num_rows; i++) {
+        char username[COLUMN_USERNAME_SIZE + 1];
+        char email[COLUMN_EMAIL_SIZE + 1];
+        sprintf(username, "user%u", i);
+        sprintf(email, "user%u@example.com", i);
+        Row row;
+        row_encode(&(table.schema), i, (char*[]){username, email}, &row);
+        Cursor cursor;
+        btree_find(&table, row.id, &cursor);
+        leaf_node_insert(&cursor, row.id, &row);
+    }
+    pager_close(pager);
+}
+
+/* drop the file from the OS page cache, so reads go to the device */
+static void drop_cache(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/* walk the leaf chain of a cold file, the way `select` does. returns the leaves read */
+static uint32_t scan(const char* filename, const Mode* mode) {
+    Pager* pager = pager_open(filename, SCAN_FRAMES, false);
+    if (mode->use_ring) pager->ring = io_ring_open(PAGER_RING_ENTRIES);
+    if (!mode->read_ahead) pager->read_ahead_max = 0;
+    // the leaves of a table built in order sit in order in the file, and the OS would read ahead of any scan by itself:
+    // this keeps it to what it's asked for
+    posix_fadvise(pager->file_descriptor, 0, 0, POSIX_FADV_RANDOM);
+    pager_read_header(pager);
+    Table table = { .root_page_num = pager->header.root_page_num, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    Cursor cursor;
+    btree_find_latched(&table, 0, LATCH_READ, 0, &cursor);
+    uint32_t num_leaves = 1;
+    for (; !cursor.end_of_table; num_leaves++) btree_next_leaf(&cursor);
+    btree_unlatch(&cursor);
+    pager_close(pager);
+    return num_leaves - 1;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    IoRing* ring = io_ring_open(PAGER_RING_ENTRIES);
+    if (ring == NULL) {
+        printf("io_uring isn't available here\n");
+        return 1;
+    }
+    io_ring_close(ring);
+
+    const char* filename = "io_bench.db";
+    build(filename, num_rows);
+    const Mode modes[] = {
+        { "a page at a time", false, false }, { "io_uring", true, false }, { "read-ahead", false, true },
+    };
+    const uint32_t num_modes = sizeof modes / sizeof *modes;
+    double scan_us[3] = { 1e18, 1e18, 1e18 };
+    uint32_t num_leaves[3] = {0};
+    // they take turns, so they all see the disk in the same state
+    for (uint32_t run = 0; run < RUNS; run++) {
+        for (uint32_t i = 0; i < num_modes; i++) {
+            drop_cache(filename);
+            double start = now_us();
+            num_leaves[i] = scan(filename, &(modes[i]));
+            double elapsed_us = now_us() - start;
+            if (elapsed_us < scan_us[i]) scan_us[i] = elapsed_us;
+        }
+    }
+    printf("%u rows, %u-byte pages\n", num_rows, PAGE_SIZE);
+    for (uint32_t i = 0; i < num_modes; i++) {
+        printf(
+            "  %-16s cold scan %7.1f ms (%u leaves)\n", modes[i].name, scan_us[i] / 1e3, num_leaves[i]
+        );
+    }
+    unlink(filename);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+benchmark for concurrent readers: reader threads look up random keys through `btree_find_latched` while a writer thread
+inserts and deletes keys in between them (so leaves split and merge under the readers), for a second per reader count.
+reports reads/sec (which should grow with the readers, up to the number of cores) and writes/sec.
+every key a reader looks up is there throughout, so a miss means a reader saw a node halfway through a change.
+build & run: `make bench`, or `gcc bench/latch_bench.c -o bench/latch_bench -fms-extensions -std=c23 -pthread -O3`
+usage: latch_bench [rows] [max readers]
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+
+#define RUN_SECONDS 1
+
+typedef struct {
+    Table* table;
+    uint32_t num_rows;
+    uint32_t seed;
+    uint64_t num_ops;
+    uint64_t num_misses;
+    bool* inserted; // the writer's: which odd keys are in the table
+} Worker;
+
+static atomic_bool running;
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+/* the table holds the even keys, which readers look up. the writer churns the odd ones */
+static void* reader(void* argument) {
+    Worker* worker = argument;
+    Table* table = worker->table;
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        uint32_t key = 2 * (rand_r(&(worker->seed)) % worker->num_rows + 1);
+        Cursor cursor;
+        btree_find_latched(table, key, LATCH_READ, 0, &cursor);
+        LeafNode* node = (LeafNode*)get_page(table->pager, cursor.page_num);
+        if (cursor.cell_num >= node->num_cells || leaf_node_key(node, cursor.cell_num) != key) worker->num_misses++;
+        unpin_page(table->pager, cursor.page_num);
+        btree_unlatch(&cursor);
+        worker->num_ops++;
+    }
+    return NULL;
+}
+
+static void* writer(void* argument) {
+    Worker* worker = argument;
+    Table* table = worker->table;
+    bool* inserted = worker->inserted;
+    Row row;
+    row_encode(&(table->schema), 0, (char*[]){"user", "user@example.com"}, &row);
+    uint32_t cell_size = row_serialized_size(&row);
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        uint32_t i = rand_r(&(worker->seed)) % worker->num_rows;
+        row.id = 2 * i + 1;
+        Cursor cursor;
+        if (inserted[i]) {
+            btree_find_latched(table, row.id, LATCH_DELETE, 0, &cursor);
+            leaf_node_delete(&cursor);
+        } else {
+            btree_find_latched(table, row.id, LATCH_INSERT, cell_size, &cursor);
+            leaf_node_insert(&cursor, row.id, &row);
+        }
+        btree_unlatch(&cursor);
+        inserted[i] = !inserted[i];
+        worker->num_ops++;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    uint32_t max_readers = argc > 2 ? atoi(argv[2]) : 8;
+    const char* filename = "latch_bench.db";
+    unlink(filename);
+    // room for the odd keys too, so nothing is evicted
+    Pager* pager = pager_open(filename, num_rows / 16 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+
+    Row row;
+    row_encode(&(table.schema), 0, (char*[]){"user", "user@example.com"}, &row);
+    for (uint32_t i = 1; i <= num_rows; i++) {
+        row.id = 2 * i;
+        Cursor cursor;
+        btree_find(&table, row.id, &cursor);
+        leaf_node_insert(&cursor, row.id, &row);
+    }
+
+    pager->threaded = true;
+    bool* inserted = calloc(num_rows, sizeof *inserted);
+    printf("%ld cores\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (uint32_t num_readers = 1; num_readers <= max_readers; num_readers *= 2) {
+        pthread_t threads[num_readers + 1];
+        Worker workers[num_readers + 1];
+        atomic_store(&running, true);
+        for (uint32_t i = 0; i <= num_readers; i++) {
+            workers[i] = (Worker){ .table = &table, .num_rows = num_rows, .seed = i + 1, .inserted = inserted };
+            // the last one writes
+            pthread_create(&(threads[i]), NULL, i < num_readers ? reader : writer, &(workers[i]));
+        }
+        double start = now_us();
+        sleep(RUN_SECONDS);
+        atomic_store(&running, false);
+        for (uint32_t i = 0; i <= num_readers; i++) pthread_join(threads[i], NULL);
+        double elapsed_s = (now_us() - start) / 1e6;
+
+        uint64_t num_reads = 0;
+        uint64_t num_misses = 0;
+        for (uint32_t i = 0; i < num_readers; i++) {
+            num_reads += workers[i].num_ops;
+            num_misses += workers[i].num_misses;
+        }
+        printf(
+            "%2d readers + 1 writer: %10.0f reads/sec, %9.0f writes/sec, %lu misses\n",
+            num_readers, num_reads / elapsed_s, workers[num_readers].num_ops / elapsed_s, num_misses
+        );
+    }
+    free(inserted);
+    pager_close(pager);
+    unlink(filename);
+    return 0;
+}
@@ -0,0 +1,36 @@
+# rows/sec through `insert` statements (one per row, 1000 rows per statement, or a `begin`/`commit` batch) vs. `.load`,
+# and how full the resulting leaves are.
+# usage: ruby bench/load_bench.rb [rows] (run from the repo root, after `make build`)
+
+rows = (ARGV[0] || 200000).to_i
+db = "bench.db"
+input = "bench.tsv"
+
+keys = (1..rows).to_a.shuffle(random: Random.new(1))
+File.write(input, keys.map { |i| "#{i} user#{i} user#{i}@example.com\n" }.join)
+
+def run(db, script, options)
+    `rm -f #{db} #{db}-wal`
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    # output is discarded rather than read back, or a long script fills the pipe and deadlocks
+    IO.popen("./meinsql #{db} --no-color #{options} > /dev/null", "w") do |pipe|
+        pipe.write(script)
+    end
+    seconds = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    [seconds, File.size(db)]
+end
+
+[
+    ["insert statements", keys.map { |i| "insert #{i} user#{i} user#{i}@example.com\n" }.join + ".exit\n"],
+    ["multi-row inserts", keys.each_slice(1000).map { |slice|
+        "insert " + slice.map { |i| "(#{i},user#{i},user#{i}@example.com)" }.join(",") + "\n"
+    }.join + ".exit\n"],
+    ["begin/commit batch", "begin\n" + keys.map { |i| "insert #{i} user#{i} user#{i}@example.com\n" }.join + "commit\n.exit\n"],
+    [".load", ".load #{input}\n.exit\n"],
+    [".load, 90% fill", ".load #{input} 90\n.exit\n"],
+].each do |name, script|
+    seconds, bytes = run(db, script, "--sync off")
+    printf("%-20s %8d rows %8.3fs %10.0f rows/sec %8.1f MiB\n", name, rows, seconds, rows / seconds, bytes / 1048576.0)
+end
+
+`rm -f #{db} #{db}-wal #{input}`
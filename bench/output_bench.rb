@@ -0,0 +1,20 @@
+# rows/sec and MiB/sec of a full `select` piped into another program, per `--output` format.
+# usage: ruby bench/output_bench.rb [rows] (run from the repo root, after `make build`)
+
+rows = (ARGV[0] || 1000000).to_i
+db = "bench.db"
+input = "bench.tsv"
+
+File.write(input, (1..rows).map { |i| "#{i} user#{i} user#{i}@example.com\n" }.join)
+`rm -f #{db} #{db}-wal`
+`printf '.load #{input}\\n.exit\\n' | ./meinsql #{db} --no-color --sync off`
+
+["text", "tsv", "csv", "binary"].each do |format|
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    # `wc -c` stands in for the consumer, so the pipe is drained as fast as it can be
+    bytes = `printf 'select\\n.exit\\n' | ./meinsql #{db} --no-color --sync off --output #{format} 2> /dev/null | wc -c`.to_i
+    seconds = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    printf("%-8s %8d rows %8.3fs %10.0f rows/sec %8.1f MiB/sec\n", format, rows, seconds, rows / seconds, bytes / seconds / 1048576.0)
+end
+
+`rm -f #{db} #{db}-wal #{input}`
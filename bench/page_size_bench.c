@@ -0,0 +1,145 @@
+/*
+benchmark for page sizes: builds the same table in a file of each size, then reports how tall its tree is, and times
+a scan reading every leaf from the file (through a pool too small to keep any, so every page is a read) and random
+point lookups through a pool of the same few MiB at every size. the file stays in the OS page cache, so a read costs a
+system call and a copy: bigger pages take fewer of them to scan, and copy more per lookup that misses.
+reports levels, pages, ms per scan and us per lookup for each page size.
+build & run: `make bench`, or `gcc bench/page_size_bench.c -o bench/page_size_bench -fms-extensions -std=c23 -pthread -O3`
+usage: page_size_bench [rows]
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+
+#include <time.h>
+
+
+#define RUNS 5
+#define LOOKUPS 100000
+#define LOOKUP_POOL_SIZE (4 << 20) // bytes of frames for the lookups, whatever the page size
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+static void build(const char* filename, uint32_t num_rows) {
+    unlink(filename);
+    Pager* pager = pager_open(filename, num_rows / 16 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+    for (uint32_t i = 1; i <= num_rows; i++) {
+        char username[COLUMN_USERNAME_SIZE + 1];
+        char email[COLUMN_EMAIL_SIZE + 1];
+        sprintf(username, "user%u", i);
+        sprintf(email, "user%u@example.com", i);
+        Row row;
+        row_encode(&(table.schema), i, (char*[]){username, email}, &row);
+        Cursor cursor;
+        btree_find(&table, row.id, &cursor);
+        leaf_node_insert(&cursor, row.id, &row);
+    }
+    pager_close(pager);
+}
+
+/* levels of the tree, and its first leaf */
+static uint32_t descend(Pager* pager, uint32_t* first_leaf) {
+    uint32_t levels = 1;
+    uint32_t page_num = pager->header.root_page_num;
+    Node* node = get_page(pager, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child((InternalNode*)node, 0);
+        unpin_page(pager, page_num);
+        page_num = child_page_num;
+        node = get_page(pager, page_num);
+        levels++;
+    }
+    unpin_page(pager, page_num);
+    *first_leaf = page_num;
+    return levels;
+}
+
+/* walk the leaf chain from an empty pool. returns the leaves read */
+static uint32_t scan(const char* filename) {
+    Pager* pager = pager_open(filename, PAGER_MIN_FRAMES, false);
+    pager_read_header(pager);
+    uint32_t page_num;
+    descend(pager, &page_num);
+    uint32_t num_leaves = 0;
+    for (; page_num; num_leaves++) {
+        LeafNode* node = (LeafNode*)get_page(pager, page_num);
+        uint32_t next_page_num = node->next_leaf;
+        unpin_page(pager, page_num);
+        page_num = next_page_num;
+    }
+    pager_close(pager);
+    return num_leaves;
+}
+
+static uint32_t lookups(const char* filename, const uint32_t* keys) {
+    Pager* pager = pager_open(filename, LOOKUP_POOL_SIZE / PAGE_SIZE, false);
+    pager_read_header(pager);
+    Table table = { .root_page_num = pager->header.root_page_num, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+        Cursor cursor;
+        btree_find(&table, keys[i], &cursor);
+        found += !cursor.end_of_table;
+    }
+    pager_close(pager);
+    return found;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    const uint32_t page_sizes[] = { 4096, 16384, 65536 };
+    uint32_t* keys = malloc(LOOKUPS * sizeof *keys);
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < LOOKUPS; i++) keys[i] = 1 + rand_r(&seed) % num_rows;
+
+    const char* filename = "page_size_bench.db";
+    for (uint32_t s = 0; s < sizeof page_sizes / sizeof *page_sizes; s++) {
+        // the page size of a new file, like `--page-size`: `pager_open` keeps it when it finds no header
+        page_size = page_sizes[s];
+        build(filename, num_rows);
+        Pager* pager = pager_open(filename, PAGER_MIN_FRAMES, false);
+        pager_read_header(pager);
+        uint32_t first_leaf;
+        uint32_t levels = descend(pager, &first_leaf);
+        uint32_t num_pages = pager->num_pages;
+        pager_close(pager);
+
+        uint32_t num_leaves = 0;
+        double scan_us = 1e18;
+        for (uint32_t run = 0; run < RUNS; run++) {
+            double start = now_us();
+            num_leaves = scan(filename);
+            double elapsed_us = now_us() - start;
+            if (elapsed_us < scan_us) scan_us = elapsed_us;
+        }
+        uint32_t found = 0;
+        double lookup_us = 1e18;
+        for (uint32_t run = 0; run < RUNS; run++) {
+            double start = now_us();
+            found = lookups(filename, keys);
+            double elapsed_us = now_us() - start;
+            if (elapsed_us < lookup_us) lookup_us = elapsed_us;
+        }
+        printf(
+            "%5u-byte pages: %u levels, %6u pages (%6u leaves), scan %7.1f ms, lookup %5.2f us (%u found, %u frames)\n",
+            PAGE_SIZE, levels, num_pages, num_leaves, scan_us / 1e3, lookup_us / LOOKUPS, found, LOOKUP_POOL_SIZE / PAGE_SIZE
+        );
+    }
+    unlink(filename);
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+benchmark for parallel scans: counts the rows of a table, and the rows matching a filter on a column, with `parallel_scan`
+on 1, 2, 4... workers, each counting the rows of its own ranges (their `aggregate`, which `parallel_scan` adds up).
+reports rows scanned/sec and the speedup over one worker, which should be close to the number of workers, up to the
+number of cores.
+build & run: `make bench`, or `gcc bench/parallel_scan_bench.c -o bench/parallel_scan_bench -fms-extensions -std=c23 -pthread -O3`
+usage: parallel_scan_bench [rows] [max workers]
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+#include "../src/scan.h"
+
+#include <time.h>
+
+
+#define RUNS 5
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+static void count_range(ParallelScan* scan, ScanRange* range) {
+    bool* filter = scan->argument; // only count the rows whose username ends in 7
+    Cursor cursor;
+    scan_seek(scan, range, &cursor);
+    while (!cursor.end_of_table) {
+        LeafNode* node = (LeafNode*)snapshot_get_page(&(scan->snapshot), cursor.page_num);
+        for (; cursor.cell_num < node->num_cells; cursor.cell_num++) {
+            RowView row;
+            uint16_t offset = node->slots[cursor.cell_num];
+            row_view((uint8_t*)node + offset, PAGE_USABLE_SIZE - offset, &row);
+            if (row.id > range->max_key) break;
+            if (*filter) {
+                uint32_t length;
+                const uint8_t* field = row_field(&(scan->table->schema), row.body, 1, &length);
+                if (field[length - 1] != '7') continue;
+            }
+            range->aggregate.count++;
+        }
+        bool done = cursor.cell_num < node->num_cells;
+        snapshot_put_page(&(scan->snapshot), cursor.page_num, (Node*)node);
+        if (done) break;
+        btree_next_leaf_snapshot(&(scan->snapshot), &cursor);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    uint32_t max_workers = argc > 2 ? atoi(argv[2]) : 8;
+    const char* filename = "parallel_scan_bench.db";
+    unlink(filename);
+    // room for every row, so scans don't read from disk
+    Pager* pager = pager_open(filename, num_rows / 64 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+
+    for (uint32_t i = 1; i <= num_rows; i++) {
+        char username[COLUMN_USERNAME_SIZE + 1];
+        char email[COLUMN_EMAIL_SIZE + 1];
+        sprintf(username, "user%u", i);
+        sprintf(email, "user%u@example.com", i);
+        Row row;
+        row_encode(&(table.schema), i, (char*[]){username, email}, &row);
+        Cursor cursor;
+        btree_find(&table, row.id, &cursor);
+        leaf_node_insert(&cursor, row.id, &row);
+    }
+
+    printf("%ld cores\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (uint32_t i = 0; i < 2; i++) {
+        bool filter = i;
+        double base_us = 0;
+        for (uint32_t num_workers = 1; num_workers <= max_workers; num_workers *= 2) {
+            Aggregate count;
+            double best_us = 1e18;
+            for (uint32_t run = 0; run < RUNS; run++) {
+                double start = now_us();
+                count = parallel_scan(&table, 0, UINT32_MAX, num_workers, false, count_range, &filter);
+                double elapsed_us = now_us() - start;
+                if (elapsed_us < best_us) best_us = elapsed_us;
+            }
+            if (num_workers == 1) base_us = best_us;
+            printf(
+                "%-9s %2u workers: %7.1f ms, %6.1fM rows/sec, %.2fx, %lu rows counted\n",
+                filter ? "filtered" : "count(*)", num_workers, best_us / 1e3, num_rows / best_us, base_us / best_us,
+                count.count
+            );
+        }
+    }
+    pager_close(pager);
+    unlink(filename);
+    return 0;
+}
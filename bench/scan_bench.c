@@ -0,0 +1,100 @@
+/*
+microbenchmark for full scans: walks every leaf of an in-memory tree (no REPL, nothing evicted) and reads each row
+either by copying it into a `Row` (`deserialize_row`) or by viewing it in place (`row_view`).
+build & run: `make bench`, or `gcc bench/scan_bench.c -o bench/scan_bench -fms-extensions -std=c23 -O3`
+usage: scan_bench [rows]
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+
+#include <time.h>
+
+
+#define SCAN_PASSES 10
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+static uint32_t first_leaf(Table* table) {
+    uint32_t page_num = table->root_page_num;
+    Node* node = get_page(table->pager, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child((InternalNode*)node, 0);
+        unpin_page(table->pager, page_num);
+        page_num = child_page_num;
+        node = get_page(table->pager, page_num);
+    }
+    unpin_page(table->pager, page_num);
+    return page_num;
+}
+
+/* sums a few bytes of every row, so neither path can skip reading them */
+static uint64_t scan(Table* table, bool copy) {
+    uint64_t checksum = 0;
+    Row row;
+    RowView view;
+    for (uint32_t page_num = first_leaf(table); page_num;) {
+        LeafNode* node = (LeafNode*)get_page(table->pager, page_num);
+        for (uint32_t i = 0; i < node->num_cells; i++) {
+            uint16_t offset = node->slots[i];
+            if (copy) {
+                deserialize_row((uint8_t*)node + offset, PAGE_USABLE_SIZE - offset, &row);
+                checksum += row.id + row.body[0] + row.body[row.size - 1];
+            } else {
+                row_view((uint8_t*)node + offset, PAGE_USABLE_SIZE - offset, &view);
+                checksum += view.id + view.body[0] + view.body[view.body_size - 1];
+            }
+        }
+        uint32_t next_page_num = node->next_leaf;
+        unpin_page(table->pager, page_num);
+        page_num = next_page_num;
+    }
+    return checksum;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char* filename = "scan_bench.db";
+    unlink(filename);
+    Pager* pager = pager_open(filename, num_rows / 64 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+
+    Row row;
+    char username[COLUMN_USERNAME_SIZE + 1];
+    char email[COLUMN_EMAIL_SIZE + 1];
+    char* values[] = {username, email};
+    for (uint32_t i = 1; i <= num_rows; i++) {
+        snprintf(username, sizeof username, "user%d", i);
+        snprintf(email, sizeof email, "user%d@example.com", i);
+        row_encode(&(table.schema), i, values, &row);
+        Cursor cursor;
+        btree_find(&table, i, &cursor);
+        leaf_node_insert(&cursor, i, &row);
+    }
+
+    for (uint32_t copy = 0; copy < 2; copy++) {
+        uint64_t checksum = 0;
+        double start = now_us();
+        for (uint32_t pass = 0; pass < SCAN_PASSES; pass++) checksum += scan(&table, copy);
+        double elapsed_us = now_us() - start;
+        printf(
+            "%-5s %8d rows x %d: %10.0f rows/sec (checksum %lu)\n",
+            copy ? "copy" : "view", num_rows, SCAN_PASSES, num_rows * (double)SCAN_PASSES / (elapsed_us / 1e6), checksum
+        );
+    }
+    pager_close(pager);
+    unlink(filename);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+benchmark for key search in internal nodes: the binary search they had before (a branch per probe, which mispredicts
+about half the time) against the branchless search of search.h, with each kernel the CPU can run.
+first within one full node, checked against the binary search on every node size, then for point lookups in a tree -
+descents from the root to a key's leaf, every page in the pool, so only the searches differ. the searchers take turns,
+run after run, so they all see the machine in the same state. the default tree fits in the CPU's caches: in larger ones
+a lookup mostly waits for memory, whichever search it runs.
+reports ns per search and per lookup.
+build & run: `make bench`, or `gcc bench/search_bench.c -o bench/search_bench -fms-extensions -std=c23 -pthread -O3`
+usage: search_bench [rows]
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+#include "../src/search.h"
+
+#include <time.h>
+
+
+#define RUNS 5
+#define PROBES 1000000
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+/* `internal_node_find_child` before search.h */
+static uint32_t binary_find_child(InternalNode* node, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = node->num_keys;
+    while (min_index < max_index) {
+        uint32_t curr_index = (min_index + max_index) / 2;
+        uint32_t curr_key = *internal_node_key(node, curr_index);
+        if (key > curr_key) {
+            min_index = curr_index + 1;
+        } else if (key < curr_key) {
+            max_index = curr_index;
+        } else {
+            min_index = curr_index;
+            break;
+        }
+    }
+    return min_index;
+}
+
+typedef struct {
+    const char* name;
+    KeyCountKernel kernel; // NULL: the binary searches
+    uint32_t block;
+} Searcher;
+
+static void use(const Searcher* searcher) {
+    if (searcher->kernel) key_search_use(searcher->kernel, searcher->block);
+}
+
+/* descend from the root to the cell `key` is in (or goes into), the way `btree_find` does */
+static uint32_t lookup(Table* table, uint32_t key, bool binary) {
+    uint32_t page_num = table->root_page_num;
+    Node* node = get_page(table->pager, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        InternalNode* internal_node = (InternalNode*)node;
+        uint32_t child_idx = binary ? binary_find_child(internal_node, key) : internal_node_find_child(internal_node, key);
+        uint32_t child_page_num = *internal_node_child(internal_node, child_idx);
+        unpin_page(table->pager, page_num);
+        page_num = child_page_num;
+        node = get_page(table->pager, page_num);
+    }
+    uint32_t cell_num = leaf_node_find_cell((LeafNode*)node, key);
+    unpin_page(table->pager, page_num);
+    return cell_num;
+}
+
+static uint32_t tree_levels(Table* table) {
+    uint32_t levels = 1;
+    uint32_t page_num = table->root_page_num;
+    Node* node = get_page(table->pager, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child((InternalNode*)node, 0);
+        unpin_page(table->pager, page_num);
+        page_num = child_page_num;
+        node = get_page(table->pager, page_num);
+        levels++;
+    }
+    unpin_page(table->pager, page_num);
+    return levels;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_rows = argc > 1 ? atoi(argv[1]) : 200000;
+    const char* default_kernel = key_search_kernel_name();
+    Searcher searchers[4] = {{ "binary search", NULL, 0 }, { "scalar", keys_count_less_scalar, 8 }};
+    uint32_t num_searchers = 2;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse4.2")) {
+        searchers[num_searchers++] = (Searcher){ "sse4.2", keys_count_less_sse4, 16 };
+    }
+    if (__builtin_cpu_supports("popcnt") && __builtin_cpu_supports("avx2")) {
+        searchers[num_searchers++] = (Searcher){ "avx2", keys_count_less_avx2, 32 };
+    }
+#endif
+
+    // a full node, with keys up in the top half of the range too (compares are unsigned)
+    Node* page = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    InternalNode* node = (InternalNode*)page;
+    initialize_internal_node(node);
+    uint32_t seed = 1;
+    uint32_t key = 0;
+    node->num_keys = INTERNAL_NODE_MAX_KEYS;
+    for (uint32_t i = 0; i < INTERNAL_NODE_MAX_KEYS; i++) {
+        key += 1 + rand_r(&seed) % (UINT32_MAX / INTERNAL_NODE_MAX_KEYS - 1);
+        *internal_node_key(node, i) = key;
+    }
+    uint32_t* probes = malloc(PROBES * sizeof *probes);
+    for (uint32_t i = 0; i < PROBES; i++) {
+        // half of them exact keys, the rest anywhere
+        probes[i] = i % 2 ? *internal_node_key(node, rand_r(&seed) % INTERNAL_NODE_MAX_KEYS) : (uint32_t)rand_r(&seed) * 2u + (i & 4);
+    }
+    // every kernel agrees with the binary search, on nodes of every size
+    for (uint32_t s = 1; s < num_searchers; s++) {
+        use(&(searchers[s]));
+        for (uint32_t num_keys = 0; num_keys <= INTERNAL_NODE_MAX_KEYS; num_keys++) {
+            node->num_keys = num_keys;
+            for (uint32_t i = 0; i < 2000; i++) {
+                if (internal_node_find_child(node, probes[i]) != binary_find_child(node, probes[i])) {
+                    printf("%s: wrong child for %u in %u keys\n", searchers[s].name, probes[i], num_keys);
+                    return 1;
+                }
+            }
+        }
+    }
+    node->num_keys = INTERNAL_NODE_MAX_KEYS;
+    printf("one node, %u keys\n", INTERNAL_NODE_MAX_KEYS);
+    for (uint32_t s = 0; s < num_searchers; s++) {
+        use(&(searchers[s]));
+        double best_us = 1e18;
+        uint64_t sum = 0;
+        for (uint32_t run = 0; run < RUNS; run++) {
+            double start = now_us();
+            for (uint32_t i = 0; i < PROBES; i++) {
+                sum += searchers[s].kernel ? internal_node_find_child(node, probes[i]) : binary_find_child(node, probes[i]);
+            }
+            double elapsed_us = now_us() - start;
+            if (elapsed_us < best_us) best_us = elapsed_us;
+        }
+        printf("  %-14s %6.2f ns/search (%lu)\n", searchers[s].name, best_us * 1e3 / PROBES, sum / RUNS);
+    }
+    free(page);
+
+    const char* filename = "search_bench.db";
+    unlink(filename);
+    // room for every row, so lookups don't read from disk
+    Pager* pager = pager_open(filename, num_rows / 64 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+    for (uint32_t i = 1; i <= num_rows; i++) {
+        char username[COLUMN_USERNAME_SIZE + 1];
+        char email[COLUMN_EMAIL_SIZE + 1];
+        sprintf(username, "user%u", i);
+        sprintf(email, "user%u@example.com", i);
+        Row row;
+        row_encode(&(table.schema), i, (char*[]){username, email}, &row);
+        Cursor cursor;
+        btree_find(&table, row.id, &cursor);
+        leaf_node_insert(&cursor, row.id, &row);
+    }
+    for (uint32_t i = 0; i < PROBES; i++) probes[i] = 1 + rand_r(&seed) % num_rows;
+
+    printf("point lookups, %u rows, %u levels\n", num_rows, tree_levels(&table));
+    double best_us[4] = { 1e18, 1e18, 1e18, 1e18 };
+    uint64_t sums[4] = {0};
+    for (uint32_t run = 0; run < 2 * RUNS; run++) {
+        for (uint32_t s = 0; s < num_searchers; s++) {
+            use(&(searchers[s]));
+            double start = now_us();
+            for (uint32_t i = 0; i < PROBES; i++) sums[s] += lookup(&table, probes[i], searchers[s].kernel == NULL);
+            double elapsed_us = now_us() - start;
+            if (elapsed_us < best_us[s]) best_us[s] = elapsed_us;
+        }
+    }
+    for (uint32_t s = 0; s < num_searchers; s++) {
+        printf(
+            "  %-14s %6.1f ns/lookup, %+.1f%% (%lu)\n", searchers[s].name, best_us[s] * 1e3 / PROBES,
+            (best_us[s] / best_us[0] - 1) * 100, sums[s] / (2 * RUNS)
+        );
+    }
+    printf("picked at startup: %s\n", default_kernel);
+    pager_close(pager);
+    unlink(filename);
+    free(probes);
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+benchmark for long scans next to a writer: a scanner thread counts every row of the table, over and over, while a writer
+thread moves rows around (each write deletes one row and inserts another, then publishes), for a second per kind of scan.
+the table always has the same number of rows between writes, so a scan that counts any other number saw part of a write.
+latched scans (`btree_next_leaf`) only see each leaf whole, snapshot scans (`btree_seek_snapshot`) see the table whole.
+reports scans/sec, writes/sec and how many scans were off.
+build & run: `make bench`, or `gcc bench/snapshot_bench.c -o bench/snapshot_bench -fms-extensions -std=c23 -pthread -O3`
+usage: snapshot_bench [slots] (the table holds 1.5 rows per slot)
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+
+#define RUN_SECONDS 1
+
+typedef enum { SCAN_NONE, SCAN_LATCHED, SCAN_SNAPSHOT } ScanKind;
+
+static const char* scan_kind_names[] = {
+    [SCAN_NONE] = "no scans",
+    [SCAN_LATCHED] = "latched scans",
+    [SCAN_SNAPSHOT] = "snapshot scans",
+};
+
+typedef struct {
+    Table* table;
+    ScanKind kind;
+    uint32_t num_rows; // in the table between writes
+    uint32_t num_slots; // keys the writer moves rows between
+    uint32_t seed;
+    uint64_t num_ops;
+    uint64_t num_inconsistent;
+    bool* inserted; // the writer's: which slots have a row
+} Worker;
+
+static atomic_bool running;
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+static uint32_t count_latched(Table* table) {
+    uint32_t num_rows = 0;
+    Cursor cursor;
+    btree_find_latched(table, 0, LATCH_READ, 0, &cursor);
+    while (!cursor.end_of_table) {
+        LeafNode* node = (LeafNode*)get_page(table->pager, cursor.page_num);
+        if (node->num_cells > cursor.cell_num) num_rows += node->num_cells - cursor.cell_num;
+        cursor.cell_num = node->num_cells;
+        unpin_page(table->pager, cursor.page_num);
+        btree_next_leaf(&cursor);
+    }
+    btree_unlatch(&cursor);
+    return num_rows;
+}
+
+static uint32_t count_snapshot(Table* table) {
+    uint32_t num_rows = 0;
+    Snapshot snapshot = snapshot_begin(table->pager);
+    Cursor cursor;
+    btree_seek_snapshot(table, &snapshot, 0, &cursor);
+    while (!cursor.end_of_table) {
+        Node* node = snapshot_get_page(&snapshot, cursor.page_num);
+        num_rows += ((LeafNode*)node)->num_cells - cursor.cell_num;
+        snapshot_put_page(&snapshot, cursor.page_num, node);
+        btree_next_leaf_snapshot(&snapshot, &cursor);
+    }
+    snapshot_end(&snapshot);
+    return num_rows;
+}
+
+static void* scanner(void* argument) {
+    Worker* worker = argument;
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        uint32_t num_rows = worker->kind == SCAN_LATCHED ? count_latched(worker->table) : count_snapshot(worker->table);
+        if (num_rows != worker->num_rows) worker->num_inconsistent++;
+        worker->num_ops++;
+    }
+    return NULL;
+}
+
+/* slot `i` is key `2 * i + 1`: the odd keys, in between the rows that stay put */
+static void* writer(void* argument) {
+    Worker* worker = argument;
+    Table* table = worker->table;
+    bool* inserted = worker->inserted;
+    Row row;
+    row_encode(&(table->schema), 0, (char*[]){"user", "user@example.com"}, &row);
+    uint32_t cell_size = row_serialized_size(&row);
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        uint32_t from;
+        uint32_t to;
+        do from = rand_r(&(worker->seed)) % worker->num_slots; while (!inserted[from]);
+        do to = rand_r(&(worker->seed)) % worker->num_slots; while (inserted[to]);
+        Cursor cursor;
+        btree_find_latched(table, 2 * from + 1, LATCH_DELETE, 0, &cursor);
+        leaf_node_delete(&cursor);
+        btree_unlatch(&cursor);
+        row.id = 2 * to + 1;
+        btree_find_latched(table, row.id, LATCH_INSERT, cell_size, &cursor);
+        leaf_node_insert(&cursor, row.id, &row);
+        btree_unlatch(&cursor);
+        snapshot_publish(table->pager);
+        inserted[from] = false;
+        inserted[to] = true;
+        worker->num_ops++;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_slots = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char* filename = "snapshot_bench.db";
+    unlink(filename);
+    // room for every row, so nothing is evicted
+    Pager* pager = pager_open(filename, num_slots / 16 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+
+    // the even keys stay, every other odd slot starts out with a row
+    bool* inserted = calloc(num_slots, sizeof *inserted);
+    uint32_t num_rows = 0;
+    Row row;
+    row_encode(&(table.schema), 0, (char*[]){"user", "user@example.com"}, &row);
+    for (uint32_t i = 0; i < num_slots; i++) {
+        for (uint32_t key = 2 * i + 1; key <= 2 * i + 2; key++) {
+            if (key % 2 && i % 2) continue;
+            row.id = key;
+            Cursor cursor;
+            btree_find(&table, row.id, &cursor);
+            leaf_node_insert(&cursor, row.id, &row);
+            num_rows++;
+        }
+        inserted[i] = i % 2 == 0;
+    }
+
+    pager->threaded = true;
+    for (ScanKind kind = SCAN_NONE; kind <= SCAN_SNAPSHOT; kind++) {
+        pthread_t threads[2];
+        Worker workers[2];
+        atomic_store(&running, true);
+        for (uint32_t i = 0; i < 2; i++) {
+            workers[i] = (Worker){
+                .table = &table, .kind = kind, .num_rows = num_rows, .num_slots = num_slots, .seed = i + 1, .inserted = inserted
+            };
+        }
+        pthread_create(&(threads[1]), NULL, writer, &(workers[1]));
+        if (kind != SCAN_NONE) pthread_create(&(threads[0]), NULL, scanner, &(workers[0]));
+        double start = now_us();
+        sleep(RUN_SECONDS);
+        atomic_store(&running, false);
+        pthread_join(threads[1], NULL);
+        if (kind != SCAN_NONE) pthread_join(threads[0], NULL);
+        double elapsed_s = (now_us() - start) / 1e6;
+        printf(
+            "%-15s %8.1f scans/sec, %9.0f writes/sec, %lu of %lu scans inconsistent\n",
+            scan_kind_names[kind], workers[0].num_ops / elapsed_s, workers[1].num_ops / elapsed_s,
+            workers[0].num_inconsistent, workers[0].num_ops
+        );
+    }
+    free(inserted);
+    pager_close(pager);
+    unlink(filename);
+    return 0;
+}
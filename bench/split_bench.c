@@ -0,0 +1,78 @@
+/*
+microbenchmark for node splits: inserts keys straight through the B+ tree (no REPL, no log, a pool large enough
+that nothing is evicted) and times inserts that split a node separately from the ones that don't.
+build & run: `make bench`, or `gcc bench/split_bench.c -o bench/split_bench -fms-extensions -std=c23 -O3`
+usage: split_bench [rows]
+*/
+#include "../src/common.h" // first: it sets the feature test macros
+#include "../src/pager.h"
+#include "../src/btree.h"
+#include "../src/schema.h"
+
+#include <time.h>
+
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+static void run(const char* name, uint32_t* keys, uint32_t num_keys) {
+    const char* filename = "split_bench.db";
+    unlink(filename);
+    Pager* pager = pager_open(filename, num_keys / 4 + PAGER_MIN_FRAMES, false);
+    pager_init_header(pager, 1);
+    Table table = { .root_page_num = 1, .pager = pager, .wal = NULL };
+    schema_default(&(table.schema));
+    LeafNode* root = (LeafNode*)get_page(pager, 1);
+    initialize_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, 1);
+    unpin_page(pager, 1);
+
+    Row row;
+    row_encode(&(table.schema), 0, (char*[]){"user", "user@example.com"}, &row);
+    // by pages allocated: 0 = no split, 1 = a leaf split, more = the split cascaded into internal nodes
+    uint32_t count[3] = {0};
+    double elapsed_us[3] = {0};
+    for (uint32_t i = 0; i < num_keys; i++) {
+        row.id = keys[i];
+        uint32_t num_pages = pager->num_pages;
+        double start = now_us();
+        Cursor cursor;
+        btree_find(&table, keys[i], &cursor);
+        leaf_node_insert(&cursor, keys[i], &row);
+        double elapsed = now_us() - start;
+        uint32_t kind = pager->num_pages - num_pages;
+        if (kind > 2) kind = 2;
+        count[kind]++;
+        elapsed_us[kind] += elapsed;
+    }
+    printf(
+        "%-10s %8d rows: %6.2f us/insert, %7d leaf splits %6.2f us each, %4d cascading splits %8.2f us each\n",
+        name, num_keys, elapsed_us[0] / count[0],
+        count[1], count[1] ? elapsed_us[1] / count[1] : 0,
+        count[2], count[2] ? elapsed_us[2] / count[2] : 0
+    );
+    pager_close(pager);
+    unlink(filename);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_keys = argc > 1 ? atoi(argv[1]) : 200000;
+    uint32_t* keys = malloc(num_keys * sizeof *keys);
+    for (uint32_t i = 0; i < num_keys; i++) keys[i] = i + 1;
+    run("ascending", keys, num_keys);
+
+    srand(42);
+    for (uint32_t i = num_keys - 1; i > 0; i--) {
+        uint32_t j = rand() % (i + 1);
+        uint32_t swap = keys[i];
+        keys[i] = keys[j];
+        keys[j] = swap;
+    }
+    run("random", keys, num_keys);
+    free(keys);
+    return 0;
+}
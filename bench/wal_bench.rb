@@ -0,0 +1,30 @@
+# inserts/sec with a log fsync per statement vs. group commit.
+# usage: ruby bench/wal_bench.rb [rows] (run from the repo root, after `make build`)
+
+rows = (ARGV[0] || 5000).to_i
+db = "bench.db"
+
+def run(db, rows, options)
+    `rm -f #{db} #{db}-wal`
+    script = (1..rows).map { |i| "insert #{i} user#{i} user#{i}@example.com\n" }.join + ".exit\n"
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    IO.popen("./meinsql #{db} --no-color #{options}", "r+") do |pipe|
+        pipe.write(script)
+        pipe.close_write
+        pipe.read
+    end
+    Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+end
+
+[
+    ["off (no log)", "--sync off"],
+    ["full (fsync per statement)", "--sync full"],
+    ["group of 16", "--sync group --group-size 16"],
+    ["group of 64", "--sync group --group-size 64"],
+    ["group of 256", "--sync group --group-size 256"],
+].each do |name, options|
+    seconds = run(db, rows, options)
+    printf("%-28s %8d rows %8.3fs %10.0f inserts/sec\n", name, rows, seconds, rows / seconds)
+end
+
+`rm -f #{db} #{db}-wal`
@@ -1,19 +1,19 @@
 describe 'database' do
     before do
         # backticks: runs given command - ruby syntax
-        `rm test.db`
+        `rm -f test.db test.db-wal test.db-vacuum test.tsv`
     end
 
     after(:all) do
         # runs after all tasks are done (e.g. after last task)
-        `rm test.db`
+        `rm -f test.db test.db-wal test.db-vacuum test.tsv`
     end
 
-    def run_script(commands)
+    def run_script(commands, options = "")
         raw_output = nil
 
         # open pipe subprocess with initial command, and read/write access, returns pipe
-        IO.popen("./meinsql test.db --no-color", "r+") do |pipe|
+        IO.popen("./meinsql test.db --no-color #{options}", "r+") do |pipe|
             commands.each do |command|
                 begin
                     pipe.puts command
@@ -46,17 +46,71 @@ describe 'database' do
         ])
     end
 
-    # TODO: how damn big is this table?
-    it 'prints error message when table is full' do
-        script = (1..700).map do |i|
-            # returns...al
+    it 'stores more pages than fit in the buffer pool' do
+        # 16 frames is the minimum, 700 rows take ~100 pages
+        script = (1..700).to_a.shuffle(random: Random.new(42)).map do |i|
             "insert #{i} user#{i} user#{i}@example.com"
         end
         script << ".exit"
+        run_script(script, "--frames 16")
 
-        result = run_script(script)
+        result = run_script(["select", ".exit"], "--frames 16")
+
+        expect(result.length).to eq 702
+        expect(result[0]).to eq "db > 1 user1 user1@example.com"
+        expect(result[699]).to eq "700 user700 user700@example.com"
+    end
 
-        expect(result[-1]).to match "db > src/common.h:179: tried to fetch a page number larger than max. allowed: 100 > 100"
+    it 'rejects numeric options that are not whole numbers in range' do
+        {
+            "--frames abc" => "--frames takes a number from 16 to 16777216: abc",
+            "--frames -1" => "--frames takes a number from 16 to 16777216: -1",
+            "--frames 0" => "--frames takes a number from 16 to 16777216: 0",
+            "--group-size 0" => "--group-size takes a number from 1 to 4294967295: 0",
+            "--checkpoint-interval 10x" => "--checkpoint-interval takes a number from 0 to 4294967295: 10x",
+            "--threads 65" => "--threads takes a number from 1 to 64: 65",
+            "--page-size 4096k" => "--page-size takes a power of two from 4096 to 65536",
+        }.each do |options, error|
+            expect(run_script([".exit"], options)).to eq [error]
+        end
+        expect(File.exist?("test.db")).to eq false
+    end
+
+    it 'reads and writes the same file format with --mmap' do
+        script = (1..300).to_a.shuffle(random: Random.new(7)).map do |i|
+            "insert #{i} user#{i} user#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script, "--mmap")
+        # trailing unused extent is trimmed on close
+        expect(File.size("test.db") % 4096).to eq 0
+
+        result = run_script(["select", ".exit"])
+        expect(result.length).to eq 302
+        expect(result[0]).to eq "db > 1 user1 user1@example.com"
+
+        result = run_script(["insert 301 a b", "select", ".exit"], "--mmap")
+        expect(result[-3]).to eq "301 a b"
+    end
+
+    it 'recovers logged inserts after a crash with --mmap, the file only changing at checkpoints' do
+        # no `.exit`: the second insert is only in the log, and in a page the kernel never writes back
+        run_script([
+            "insert 1 user1 user1@example.com",
+            ".checkpoint",
+            "insert 2 user2 user2@example.com",
+        ], "--mmap --checkpoint-interval 0")
+        expect(File.binread("test.db")).to include "user1@example.com"
+        expect(File.binread("test.db")).not_to include "user2@example.com"
+
+        result = run_script(["select", ".check", ".exit"], "--mmap")
+        expect(result[0..3]).to eq([
+            "recovered 1 statements from log",
+            "db > 1 user1 user1@example.com",
+            "2 user2 user2@example.com",
+            "executed",
+        ])
+        expect(result[4]).to start_with "db > check: ok"
     end
 
     it 'allows inserting strings that are the maximum length' do
@@ -105,6 +159,208 @@ describe 'database' do
         ])
     end
 
+    it 'writes only dirty pages on checkpoint' do
+        script = (1..200).map do |i|
+            "insert #{i} user#{i} user#{i}@example.com"
+        end
+        script << ".checkpoint"
+        script << "insert 201 user201 user201@example.com"
+        script << ".checkpoint"
+        script << ".checkpoint"
+        script << ".exit"
+        result = run_script(script)
+
+        # header + root + three leaves, then the rightmost leaf and the root (its max key grew)
+        expect(result[-5]).to eq "db > checkpoint: wrote 5 dirty pages"
+        expect(result[-4]).to eq "db > executed"
+        expect(result[-3]).to eq "db > checkpoint: wrote 2 dirty pages"
+        expect(result[-2]).to eq "db > checkpoint: wrote 0 dirty pages"
+    end
+
+    it 'keeps checkpointed data without a clean exit' do
+        # no `.exit`: input runs out and the process dies without flushing
+        run_script([
+            "insert 1 user1 user1@example.com",
+            ".checkpoint",
+            "insert 2 user2 user2@example.com",
+        ], "--checkpoint-interval 0 --sync off")
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > 1 user1 user1@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
+
+    it 'recovers logged inserts after a crash' do
+        run_script([
+            "insert 1 user1 user1@example.com",
+            "insert 2 user2 user2@example.com",
+        ], "--checkpoint-interval 0")
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "recovered 2 statements from log",
+            "db > 1 user1 user1@example.com",
+            "2 user2 user2@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
+
+    it 'only loses the unsynced tail of a commit group after a crash' do
+        run_script((1..5).map do |i|
+            "insert #{i} user#{i} user#{i}@example.com"
+        end, "--checkpoint-interval 0 --sync group --group-size 2")
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "recovered 4 statements from log",
+            "db > 1 user1 user1@example.com",
+            "2 user2 user2@example.com",
+            "3 user3 user3@example.com",
+            "4 user4 user4@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
+
+    it 'opens files written before the header page' do
+        # one root leaf in page 0: is_root, type, parent, num_cells, next_leaf, then 292-byte cells
+        page = [1, 0, 0, 0, 1, 0, 2, 0].pack("CCCCL<L<L<L<")
+        [1, 2].each do |i|
+            page << [i, "user#{i}", "user#{i}@example.com"].pack("L<a32a256")
+        end
+        File.binwrite("test.db", page.ljust(4096, "\0"))
+
+        result = run_script(["select", ".btree", ".exit"])
+
+        expect(result).to match_array([
+            "db > 1 user1 user1@example.com",
+            "2 user2 user2@example.com",
+            "executed",
+            "db > page 2; root; leaf; 2 keys, 4008 bytes free",
+            "  - key 1",
+            "  - key 2",
+            "db > exiting",
+        ])
+    end
+
+    it 'lays the tree out in key order on .vacuum, renaming a copy over the file' do
+        ["", "--mmap"].each do |options|
+            `rm -f test.db test.db-wal`
+            script = (1..400).to_a.shuffle(random: Random.new(3)).map do |i|
+                "insert #{i} user#{i} user#{i}@example.com"
+            end
+            script << ".vacuum"
+            script << "insert 401 user401 user401@example.com"
+            script << ".exit"
+            run_script(script, options)
+            expect(File.exist?("test.db-vacuum")).to eq false
+
+            result = run_script([".btree", "select", ".check", ".exit"], options)
+            pages = result.map { |line| line[/page (\d+)/, 1] }.compact.map(&:to_i)
+            expect(pages).to eq (1..pages.length).to_a
+            expect(File.size("test.db")).to eq (pages.length + 1) * 4096
+            expect(result.count { |line| line =~ /^(db > )?\d+ user/ }).to eq 401
+            expect(result.grep(/check:/)[0]).to start_with "db > check: ok"
+        end
+    end
+
+    it 'checks pages against their checksums, and the trees, on .check' do
+        script = (1..300).map { |i| "insert #{i} user#{i} user#{i}@example.com" }
+        script << ".check"
+        script << ".exit"
+        result = run_script(script)
+        expect(result[-2]).to eq "db > check: ok, 6 pages: 5 in trees, 0 free"
+
+        # a flipped bit in the first leaf
+        File.open("test.db", "r+b") do |file|
+            file.seek(2 * 4096 + 1000)
+            byte = file.read(1).ord
+            file.seek(2 * 4096 + 1000)
+            file.write((byte ^ 1).chr)
+        end
+        result = run_script([".check", "select"])
+        expect(result).to match_array([
+            "db > check: file, page 2 fails its checksum",
+            "check: 1 problems",
+            "db > page 2 fails its checksum - the database file is corrupt",
+        ])
+    end
+
+    it 'keeps the page size a file was created with' do
+        script = (1..1000).map { |i| "insert #{i} user#{i} user#{i}@example.com" }
+        script << ".exit"
+        run_script(script, "--page-size 16384")
+        expect(File.size("test.db") % 16384).to eq 0
+
+        # 4 times the rows per leaf: a root over 3 leaves, rather than 15
+        result = run_script([".print", ".check", "select count(*)", ".exit"], "--page-size 4096")
+        expect(result).to include("PAGE_SIZE: 16384", "INTERNAL_NODE_MAX_KEYS: 2044", "db > check: ok, 5 pages: 4 in trees, 0 free")
+        expect(result).to include("db > 1000")
+    end
+
+    it 'scans the same rows reading ahead through io_uring as one read at a time' do
+        # inserted out of order, so the leaves are all over the file: they're read ahead from their parent
+        script = (1..2000).to_a.shuffle(random: Random.new(9)).map { |i| "insert #{i} user#{i} user#{i}@example.com" }
+        script << ".exit"
+        run_script(script)
+
+        # a pool too small for the table, so the scans read leaves from the file (and ahead of themselves, by default)
+        read_ahead = run_script(["select", ".check", ".exit"], "--frames 16")
+        one_at_a_time = run_script(["select", ".check", ".exit"], "--frames 16 --io sync")
+        expect(read_ahead).to eq one_at_a_time
+        expect(read_ahead.count { |line| line =~ /^(db > )?\d+ / }).to eq 2000
+        expect(read_ahead).to include("db > check: ok, 24 pages: 23 in trees, 0 free")
+    end
+
+    it 'scans leaves that follow each other in the file with the OS reading ahead' do
+        # inserted in order, so every leaf is followed by the next one in the file (internal nodes aside)
+        script = (1..2000).map { |i| "insert #{i} user#{i} user#{i}@example.com" }
+        script << ".exit"
+        run_script(script)
+
+        results = ["--frames 16", "--frames 16 --io sync", "--mmap"].map do |options|
+            run_script(["select", ".exit"], options)
+        end
+        expect(results.uniq.length).to eq 1
+        expect(results[0].count { |line| line =~ /^(db > )?\d+ / }).to eq 2000
+        expect(results[0][1999]).to eq "2000 user2000 user2000@example.com"
+    end
+
+    it 'bulk loads rows from a file into full leaves' do
+        # 252-byte rows: 16 of them (and their slots) fill a leaf exactly
+        rows = (1..48).to_a.shuffle(random: Random.new(5)).map do |i|
+            "#{i} user#{"%03d" % i} #{"%03d" % i}@#{"x" * 236}"
+        end
+        File.write("test.tsv", rows.join("\n") + "\n")
+
+        result = run_script([
+            "insert 7 first first@example.com",
+            ".load test.tsv",
+            ".btree",
+            "select",
+            ".exit",
+        ])
+
+        expect(result[1]).to eq "db > load: 48 rows in 3 leaves, 1 duplicates skipped"
+        expect(result.count { |line| line.include?("leaf; 16 keys") }).to eq 3
+        expect(result.count { |line| line.include?("leaf; 16 keys, 0 bytes free") }).to eq 2
+        expect(result).to include "7 first first@example.com"
+        expect(result.count { |line| line =~ /^(db > )?\d+ / }).to eq 48
+    end
+
     it 'prints constants' do
         result = run_script([
             ".print",
@@ -119,13 +375,13 @@ describe 'database' do
             # "LEAF_NODE_CELL_SIZE: 297",
             # "LEAF_NODE_SPACE_FOR_CELLS: 4082",
             # "LEAF_NODE_MAX_CELLS: 13",
-            "ROW_SIZE: 292",
+            "PAGE_SIZE: 4096",
+            "ROW_MAX_SIZE: 1031",
             "COMMON_NODE_HEADER_SIZE: 12",
-            "INTERNAL_NODE_MAX_KEYS: 509",
-            "LEAF_NODE_HEADER_SIZE: 20",
-            "LEAF_NODE_CELL_SIZE: 292",
-            "LEAF_NODE_SPACE_FOR_CELLS: 4076",
-            "LEAF_NODE_MAX_CELLS: 13",
+            "INTERNAL_NODE_MAX_KEYS: 508",
+            "LEAF_NODE_HEADER_SIZE: 28",
+            "LEAF_NODE_SPACE_FOR_CELLS: 4064",
+            "LEAF_NODE_MAX_CELLS: 1016",
             "db > exiting",
         ]
     end
@@ -144,7 +400,7 @@ describe 'database' do
             "db > executed",
             "db > executed",
             "db > executed",
-            "db > page 0/100; root; leaf; 3/13 keys",
+            "db > page 1; root; leaf; 3 keys, 3980 bytes free",
             "  - key 1",
             "  - key 2",
             "  - key 3",
@@ -168,7 +424,7 @@ describe 'database' do
     end
 
     it "prints all rows in a multi-level tree" do
-        script = (1..15).map do |i|
+        script = (1..300).map do |i|
             "insert #{i} user#{i} user#{i}@example.com"
         end
         script << "select"
@@ -177,11 +433,11 @@ describe 'database' do
         result = run_script(script)
 
         expect(result).to match_array([
-            *(1..15).map do |i|
+            *(1..300).map do |i|
                 "db > executed"
             end,
             "db > 1 user1 user1@example.com",
-            *(2..15).map do |i|
+            *(2..300).map do |i|
                 "#{i} user#{i} user#{i}@example.com"
             end,
 
@@ -190,4 +446,374 @@ describe 'database' do
             "db > exiting",
         ])
     end
+
+    it 'splits scans over threads by subtree' do
+        rows = (1..3000).map { |i| "#{i} user#{i} user#{i}@example.com" }
+        File.write("test.tsv", rows.join("\n") + "\n")
+        run_script([".load test.tsv 50", ".exit"])
+
+        script = ["select", "select where id between 250 and 2750", "select where username like user2%", ".exit"]
+        serial = run_script(script)
+        expect(serial.count { |line| line =~ /^(db > )?\d+ / }).to eq 3000 + 2501 + 1111
+        expect(run_script(script, "--threads 4")).to eq serial
+        expect(run_script(script, "--threads 8 --frames 16")).to eq serial
+        # rows come out as the workers get to them (the prompt sticks to whichever is first), but the same rows
+        unordered = run_script(["select", ".exit"], "--threads 4 --unordered").map { |line| line.delete_prefix("db > ") }
+        ordered = run_script(["select", ".exit"]).map { |line| line.delete_prefix("db > ") }
+        expect(unordered.sort).to eq ordered.sort
+    end
+
+    it 'computes aggregates without printing rows' do
+        script = ["create table t (id int, n int, tag char(1))", "use t"]
+        script << "insert " + (1..400).map { |i| "(#{i * 2},#{i % 10},#{"ab"[i % 2]})" }.join(",")
+        script += [
+            "create index on tag",
+            "select count(*)", "select min(id)", "select max(id)", "select sum(n)", "select max(n)",
+            "select count(*) where id between 101 and 299", "select max(id) where id between 101 and 299",
+            "select min(id) where id between 801 and 900", "select sum(id) where tag = a", "select count(*) where n = 7",
+            "select count(id)", "select sum(tag)",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result[4..]).to eq([
+            "db > executed",
+            "db > 400", "executed",
+            "db > 2", "executed",
+            "db > 800", "executed",
+            "db > 1800", "executed",
+            "db > 9", "executed",
+            "db > 99", "executed",
+            "db > 298", "executed",
+            "db > null", "executed",
+            "db > 80400", "executed",
+            "db > 40", "executed",
+            "db > incorrect syntax for valid command: select",
+            "db > incorrect syntax for valid command: select",
+            "db > exiting",
+        ])
+    end
+
+    it 'selects a single id or a range of ids' do
+        script = (1..300).map do |i|
+            "insert #{i * 2} user#{i} user#{i}@example.com"
+        end
+        script << "select where id = 42"
+        script << "select where id = 43"
+        script << "select where id between 277 and 284"
+        script << "select where id between 599 and 1000"
+        script << "select where id between 3"
+        script << ".exit"
+
+        result = run_script(script)
+
+        expect(result[300..]).to eq([
+            "db > 42 user21 user21@example.com",
+            "executed",
+            "db > executed",
+            "db > 278 user139 user139@example.com",
+            "280 user140 user140@example.com",
+            "282 user141 user141@example.com",
+            "284 user142 user142@example.com",
+            "executed",
+            "db > 600 user300 user300@example.com",
+            "executed",
+            "db > incorrect syntax for valid command: select",
+            "db > exiting",
+        ])
+    end
+
+    it 'updates and deletes rows' do
+        script = (1..300).map do |i|
+            "insert #{i} user#{i} user#{i}@example.com"
+        end
+        script << "update renamed renamed@example.com where id = 7"
+        script << "update x y where id = 301"
+        script += (2..300).map { |i| "delete where id = #{i}" unless i == 7 }.compact
+        script << "delete where id = 2"
+        script << ".btree"
+        script << "select"
+        script << ".exit"
+
+        result = run_script(script)
+
+        expect(result[301]).to eq "db > failed to execute statement: key not found: 301"
+        # the tree collapses back into a single root leaf
+        expect(result[-8..]).to eq([
+            "db > failed to execute statement: key not found: 2",
+            "db > page 1; root; leaf; 2 keys, 4004 bytes free",
+            "  - key 1",
+            "  - key 7",
+            "db > 1 user1 user1@example.com",
+            "7 renamed renamed@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
+
+    it 'recovers logged updates and deletes after a crash' do
+        run_script([
+            "insert 1 user1 user1@example.com",
+            "insert 2 user2 user2@example.com",
+            "update renamed renamed@example.com where id = 1",
+            "delete where id = 2",
+        ], "--checkpoint-interval 0")
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "recovered 4 statements from log",
+            "db > 1 renamed renamed@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
+
+    it 'reuses pages freed by deletes' do
+        rows = (1..2000).map { |i| "insert #{i} user#{i} user#{i}@example.com" }
+        run_script(rows + (1..2000).map { |i| "delete where id = #{i}" } + [".exit"])
+        size = File.size("test.db")
+        run_script(rows + [".exit"])
+
+        expect(File.size("test.db")).to eq size
+    end
+
+    it 'inserts many rows in one statement or a batch' do
+        values = (1..300).to_a.shuffle(random: Random.new(1)).map { |i| "(#{i},user#{i},user#{i}@example.com)" }
+        script = [
+            "insert (5, user5, user5@example.com), (3,user3,user3@example.com),(5,dup,dup)",
+            "begin",
+            "insert 3 dup dup",
+            "insert #{values.join(",")}",
+            "select where id = 1",
+            "commit",
+            "begin",
+            "insert 301 user301 user301@example.com",
+            "rollback",
+            "commit",
+            "insert (1,a,b)(2,c,d)",
+            "select where id between 298 and 302",
+            ".exit",
+        ]
+
+        result = run_script(script)
+
+        expect(result).to eq([
+            "db > inserted 2 rows, 1 duplicates skipped",
+            "executed",
+            "db > executed",
+            "db > executed",
+            "db > executed",
+            "db > failed to execute statement: only inserts can be batched, `commit` or `rollback` first",
+            "db > inserted 298 rows, 3 duplicates skipped",
+            "executed",
+            "db > executed",
+            "db > executed",
+            "db > executed",
+            "db > failed to execute statement: no batch to end, `begin` one first",
+            "db > incorrect syntax for valid command: insert (1",
+            "db > 298 user298 user298@example.com",
+            "299 user299 user299@example.com",
+            "300 user300 user300@example.com",
+            "executed",
+            "db > exiting",
+        ])
+
+        # a mapped file has no pool for batches to be split by
+        `rm -f test.db test.db-wal`
+        expect(run_script(script, "--mmap --sync off")).to eq result
+    end
+
+    it 'recovers a committed batch after a crash' do
+        run_script([
+            "begin",
+            *(1..200).map { |i| "insert #{i} user#{i} user#{i}@example.com" },
+            "commit",
+            "begin",
+            "insert 201 user201 user201@example.com",
+        ], "--checkpoint-interval 0")
+
+        result = run_script([
+            "select where id between 199 and 201",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "recovered 1 statements from log",
+            "db > 199 user199 user199@example.com",
+            "200 user200 user200@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
+
+    it 'recovers a batch larger than the buffer pool killed while it goes in' do
+        ["--frames 16", "--mmap"].each do |options|
+            `rm -f test.db test.db-wal`
+            run_script(["insert " + (1..2000).map { |i| "(#{i * 2},a#{i},a#{i}@example.com)" }.join(","), ".exit"])
+            size = File.size("test.db")
+
+            # the batch is in the log before it goes in. the file growing means it's partway in: a checkpoint between
+            # its groups wrote pages, or the mapping grew the file for the pages to come
+            reader, writer = IO.pipe
+            pid = spawn("exec ./meinsql test.db --no-color #{options} > /dev/null 2>&1", in: reader)
+            reader.close
+            writer.puts "begin", *(1..20000).map { |i| "insert #{i * 2 + 1} b#{i} b#{i}@example.com" }, "commit"
+            writer.flush
+            exited = nil
+            exited = Process.wait(pid, Process::WNOHANG) until exited || File.size("test.db") > size
+            Process.kill("KILL", pid) unless exited
+            Process.wait(pid) unless exited
+            writer.close
+
+            result = run_script(["select count(*)", ".check", ".exit"], options)
+            expect(result).to include("db > 22000")
+            expect(result.grep(/check:/)[0]).to start_with "db > check: ok"
+        end
+    end
+
+    it 'writes only rows to stdout in tsv, csv and binary output' do
+        run_script([
+            'insert 1 a,b "quoted"',
+            "insert 2 back\\slash user2@example.com",
+            "insert 300 user300 user300@example.com",
+            ".exit",
+        ])
+
+        expect(run_script(["select", ".exit"], "--output tsv 2> /dev/null")).to eq([
+            "1\ta,b\t\"quoted\"",
+            "2\tback\\\\slash\tuser2@example.com",
+            "300\tuser300\tuser300@example.com",
+        ])
+        expect(run_script(["select where id between 2 and 300", ".exit"], "--output csv 2> /dev/null")).to eq([
+            "2,back\\slash,user2@example.com",
+            "300,user300,user300@example.com",
+        ])
+        # rows as stored: varint id, the body's size, then each string prefixed with its length
+        binary = IO.popen("./meinsql test.db --output binary 2> /dev/null", "r+b") do |pipe|
+            pipe.puts "select where id = 300"
+            pipe.puts ".exit"
+            pipe.close_write
+            pipe.read
+        end
+        expect(binary).to eq([0xac, 0x02, 28, 7].pack("C*") + "user300" + [19].pack("C") + "user300@example.com")
+    end
+
+    it 'creates, uses and drops tables' do
+        result = run_script([
+            "create table items (id int, name char(8), qty int)",
+            "create table items (id int)",
+            "use items",
+            "insert 1 apple 5",
+            "insert 2 pineapples 3",
+            "insert 3 pear x",
+            "select",
+            "use users",
+            "insert 1 user1 user1@example.com",
+            "use nope",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > executed",
+            "db > failed to execute statement: table already exists: items",
+            "db > executed",
+            "db > executed",
+            "db > string too long for command: insert",
+            "db > incorrect syntax for valid command: insert",
+            "db > 1 apple 5",
+            "executed",
+            "db > executed",
+            "db > executed",
+            "db > failed to execute statement: no such table: nope",
+            "db > exiting",
+        ])
+
+        # a logged insert into items, replayed into items rather than users
+        run_script(["use items", "insert 4 fig 1"], "--checkpoint-interval 0")
+
+        result = run_script([
+            ".tables",
+            "use items",
+            "select",
+            "drop table items",
+            ".tables",
+            "select",
+            "use users",
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "recovered 1 statements from log",
+            "db > users (id int, username text(31), email text(255))",
+            "items (id int, name char(8), qty int)",
+            "db > executed",
+            "db > 1 apple 5",
+            "4 fig 1",
+            "executed",
+            "db > executed",
+            "db > users (id int, username text(31), email text(255))",
+            "db > no table in use, `use` one first: select",
+            "db > executed",
+            "db > 1 user1 user1@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
+
+    it 'looks rows up through secondary indexes' do
+        result = run_script([
+            "insert 1 bob bob@example.com",
+            "insert 2 alice alice@example.com",
+            "insert 3 bob bob3@example.com",
+            "create index on username",
+            "create index on username",
+            "create index on nope",
+            "select where username = bob",
+            "select where username like al%",
+            "update alicia alicia@example.com where id = 2",
+            "delete where id = 1",
+            "insert (4,bob,bob4@example.com),(3,dup,dup@example.com)",
+            ".btree username",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > executed",
+            "db > executed",
+            "db > executed",
+            "db > executed",
+            "db > failed to execute statement: index already exists: username",
+            "db > no such column for command: create",
+            "db > 1 bob bob@example.com",
+            "3 bob bob3@example.com",
+            "executed",
+            "db > 2 alice alice@example.com",
+            "executed",
+            "db > executed",
+            "db > executed",
+            "db > inserted 1 rows, 1 duplicates skipped",
+            "executed",
+            "db > page 2; root; leaf; 3 keys, 4040 bytes free",
+            "  - key alicia, id 2",
+            "  - key bob, id 3",
+            "  - key bob, id 4",
+            "db > exiting",
+        ])
+
+        # the index is in the catalog, and the same rows come out of a scan on a column without one
+        result = run_script([
+            ".tables",
+            "select where username like b%",
+            "select where email like alicia@%",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > users (id int, username text(31), email text(255)) indexed on username",
+            "db > 3 bob bob3@example.com",
+            "4 bob bob4@example.com",
+            "executed",
+            "db > 2 alicia alicia@example.com",
+            "executed",
+            "db > exiting",
+        ])
+    end
 end
@@ -2,293 +2,499 @@
 
 
 #include "common.h"
+#include "pager.h"
+#include "search.h"
 
 
-uint32_t get_node_max_key(Pager* pager, Node* _node) {
+/* the serialized row stored in cell `cell_num` */
+uint8_t* leaf_node_cell(LeafNode* node, uint32_t cell_num) {
+    return (uint8_t*)node + node->slots[cell_num];
+}
+
+/* a cell starts with its key, so this only decodes the varint */
+uint32_t leaf_node_key(LeafNode* node, uint32_t cell_num) {
+    return serialized_row_key(leaf_node_cell(node, cell_num));
+}
+
+/* bytes left for new cells and their slots, counting the ones compaction would reclaim */
+uint32_t leaf_node_free_space(LeafNode* node) {
+    return node->content_start - LEAF_NODE_HEADER_SIZE - node->num_cells * LEAF_NODE_SLOT_SIZE + node->fragmented_bytes;
+}
+
+/* drop every cell, keeping the rest of the header */
+void leaf_node_clear(LeafNode* node) {
+    node->num_cells = 0;
+    node->content_start = PAGE_USABLE_SIZE;
+    node->fragmented_bytes = 0;
+}
+
+/* repack the cells against the end of the page (its usable part), so that all free space sits between the slots and the cells */
+void leaf_node_compact(LeafNode* node) {
+    LeafNode copy;
+    memcpy(&copy, node, PAGE_SIZE);
+    uint32_t offset = PAGE_USABLE_SIZE;
+    for (uint32_t i = 0; i < copy.num_cells; i++) {
+        uint8_t* cell = leaf_node_cell(&copy, i);
+        uint32_t cell_size = serialized_row_size(cell);
+        offset -= cell_size;
+        memcpy((uint8_t*)node + offset, cell, cell_size);
+        node->slots[i] = offset;
+    }
+    node->content_start = offset;
+    node->fragmented_bytes = 0;
+}
+
+/* place a serialized row so it becomes cell `cell_num`. the caller has checked it fits (`leaf_node_free_space`) */
+void leaf_node_insert_cell(LeafNode* node, uint32_t cell_num, const uint8_t* cell, uint32_t cell_size) {
+    uint32_t slots_end = LEAF_NODE_HEADER_SIZE + (node->num_cells + 1) * LEAF_NODE_SLOT_SIZE;
+    if (node->content_start < slots_end + cell_size) leaf_node_compact(node);
+    node->content_start -= cell_size;
+    memcpy((uint8_t*)node + node->content_start, cell, cell_size);
+    memmove(
+        &(node->slots[cell_num + 1]),
+        &(node->slots[cell_num]),
+        (node->num_cells - cell_num) * LEAF_NODE_SLOT_SIZE
+    );
+    node->slots[cell_num] = node->content_start;
+    node->num_cells++;
+}
+
+/* take cell `cell_num` out. its bytes are only reclaimed right away if it's the lowest cell */
+void leaf_node_remove_cell(LeafNode* node, uint32_t cell_num) {
+    uint32_t cell_size = serialized_row_size(leaf_node_cell(node, cell_num));
+    if (node->slots[cell_num] == node->content_start) {
+        node->content_start += cell_size;
+    } else {
+        node->fragmented_bytes += cell_size;
+    }
+    memmove(
+        &(node->slots[cell_num]),
+        &(node->slots[cell_num + 1]),
+        (node->num_cells - cell_num - 1) * LEAF_NODE_SLOT_SIZE
+    );
+    node->num_cells--;
+}
+
+/* bytes taken by cells and their slots */
+uint32_t leaf_node_used_bytes(LeafNode* node) {
+    return LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(node);
+}
+
+/*
+lay out `num_cells` cells, in order, over two empty leaves: about half the bytes in `left`, the rest in `right`.
+both get at least one cell. `cells` must not point into either leaf.
+*/
+void leaf_nodes_distribute(
+    LeafNode* left,
+    LeafNode* right,
+    const uint8_t** cells,
+    const uint32_t* cell_sizes,
+    uint32_t num_cells
+) {
+    uint32_t total_bytes = 0;
+    for (uint32_t i = 0; i < num_cells; i++) total_bytes += cell_sizes[i] + LEAF_NODE_SLOT_SIZE;
+    uint32_t left_bytes = 0;
+    uint32_t i = 0;
+    // a cell goes left if most of it lands in the first half
+    while (i < num_cells - 1 && (i == 0 || 2 * left_bytes + cell_sizes[i] + LEAF_NODE_SLOT_SIZE <= total_bytes)) {
+        leaf_node_insert_cell(left, left->num_cells, cells[i], cell_sizes[i]);
+        left_bytes += cell_sizes[i] + LEAF_NODE_SLOT_SIZE;
+        i++;
+    }
+    for (; i < num_cells; i++) {
+        leaf_node_insert_cell(right, right->num_cells, cells[i], cell_sizes[i]);
+    }
+}
+
+/* spread the cells of two neighbouring leaves evenly (by size) over both */
+void leaf_nodes_redistribute(LeafNode* left, LeafNode* right) {
+    LeafNode copies[2];
+    memcpy(&(copies[0]), left, PAGE_SIZE);
+    memcpy(&(copies[1]), right, PAGE_SIZE);
+    const uint8_t* cells[2 * LEAF_NODE_MAX_CELLS];
+    uint32_t cell_sizes[2 * LEAF_NODE_MAX_CELLS];
+    uint32_t num_cells = 0;
+    for (uint32_t copy = 0; copy < 2; copy++) {
+        for (uint32_t i = 0; i < copies[copy].num_cells; i++) {
+            cells[num_cells] = leaf_node_cell(&(copies[copy]), i);
+            cell_sizes[num_cells] = serialized_row_size(cells[num_cells]);
+            num_cells++;
+        }
+    }
+    leaf_node_clear(left);
+    leaf_node_clear(right);
+    leaf_nodes_distribute(left, right, cells, cell_sizes, num_cells);
+}
+
+uint32_t get_node_max_key(Node* _node) {
     if (_node->common_header.type == NODE_INTERNAL) {
-        InternalNode* node = (InternalNode*)_node;
-        Node* last_child = get_page(pager, node->last_child);
-        return get_node_max_key(pager, last_child);
+        // kept up to date by every insert and split, so we don't have to walk down to the rightmost leaf
+        return ((InternalNode*)_node)->max_key;
     } else {
         LeafNode* node = (LeafNode*)_node;
-        return node->cells[node->num_cells - 1].key;
+        return leaf_node_key(node, node->num_cells - 1);
     }
 }
 
+/* same as `get_node_max_key`, for a page that isn't pinned yet */
+uint32_t get_page_max_key(Pager* pager, uint32_t page_num) {
+    uint32_t max_key = get_node_max_key(get_page(pager, page_num));
+    unpin_page(pager, page_num);
+    return max_key;
+}
+
+/*
+helper function that returns index of a child where
+given key is equal to or greater than the child's key,
+but less than the next child's key (see search.h).
+*/
+static uint32_t internal_node_find_child(
+    InternalNode* node,
+    uint32_t key
+) {
+    return keys_lower_bound(node->_keys, node->num_keys, key);
+}
+
+/* the children but `last_child`, right after room for a full node's keys */
+static inline uint32_t* internal_node_children(InternalNode* node) {
+    return node->_keys + INTERNAL_NODE_MAX_KEYS;
+}
+
+/*
+return the page number (not pointer) of a given child index
+from the children array for an index lower than `num_keys`,
+or returns `last_child` for an index equal to `num_keys`
+*/
+uint32_t* internal_node_child(InternalNode* node, uint32_t child_idx) {
+    if (child_idx > node->num_keys) {
+        log("tried accessing child %d", child_idx);
+        exit(EXIT_FAILURE);
+    } else if (child_idx == node->num_keys) {
+        return &(node->last_child);
+    } else {
+        return internal_node_children(node) + child_idx;
+    }
+}
+
+/* the max key of child `key_idx`, below `num_keys`: `last_child` has none, the node's `max_key` is its */
+uint32_t* internal_node_key(InternalNode* node, uint32_t key_idx) {
+    return &(node->_keys[key_idx]);
+}
+
 void initialize_internal_node(InternalNode* node) {
     // memset(node, 0, PAGE_SIZE);
     // if we are initializing a root node, all of these are pointless
     node->is_root = false;
     node->num_keys = 0;
     node->type = NODE_INTERNAL;
+    node->parent = 0;
     node->last_child = INVALID_PAGE_NUM;
+    node->max_key = 0;
 }
 
 /*
-create new parent root node for a current root node that is being split into two.
-allocate new page for left node, point both nodes to new root.
+create new parent root node for a current root node that has been split into two:
+the root page holds the left half, `new_child_page_num` the right half.
+allocate new page for left node, and make both of them the new root's children.
 we do this instead of allocating a new root and not copying over memory,
 so that table->root_page_num can stay the same forever.
+returns the page the left half moved to.
 */
-void create_new_root(Table* table, uint32_t new_child_page_num) {
+uint32_t create_new_root(Table* table, uint32_t new_child_page_num) {
     // RESEARCH: could also request a new page and point new root node there, rather than memcpy
-    uint32_t old_child_new_page_num = get_unused_page_num(table->pager);
+    uint32_t old_child_new_page_num = get_unused_page_num(table->pager, table->root_page_num);
 
     // may not be an internal node yet, but we'll turn it into one
     InternalNode* root_node = (InternalNode*)get_page(table->pager, table->root_page_num);
     // old child will get assigned to a new page
     Node* old_child_new_node = get_page(table->pager, old_child_new_page_num);
     Node* new_child_node = get_page(table->pager, new_child_page_num);
+    mark_page_dirty(table->pager, table->root_page_num);
+    mark_page_dirty(table->pager, old_child_new_page_num);
 
-    if (root_node->type == NODE_INTERNAL) {
-        // `new_child_node` is presumably uninitialized
-        initialize_internal_node((InternalNode*)new_child_node);
-        initialize_internal_node((InternalNode*)old_child_new_node);
-    }
-
+    // the root may be an internal node that has already been split: its left half moves along with it.
+    // nodes don't point back at their parent, so the children it kept needn't change
     memcpy(old_child_new_node, root_node, PAGE_SIZE);
     old_child_new_node->common_header.is_root = false;
-    uint32_t old_child_key = get_node_max_key(table->pager, old_child_new_node);
-    old_child_new_node->common_header.parent = table->root_page_num;
-    
-    new_child_node->common_header.parent = table->root_page_num;
-
-    if (old_child_new_node->common_header.type == NODE_INTERNAL) {
-        InternalNode* old_child_node = (InternalNode*)old_child_new_node;
-        /* 
-        we're splitting an internal node, and haven't moved the last half of children over yet.
-        so we can promptly update all of its children's parent pointers before splitting
-        */
-        Node* sub_child;
-        for (uint32_t i = 0; i < old_child_node->num_keys; i++) {
-            sub_child = get_page(table->pager, old_child_node->_cells[i].child);
-            sub_child->common_header.parent = old_child_new_page_num;
-        }
-        sub_child = get_page(table->pager, old_child_node->last_child);
-        sub_child->common_header.parent = old_child_new_page_num;
-    }
+    uint32_t old_child_key = get_node_max_key(old_child_new_node);
 
     initialize_internal_node(root_node);
     root_node->is_root = true;
     root_node->num_keys = 1;
-    root_node->_cells[0].child = old_child_new_page_num;
-    root_node->_cells[0].key = old_child_key;
+    *internal_node_child(root_node, 0) = old_child_new_page_num;
+    *internal_node_key(root_node, 0) = old_child_key;
     root_node->last_child = new_child_page_num;
+    root_node->max_key = get_node_max_key(new_child_node);
 
+    unpin_page(table->pager, table->root_page_num);
+    unpin_page(table->pager, old_child_new_page_num);
+    unpin_page(table->pager, new_child_page_num);
+    return old_child_new_page_num;
 }
 
-/* helper function that returns index of a child where
-given key is equal to or greater than the child's key,
-but less than the next child's key.  */
-static uint32_t internal_node_find_child(
-    InternalNode* node,
-    uint32_t key
-) {
-    uint32_t min_index = 0;
-    uint32_t max_index = node->num_keys;
-    while (min_index < max_index) {
-        uint32_t curr_index = (min_index+max_index)/2;
-        uint32_t curr_key = node->_cells[curr_index].key;
-        if (key > curr_key) {
-            min_index = curr_index + 1;
-        } else if (key < curr_key) {
-            max_index = curr_index;
-        } else {
-            min_index = curr_index;
-            break;
-        }
+/* the root just split into `left_page_num` and `right_page_num` (see `create_new_root`): `cursor->path` gains a level */
+static void cursor_push_root(Cursor* cursor, uint32_t left_page_num, uint32_t right_page_num, bool went_right) {
+    if (cursor->depth == BTREE_MAX_DEPTH) {
+        log("tree deeper than %d levels", BTREE_MAX_DEPTH);
+        exit(EXIT_FAILURE);
     }
-    return min_index;
+    memmove(&(cursor->path[1]), &(cursor->path[0]), cursor->depth * sizeof *(cursor->path));
+    cursor->path[0] = cursor->table->root_page_num;
+    cursor->path[1] = went_right ? right_page_num : left_page_num;
+    cursor->depth++;
 }
 
-Cursor* internal_node_find(
-    Table* table,
-    uint32_t node_num,
-    uint32_t key
-) {
-    InternalNode* node = (InternalNode*)get_page(table->pager, node_num);
-    uint32_t child_idx = internal_node_find_child(node, key);
-    Cursor* cursor = malloc(sizeof *cursor);
-    cursor->table = table;
-    cursor->page_num = node_num;
-    cursor->cell_num = child_idx;
-    return cursor;
+/* cell `cell_num` of an index internal node: the child's page number (4 bytes), then the largest entry under it */
+uint8_t* index_internal_node_cell(IndexInternalNode* node, uint32_t cell_num) {
+    return (uint8_t*)node + node->slots[cell_num];
 }
 
-/*
-return the page number (not pointer) of a given child index
-searches key-cell pairs for an index lower than `num_keys`,
-or returns `last_child` for an index equal to `num_keys`
-*/
-uint32_t* internal_node_child(InternalNode* node, uint32_t child_idx) {
-    if (child_idx > node->num_keys) {
-        log("tried accessing child %d", child_idx);
-        exit(EXIT_FAILURE);
-    /* child page number offset is 0,
-    so we can just use the cell or last_child pointer directly */
-    } else if (child_idx == node->num_keys) {
-        return &(node->last_child);
+/* child `child_idx` of an index internal node, `last_child` being `num_cells`. cells aren't aligned, so this copies */
+uint32_t index_internal_node_child(IndexInternalNode* node, uint32_t child_idx) {
+    if (child_idx == node->num_cells) return node->last_child;
+    uint32_t child;
+    memcpy(&child, index_internal_node_cell(node, child_idx), sizeof child);
+    return child;
+}
+
+void index_internal_node_set_child(IndexInternalNode* node, uint32_t child_idx, uint32_t child_page_num) {
+    if (child_idx == node->num_cells) {
+        node->last_child = child_page_num;
     } else {
-        return &(node->_cells[child_idx].child);
+        memcpy(index_internal_node_cell(node, child_idx), &child_page_num, sizeof child_page_num);
     }
 }
 
+/* up to format 6, internal nodes interleaved children and keys: `InternalCell`s, right after the header */
+static uint8_t* legacy_internal_node_cells(InternalNode* node) {
+    return (uint8_t*)node + sizeof(InternalHeader);
+}
+
+static uint32_t legacy_internal_node_child(InternalNode* node, uint32_t child_idx) {
+    if (child_idx == node->num_keys) return node->last_child;
+    InternalCell cell;
+    memcpy(&cell, legacy_internal_node_cells(node) + child_idx * INTERNAL_NODE_CELL_SIZE, sizeof cell);
+    return cell.child;
+}
+
+/* children of an internal node of any kind, table or index. 0 for a leaf */
+uint32_t node_num_children(Node* node) {
+    switch (node->common_header.type) {
+    case NODE_INTERNAL:
+    case NODE_LEGACY_INTERNAL:
+        return ((InternalNode*)node)->num_keys + 1;
+    case NODE_INDEX_INTERNAL:
+        return ((IndexInternalNode*)node)->num_cells + 1;
+    default:
+        return 0;
+    }
+}
+
+uint32_t node_child(Node* node, uint32_t child_idx) {
+    if (node->common_header.type == NODE_INDEX_INTERNAL) {
+        return index_internal_node_child((IndexInternalNode*)node, child_idx);
+    }
+    if (node->common_header.type == NODE_LEGACY_INTERNAL) {
+        return legacy_internal_node_child((InternalNode*)node, child_idx);
+    }
+    return *internal_node_child((InternalNode*)node, child_idx);
+}
+
+/* position of `child_page_num` among the children of `node`, `last_child` being `num_keys` */
+uint32_t internal_node_child_index(InternalNode* node, uint32_t child_page_num) {
+    const uint32_t* children = internal_node_children(node);
+    for (uint32_t i = 0; i < node->num_keys; i++) {
+        if (children[i] == child_page_num) return i;
+    }
+    if (node->last_child != child_page_num) {
+        log("page %d is not a child of this node", child_page_num);
+        exit(EXIT_FAILURE);
+    }
+    return node->num_keys;
+}
+
+/* list every child with its max key, `last_child` included, into `cells`. returns the number of children */
+uint32_t internal_node_get_children(InternalNode* node, InternalCell* cells) {
+    const uint32_t* children = internal_node_children(node);
+    for (uint32_t i = 0; i < node->num_keys; i++) {
+        cells[i].child = children[i];
+        cells[i].key = node->_keys[i];
+    }
+    cells[node->num_keys].child = node->last_child;
+    cells[node->num_keys].key = node->max_key;
+    return node->num_keys + 1;
+}
+
+/* the inverse of `internal_node_get_children`: the last of `cells` becomes `last_child` */
+void internal_node_set_children(InternalNode* node, const InternalCell* cells, uint32_t num_children) {
+    node->num_keys = num_children - 1;
+    uint32_t* children = internal_node_children(node);
+    for (uint32_t i = 0; i < node->num_keys; i++) {
+        children[i] = cells[i].child;
+        node->_keys[i] = cells[i].key;
+    }
+    node->last_child = cells[num_children - 1].child;
+    node->max_key = cells[num_children - 1].key;
+}
+
+/* replace the key of the child under `old_key` in `node` (pinned, at `page_num`), marking it dirty if that changes it */
 void update_internal_node_key(
+    Pager* pager,
+    uint32_t page_num,
     InternalNode* node,
     uint32_t old_key,
     uint32_t new_key
 ) {
     uint32_t old_child_index = internal_node_find_child(node, old_key);
-    node->_cells[old_child_index].key = new_key;
+    // `last_child` has no key cell; writing one would clobber memory past the last cell when the node is full
+    if (old_child_index >= node->num_keys) return;
+    mark_page_dirty(pager, page_num);
+    *internal_node_key(node, old_child_index) = new_key;
 }
 
-static void internal_node_split_and_insert(
-    Table* table,
-    uint32_t old_sibling_page_num,
-    uint32_t insert_node_num
-);
+static void internal_node_split_and_insert(Cursor* cursor, uint32_t level, uint32_t insert_page_num);
 
-void internal_node_insert(
-    Table* table,
-    uint32_t parent_page_num,
-    uint32_t insert_page_num
-) {
+/*
+add child `insert_page_num` to `cursor->path[level]`, the internal node `level` levels below the root on the cursor's path.
+if that node splits, the path is left pointing at whichever half took the child.
+*/
+void internal_node_insert(Cursor* cursor, uint32_t level, uint32_t insert_page_num) {
+    Table* table = cursor->table;
+    uint32_t parent_page_num = cursor->path[level];
     InternalNode* parent_node = (InternalNode*)get_page(table->pager, parent_page_num);
-    Node* insert_node = (Node*)get_page(table->pager, insert_page_num);
+    uint32_t insert_node_key = get_page_max_key(table->pager, insert_page_num);
     // a node with `last_child == INVALID_PAGE_NUM` is empty
     if (parent_node->last_child == INVALID_PAGE_NUM) {
+        mark_page_dirty(table->pager, parent_page_num);
         parent_node->last_child = insert_page_num;
+        parent_node->max_key = insert_node_key;
+        unpin_page(table->pager, parent_page_num);
         return;
     }
-    uint32_t insert_node_key = get_node_max_key(table->pager, insert_node);
-    uint32_t insert_idx = internal_node_find_child(parent_node, insert_node_key);
     if (parent_node->num_keys >= INTERNAL_NODE_MAX_KEYS) { // we're already at the limit, inserting one more would overflow
-        internal_node_split_and_insert(table, parent_page_num, insert_page_num);
+        unpin_page(table->pager, parent_page_num);
+        internal_node_split_and_insert(cursor, level, insert_page_num);
         return;
     }
-    // if () {
-    /* 
-    we compare keys rather than `insert_idx >= parent_node->num_keys`
-    because `num_keys == 0` guarantees `insert_idx == 0`, 
-    however `num_keys` may be 0 but we may already have a `last_child`,
-    and `internal_node_find_child` is blind to that possibility.
+    mark_page_dirty(table->pager, parent_page_num);
+    /*
+    compare against `last_child` itself rather than `parent_node->max_key`:
+    when `last_child` was just split, `insert_page_num` is its right half and the cached max belongs to that now.
     */
-    if (insert_node_key > get_node_max_key(table->pager, (Node*)parent_node)) {
+    uint32_t last_child_key = get_page_max_key(table->pager, parent_node->last_child);
+    uint32_t* children = internal_node_children(parent_node);
+    if (insert_node_key > last_child_key) {
         // node to be inserted should be the new last child - swap with current last child
-        Node* last_child_node = get_page(table->pager, parent_node->last_child);
-        parent_node->_cells[parent_node->num_keys].child = parent_node->last_child;
-        parent_node->_cells[parent_node->num_keys].key = get_node_max_key(table->pager, last_child_node);
+        children[parent_node->num_keys] = parent_node->last_child;
+        parent_node->_keys[parent_node->num_keys] = last_child_key;
         parent_node->last_child = insert_page_num;
-        // RESEARCH: should we update the parent's key on *its* parent?
+        parent_node->max_key = insert_node_key;
     } else {
+        uint32_t insert_idx = internal_node_find_child(parent_node, insert_node_key);
         // [0, 1, 3, 4] [*] (invalid memory)
         //      ^^          ^ parent_num_keys
-        for (uint32_t i = parent_node->num_keys; i > insert_idx + 1; i--) {
-            memcpy(
-                &(parent_node->_cells[i]),
-                &(parent_node->_cells[i-1]),
-                INTERNAL_NODE_CELL_SIZE
-            );
-        }
-        parent_node->_cells[insert_idx].child = insert_page_num;
-        parent_node->_cells[insert_idx].key = get_node_max_key(table->pager, insert_node);
+        uint32_t num_moved = parent_node->num_keys - insert_idx;
+        memmove(&(children[insert_idx + 1]), &(children[insert_idx]), num_moved * sizeof(uint32_t));
+        memmove(&(parent_node->_keys[insert_idx + 1]), &(parent_node->_keys[insert_idx]), num_moved * sizeof(uint32_t));
+        children[insert_idx] = insert_page_num;
+        parent_node->_keys[insert_idx] = insert_node_key;
     }
     parent_node->num_keys++;
+    unpin_page(table->pager, parent_page_num);
 }
 
-static void internal_node_split_and_insert(
-    // TODO: probably wrong signature
-    Table* table,
-    uint32_t old_sibling_page_num,
-    uint32_t insert_node_num
-) {
-    InternalNode* old_sibling_node = (InternalNode*)get_page(table->pager, old_sibling_page_num);
-    uint32_t old_sibling_old_key = get_node_max_key(table->pager, (Node*)old_sibling_node);
-
-    Node* insert_node = (Node*)get_page(table->pager, insert_node_num);
-    uint32_t insert_key = get_node_max_key(table->pager, insert_node);
-
-    uint32_t new_sibling_num = get_unused_page_num(table->pager);
-    InternalNode* new_sibling_node = (InternalNode*)get_page(table->pager, new_sibling_num);
+/*
+split a full internal node while adding `insert_page_num` to it.
+all children (and their keys) are laid out in order in a scratch array, then each half is copied over in one go:
+the lower half stays, the upper half goes to a new sibling. the children themselves aren't touched: nodes don't point
+back at their parent. the new sibling goes into the parent the cursor's path names, which may split in turn.
+*/
+static void internal_node_split_and_insert(Cursor* cursor, uint32_t level, uint32_t insert_page_num) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    uint32_t old_page_num = cursor->path[level];
+    InternalNode* old_node = (InternalNode*)get_page(pager, old_page_num);
+    mark_page_dirty(pager, old_page_num);
+    uint32_t old_max_key = old_node->max_key;
+    uint32_t insert_key = get_page_max_key(pager, insert_page_num);
 
-    // parent of two nodes resulting from split
-    InternalNode* parent_node;
-    /*
-    we branch here because `create_new_root` initializes `new_node_num` for us,
-    but if we don't use it, then we have to initialize `new_node` ourselves.
-    */
-    bool splitting_root = old_sibling_node->is_root;
-    if (splitting_root) {
-        // parent node is newly created
-        create_new_root(table, new_sibling_num);
-        parent_node = (InternalNode*)get_page(table->pager, table->root_page_num);
-        // since `old_sibling_node` moved to a new page, the current page num and page pointer are invalid - update them
-        old_sibling_page_num = parent_node->_cells[0].child;
-        old_sibling_node = (InternalNode*)get_page(table->pager, old_sibling_page_num);
-    } else {
-        parent_node = (InternalNode*)get_page(table->pager, old_sibling_node->parent);
-    }
-    initialize_internal_node(new_sibling_node);
+    InternalCell cells[INTERNAL_NODE_MAX_KEYS + 2];
+    uint32_t num_cells = internal_node_get_children(old_node, cells);
+    // as in `internal_node_insert`, `last_child` may have just been split, so ask it for its max
+    cells[num_cells - 1].key = get_page_max_key(pager, old_node->last_child);
+    uint32_t insert_idx = num_cells;
+    while (insert_idx > 0 && cells[insert_idx - 1].key > insert_key) insert_idx--;
+    memmove(&(cells[insert_idx + 1]), &(cells[insert_idx]), (num_cells - insert_idx) * INTERNAL_NODE_CELL_SIZE);
+    cells[insert_idx].child = insert_page_num;
+    cells[insert_idx].key = insert_key;
+    num_cells++;
 
-    uint32_t cur_page_num = old_sibling_node->last_child;
-    Node* cur_node = get_page(table->pager, cur_page_num);
+    uint32_t left_count = num_cells / 2;
+    uint32_t right_count = num_cells - left_count;
 
-    // make `old_sibling_node`'s `last_child`, `new_sibling_node`'s `last_child`
-    internal_node_insert(table, new_sibling_num, cur_page_num);
-    cur_node->common_header.parent = new_sibling_num;
-    old_sibling_node->last_child = INVALID_PAGE_NUM;
+    internal_node_set_children(old_node, cells, left_count);
 
-    /* 
-    all children (except `last_child`) are currently in the old node.
-    let's move them one by one and update `num_keys` in the old node accordingly.
-    */
-    for (uint32_t i = INTERNAL_NODE_MAX_KEYS - 1; i > (INTERNAL_NODE_MAX_KEYS) / 2; i--) {
-        cur_page_num = old_sibling_node->_cells[i].child;
-        cur_node = get_page(table->pager, cur_page_num);
+    uint32_t new_page_num = get_unused_page_num(pager, old_page_num);
+    InternalNode* new_node = (InternalNode*)get_page(pager, new_page_num);
+    mark_page_dirty(pager, new_page_num);
+    initialize_internal_node(new_node);
+    internal_node_set_children(new_node, &(cells[left_count]), right_count);
 
-        internal_node_insert(table, new_sibling_num, cur_page_num);
-        cur_node->common_header.parent = new_sibling_num;
-        old_sibling_node->num_keys--;
+    bool went_right = insert_idx >= left_count;
+    if (old_node->is_root) {
+        unpin_page(pager, old_page_num);
+        unpin_page(pager, new_page_num);
+        // moves the lower half off the root page, and makes both halves the root's children
+        uint32_t left_page_num = create_new_root(table, new_page_num);
+        cursor_push_root(cursor, left_page_num, new_page_num, went_right);
+        return;
     }
 
-    // make current "last" child (last cell, invalid state) into `last_child`
-    old_sibling_node->last_child = old_sibling_node->_cells[old_sibling_node->num_keys-1].child;
-    old_sibling_node->num_keys--;
-    // since `old_sibling_node` has an updated `last_child`, update its corresponding key in its parent also
-    uint32_t old_sibling_new_key = get_node_max_key(table->pager, (Node*)old_sibling_node);
-    update_internal_node_key(parent_node, old_sibling_old_key, old_sibling_new_key);
-
-    uint32_t destination_page_num = (insert_key > old_sibling_new_key) ? new_sibling_num : old_sibling_page_num;
-    internal_node_insert(table, destination_page_num, insert_node_num);
-    insert_node->common_header.parent = destination_page_num;
+    uint32_t parent_page_num = cursor->path[level - 1];
+    if (went_right) cursor->path[level] = new_page_num;
+    InternalNode* parent_node = (InternalNode*)get_page(pager, parent_page_num);
+    update_internal_node_key(pager, parent_page_num, parent_node, old_max_key, old_node->max_key);
+    unpin_page(pager, parent_page_num);
+    unpin_page(pager, old_page_num);
+    unpin_page(pager, new_page_num);
+    internal_node_insert(cursor, level - 1, new_page_num);
+}
 
-    if (!splitting_root) {
-        // we have to manually insert new sibling, `create_new_root` doesn't do it for us
-        internal_node_insert(table, old_sibling_node->parent, new_sibling_num);
-        new_sibling_node->parent = old_sibling_node->parent;
+/* a new largest key lands in the rightmost leaf: raise the cached max of every node on the way down to it */
+static void btree_raise_max_key(Table* table, uint32_t key) {
+    uint32_t page_num = table->root_page_num;
+    Node* node = get_page(table->pager, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        InternalNode* internal_node = (InternalNode*)node;
+        if (internal_node->max_key < key) {
+            mark_page_dirty(table->pager, page_num);
+            internal_node->max_key = key;
+        }
+        uint32_t child_page_num = internal_node->last_child;
+        unpin_page(table->pager, page_num);
+        page_num = child_page_num;
+        node = get_page(table->pager, page_num);
     }
+    unpin_page(table->pager, page_num);
 }
 
 void initialize_leaf_node(LeafNode* node) {
     // memset(node, 0, PAGE_SIZE);
     // memset 0 already does all these
     node->is_root = false;
-    node->num_cells = 0;
     node->next_leaf = 0;
     node->type = NODE_LEAF;
+    node->parent = 0;
+    leaf_node_clear(node);
 }
 
 /*
 find cell with matching key, OR cell ideal for inserting the key.
-return cursor may point to cell past limit and node splitting should be handled.
+returned index may be past limit and node splitting should be handled.
 ex: [0, 1, 2, 3,][*]
-            limit ^ ^ return_cursor->cell_num
+            limit ^ ^ returned index
 */
-Cursor* leaf_node_find(Table* table, uint32_t node_num, uint32_t key) {
-    LeafNode* node = (LeafNode*)get_page(table->pager, node_num);
-    Cursor* cursor = malloc(sizeof *cursor);
-    cursor->table = table;
-    cursor->page_num = node_num;
+static uint32_t leaf_node_find_cell(LeafNode* node, uint32_t key) {
     // binary search
     uint32_t min_index = 0;
     // keys are monotonic but not necessarily continuons. e.g. [2, 3, 8, 14]
@@ -296,11 +502,8 @@ Cursor* leaf_node_find(Table* table, uint32_t node_num, uint32_t key) {
     while (one_past_max_index != min_index) {
         //`min + (max-min) / 2` simplifies into `(min + max) / 2`
         uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = node->cells[index].key;
-        if (key == key_at_index) {
-            cursor->cell_num = index;
-            return cursor;
-        }
+        uint32_t key_at_index = leaf_node_key(node, index);
+        if (key == key_at_index) return index;
         if (key < key_at_index) {
             one_past_max_index = index;
         } else {
@@ -311,110 +514,913 @@ Cursor* leaf_node_find(Table* table, uint32_t node_num, uint32_t key) {
     }
 
     // num_cells == 0, or key is not found but now we have a position to insert it into.
-    cursor->cell_num = min_index;
-    return cursor;
+    return min_index;
+}
+
+/*
+point the caller's `cursor` at the cell with `key`, or the cell to insert it into, descending from the root.
+the internal pages on the way are recorded in `cursor->path`.
+*/
+void btree_find(Table* table, uint32_t key, Cursor* cursor) {
+    cursor->table = table;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    cursor->read_ahead_end = 0;
+    cursor->read_ahead_window = 0;
+    uint32_t page_num = table->root_page_num;
+    Node* node = get_page(table->pager, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        if (cursor->depth == BTREE_MAX_DEPTH) {
+            log("tree deeper than %d levels", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        cursor->path[cursor->depth++] = page_num;
+        InternalNode* internal_node = (InternalNode*)node;
+        uint32_t child_page_num = *internal_node_child(internal_node, internal_node_find_child(internal_node, key));
+        unpin_page(table->pager, page_num);
+        page_num = child_page_num;
+        node = get_page(table->pager, page_num);
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = leaf_node_find_cell((LeafNode*)node, key);
+    unpin_page(table->pager, page_num);
+}
+
+/* release every latch `cursor` holds (see `btree_find_latched`) */
+void btree_unlatch(Cursor* cursor) {
+    for (uint32_t i = 0; i < cursor->num_latched; i++) unlatch_page(cursor->table->pager, cursor->latched[i]);
+    cursor->num_latched = 0;
+}
+
+/* crabbing: release the latches above the node latched last */
+static void btree_unlatch_ancestors(Cursor* cursor) {
+    uint32_t last = cursor->latched[cursor->num_latched - 1];
+    for (uint32_t i = 0; i + 1 < cursor->num_latched; i++) unlatch_page(cursor->table->pager, cursor->latched[i]);
+    cursor->latched[0] = last;
+    cursor->num_latched = 1;
+}
+
+/*
+whether a write with `intent` at `key` (a row of `cell_size` bytes) stays within `node`'s subtree, leaving the nodes
+above it alone - then their latches can go. for a leaf, `cell_num` is where `key` is, or would go.
+- an insert splits a node that's full, and changes the max key (kept by the parent) of every node it goes past the end of.
+- an update splits a leaf its row outgrows.
+- a delete rebalances a node it leaves underflowing, collapses a root it leaves with a single child,
+  and changes the max key of every node whose largest key it takes.
+*/
+static bool node_is_safe(Node* node, LatchIntent intent, uint32_t key, uint32_t cell_size, uint32_t cell_num) {
+    if (node->common_header.type == NODE_INTERNAL) {
+        InternalNode* internal_node = (InternalNode*)node;
+        switch (intent) {
+        case LATCH_INSERT:
+            return internal_node->num_keys < INTERNAL_NODE_MAX_KEYS && key < internal_node->max_key;
+        case LATCH_UPDATE:
+            return internal_node->num_keys < INTERNAL_NODE_MAX_KEYS;
+        case LATCH_DELETE:
+            return internal_node->num_keys >= (internal_node->is_root ? 2 : INTERNAL_NODE_MIN_CHILDREN)
+                && key < internal_node->max_key;
+        default:
+            return intent == LATCH_READ;
+        }
+    }
+    LeafNode* leaf = (LeafNode*)node;
+    bool found = cell_num < leaf->num_cells && leaf_node_key(leaf, cell_num) == key;
+    switch (intent) {
+    case LATCH_INSERT:
+        return found || (cell_num < leaf->num_cells && leaf_node_free_space(leaf) >= cell_size + LEAF_NODE_SLOT_SIZE);
+    case LATCH_UPDATE:
+        return !found || leaf_node_free_space(leaf) + serialized_row_size(leaf_node_cell(leaf, cell_num)) >= cell_size;
+    case LATCH_DELETE:
+        if (!found || leaf->is_root) return true;
+        return cell_num + 1 < leaf->num_cells
+            && leaf_node_used_bytes(leaf) - serialized_row_size(leaf_node_cell(leaf, cell_num)) - LEAF_NODE_SLOT_SIZE
+                >= LEAF_NODE_MIN_USED_BYTES;
+    default:
+        return intent == LATCH_READ;
+    }
+}
+
+/*
+`btree_find`, for when other threads may be in the tree: the pages on the way down are latched, shared to read and
+exclusive to write, and a child is latched before its parent is let go (crabbing), so no thread ever sees a node
+halfway through a change. a reader holds at most two latches at a time. a writer holds on to the nodes above the leaf
+for as long as the write could still reach them (`node_is_safe`), so a split or a merge has every page it changes on
+the path latched - and nothing above that.
+the cursor ends up holding the leaf's latch (and whichever ancestors' it kept), release them with `btree_unlatch`.
+only one thread may write at a time, and it must not take latches in any other order: top down, then along a level
+while holding the parent (a rebalance's sibling).
+`cell_size` is the row's for an insert or an update.
+*/
+void btree_find_latched(Table* table, uint32_t key, LatchIntent intent, uint32_t cell_size, Cursor* cursor) {
+    Pager* pager = table->pager;
+    bool exclusive = intent != LATCH_READ;
+    cursor->table = table;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    cursor->read_ahead_end = 0;
+    cursor->read_ahead_window = 0;
+    cursor->num_latched = 0;
+    uint32_t page_num = table->root_page_num;
+    Node* node = latch_page(pager, page_num, exclusive);
+    cursor->latched[cursor->num_latched++] = page_num;
+    while (node->common_header.type == NODE_INTERNAL) {
+        if (cursor->depth == BTREE_MAX_DEPTH) {
+            log("tree deeper than %d levels", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        cursor->path[cursor->depth++] = page_num;
+        InternalNode* internal_node = (InternalNode*)node;
+        page_num = *internal_node_child(internal_node, internal_node_find_child(internal_node, key));
+        node = latch_page(pager, page_num, exclusive);
+        cursor->latched[cursor->num_latched++] = page_num;
+        if (node->common_header.type == NODE_INTERNAL && node_is_safe(node, intent, key, cell_size, 0)) {
+            btree_unlatch_ancestors(cursor);
+        }
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = leaf_node_find_cell((LeafNode*)node, key);
+    if (node_is_safe(node, intent, key, cell_size, cursor->cell_num)) btree_unlatch_ancestors(cursor);
+}
+
+/*
+a scan is about to read `next_page_num`, the leaf holding `key`, and the pool doesn't have it: read it together with
+the leaves after it (see `pager_prefetch`), which its parent lists. the descent to the parent only tries latches, and
+goes no further than the pool has - the scan holds a leaf, and this is only a hint, it mustn't wait on anything
+*/
+static void btree_prefetch_leaves(Table* table, uint32_t key, uint32_t next_page_num) {
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    if (page_num == next_page_num || pager_can_prefetch(pager, page_num)) return;
+    Node* node = try_latch_page(pager, page_num);
+    for (uint32_t depth = 0; node && node->common_header.type == NODE_INTERNAL && depth < BTREE_MAX_DEPTH; depth++) {
+        InternalNode* internal_node = (InternalNode*)node;
+        uint32_t child_idx = internal_node_find_child(internal_node, key);
+        uint32_t child_page_num = *internal_node_child(internal_node, child_idx);
+        if (child_page_num == next_page_num) {
+            uint32_t page_nums[PAGER_PREFETCH_PAGES];
+            uint32_t count = 0;
+            for (uint32_t i = child_idx; i <= internal_node->num_keys && count < PAGER_PREFETCH_PAGES; i++) {
+                page_nums[count++] = *internal_node_child(internal_node, i);
+            }
+            unlatch_page(pager, page_num);
+            pager_prefetch(pager, page_nums, count);
+            return;
+        }
+        unlatch_page(pager, page_num);
+        if (pager_can_prefetch(pager, child_page_num)) return;
+        page_num = child_page_num;
+        node = try_latch_page(pager, page_num);
+    }
+    if (node) unlatch_page(pager, page_num);
+}
+
+/*
+a scan is moving on from its leaf to `next_page_num`. leaves written in key order (appended, loaded, vacuumed) sit in
+the same order in the file, and once the scan steps forward through them, the OS is asked to read the pages ahead of it
+(`pager_read_ahead`) - a few at first, then twice as many every time, as long as the leaves keep following each other.
+the next ask goes out when the scan is halfway through the last one, so the reads are done before it gets there.
+returns false if the leaves don't follow each other: then the window starts over, small.
+*/
+bool btree_read_ahead(Cursor* cursor, uint32_t next_page_num) {
+    Pager* pager = cursor->table->pager;
+    if (pager->read_ahead_max == 0) return false;
+    if (next_page_num <= cursor->page_num || next_page_num - cursor->page_num > READ_AHEAD_MAX_GAP) {
+        cursor->read_ahead_end = 0;
+        cursor->read_ahead_window = 0;
+        return false;
+    }
+    if (cursor->read_ahead_window == 0) cursor->read_ahead_window = READ_AHEAD_MIN_PAGES;
+    if (cursor->read_ahead_end < next_page_num) cursor->read_ahead_end = next_page_num;
+    if (next_page_num + cursor->read_ahead_window / 2 >= cursor->read_ahead_end) {
+        pager_read_ahead(pager, cursor->read_ahead_end, cursor->read_ahead_window);
+        cursor->read_ahead_end += cursor->read_ahead_window;
+        cursor->read_ahead_window *= 2;
+        if (cursor->read_ahead_window > pager->read_ahead_max) cursor->read_ahead_window = pager->read_ahead_max;
+    }
+    return true;
+}
+
+/*
+move `cursor`, at the end of its leaf, on to the first cell of the next leaf (or the end of the table).
+a read-latched cursor crabs along the chain, latching the next leaf before letting go of this one. but a rebalance
+latches a leaf's left sibling while holding the leaf, so rather than wait (and maybe deadlock), the next leaf is only
+tried: if it's taken, this leaf is let go, and a new descent picks up from the key after the last one seen.
+*/
+void btree_next_leaf(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    while (true) {
+        LeafNode* node = (LeafNode*)get_page(pager, cursor->page_num);
+        uint32_t next_page_num = node->next_leaf;
+        uint32_t max_key = node->num_cells ? get_node_max_key((Node*)node) : 0;
+        unpin_page(pager, cursor->page_num);
+        // page 0 is the file header, so a `next_page_num` of 0 (what a fresh leaf starts with) means there is none
+        if (next_page_num == 0 || (cursor->num_latched && max_key == UINT32_MAX)) {
+            cursor->end_of_table = true;
+            return;
+        }
+        // leaves in order in the file are read ahead by the OS; any others, a few at a time from their parent
+        if (!btree_read_ahead(cursor, next_page_num) && pager_can_prefetch(pager, next_page_num)) {
+            btree_prefetch_leaves(cursor->table, max_key + 1, next_page_num);
+        }
+        bool latched = cursor->num_latched > 0;
+        if (!latched || try_latch_page(pager, next_page_num)) {
+            btree_unlatch(cursor);
+            if (latched) cursor->latched[cursor->num_latched++] = next_page_num;
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
+            return;
+        }
+        btree_unlatch(cursor);
+        btree_find_latched(cursor->table, max_key + 1, LATCH_READ, 0, cursor);
+        node = (LeafNode*)get_page(pager, cursor->page_num);
+        bool found = cursor->cell_num < node->num_cells;
+        unpin_page(pager, cursor->page_num);
+        if (found) return;
+    }
+}
+
+/* move a cursor from `btree_seek_snapshot`, at the end of its leaf, on to the next leaf as the snapshot sees it */
+void btree_next_leaf_snapshot(Snapshot* snapshot, Cursor* cursor) {
+    Node* node = snapshot_get_page(snapshot, cursor->page_num);
+    uint32_t next_page_num = ((LeafNode*)node)->next_leaf;
+    uint32_t max_key = ((LeafNode*)node)->num_cells ? get_node_max_key(node) : 0;
+    snapshot_put_page(snapshot, cursor->page_num, node);
+    if (next_page_num == 0) {
+        cursor->end_of_table = true;
+        return;
+    }
+    // the pages the snapshot reads may be copies, but the leaves after it are where they were, or near enough for a hint
+    if (!btree_read_ahead(cursor, next_page_num) && pager_can_prefetch(snapshot->pager, next_page_num)) {
+        btree_prefetch_leaves(cursor->table, max_key + 1, next_page_num);
+    }
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+}
+
+/*
+point `cursor` at the first row with a key >= `key` in the table as `snapshot` sees it, or at the end of the table.
+the cursor holds nothing: read its leaf with `snapshot_get_page`, and move it along with `btree_next_leaf_snapshot`.
+there's no crabbing - every page read is as of the snapshot, whatever a writer does to the tree in between.
+the descent starts from `page_num`, the root of a subtree holding `key` (`btree_seek_snapshot` starts from the table's).
+*/
+void btree_seek_subtree_snapshot(Table* table, Snapshot* snapshot, uint32_t page_num, uint32_t key, Cursor* cursor) {
+    cursor->table = table;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    cursor->read_ahead_end = 0;
+    cursor->read_ahead_window = 0;
+    cursor->num_latched = 0;
+    Node* node = snapshot_get_page(snapshot, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        if (cursor->depth == BTREE_MAX_DEPTH) {
+            log("tree deeper than %d levels", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        cursor->path[cursor->depth++] = page_num;
+        InternalNode* internal_node = (InternalNode*)node;
+        uint32_t child_page_num = *internal_node_child(internal_node, internal_node_find_child(internal_node, key));
+        snapshot_put_page(snapshot, page_num, node);
+        page_num = child_page_num;
+        node = snapshot_get_page(snapshot, page_num);
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = leaf_node_find_cell((LeafNode*)node, key);
+    uint32_t num_cells = ((LeafNode*)node)->num_cells;
+    snapshot_put_page(snapshot, page_num, node);
+    // `key` is past this leaf's last row (only in the last leaf), the next leaf starts with the row after it
+    if (cursor->cell_num >= num_cells) btree_next_leaf_snapshot(snapshot, cursor);
+}
+
+void btree_seek_snapshot(Table* table, Snapshot* snapshot, uint32_t key, Cursor* cursor) {
+    btree_seek_subtree_snapshot(table, snapshot, table->root_page_num, key, cursor);
+}
+
+/* `btree_last_key_snapshot` under `page_num`. a child's key may be stale (its largest row deleted), so if the child that would
+hold `key` has nothing up to it, the largest key is in the child before it */
+static bool btree_last_key_under(Snapshot* snapshot, uint32_t page_num, uint32_t key, uint32_t* last_key) {
+    Node* node = snapshot_get_page(snapshot, page_num);
+    bool found = false;
+    if (node->common_header.type == NODE_INTERNAL) {
+        InternalNode* internal_node = (InternalNode*)node;
+        uint32_t child_idx = internal_node_find_child(internal_node, key);
+        uint32_t child_page_nums[INTERNAL_NODE_MAX_CHILDREN];
+        for (uint32_t i = 0; i <= child_idx; i++) child_page_nums[i] = *internal_node_child(internal_node, i);
+        snapshot_put_page(snapshot, page_num, node);
+        for (int64_t i = child_idx; i >= 0 && !found; i--) {
+            found = btree_last_key_under(snapshot, child_page_nums[i], key, last_key);
+        }
+        return found;
+    }
+    LeafNode* leaf = (LeafNode*)node;
+    uint32_t cell_num = leaf_node_find_cell(leaf, key);
+    if (cell_num < leaf->num_cells && leaf_node_key(leaf, cell_num) == key) {
+        *last_key = key;
+        found = true;
+    } else if (cell_num > 0) {
+        *last_key = leaf_node_key(leaf, cell_num - 1);
+        found = true;
+    }
+    snapshot_put_page(snapshot, page_num, node);
+    return found;
+}
+
+/* the largest key <= `key` in the table as `snapshot` sees it, if there's any: one descent, to the leaf that would hold `key` */
+bool btree_last_key_snapshot(Table* table, Snapshot* snapshot, uint32_t key, uint32_t* last_key) {
+    return btree_last_key_under(snapshot, table->root_page_num, key, last_key);
 }
 
 /*
 create new sibling node,
-move over top half of items (rounding down),
-while inserting new value into appropriate node
+move over the top half of the cells (by size),
+while inserting the new cell into the appropriate node
 */
-static void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
+static void leaf_node_split_and_insert(Cursor* cursor, const uint8_t* cell, uint32_t cell_size) {
     LeafNode* old_node = (LeafNode*)get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_key = get_node_max_key(cursor->table->pager, (Node*)old_node);
+    mark_page_dirty(cursor->table->pager, cursor->page_num);
+    uint32_t old_key = get_node_max_key((Node*)old_node);
 
-    uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
+    uint32_t new_page_num = get_unused_page_num(cursor->table->pager, cursor->page_num);
     LeafNode* new_node = (LeafNode*)get_page(cursor->table->pager, new_page_num);
+    mark_page_dirty(cursor->table->pager, new_page_num);
     initialize_leaf_node(new_node);
     new_node->next_leaf = old_node->next_leaf;
-    new_node->num_cells = LEAF_NODE_RIGHT_SPLIT_COUNT;
-    new_node->parent = old_node->parent;
 
     old_node->next_leaf = new_page_num;
-    old_node->num_cells = LEAF_NODE_LEFT_SPLIT_COUNT;
-
-    /* because we're also inserting, we have to account for a cell that doesn't exist yet.
-    (because max_cells == max_idx + 1) */
-    for (uint32_t i = LEAF_NODE_MAX_CELLS; i > 0; i--) {
-        /*
-        cell_num > insert_cell: move over, copy memory from i-1 to i, possibly to sibling node
-        cell_num == insert_cell: equals `i`, copy there.
-        cell_num < insert_cell: don't move over, but possibly copy to sibling node.
-        */
-        uint32_t new_cell_idx = i % LEAF_NODE_RIGHT_SPLIT_COUNT; // new index for cells after insert_cell
-        LeafNode* destination_node = (i >= LEAF_NODE_RIGHT_SPLIT_COUNT) ? new_node : old_node;
-        void *destination = &(destination_node->cells[new_cell_idx]);
+
+    // cells are variable-sized, so rather than shifting them around, list them (and the new one) in order from a copy
+    LeafNode old_copy;
+    memcpy(&old_copy, old_node, PAGE_SIZE);
+    const uint8_t* cells[LEAF_NODE_MAX_CELLS + 1];
+    uint32_t cell_sizes[LEAF_NODE_MAX_CELLS + 1];
+    uint32_t num_cells = 0;
+    for (uint32_t i = 0; i <= old_copy.num_cells; i++) {
         if (i == cursor->cell_num) {
-            destination_node->cells[new_cell_idx].key = key;
-            serialize_row(value, destination);
-        } else if (i < cursor->cell_num) { // before insert
-            // NOTE: if destination_node == old_node, this actually does nothing!
-            memcpy(destination, &(old_node->cells[i]), LEAF_NODE_CELL_SIZE);
-        } else { // past insert
-            memcpy(destination, &(old_node->cells[i-1]), LEAF_NODE_CELL_SIZE);
+            cells[num_cells] = cell;
+            cell_sizes[num_cells++] = cell_size;
+        }
+        if (i < old_copy.num_cells) {
+            cells[num_cells] = leaf_node_cell(&old_copy, i);
+            cell_sizes[num_cells] = serialized_row_size(cells[num_cells]);
+            num_cells++;
         }
     }
+    leaf_node_clear(old_node);
+    leaf_nodes_distribute(old_node, new_node, cells, cell_sizes, num_cells);
 
+    uint32_t old_page_num = cursor->page_num;
     if (old_node->is_root) {
-        create_new_root(cursor->table, new_page_num);
+        // the leaf's cells move off the root page
+        cursor->page_num = create_new_root(cursor->table, new_page_num);
+        cursor->depth = 1;
+        cursor->path[0] = cursor->table->root_page_num;
     } else {
-        uint32_t parent_page_num = old_node->parent;
+        uint32_t parent_page_num = cursor->path[cursor->depth - 1];
         InternalNode* parent_node = (InternalNode*)get_page(cursor->table->pager, parent_page_num);
         // we haven't inserted the new node yet, so no need to update its key
-        uint32_t new_key = get_node_max_key(cursor->table->pager, (Node*)old_node);
-        update_internal_node_key(parent_node, old_key, new_key);
-        internal_node_insert(cursor->table, parent_page_num, new_page_num);
+        uint32_t new_key = get_node_max_key((Node*)old_node);
+        update_internal_node_key(cursor->table->pager, parent_page_num, parent_node, old_key, new_key);
+        unpin_page(cursor->table->pager, parent_page_num);
+        internal_node_insert(cursor, cursor->depth - 1, new_page_num);
     }
+
+    unpin_page(cursor->table->pager, old_page_num);
+    unpin_page(cursor->table->pager, new_page_num);
 }
 
 void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
     LeafNode* node = (LeafNode*)get_page(cursor->table->pager, cursor->page_num);
+    uint8_t cell[ROW_MAX_SIZE];
+    uint32_t cell_size = serialize_row(value, cell);
 
     uint32_t num_cells = node->num_cells;
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
-        leaf_node_split_and_insert(cursor, key, value);
+    // past the last cell of the last leaf: the largest key in the table
+    bool new_max_key = cursor->cell_num == num_cells && node->next_leaf == 0 && !node->is_root;
+    if (leaf_node_free_space(node) < cell_size + LEAF_NODE_SLOT_SIZE) {
+        unpin_page(cursor->table->pager, cursor->page_num);
+        leaf_node_split_and_insert(cursor, cell, cell_size);
+        if (new_max_key) btree_raise_max_key(cursor->table, key);
         return;
     }
 
-    if (cursor->cell_num < num_cells) {
-        // key is to be inserted between 2 existing cells
-        // shift cells to the right to insert in the middle
-        for (uint32_t i = num_cells; i>cursor->cell_num; i--) {
-            memcpy(&(node->cells[i]), &(node->cells[i-1]), LEAF_NODE_CELL_SIZE);
-        }
     // TODO: check whether this code is necessary
-    } else if (!node->is_root) {
+    if (cursor->cell_num == num_cells && !node->is_root) {
         // largest key yet - update parent node's key on current node
         // above check is there because a root node has no parent
-        uint32_t old_key = get_node_max_key(cursor->table->pager, (Node*)node);
-        InternalNode* parent_node = (InternalNode*)get_page(cursor->table->pager, node->parent);
-        update_internal_node_key(parent_node, old_key, key);
+        uint32_t old_key = get_node_max_key((Node*)node);
+        uint32_t parent_page_num = cursor->path[cursor->depth - 1];
+        InternalNode* parent_node = (InternalNode*)get_page(cursor->table->pager, parent_page_num);
+        update_internal_node_key(cursor->table->pager, parent_page_num, parent_node, old_key, key);
+        unpin_page(cursor->table->pager, parent_page_num);
     }
 
-    node->num_cells += 1;
-    // node->cells[cursor->cell_num].key = key; // guaranteed by `serialize_row`
-    // serialize row in memory
-    serialize_row(value, &(node->cells[cursor->cell_num]));
+    mark_page_dirty(cursor->table->pager, cursor->page_num);
+    // later cells' slots shift right, the cells themselves stay put
+    leaf_node_insert_cell(node, cursor->cell_num, cell, cell_size);
+    unpin_page(cursor->table->pager, cursor->page_num);
+    if (new_max_key) btree_raise_max_key(cursor->table, key);
 }
 
 /*
-navigate down an internal node `node_num`  until it finds a leaf node with matching `key`,
-or cell to insert `key` into, and return a cursor pointing to it.
+insert `rows` (serialized, sorted by key, no repeats, all routed to the leaf under `cursor`) into that leaf in one pass:
+the leaf's cells and the new rows are merged in order, skipping rows whose key is already there, and laid out again.
+if they don't fit, they're spread evenly over the leaf and as many new leaves after it as needed, which go into the
+parent one after the other. returns the number of rows inserted.
 */
-Cursor* internal_node_find_leaf(Table* table, uint32_t node_num, uint32_t key) {
-    InternalNode* node = (InternalNode*)get_page(table->pager, node_num);
-    uint32_t child_idx = internal_node_find_child(node, key);
-    uint32_t child_page_num = *internal_node_child(node, child_idx);
-    Node* child_ptr = (Node*)get_page(table->pager, child_page_num);
-    switch (child_ptr->common_header.type) {
-    case NODE_INTERNAL:
-        return internal_node_find_leaf(table, child_page_num, key);
-    case NODE_LEAF:
-        return leaf_node_find(table, child_page_num, key);
-    default:
-        log("invalid node type");
-        exit(EXIT_FAILURE);
-        break;
+uint32_t leaf_node_insert_many(Cursor* cursor, const uint8_t** rows, uint32_t num_rows) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    LeafNode* node = (LeafNode*)get_page(pager, cursor->page_num);
+    mark_page_dirty(pager, cursor->page_num);
+    LeafNode* old_copy = malloc(PAGE_SIZE);
+    memcpy(old_copy, node, PAGE_SIZE);
+    uint32_t max_cells = old_copy->num_cells + num_rows;
+    const uint8_t** cells = malloc(max_cells * sizeof *cells);
+    uint32_t* cell_sizes = malloc(max_cells * sizeof *cell_sizes);
+
+    uint32_t num_cells = 0;
+    uint32_t num_inserted = 0;
+    uint32_t total_bytes = 0;
+    uint32_t max_cell_size = 0;
+    uint32_t old_idx = 0;
+    for (uint32_t row_idx = 0; row_idx < num_rows || old_idx < old_copy->num_cells;) {
+        bool take_old = row_idx == num_rows
+            || (old_idx < old_copy->num_cells && leaf_node_key(old_copy, old_idx) <= serialized_row_key(rows[row_idx]));
+        if (take_old) {
+            if (row_idx < num_rows && leaf_node_key(old_copy, old_idx) == serialized_row_key(rows[row_idx])) row_idx++; // existing row wins
+            cells[num_cells] = leaf_node_cell(old_copy, old_idx++);
+        } else {
+            cells[num_cells] = rows[row_idx++];
+            num_inserted++;
+        }
+        cell_sizes[num_cells] = serialized_row_size(cells[num_cells]);
+        if (cell_sizes[num_cells] > max_cell_size) max_cell_size = cell_sizes[num_cells];
+        total_bytes += cell_sizes[num_cells++] + LEAF_NODE_SLOT_SIZE;
+    }
+
+    /*
+    plan the pages with the largest row's worth of slack each, so a page is never full before it reaches its share,
+    and the leftovers always fit in the last one
+    */
+    uint32_t page_capacity = LEAF_NODE_SPACE_FOR_CELLS - max_cell_size - LEAF_NODE_SLOT_SIZE;
+    uint32_t num_pages = total_bytes <= LEAF_NODE_SPACE_FOR_CELLS ? 1 : (total_bytes + page_capacity - 1) / page_capacity;
+    uint32_t old_max_key = old_copy->num_cells ? get_node_max_key((Node*)old_copy) : 0;
+    uint32_t old_next_leaf = node->next_leaf;
+    bool is_root = node->is_root;
+
+    uint32_t cell_idx = 0;
+    uint32_t remaining_bytes = total_bytes;
+    uint32_t page_num = cursor->page_num;
+    for (uint32_t page = 0; page < num_pages; page++) {
+        LeafNode* leaf = node;
+        uint32_t previous_page_num = page_num;
+        if (page > 0) {
+            page_num = get_unused_page_num(pager, previous_page_num);
+            leaf = (LeafNode*)get_page(pager, page_num);
+            mark_page_dirty(pager, page_num);
+            initialize_leaf_node(leaf);
+        } else {
+            leaf_node_clear(leaf);
+        }
+        uint32_t pages_left = num_pages - page;
+        uint32_t target_bytes = (remaining_bytes + pages_left - 1) / pages_left;
+        uint32_t used_bytes = 0;
+        // leave at least a cell for every page after this one
+        while (cell_idx < num_cells && (pages_left == 1 || (used_bytes < target_bytes && num_cells - cell_idx >= pages_left))) {
+            leaf_node_insert_cell(leaf, leaf->num_cells, cells[cell_idx], cell_sizes[cell_idx]);
+            used_bytes += cell_sizes[cell_idx++] + LEAF_NODE_SLOT_SIZE;
+        }
+        remaining_bytes -= used_bytes;
+        if (page == 0) {
+            unpin_page(pager, cursor->page_num);
+            continue;
+        }
+
+        // link the new leaf in after the previous one, under the same parent
+        leaf->next_leaf = old_next_leaf;
+        LeafNode* previous = (LeafNode*)get_page(pager, previous_page_num);
+        mark_page_dirty(pager, previous_page_num);
+        previous->next_leaf = page_num;
+        unpin_page(pager, previous_page_num);
+        if (page == 1 && is_root) {
+            unpin_page(pager, page_num);
+            create_new_root(table, page_num);
+            cursor->depth = 1;
+            cursor->path[0] = table->root_page_num;
+            continue;
+        }
+        // the path follows the previous leaf if inserting it split its parent
+        uint32_t parent_page_num = cursor->path[cursor->depth - 1];
+        unpin_page(pager, page_num);
+        if (page == 1) {
+            InternalNode* parent = (InternalNode*)get_page(pager, parent_page_num);
+            update_internal_node_key(pager, parent_page_num, parent, old_max_key, get_page_max_key(pager, cursor->page_num));
+            unpin_page(pager, parent_page_num);
+        }
+        internal_node_insert(cursor, cursor->depth - 1, page_num);
     }
+    // the last leaf takes every key past the table's max: raise the cached max keys on the way to it
+    if (old_next_leaf == 0) btree_raise_max_key(table, serialized_row_key(cells[num_cells - 1]));
+
+    free(cell_sizes);
+    free(cells);
+    free(old_copy);
+    return num_inserted;
+}
+
+/* replace the row in the cell under `cursor`, which has the same key as `value` */
+void leaf_node_update(Cursor* cursor, Row* value) {
+    Pager* pager = cursor->table->pager;
+    LeafNode* node = (LeafNode*)get_page(pager, cursor->page_num);
+    mark_page_dirty(pager, cursor->page_num);
+    uint8_t cell[ROW_MAX_SIZE];
+    uint32_t cell_size = serialize_row(value, cell);
+    uint8_t* old_cell = leaf_node_cell(node, cursor->cell_num);
+    if (serialized_row_size(old_cell) == cell_size) {
+        memcpy(old_cell, cell, cell_size);
+        unpin_page(pager, cursor->page_num);
+        return;
+    }
+    leaf_node_remove_cell(node, cursor->cell_num);
+    if (leaf_node_free_space(node) >= cell_size + LEAF_NODE_SLOT_SIZE) {
+        leaf_node_insert_cell(node, cursor->cell_num, cell, cell_size);
+        unpin_page(pager, cursor->page_num);
+        return;
+    }
+    // the row grew past the free space: put it back the way a new one goes in, splitting the leaf
+    unpin_page(pager, cursor->page_num);
+    leaf_node_insert(cursor, value->id, value);
+}
+
+/*
+the max key of `page_num`, `level` levels below the root (a child of `cursor->path[level - 1]`), changed to `max_key`:
+fix the key its parent keeps for it, and keep going up the path for as long as the node is a last child
+(whose max is its parent's max).
+*/
+static void btree_update_max_key(Cursor* cursor, uint32_t level, uint32_t page_num, uint32_t max_key) {
+    Pager* pager = cursor->table->pager;
+    for (; level > 0; level--) {
+        uint32_t parent_page_num = cursor->path[level - 1];
+        InternalNode* parent = (InternalNode*)get_page(pager, parent_page_num);
+        uint32_t child_idx = internal_node_child_index(parent, page_num);
+        // nothing changes from here up - and a latched write may not hold the nodes further up (see `node_is_safe`)
+        if ((child_idx < parent->num_keys ? *internal_node_key(parent, child_idx) : parent->max_key) == max_key) {
+            unpin_page(pager, parent_page_num);
+            return;
+        }
+        mark_page_dirty(pager, parent_page_num);
+        if (child_idx < parent->num_keys) {
+            *internal_node_key(parent, child_idx) = max_key;
+            unpin_page(pager, parent_page_num);
+            return;
+        }
+        parent->max_key = max_key;
+        unpin_page(pager, parent_page_num);
+        page_num = parent_page_num;
+    }
+}
+
+/* whether a non-root node is empty enough to borrow from, or merge with, a sibling */
+static bool node_underflows(Node* node) {
+    if (node->common_header.type == NODE_LEAF) {
+        return leaf_node_used_bytes((LeafNode*)node) < LEAF_NODE_MIN_USED_BYTES;
+    }
+    return ((InternalNode*)node)->num_keys + 1 < INTERNAL_NODE_MIN_CHILDREN;
+}
+
+/*
+the root has a single child left: copy the child into the root page (so the root keeps its page number)
+and free the child's page. the tree loses a level.
+*/
+static void btree_collapse_root(Table* table) {
+    Pager* pager = table->pager;
+    InternalNode* root = (InternalNode*)get_page(pager, table->root_page_num);
+    uint32_t child_page_num = root->last_child;
+    Node* child = get_page(pager, child_page_num);
+    mark_page_dirty(pager, table->root_page_num);
+    memcpy(root, child, PAGE_SIZE);
+    root->is_root = true;
+    unpin_page(pager, child_page_num);
+    unpin_page(pager, table->root_page_num);
+    pager_free_page(pager, child_page_num);
+}
+
+/* move `right`'s cells to the end of `left`, which has room for them, and take `right` out of the leaf chain */
+static void leaf_nodes_merge(LeafNode* left, LeafNode* right) {
+    for (uint32_t i = 0; i < right->num_cells; i++) {
+        uint8_t* cell = leaf_node_cell(right, i);
+        leaf_node_insert_cell(left, left->num_cells, cell, serialized_row_size(cell));
+    }
+    left->next_leaf = right->next_leaf;
+}
+
+/*
+merge two neighbouring internal nodes into `left` if their children fit in one node, otherwise even them out.
+returns whether they merged.
+*/
+static bool internal_nodes_merge_or_redistribute(InternalNode* left, InternalNode* right) {
+    InternalCell cells[2 * INTERNAL_NODE_MAX_CHILDREN];
+    uint32_t num_left = internal_node_get_children(left, cells);
+    uint32_t num_cells = num_left + internal_node_get_children(right, &(cells[num_left]));
+    bool merge = num_cells <= INTERNAL_NODE_MAX_CHILDREN;
+    uint32_t left_count = merge ? num_cells : num_cells / 2;
+    internal_node_set_children(left, cells, left_count);
+    if (!merge) internal_node_set_children(right, &(cells[left_count]), num_cells - left_count);
+    return merge;
+}
+
+/*
+`page_num`, `level` levels below the root on `cursor`'s path, underflows: merge it with a sibling if both fit in one
+node, otherwise borrow from the sibling by evening the two out. a merge frees the right node's page and removes a child
+from the parent, which may then underflow in turn, or - if it's the root and only has one child left - collapse.
+*/
+static void btree_rebalance(Cursor* cursor, uint32_t level, uint32_t page_num) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    uint32_t parent_page_num = cursor->path[level - 1];
+    InternalNode* parent = (InternalNode*)get_page(pager, parent_page_num);
+    uint32_t child_idx = internal_node_child_index(parent, page_num);
+    // pair up with the left sibling, or the right one for a first child
+    uint32_t left_idx = child_idx > 0 ? child_idx - 1 : child_idx;
+    uint32_t left_page_num = *internal_node_child(parent, left_idx);
+    uint32_t right_page_num = *internal_node_child(parent, left_idx + 1);
+    unpin_page(pager, parent_page_num);
+
+    // a latched delete holds the path down to `page_num`, but not its sibling. the parent's latch keeps others out of
+    // both, apart from readers coming along the leaf chain - which don't wait for the leaf they hold either
+    uint32_t sibling_page_num = page_num == left_page_num ? right_page_num : left_page_num;
+    latch_page(pager, sibling_page_num, true);
+    Node* left = get_page(pager, left_page_num);
+    Node* right = get_page(pager, right_page_num);
+    mark_page_dirty(pager, left_page_num);
+    mark_page_dirty(pager, right_page_num);
+    bool merged;
+    if (left->common_header.type == NODE_LEAF) {
+        LeafNode* left_leaf = (LeafNode*)left;
+        LeafNode* right_leaf = (LeafNode*)right;
+        merged = leaf_node_used_bytes(left_leaf) + leaf_node_used_bytes(right_leaf) <= LEAF_NODE_SPACE_FOR_CELLS;
+        if (merged) {
+            leaf_nodes_merge(left_leaf, right_leaf);
+        } else {
+            leaf_nodes_redistribute(left_leaf, right_leaf);
+        }
+    } else {
+        merged = internal_nodes_merge_or_redistribute((InternalNode*)left, (InternalNode*)right);
+    }
+    // either of them may have been the empty one, so neither's old max key is reliable
+    uint32_t left_max_key = get_node_max_key(left);
+    uint32_t right_max_key = merged ? left_max_key : get_node_max_key(right);
+    unpin_page(pager, left_page_num);
+    unpin_page(pager, right_page_num);
+    unlatch_page(pager, sibling_page_num);
+
+    if (!merged) {
+        btree_update_max_key(cursor, level, left_page_num, left_max_key);
+        btree_update_max_key(cursor, level, right_page_num, right_max_key);
+        return;
+    }
+
+    pager_free_page(pager, right_page_num);
+    // the merged node takes over the right node's place, the left one's goes away
+    parent = (InternalNode*)get_page(pager, parent_page_num);
+    mark_page_dirty(pager, parent_page_num);
+    *internal_node_child(parent, left_idx + 1) = left_page_num;
+    uint32_t num_moved = parent->num_keys - left_idx - 1;
+    uint32_t* children = internal_node_children(parent);
+    memmove(&(children[left_idx]), &(children[left_idx + 1]), num_moved * sizeof(uint32_t));
+    memmove(&(parent->_keys[left_idx]), &(parent->_keys[left_idx + 1]), num_moved * sizeof(uint32_t));
+    parent->num_keys--;
+    bool parent_is_root = parent->is_root;
+    bool parent_underflows = parent_is_root ? parent->num_keys == 0 : node_underflows((Node*)parent);
+    unpin_page(pager, parent_page_num);
+    btree_update_max_key(cursor, level, left_page_num, left_max_key);
+
+    if (!parent_underflows) return;
+    if (parent_is_root) {
+        btree_collapse_root(table);
+    } else {
+        btree_rebalance(cursor, level - 1, parent_page_num);
+    }
+}
+
+/* remove the cell under `cursor`, then fix up the tree: max keys above it, and the leaf if it underflows */
+void leaf_node_delete(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    LeafNode* node = (LeafNode*)get_page(pager, cursor->page_num);
+    mark_page_dirty(pager, cursor->page_num);
+    bool removed_max_key = cursor->cell_num == node->num_cells - 1;
+    leaf_node_remove_cell(node, cursor->cell_num);
+    bool is_root = node->is_root;
+    uint32_t num_cells = node->num_cells;
+    uint32_t max_key = num_cells ? get_node_max_key((Node*)node) : 0;
+    bool underflows = !is_root && node_underflows((Node*)node);
+    unpin_page(pager, cursor->page_num);
+    if (is_root) return;
+
+    // an empty leaf has no max, `btree_rebalance` sorts its key out
+    if (removed_max_key && num_cells) btree_update_max_key(cursor, cursor->depth, cursor->page_num, max_key);
+    if (underflows) btree_rebalance(cursor, cursor->depth, cursor->page_num);
+}
+
+/* append `page_num` and every page below it to `pages`: parents before their children, children in key order */
+static void btree_collect_pages(Pager* pager, uint32_t page_num, uint32_t* pages, uint32_t* num_pages) {
+    pages[(*num_pages)++] = page_num;
+    Node* node = get_page(pager, page_num);
+    for (uint32_t i = 0; i < node_num_children(node); i++) {
+        btree_collect_pages(pager, node_child(node, i), pages, num_pages);
+    }
+    unpin_page(pager, page_num);
+}
+
+/* rewrite every page number stored in `node` (children, next leaf) through `new_page_nums` */
+static void btree_renumber_node(Node* node, const uint32_t* new_page_nums) {
+    if (node->common_header.type == NODE_INTERNAL) {
+        InternalNode* internal_node = (InternalNode*)node;
+        for (uint32_t i = 0; i <= internal_node->num_keys; i++) {
+            uint32_t* child = internal_node_child(internal_node, i);
+            *child = new_page_nums[*child];
+        }
+    } else if (node->common_header.type == NODE_INDEX_INTERNAL) {
+        IndexInternalNode* index_node = (IndexInternalNode*)node;
+        for (uint32_t i = 0; i <= index_node->num_cells; i++) {
+            index_internal_node_set_child(index_node, i, new_page_nums[index_internal_node_child(index_node, i)]);
+        }
+    } else {
+        LeafNode* leaf_node = (LeafNode*)node;
+        if (leaf_node->next_leaf) leaf_node->next_leaf = new_page_nums[leaf_node->next_leaf];
+    }
+}
+
+/*
+before format version 3, leaves had a header up to `next_leaf` and fixed-width cells,
+each the `users` row as it was laid out in memory: id, then NUL padded username and email
+*/
+typedef struct {
+    uint32_t id;
+    char username[COLUMN_USERNAME_SIZE + 1];
+    char email[COLUMN_EMAIL_SIZE + 1];
+} LegacyRow;
+
+constexpr const uint32_t LEGACY_LEAF_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + 2 * sizeof(uint32_t); // num_cells, next_leaf
+constexpr const uint32_t LEGACY_LEAF_CELL_SIZE = sizeof(LegacyRow);
+
+static uint32_t legacy_leaf_node_max_key(LeafNode* node) {
+    uint32_t key;
+    memcpy(&key, (uint8_t*)node + LEGACY_LEAF_HEADER_SIZE + (node->num_cells - 1) * LEGACY_LEAF_CELL_SIZE, sizeof key);
+    return key;
+}
+
+/*
+format version 1 had no `max_key` in internal nodes, so their cells started where it is now.
+shift the cells into place and fill in `max_key` for every internal node under `page_num`. returns the subtree's max key.
+the cells stay interleaved: `btree_mark_legacy_internal_nodes` takes it from there.
+*/
+uint32_t btree_upgrade_internal_nodes(Pager* pager, uint32_t page_num) {
+    Node* node = get_page(pager, page_num);
+    if (node->common_header.type != NODE_INTERNAL) {
+        // leaves are upgraded after this, so they're still in the fixed-width format
+        uint32_t max_key = ((LeafNode*)node)->num_cells ? legacy_leaf_node_max_key((LeafNode*)node) : 0;
+        unpin_page(pager, page_num);
+        return max_key;
+    }
+    InternalNode* internal_node = (InternalNode*)node;
+    memmove(legacy_internal_node_cells(internal_node), &(internal_node->max_key), internal_node->num_keys * INTERNAL_NODE_CELL_SIZE);
+    mark_page_dirty(pager, page_num);
+
+    // the tree is balanced: if one child is a leaf they all are, and only the last one's max matters
+    uint32_t first_child_page_num = legacy_internal_node_child(internal_node, 0);
+    Node* first_child = get_page(pager, first_child_page_num);
+    bool leaf_children = first_child->common_header.type == NODE_LEAF;
+    unpin_page(pager, first_child_page_num);
+    uint32_t max_key = 0;
+    if (leaf_children) {
+        max_key = btree_upgrade_internal_nodes(pager, internal_node->last_child);
+    } else {
+        for (uint32_t i = 0; i <= internal_node->num_keys; i++) {
+            max_key = btree_upgrade_internal_nodes(pager, legacy_internal_node_child(internal_node, i));
+        }
+    }
+    internal_node->max_key = max_key;
+    unpin_page(pager, page_num);
+    return max_key;
+}
+
+/*
+rewrite a fixed-width leaf as a slotted page in place, with cells in the current format.
+rows only shrink, so they all still fit
+*/
+static void btree_upgrade_leaf(Pager* pager, uint32_t page_num) {
+    LeafNode* node = (LeafNode*)get_page(pager, page_num);
+    uint8_t legacy[PAGE_SIZE];
+    memcpy(legacy, node, PAGE_SIZE);
+    uint32_t num_cells = node->num_cells;
+    leaf_node_clear(node);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        LegacyRow legacy_row;
+        memcpy(&legacy_row, legacy + LEGACY_LEAF_HEADER_SIZE + i * LEGACY_LEAF_CELL_SIZE, sizeof legacy_row);
+        // the `users` body: username and email, each a length byte and the characters
+        Row row = {.id = legacy_row.id, .size = 0};
+        uint8_t username_length = strnlen(legacy_row.username, COLUMN_USERNAME_SIZE);
+        uint8_t email_length = strnlen(legacy_row.email, COLUMN_EMAIL_SIZE);
+        row.body[row.size++] = username_length;
+        memcpy(row.body + row.size, legacy_row.username, username_length);
+        row.size += username_length;
+        row.body[row.size++] = email_length;
+        memcpy(row.body + row.size, legacy_row.email, email_length);
+        row.size += email_length;
+        uint8_t cell[ROW_MAX_SIZE];
+        uint32_t cell_size = serialize_row(&row, cell);
+        leaf_node_insert_cell(node, i, cell, cell_size);
+    }
+    mark_page_dirty(pager, page_num);
+    unpin_page(pager, page_num);
+}
+
+/*
+format version 7 split the cells of internal nodes into an array of keys and one of children. older trees are read once
+more, to be rebuilt (see `db_upgrade_format`): mark their internal nodes as legacy ones, which `node_child` reads the old way.
+*/
+void btree_mark_legacy_internal_nodes(Pager* pager, uint32_t page_num) {
+    Node* node = get_page(pager, page_num);
+    if (node->common_header.type == NODE_INTERNAL) {
+        node->common_header.type = NODE_LEGACY_INTERNAL;
+        mark_page_dirty(pager, page_num);
+    }
+    for (uint32_t i = 0; i < node_num_children(node); i++) {
+        btree_mark_legacy_internal_nodes(pager, node_child(node, i));
+    }
+    unpin_page(pager, page_num);
+}
+
+/* format version 3 made leaves slotted pages: convert every leaf of the tree, left to right along the leaf chain */
+void btree_upgrade_leaves(Pager* pager, uint32_t root_page_num) {
+    uint32_t page_num = root_page_num;
+    Node* node = get_page(pager, page_num);
+    while (node->common_header.type != NODE_LEAF) {
+        uint32_t child_page_num = node_child(node, 0);
+        unpin_page(pager, page_num);
+        page_num = child_page_num;
+        node = get_page(pager, page_num);
+    }
+    unpin_page(pager, page_num);
+    while (page_num != 0) {
+        LeafNode* leaf = (LeafNode*)get_page(pager, page_num);
+        uint32_t next_leaf = leaf->next_leaf;
+        unpin_page(pager, page_num);
+        btree_upgrade_leaf(pager, page_num);
+        page_num = next_leaf;
+    }
+}
+
+/* put every page of the tree under `page_num` (itself included, a table's or an index's) on the freelist */
+void btree_free_pages(Pager* pager, uint32_t page_num) {
+    Node* node = get_page(pager, page_num);
+    for (uint32_t i = 0; i < node_num_children(node); i++) {
+        btree_free_pages(pager, node_child(node, i));
+    }
+    unpin_page(pager, page_num);
+    pager_free_page(pager, page_num);
+}
+
+/*
+copy the trees (tables' and indexes') under `root_page_nums` into pages 1..n of the file `fd`, one after the other, each
+in key order, renumbered as they go. the roots are updated to their new page numbers. the pager's pages are only read:
+free pages, and anything else the trees don't reach, are left out. page 0 is the caller's (see `pager_replace_file`).
+returns the number of pages of the copy, page 0 included.
+*/
+uint32_t btree_vacuum(Pager* pager, uint32_t* root_page_nums, uint32_t num_roots, int fd) {
+    uint32_t* pages = malloc(pager->num_pages * sizeof *pages);
+    uint32_t num_tree_pages = 0;
+    for (uint32_t i = 0; i < num_roots; i++) btree_collect_pages(pager, root_page_nums[i], pages, &num_tree_pages);
+
+    // page 0 stays the header, tree pages follow it in the order they were collected
+    uint32_t* new_page_nums = malloc(pager->num_pages * sizeof *new_page_nums);
+    for (uint32_t i = 0; i < pager->num_pages; i++) new_page_nums[i] = INVALID_PAGE_NUM;
+    new_page_nums[0] = 0;
+    for (uint32_t i = 0; i < num_tree_pages; i++) new_page_nums[pages[i]] = i + 1;
+
+    // a batch of pages at a time, each write one run of the copy
+    const uint32_t batch_pages = 64;
+    Node* batch = aligned_alloc(PAGE_SIZE, (size_t)batch_pages * PAGE_SIZE);
+    for (uint32_t first = 0; first < num_tree_pages; first += batch_pages) {
+        uint32_t num_pages = num_tree_pages - first < batch_pages ? num_tree_pages - first : batch_pages;
+        for (uint32_t i = 0; i < num_pages; i++) {
+            Node* copy = page_at(batch, i);
+            memcpy(copy, get_page(pager, pages[first + i]), PAGE_SIZE);
+            unpin_page(pager, pages[first + i]);
+            btree_renumber_node(copy, new_page_nums);
+            if (pager->checksums) page_stamp_checksum(copy, first + i + 1);
+        }
+        off_t offset = (off_t)(first + 1) * PAGE_SIZE;
+        if (pwrite(fd, batch, (size_t)num_pages * PAGE_SIZE, offset) != (ssize_t)num_pages * PAGE_SIZE) {
+            print_error("failed writing to file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (uint32_t i = 0; i < num_roots; i++) root_page_nums[i] = new_page_nums[root_page_nums[i]];
+
+    free(batch);
+    free(new_page_nums);
+    free(pages);
+    return num_tree_pages + 1;
 }
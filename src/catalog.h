@@ -0,0 +1,203 @@
+#pragma once
+#include "common.h"
+#include "pager.h"
+#include "schema.h"
+
+/*
+the catalog lists every table in the file: its id, name, root page and columns.
+it's stored in page 0, right after the `DbHeader` (which grew a field in format 8, see `catalog_offset`):
+    [next table id: u32][number of tables: u32], then for each table
+    [id: u32][root page: u32][name length: u8][name][number of columns: u8], then for each column
+    [name length: u8][name][type: u8][size: u16], then [number of indexes: u8] and for each index
+    [column: u8][root page: u32] (format version 4 had no indexes, nor their count)
+it's kept in memory (`Database.tables`), and written back on checkpoint if it changed - like the header,
+so a root that moved (`.load`) is only recorded along with the pages of the tree it points at. `.vacuum` writes
+its catalog into the copy of the file it builds (see `db_vacuum`).
+*/
+
+constexpr const uint32_t CATALOG_OFFSET = sizeof(DbHeader);
+#define CATALOG_MAX_SIZE (PAGE_USABLE_SIZE - CATALOG_OFFSET)
+
+/* where the catalog starts in a file of format `version`: before 8, the header had no `page_size` */
+static uint32_t catalog_offset(uint32_t version) {
+    return version >= 8 ? CATALOG_OFFSET : CATALOG_OFFSET - sizeof_ct(DbHeader, page_size);
+}
+
+Table* catalog_find(Database* db, const char* name) {
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        if (strcmp(db->tables[i]->name, name) == 0) return db->tables[i];
+    }
+    return NULL;
+}
+
+Table* catalog_find_id(Database* db, uint32_t id) {
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        if (db->tables[i]->id == id) return db->tables[i];
+    }
+    return NULL;
+}
+
+Table* catalog_add(Database* db, uint32_t id, const char* name, const Schema* schema, uint32_t root_page_num) {
+    Table* table = calloc(1, sizeof *table);
+    table->id = id;
+    strcpy(table->name, name);
+    table->schema = *schema;
+    table->root_page_num = root_page_num;
+    table->pager = db->pager;
+    table->wal = db->wal;
+    db->tables = realloc(db->tables, (db->num_tables + 1) * sizeof *(db->tables));
+    db->tables[db->num_tables++] = table;
+    if (id >= db->next_table_id) db->next_table_id = id + 1;
+    return table;
+}
+
+void catalog_remove(Database* db, Table* table) {
+    uint32_t i = 0;
+    while (db->tables[i] != table) i++;
+    memmove(&(db->tables[i]), &(db->tables[i + 1]), (db->num_tables - i - 1) * sizeof *(db->tables));
+    db->num_tables--;
+    if (db->current == table) db->current = NULL;
+    free(table);
+}
+
+static void catalog_put(uint8_t* destination, uint32_t* length, const void* source, uint32_t size) {
+    if (*length + size <= CATALOG_MAX_SIZE) memcpy(destination + *length, source, size);
+    *length += size;
+}
+
+static void catalog_put_name(uint8_t* destination, uint32_t* length, const char* name) {
+    uint8_t name_length = strlen(name);
+    catalog_put(destination, length, &name_length, sizeof name_length);
+    catalog_put(destination, length, name, name_length);
+}
+
+/* returns the catalog's size, which may be past `CATALOG_MAX_SIZE` (only what fits is written) */
+uint32_t catalog_serialize(Database* db, uint8_t* destination) {
+    uint32_t length = 0;
+    catalog_put(destination, &length, &(db->next_table_id), sizeof db->next_table_id);
+    catalog_put(destination, &length, &(db->num_tables), sizeof db->num_tables);
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        Table* table = db->tables[i];
+        catalog_put(destination, &length, &(table->id), sizeof table->id);
+        catalog_put(destination, &length, &(table->root_page_num), sizeof table->root_page_num);
+        catalog_put_name(destination, &length, table->name);
+        uint8_t num_columns = table->schema.num_columns;
+        catalog_put(destination, &length, &num_columns, sizeof num_columns);
+        for (uint32_t j = 0; j < num_columns; j++) {
+            Column* column = &(table->schema.columns[j]);
+            catalog_put_name(destination, &length, column->name);
+            uint8_t type = column->type;
+            uint16_t size = column->size;
+            catalog_put(destination, &length, &type, sizeof type);
+            catalog_put(destination, &length, &size, sizeof size);
+        }
+        uint8_t num_indexes = table->num_indexes;
+        catalog_put(destination, &length, &num_indexes, sizeof num_indexes);
+        for (uint32_t j = 0; j < num_indexes; j++) {
+            uint8_t column = table->indexes[j].column;
+            catalog_put(destination, &length, &column, sizeof column);
+            catalog_put(destination, &length, &(table->indexes[j].root_page_num), sizeof table->indexes[j].root_page_num);
+        }
+    }
+    return length;
+}
+
+/* whether the catalog still fits in page 0, e.g. after adding a table */
+bool catalog_fits(Database* db) {
+    uint8_t catalog[CATALOG_MAX_SIZE];
+    return catalog_serialize(db, catalog) <= CATALOG_MAX_SIZE;
+}
+
+/* put the catalog into page 0, if it differs from what's there */
+void catalog_write(Database* db) {
+    uint8_t catalog[CATALOG_MAX_SIZE];
+    uint32_t length = catalog_serialize(db, catalog);
+    Node* page = get_page(db->pager, 0);
+    uint8_t* destination = (uint8_t*)page + CATALOG_OFFSET;
+    if (memcmp(destination, catalog, length) != 0) {
+        memcpy(destination, catalog, length);
+        mark_page_dirty(db->pager, 0);
+    }
+    unpin_page(db->pager, 0);
+}
+
+static bool catalog_get(const uint8_t* source, uint32_t* position, void* destination, uint32_t size) {
+    if (*position + size > CATALOG_MAX_SIZE) return false;
+    memcpy(destination, source + *position, size);
+    *position += size;
+    return true;
+}
+
+static bool catalog_get_name(const uint8_t* source, uint32_t* position, char* name) {
+    uint8_t name_length;
+    if (!catalog_get(source, position, &name_length, sizeof name_length) || name_length > TABLE_NAME_MAX_SIZE) return false;
+    if (!catalog_get(source, position, name, name_length)) return false;
+    name[name_length] = '\0';
+    return true;
+}
+
+static bool catalog_parse(Database* db, const uint8_t* source, bool has_indexes) {
+    uint32_t position = 0;
+    uint32_t next_table_id;
+    uint32_t num_tables;
+    if (!catalog_get(source, &position, &next_table_id, sizeof next_table_id)) return false;
+    if (!catalog_get(source, &position, &num_tables, sizeof num_tables)) return false;
+    for (uint32_t i = 0; i < num_tables; i++) {
+        uint32_t id;
+        uint32_t root_page_num;
+        char name[TABLE_NAME_MAX_SIZE + 1];
+        uint8_t num_columns;
+        if (!catalog_get(source, &position, &id, sizeof id)
+                || !catalog_get(source, &position, &root_page_num, sizeof root_page_num)
+                || !catalog_get_name(source, &position, name)
+                || !catalog_get(source, &position, &num_columns, sizeof num_columns)
+                || num_columns > TABLE_MAX_COLUMNS) {
+            return false;
+        }
+        Schema schema = {.num_columns = num_columns};
+        for (uint32_t j = 0; j < num_columns; j++) {
+            Column* column = &(schema.columns[j]);
+            uint8_t type;
+            uint16_t size;
+            if (!catalog_get_name(source, &position, column->name)
+                    || !catalog_get(source, &position, &type, sizeof type)
+                    || !catalog_get(source, &position, &size, sizeof size)
+                    || type > COLUMN_CHAR) {
+                return false;
+            }
+            column->type = type;
+            column->size = size;
+        }
+        if (!schema_finish(&schema) || root_page_num == 0 || root_page_num >= db->pager->num_pages) return false;
+        Table* table = catalog_add(db, id, name, &schema, root_page_num);
+        uint8_t num_indexes = 0;
+        if (has_indexes && (!catalog_get(source, &position, &num_indexes, sizeof num_indexes) || num_indexes >= num_columns)) {
+            return false;
+        }
+        for (uint32_t j = 0; j < num_indexes; j++) {
+            Index* index = &(table->indexes[table->num_indexes++]);
+            uint8_t column;
+            if (!catalog_get(source, &position, &column, sizeof column)
+                    || !catalog_get(source, &position, &(index->root_page_num), sizeof index->root_page_num)
+                    || column == 0 || column >= num_columns
+                    || index->root_page_num == 0 || index->root_page_num >= db->pager->num_pages) {
+                return false;
+            }
+            index->column = column;
+        }
+    }
+    db->next_table_id = next_table_id;
+    return true;
+}
+
+/* load the catalog from page 0 into `db->tables` */
+void catalog_read(Database* db) {
+    Node* page = get_page(db->pager, 0);
+    uint32_t version = db->pager->header.format_version;
+    bool parsed = catalog_parse(db, (uint8_t*)page + catalog_offset(version), version >= 5);
+    unpin_page(db->pager, 0);
+    if (!parsed) {
+        print_error("the catalog in page 0 is corrupt");
+        exit(EXIT_FAILURE);
+    }
+}
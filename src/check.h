@@ -0,0 +1,349 @@
+#pragma once
+#include "common.h"
+#include "pager.h"
+#include "btree.h"
+#include "index.h"
+
+/*
+`.check` reads the whole file back and verifies it: every page against its checksum, and every tree - tables and
+indexes - from the root down. nodes have to be of the tree's kind, their cells well-formed and in order, within the keys
+their parent gives them. leaves all sit at one depth, chained in key order, and account for every byte of their cells.
+every page written, but the header, is in exactly one tree or free.
+the file is read once, front to back, in batches - not through the pool, which would stop at the first page that fails
+its checksum (so the file is checkpointed first). the sweep checks what a page can tell on its own, and keeps what the
+trees need: a copy of every internal node, and the first and last cells of every leaf. the trees are walked from those.
+*/
+
+#define check_error(check, page_num, format, ...) do {\
+    if ((check)->num_errors++ < CHECK_MAX_ERRORS) {\
+        print_error("check: %s, page %d " format, (check)->tree, page_num __VA_OPT__(,) __VA_ARGS__);\
+    }\
+} while (0)
+
+static void check_read(IntegrityCheck* check, uint32_t first_page_num, uint32_t num_pages, Node* pages) {
+    size_t length = (size_t)num_pages * PAGE_SIZE;
+    if (pread(check->pager->file_descriptor, pages, length, (off_t)first_page_num * PAGE_SIZE) != (ssize_t)length) {
+        print_error("error reading file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* the cell at `offset` into `node`: it has to lie in the node's cell content, and decode. NULL if it doesn't */
+static const uint8_t* check_cell(
+    IntegrityCheck* check, uint32_t page_num, const Node* node, uint32_t content_start, uint32_t offset, uint32_t cell_num,
+    uint32_t* size
+) {
+    const uint8_t* cell = (const uint8_t*)node + offset;
+    RowView view;
+    if (offset < content_start || offset >= PAGE_USABLE_SIZE || !row_view(cell, PAGE_USABLE_SIZE - offset, &view)) {
+        check_error(check, page_num, "cell %d is malformed", cell_num);
+        return NULL;
+    }
+    *size = view.size;
+    return cell;
+}
+
+/* keep a leaf's cell, with its size in front. an index entry is kept whole, a row only as far as its key is concerned */
+static void check_keep_cell(IntegrityCheck* check, const uint8_t* cell, uint32_t size) {
+    uint32_t kept = size < INDEX_ENTRY_MAX_SIZE ? size : INDEX_ENTRY_MAX_SIZE;
+    if (check->cells_length + sizeof(uint16_t) + kept > check->cells_capacity) {
+        check->cells_capacity = 2 * check->cells_capacity + sizeof(uint16_t) + kept;
+        check->cells = realloc(check->cells, check->cells_capacity);
+    }
+    uint16_t size16 = size;
+    memcpy(check->cells + check->cells_length, &size16, sizeof size16);
+    memcpy(check->cells + check->cells_length + sizeof size16, cell, kept);
+    check->cells_length += sizeof size16 + kept;
+}
+
+static void check_sweep_leaf(IntegrityCheck* check, uint32_t page_num, LeafNode* node, CheckPage* page) {
+    if (node->num_cells > LEAF_NODE_MAX_CELLS || node->content_start > PAGE_USABLE_SIZE
+            || node->content_start < LEAF_NODE_HEADER_SIZE + node->num_cells * LEAF_NODE_SLOT_SIZE) {
+        check_error(check, page_num, "has %d cells, their content starting at %d", node->num_cells, node->content_start);
+        page->broken = true;
+        return;
+    }
+    // in order either way the tree might be ordered: which one has to hold is only known once the trees are walked
+    uint32_t cell_bytes = 0;
+    const uint8_t* previous = NULL;
+    uint32_t first_size = 0;
+    uint32_t last_size = 0;
+    for (uint32_t i = 0; i < node->num_cells; i++) {
+        uint32_t size = 0;
+        const uint8_t* cell = check_cell(check, page_num, (Node*)node, node->content_start, node->slots[i], i, &size);
+        if (cell == NULL) {
+            page->broken = true;
+            return;
+        }
+        if (previous && page->key_disorder == 0 && serialized_row_key(previous) >= serialized_row_key(cell)) {
+            page->key_disorder = i;
+        }
+        if (previous && page->entry_disorder == 0 && index_entry_compare(previous, cell) >= 0) page->entry_disorder = i;
+        cell_bytes += size;
+        previous = cell;
+        if (i == 0) first_size = size;
+        last_size = size;
+    }
+    if (cell_bytes + node->fragmented_bytes != PAGE_USABLE_SIZE - node->content_start) {
+        check_error(
+            check, page_num, "has %d bytes of cells and %d fragmented, in %d bytes of content",
+            cell_bytes, node->fragmented_bytes, PAGE_USABLE_SIZE - node->content_start
+        );
+    }
+    page->num_cells = node->num_cells;
+    page->next_leaf = node->next_leaf;
+    page->copy = check->cells_length;
+    if (node->num_cells) {
+        check_keep_cell(check, (uint8_t*)node + node->slots[0], first_size);
+        check_keep_cell(check, previous, last_size);
+    }
+}
+
+static void check_sweep_internal(IntegrityCheck* check, uint32_t page_num, Node* node, CheckPage* page) {
+    if (page->type == NODE_INTERNAL) {
+        InternalNode* internal = (InternalNode*)node;
+        if (internal->num_keys > INTERNAL_NODE_MAX_KEYS) {
+            check_error(check, page_num, "has %d keys, %d fit", internal->num_keys, INTERNAL_NODE_MAX_KEYS);
+            page->broken = true;
+            return;
+        }
+    } else {
+        IndexInternalNode* internal = (IndexInternalNode*)node;
+        if (internal->num_cells > INDEX_INTERNAL_NODE_SPACE_FOR_CELLS / sizeof(uint16_t) || internal->content_start > PAGE_USABLE_SIZE
+                || internal->content_start < INDEX_INTERNAL_NODE_HEADER_SIZE + internal->num_cells * sizeof(uint16_t)) {
+            check_error(check, page_num, "has %d cells, their content starting at %d", internal->num_cells, internal->content_start);
+            page->broken = true;
+            return;
+        }
+        // a cell is the child's page number, then the largest entry under it
+        for (uint32_t i = 0; i < internal->num_cells; i++) {
+            uint32_t size = 0;
+            if (!check_cell(
+                check, page_num, node, internal->content_start + sizeof(uint32_t), internal->slots[i] + sizeof(uint32_t), i, &size
+            )) {
+                page->broken = true;
+                return;
+            }
+        }
+    }
+    if (check->num_nodes == check->nodes_capacity) {
+        check->nodes_capacity = 2 * check->nodes_capacity + 1;
+        check->nodes = realloc(check->nodes, (size_t)check->nodes_capacity * PAGE_SIZE);
+    }
+    page->copy = check->num_nodes++;
+    memcpy(page_at(check->nodes, page->copy), node, PAGE_SIZE);
+}
+
+/* what a page tells on its own, kept in `check->pages[page_num]` */
+static void check_sweep_page(IntegrityCheck* check, uint32_t page_num, Node* node) {
+    CheckPage* page = &(check->pages[page_num]);
+    if (page_is_zero(node)) {
+        page->zero = true;
+        return;
+    }
+    if (check->pager->checksums && !page_checksum_valid(node, page_num)) {
+        check_error(check, page_num, "fails its checksum");
+        page->broken = true;
+        return;
+    }
+    // the header and free pages hold no node
+    if (page_num == 0 || page->state == CHECK_PAGE_FREE) return;
+    page->type = node->common_header.type;
+    page->is_root = node->common_header.is_root;
+    if (page->type == NODE_LEAF) {
+        check_sweep_leaf(check, page_num, (LeafNode*)node, page);
+    } else if (page->type == NODE_INTERNAL || page->type == NODE_INDEX_INTERNAL) {
+        check_sweep_internal(check, page_num, node, page);
+    } else {
+        check_error(check, page_num, "is not a node (type %d)", page->type);
+        page->broken = true;
+    }
+}
+
+/* where `cell` is in the order of the tree, relative to `bound`, like `memcmp` */
+static int check_compare_bound(IntegrityCheck* check, const uint8_t* cell, CheckBound bound) {
+    if (check->index) return index_entry_compare(cell, bound.entry);
+    uint32_t key = serialized_row_key(cell);
+    return (key > bound.key) - (key < bound.key);
+}
+
+static bool check_within(IntegrityCheck* check, const uint8_t* cell, CheckBound lower, CheckBound upper) {
+    return (!lower.set || check_compare_bound(check, cell, lower) > 0) && (!upper.set || check_compare_bound(check, cell, upper) <= 0);
+}
+
+static void check_node(
+    IntegrityCheck* check, uint32_t page_num, uint32_t depth, CheckBound lower, CheckBound upper
+);
+
+static void check_leaf(IntegrityCheck* check, uint32_t page_num, CheckPage* page, uint32_t depth, CheckBound lower, CheckBound upper) {
+    if (check->leaf_depth == UINT32_MAX) check->leaf_depth = depth;
+    if (depth != check->leaf_depth) check_error(check, page_num, "is a leaf at depth %d, others are at %d", depth, check->leaf_depth);
+    if (check->last_leaf != INVALID_PAGE_NUM && check->next_leaf != page_num) {
+        check_error(check, page_num, "comes after leaf %d, which points at page %d", check->last_leaf, check->next_leaf);
+    }
+    check->last_leaf = page_num;
+    check->next_leaf = page->next_leaf;
+    if (page->num_cells == 0) {
+        if (depth > 0) check_error(check, page_num, "is an empty leaf");
+        return;
+    }
+    uint32_t disorder = check->index ? page->entry_disorder : page->key_disorder;
+    if (disorder) check_error(check, page_num, "cell %d is out of order", disorder);
+
+    // its cells are in order, so only the first and last can stray from the parent's range
+    const uint8_t* cells[2];
+    uint16_t sizes[2];
+    size_t offset = page->copy;
+    for (uint32_t i = 0; i < 2; i++) {
+        memcpy(&(sizes[i]), check->cells + offset, sizeof(uint16_t));
+        cells[i] = check->cells + offset + sizeof(uint16_t);
+        offset += sizeof(uint16_t) + (sizes[i] < INDEX_ENTRY_MAX_SIZE ? sizes[i] : INDEX_ENTRY_MAX_SIZE);
+    }
+    if (check->index && (sizes[0] > INDEX_ENTRY_MAX_SIZE || sizes[1] > INDEX_ENTRY_MAX_SIZE)) {
+        check_error(check, page_num, "holds cells too large for index entries");
+        return;
+    }
+    if (!check_within(check, cells[0], lower, upper) || !check_within(check, cells[1], lower, upper)) {
+        check_error(
+            check, page_num, "holds ids %d to %d, outside its parent's range for it",
+            serialized_row_key(cells[0]), serialized_row_key(cells[1])
+        );
+    }
+}
+
+static void check_internal(IntegrityCheck* check, uint32_t page_num, InternalNode* node, uint32_t depth, CheckBound lower, CheckBound upper) {
+    InternalCell children[INTERNAL_NODE_MAX_CHILDREN];
+    uint32_t num_children = internal_node_get_children(node, children);
+    CheckBound child_lower = lower;
+    for (uint32_t i = 0; i < num_children; i++) {
+        uint32_t key = children[i].key;
+        if ((child_lower.set && key <= child_lower.key) || (upper.set && key > upper.key)) {
+            check_error(check, page_num, "key %d (child %d) is out of order", key, i);
+        }
+        CheckBound child_upper = { .set = true, .key = key };
+        check_node(check, children[i].child, depth + 1, child_lower, child_upper);
+        child_lower = child_upper;
+    }
+}
+
+static void check_index_internal(
+    IntegrityCheck* check, uint32_t page_num, IndexInternalNode* node, uint32_t depth, CheckBound lower, CheckBound upper
+) {
+    // each entry bounds the child before it, the last child is bound by the parent
+    CheckBound child_lower = lower;
+    for (uint32_t i = 0; i <= node->num_cells; i++) {
+        CheckBound child_upper = upper;
+        if (i < node->num_cells) {
+            const uint8_t* entry = index_internal_node_entry(node, i);
+            if ((child_lower.set && index_entry_compare(entry, child_lower.entry) <= 0)
+                    || (upper.set && index_entry_compare(entry, upper.entry) > 0)) {
+                check_error(check, page_num, "cell %d (id %d) is out of order", i, serialized_row_key(entry));
+            }
+            child_upper = (CheckBound){ .set = true, .entry = entry };
+        }
+        check_node(check, index_internal_node_child(node, i), depth + 1, child_lower, child_upper);
+        child_lower = child_upper;
+    }
+}
+
+/* the subtree at `page_num`, `depth` levels below the root, holding keys above `lower` up to `upper` */
+static void check_node(
+    IntegrityCheck* check, uint32_t page_num, uint32_t depth, CheckBound lower, CheckBound upper
+) {
+    Pager* pager = check->pager;
+    if (page_num == 0 || page_num >= pager->num_pages) {
+        check_error(check, page_num, "is out of bounds, the file has %d pages", pager->num_pages);
+        return;
+    }
+    CheckPage* page = &(check->pages[page_num]);
+    if (page->state != CHECK_PAGE_UNSEEN) {
+        check_error(check, page_num, "is %s", page->state == CHECK_PAGE_FREE ? "free" : "used twice");
+        return;
+    }
+    page->state = CHECK_PAGE_IN_TREE;
+    check->num_tree_pages++;
+    if (page->broken || page->zero) {
+        // a broken one was reported by the sweep. either way the leaf chain can't be followed through it
+        if (page->zero) check_error(check, page_num, "was never written");
+        check->last_leaf = INVALID_PAGE_NUM;
+        return;
+    }
+    if (depth == BTREE_MAX_DEPTH) {
+        check_error(check, page_num, "is deeper than %d levels", BTREE_MAX_DEPTH);
+        return;
+    }
+    if (page->type != NODE_LEAF && page->type != (check->index ? NODE_INDEX_INTERNAL : NODE_INTERNAL)) {
+        check_error(check, page_num, "is not a node of this tree (type %d)", page->type);
+        return;
+    }
+    if (page->is_root != (depth == 0)) check_error(check, page_num, "%s marked as the root", depth ? "is" : "isn't");
+    if (page->type == NODE_LEAF) {
+        check_leaf(check, page_num, page, depth, lower, upper);
+    } else if (check->index) {
+        check_index_internal(check, page_num, (IndexInternalNode*)page_at(check->nodes, page->copy), depth, lower, upper);
+    } else {
+        check_internal(check, page_num, (InternalNode*)page_at(check->nodes, page->copy), depth, lower, upper);
+    }
+}
+
+static void check_tree(IntegrityCheck* check, uint32_t root_page_num) {
+    check->leaf_depth = UINT32_MAX;
+    check->last_leaf = INVALID_PAGE_NUM;
+    check_node(check, root_page_num, 0, (CheckBound){0}, (CheckBound){0});
+    if (check->last_leaf != INVALID_PAGE_NUM && check->next_leaf != 0) {
+        check_error(check, check->last_leaf, "is the last leaf, but points at page %d", check->next_leaf);
+    }
+}
+
+/*
+verify the file behind `pager`, which has to be checkpointed, and the trees of `tables` in it.
+prints what's wrong (the first `CHECK_MAX_ERRORS` problems), and returns how many problems there were.
+*/
+uint32_t check_database(Pager* pager, Table** tables, uint32_t num_tables) {
+    IntegrityCheck check = { .pager = pager };
+    check.pages = calloc(pager->num_pages ? pager->num_pages : 1, sizeof *(check.pages));
+    for (uint32_t i = 0; i < pager->num_free_pages; i++) check.pages[pager->free_pages[i]].state = CHECK_PAGE_FREE;
+
+    snprintf(check.tree, sizeof check.tree, "file");
+    Node* batch = aligned_alloc(PAGE_SIZE, CHECK_BATCH_PAGES * PAGE_SIZE);
+    for (uint32_t first = 0; first < pager->num_pages; first += CHECK_BATCH_PAGES) {
+        uint32_t num_pages = pager->num_pages - first < CHECK_BATCH_PAGES ? pager->num_pages - first : CHECK_BATCH_PAGES;
+        check_read(&check, first, num_pages, batch);
+        for (uint32_t i = 0; i < num_pages; i++) check_sweep_page(&check, first + i, page_at(batch, i));
+    }
+    free(batch);
+
+    for (uint32_t i = 0; i < num_tables; i++) {
+        Table* table = tables[i];
+        snprintf(check.tree, sizeof check.tree, "%s", table->name);
+        check.index = false;
+        check_tree(&check, table->root_page_num);
+        for (uint32_t j = 0; j < table->num_indexes; j++) {
+            const Index* index = &(table->indexes[j]);
+            snprintf(check.tree, sizeof check.tree, "%s(%s)", table->name, table->schema.columns[index->column].name);
+            check.index = true;
+            check_tree(&check, index->root_page_num);
+        }
+    }
+
+    // any page no tree reached, unless it was never written (or is broken, and was reported as such)
+    snprintf(check.tree, sizeof check.tree, "file");
+    for (uint32_t page_num = 1; page_num < pager->num_pages; page_num++) {
+        CheckPage* page = &(check.pages[page_num]);
+        if (page->state == CHECK_PAGE_UNSEEN && !page->zero && !page->broken) {
+            check_error(&check, page_num, "is neither in a tree nor free");
+        }
+    }
+
+    if (check.num_errors == 0) {
+        print_success(
+            "check: ok, %d pages: %d in trees, %d free", pager->num_pages, check.num_tree_pages, pager->num_free_pages
+        );
+    } else {
+        print_error("check: %d problems", check.num_errors);
+    }
+    free(check.pages);
+    free(check.nodes);
+    free(check.cells);
+    return check.num_errors;
+}
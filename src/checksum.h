@@ -0,0 +1,107 @@
+#pragma once
+#include "common.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/*
+page checksums: CRC32C (the Castagnoli polynomial, as in iSCSI, ext4 and SQLite's cksumvfs) of a page's first
+`PAGE_USABLE_SIZE` bytes, seeded with its page number - so a page written to the wrong place doesn't check out either -
+and stored in the last `PAGE_CHECKSUM_SIZE`. a torn write (part of a page new, part old) or a flipped bit fails it.
+x86 has an instruction for it since SSE 4.2, 8 bytes at a time. without it, a table-driven version does 8 bytes per
+round too ("slicing-by-8"), several times slower. which one runs is picked on first use.
+*/
+
+#define CRC32C_POLYNOMIAL 0x82f63b78 // reversed
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_software(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof word);
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff]
+            ^ crc32c_table[5][(word >> 16) & 0xff] ^ crc32c_table[4][(word >> 24) & 0xff]
+            ^ crc32c_table[3][(word >> 32) & 0xff] ^ crc32c_table[2][(word >> 40) & 0xff]
+            ^ crc32c_table[1][(word >> 48) & 0xff] ^ crc32c_table[0][word >> 56];
+    }
+    for (; length; data++, length--) crc = crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+    uint64_t crc64 = ~crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof word);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; length; data++, length--) crc = _mm_crc32_u8(crc, *data);
+    return ~crc;
+}
+#endif
+
+static uint32_t (*crc32c_kernel)(uint32_t crc, const uint8_t* data, size_t length);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void) {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (uint32_t bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        crc32c_table[0][byte] = crc;
+    }
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        for (uint32_t slice = 1; slice < 8; slice++) {
+            uint32_t previous = crc32c_table[slice - 1][byte];
+            crc32c_table[slice][byte] = crc32c_table[0][previous & 0xff] ^ (previous >> 8);
+        }
+    }
+    crc32c_kernel = crc32c_software;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc32c_kernel = crc32c_hardware;
+#endif
+}
+
+/* CRC32C of `length` bytes, continuing from `crc` (0 to start) */
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_kernel(crc, data, length);
+}
+
+/* whether `crc32c` runs on the CPU's instruction */
+bool crc32c_hardware_supported(void) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_kernel != crc32c_software;
+}
+
+uint32_t page_checksum(const Node* page, uint32_t page_num) {
+    return crc32c(page_num, page, PAGE_USABLE_SIZE);
+}
+
+static uint32_t* page_checksum_slot(Node* page) {
+    return (uint32_t*)(page->data + PAGE_USABLE_SIZE);
+}
+
+/* stamp `page` with its checksum, right before it's written out as `page_num` */
+void page_stamp_checksum(Node* page, uint32_t page_num) {
+    *page_checksum_slot(page) = page_checksum(page, page_num);
+}
+
+/* a page of zeroes was never written at all: a hole past the last page written, or `--mmap` growing the file ahead of use */
+bool page_is_zero(const Node* page) {
+    for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+        if (page->data[i]) return false;
+    }
+    return true;
+}
+
+/* whether `page`, read back as `page_num`, is what was written there (or was never written, and holds nothing to check) */
+bool page_checksum_valid(Node* page, uint32_t page_num) {
+    return *page_checksum_slot(page) == page_checksum(page, page_num) || page_is_zero(page);
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // pwritev
+#define _GNU_SOURCE // writer-preferring rwlocks (`pthread_rwlockattr_setkind_np`)
 #define NDEBUG
 
 #include <sys/types.h>
@@ -10,60 +12,161 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include <assert.h>
 
 
 // NOTE: requires c2x standard
 // `__VA_OPT__` gets replaced with its argument if variadic arguments (e.g. `...`) are present
-#define print_success(format, ...) (use_color ? printf("\x1b[32m" format "\x1b[39m\n" __VA_OPT__(,) __VA_ARGS__) : printf(format"\n" __VA_OPT__(,) __VA_ARGS__))
-#define print_error(format, ...) (use_color ? printf("\x1b[31m" format "\x1b[39m\n" __VA_OPT__(,) __VA_ARGS__) : printf(format"\n" __VA_OPT__(,)  __VA_ARGS__))
+// messages (and the prompt) go to stderr when stdout only carries rows, see `--output`
+#define message_stream (messages_to_stderr ? stderr : stdout)
+#define print_success(format, ...) (use_color ? fprintf(message_stream, "\x1b[32m" format "\x1b[39m\n" __VA_OPT__(,) __VA_ARGS__) : fprintf(message_stream, format"\n" __VA_OPT__(,) __VA_ARGS__))
+#define print_error(format, ...) (use_color ? fprintf(message_stream, "\x1b[31m" format "\x1b[39m\n" __VA_OPT__(,) __VA_ARGS__) : fprintf(message_stream, format"\n" __VA_OPT__(,)  __VA_ARGS__))
 #define log(format, ...) (\
     use_color\
-    ? printf("\x1b[35m%s:%d: " format "\x1b[39m\n",  __FILE__, __LINE__ __VA_OPT__(,) __VA_ARGS__)\
-    : printf("%s:%d: " format "\n",  __FILE__, __LINE__ __VA_OPT__(,) __VA_ARGS__)\
+    ? fprintf(message_stream, "\x1b[35m%s:%d: " format "\x1b[39m\n",  __FILE__, __LINE__ __VA_OPT__(,) __VA_ARGS__)\
+    : fprintf(message_stream, "%s:%d: " format "\n",  __FILE__, __LINE__ __VA_OPT__(,) __VA_ARGS__)\
 )
 // get sizeof on compile time for uninitialized structures
 #define sizeof_ct(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
 
+// the columns of the `users` table, which every database starts out with (and files from before the catalog had)
 #define COLUMN_USERNAME_SIZE 31
 #define COLUMN_EMAIL_SIZE 255
-#define TABLE_MAX_PAGES 100
+#define TABLE_NAME_MAX_SIZE 31 // also the longest column name
+#define TABLE_MAX_COLUMNS 32 // the key included
+#define INDEX_VALUE_MAX_SIZE 255 // longest value an index holds: a text or char column's characters, or an int's 4 bytes
+#define ROW_MAX_BODY_SIZE 1024 // bytes of a row's columns after the key, so a leaf still holds at least 3 rows
+#define PAGER_DEFAULT_FRAMES 256
+// a file's page size is picked when it's created (`--page-size`): a power of two between these
+#define PAGE_MIN_SIZE 4096 // a leaf has to hold 3 of the largest rows
+#define PAGE_MAX_SIZE 65536 // offsets within a page are 16 bits (`LeafNode.slots`)
+#define DEFAULT_PAGE_SIZE 4096
+#define LEGACY_PAGE_SIZE 4096 // every file's, up to format 7
+// `select` output is collected here and written with one `fwrite` whenever it fills up
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+// deepest split cascade keeps a handful of pages pinned per tree level
+#define PAGER_MIN_FRAMES 16
+#define PAGER_MAX_FRAMES (1 << 24) // `--frames`: keeps the page table (twice as many slots, rounded up) within a `uint32_t`
+// internal levels a `Cursor` can record. at a third full, internal nodes still fan out over 100 ways, so 4 billion rows take 6
+#define BTREE_MAX_DEPTH 16
+#define PAGER_MAX_IOVECS 1024 // IOV_MAX on linux; longest run of pages written by one `pwritev`
+#define PAGER_RING_ENTRIES 64 // reads the pager keeps in flight at once, with io_uring
+#define PAGER_PREFETCH_PAGES 32 // pages a scan reads ahead of itself at once, at most a quarter of the pool's frames
+#define READ_AHEAD_MIN_PAGES 4 // pages a scan first asks the OS to read ahead, once its leaves follow each other in the file
+#define READ_AHEAD_MAX_BYTES (1 << 20) // ...doubling for as long as they do, up to this much (whatever the page size)
+#define READ_AHEAD_MAX_GAP 8 // how far on in the file the next leaf can be and still follow: internal nodes sit in between
+#define DEFAULT_CHECKPOINT_INTERVAL 1000 // statements between periodic checkpoints, 0 disables them
+#define DEFAULT_GROUP_COMMIT_SIZE 64 // statements per fsync in `--sync group` mode
+#define BATCH_GROUP_POOL_FRACTION 8 // a batch goes in a group of rows at a time, each dirtying about 1/this of the pool's frames at most
+#define PAGER_MMAP_RESERVE (1ull << 36) // address space reserved up front by `--mmap`, i.e. the largest file it can map (64 GiB)
+#define PAGER_MMAP_EXTENT_PAGES 256 // `--mmap` grows the file by at least this many pages at a time
+#define PAGER_LATCH_CHUNK_PAGES 1024 // `--mmap` has no frames to keep latches in, they're allocated for this many pages at a time
+// a parallel scan cuts the table into about this many subtrees per worker, so the workers that finish early have some to steal
+#define SCAN_RANGES_PER_WORKER 4
+#define SCAN_MAX_THREADS 64 // `--threads`
+#define SCAN_OUTPUT_BUFFER_SIZE (1 << 18) // a parallel scan formats rows into one of these per subtree, grown while it waits its turn
+#define LOAD_SORT_BUFFER_ROWS (1 << 16) // rows `.load` sorts in memory before spilling a run to disk (~2 MiB of typical rows)
+#define LOAD_DEFAULT_FILL_FACTOR 100 // percent of each node `.load` fills
+#define CHECK_MAX_ERRORS 20 // `.check` prints this many problems, and only counts the rest
+#define CHECK_BATCH_PAGES 64 // pages `.check` reads at a time as it sweeps the file
+
+typedef enum {
+    PREPARE_SUCCESS,
+    PREPARE_UNRECOGNIZED_STATEMENT,
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_INVALID_SCHEMA,
+    PREPARE_NO_TABLE,
+    PREPARE_NO_SUCH_COLUMN,
+} PrepareResult;
+
+/*
+columns are typed, and encoded back to back after the key (see schema.h):
+- int: 4 bytes, little endian, unsigned like the key
+- text(N): a length byte and up to N characters
+- char(N): exactly N bytes, NUL padded
+*/
+typedef enum { COLUMN_INT, COLUMN_TEXT, COLUMN_CHAR } ColumnType;
 
+typedef struct {
+    char name[TABLE_NAME_MAX_SIZE + 1];
+    ColumnType type;
+    uint32_t size; // longest text, width of a char, 4 for an int
+    uint32_t offset; // where the column starts in a row's body, if the schema is `fixed_width`
+} Column;
+
+/* the first column is the key: always an int, stored as the cell's varint id rather than in the body */
+typedef struct {
+    uint32_t num_columns;
+    Column columns[TABLE_MAX_COLUMNS];
+    bool fixed_width; // no text columns: every body takes `max_body_size` bytes and columns sit at fixed offsets
+    uint32_t max_body_size;
+} Schema;
+
+/*
+serialized (on disk) row, i.e. a leaf cell: varint id, varint body size, then the body - every column but the key,
+encoded per the table's schema. the btree only ever looks at the id and the sizes.
+*/
 typedef struct {
     uint32_t id;
-    char username[COLUMN_USERNAME_SIZE+1]; // +1 for C-style strings
-    char email[COLUMN_EMAIL_SIZE+1];
+    uint32_t size; // bytes of `body` in use
+    uint8_t body[ROW_MAX_BODY_SIZE];
 } Row;
 
-constexpr const uint32_t ID_SIZE = sizeof_ct(Row, id);
-constexpr const uint32_t ID_OFFSET = 0;
-constexpr const uint32_t USERNAME_SIZE = sizeof_ct(Row, username);
-constexpr const uint32_t USERNAME_OFFSET = ID_SIZE;
-constexpr const uint32_t EMAIL_SIZE = sizeof_ct(Row, email);
-constexpr const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-constexpr const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE; // serialized size
-// constexpr const uint32_t PAGE_SIZE = sysconf(_SC_PAGESIZE);
-constexpr const uint32_t PAGE_SIZE = 4096; // I think a more relevant name would be `BLOCK_SIZE`
-constexpr const uint32_t ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
-constexpr const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
-const uint32_t INVALID_PAGE_NUM = UINT32_MAX;
+/*
+a row read in place (see `row_view`): `body` points into the page holding the row.
+only valid while that page is pinned.
+*/
+typedef struct {
+    uint32_t id;
+    const uint8_t* body;
+    uint32_t body_size;
+    const uint8_t* cell; // the serialized row itself
+    uint32_t size;       // ...and its size
+} RowView;
+
+constexpr const uint32_t ROW_MAX_SIZE = 5 + 2 + ROW_MAX_BODY_SIZE;
+// an index entry is serialized like a row, with the indexed value as its body (see index.h)
+constexpr const uint32_t INDEX_ENTRY_MAX_SIZE = 5 + 2 + INDEX_VALUE_MAX_SIZE;
+/* a row formatted by `output_row`: a column takes at most twice its bytes, plus a separator and csv quotes.
+an int is 4 bytes and up to 10 digits, within that too */
+constexpr const uint32_t OUTPUT_ROW_MAX_SIZE = 2 * ROW_MAX_SIZE + 4 * TABLE_MAX_COLUMNS;
+/*
+the page size of the open file: the one its header records (see `pager_open`), or `--page-size` for a new one.
+what a node holds follows from it, so the sizes below that depend on it are worked out where they're used, which only
+takes a load and some arithmetic
+*/
+static uint32_t page_size = DEFAULT_PAGE_SIZE;
+#define PAGE_SIZE page_size // I think a more relevant name would be `BLOCK_SIZE`
+
+static inline bool page_size_valid(uint32_t size) {
+    return size >= PAGE_MIN_SIZE && size <= PAGE_MAX_SIZE && (size & (size - 1)) == 0;
+}
 
-typedef union {
-    uint32_t key;
-    char data[ROW_SIZE];
-} SerializedRow;
+// every page ends in a CRC32C of the rest of it (see checksum.h), nodes only use the bytes before that
+constexpr const uint32_t PAGE_CHECKSUM_SIZE = sizeof(uint32_t);
+#define PAGE_USABLE_SIZE (PAGE_SIZE - PAGE_CHECKSUM_SIZE)
+const uint32_t INVALID_PAGE_NUM = UINT32_MAX;
+const uint32_t INVALID_FRAME = UINT32_MAX;
 
 typedef struct _InternalNode InternalNode;
 typedef struct _LeafNode LeafNode;
+typedef struct _IndexInternalNode IndexInternalNode;
 typedef union _Node Node;
+typedef struct _IoRing IoRing;
 
 
-typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
+// `NODE_LEGACY_INTERNAL` only lives while a file from before format 7 is upgraded (see `btree_mark_legacy_internal_nodes`)
+typedef enum { NODE_INTERNAL, NODE_LEAF, NODE_INDEX_INTERNAL, NODE_LEGACY_INTERNAL } NodeType;
 // RESEARCH: maybe we can fit the same n. of cells without packing these (since there's wasted space)?
 // RESEARCH: so far, only INTERNAL_NODE_MAX_KEYS goes 510 -> 509
 // typedef enum __attribute__((packed)) { NODE_INTERNAL, NODE_LEAF } NodeType;
@@ -71,7 +174,7 @@ typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
 typedef struct {
     uint8_t is_root;
     NodeType type;
-    uint32_t parent;
+    uint32_t parent; // 0. up to format 8, a table's nodes kept their parent's page number here
 } CommonHeader;
 
 constexpr const uint32_t COMMON_NODE_HEADER_SIZE = sizeof(CommonHeader);
@@ -80,75 +183,473 @@ typedef struct {
     CommonHeader;
     uint32_t num_keys;
     uint32_t last_child;
+    uint32_t max_key; // largest key in the subtree, i.e. `last_child`'s - the cells only carry keys for the other children
 } InternalHeader;
 
+/* a child and its max key, as internal nodes are read and written (`internal_node_get_children`). up to format 6, the node's layout too */
 typedef struct {
     uint32_t child; // page number
     uint32_t key;
 } InternalCell;
 
 constexpr const uint32_t INTERNAL_NODE_CELL_SIZE = sizeof(InternalCell);
-constexpr const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - sizeof(InternalHeader);
-constexpr const uint32_t INTERNAL_NODE_MAX_KEYS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
-// constexpr const uint32_t INTERNAL_NODE_MAX_KEYS = 3;
-constexpr const uint32_t INTERNAL_NODE_MAX_CHILDREN = INTERNAL_NODE_MAX_KEYS + 1;
-
+#define INTERNAL_NODE_SPACE_FOR_CELLS (PAGE_USABLE_SIZE - (uint32_t)sizeof(InternalHeader))
+#define INTERNAL_NODE_MAX_KEYS (INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE)
+// #define INTERNAL_NODE_MAX_KEYS 3u
+#define INTERNAL_NODE_MAX_CHILDREN (INTERNAL_NODE_MAX_KEYS + 1)
+// a non-root internal node left with fewer children after a delete borrows from or merges with a sibling
+#define INTERNAL_NODE_MIN_CHILDREN (INTERNAL_NODE_MAX_CHILDREN / 3)
+
+/*
+keys and children are kept apart, so a search compares a vector of keys at a time (see search.h).
+`INTERNAL_NODE_MAX_KEYS` keys, then as many children - where the children start depends on the page size
+*/
 struct _InternalNode {
     InternalHeader;
-    /* NOTE: NEVER ACCESS THIS DIRECTLY, use `internal_node_child` */
-    InternalCell _cells[INTERNAL_NODE_MAX_KEYS];
+    /* NOTE: NEVER ACCESS THESE DIRECTLY, use `internal_node_key` and `internal_node_child` */
+    uint32_t _keys[];
 };
 
+/*
+leaves are slotted pages: a directory of 2-byte cell offsets (`slots`, in key order) grows up from the header,
+the cells themselves (serialized rows, see `serialize_row`) are packed down from the end of the page.
+*/
 typedef struct {
     CommonHeader;
     uint32_t num_cells;
     uint32_t next_leaf;
+    uint32_t content_start; // offset of the lowest cell, everything from here to the end of the page is cell content
+    uint32_t fragmented_bytes; // dead bytes between cells, reclaimed by `leaf_node_compact`
 } LeafHeader;
 
-typedef SerializedRow LeafCell;
-
-
-constexpr const uint32_t LEAF_NODE_CELL_SIZE = sizeof(LeafCell);
 constexpr const uint32_t LEAF_NODE_HEADER_SIZE = sizeof(LeafHeader);
-constexpr const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-constexpr const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS+1) / 2; // point at which (inclusive) node should split to right sibling
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS+1)-LEAF_NODE_RIGHT_SPLIT_COUNT; // point at which (inclusive) node should split to right sibling
+constexpr const uint32_t LEAF_NODE_SLOT_SIZE = sizeof(uint16_t);
+#define LEAF_NODE_SPACE_FOR_CELLS (PAGE_USABLE_SIZE - LEAF_NODE_HEADER_SIZE)
+constexpr const uint32_t LEAF_NODE_MIN_CELL_SIZE = 2; // 1-byte id and an empty body
+// upper bound, for scratch space. rows per leaf depend on their size: 3 at the largest, ~100 for typical ones (in 4 KiB)
+#define LEAF_NODE_MAX_CELLS (LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_MIN_CELL_SIZE + LEAF_NODE_SLOT_SIZE))
+// same as `INTERNAL_NODE_MIN_CHILDREN`, in bytes of cells and slots
+#define LEAF_NODE_MIN_USED_BYTES (LEAF_NODE_SPACE_FOR_CELLS / 3)
 
 
 struct  _LeafNode {
     LeafHeader;
-    LeafCell cells[LEAF_NODE_MAX_CELLS];
+    /* NOTE: offsets into the page, use `leaf_node_cell`/`leaf_node_key`. sized to the largest page, so a copy holds one */
+    uint16_t slots[(PAGE_MAX_SIZE - LEAF_NODE_HEADER_SIZE) / LEAF_NODE_SLOT_SIZE];
 };
 
+/*
+internal nodes of a secondary index (see index.h), slotted like leaves since their keys vary in length.
+each cell is a child page number followed by the largest entry under that child, `last_child` has no cell.
+cells are never removed, so unlike leaves there's nothing to compact.
+*/
+typedef struct {
+    CommonHeader;
+    uint32_t num_cells;
+    uint32_t last_child;
+    uint32_t content_start;
+} IndexInternalHeader;
+
+constexpr const uint32_t INDEX_INTERNAL_NODE_HEADER_SIZE = sizeof(IndexInternalHeader);
+#define INDEX_INTERNAL_NODE_SPACE_FOR_CELLS (PAGE_USABLE_SIZE - INDEX_INTERNAL_NODE_HEADER_SIZE)
+
+struct _IndexInternalNode {
+    IndexInternalHeader;
+    /* NOTE: offsets into the page, use `index_internal_node_cell` */
+    uint16_t slots[(PAGE_MAX_SIZE - INDEX_INTERNAL_NODE_HEADER_SIZE) / sizeof(uint16_t)];
+};
+
+/* room for the largest page: only the first `PAGE_SIZE` bytes of one are the page (see `page_at`) */
 union  _Node {
     CommonHeader common_header;
-    char data[PAGE_SIZE];
+    char data[PAGE_MAX_SIZE];
 };
 
+/* page `i` of pages that sit next to each other in memory, e.g. read together */
+static inline Node* page_at(void* pages, uint32_t i) {
+    return (Node*)((uint8_t*)pages + (size_t)i * PAGE_SIZE);
+}
+
+#define DB_FILE_MAGIC "meinsql" // legacy files start with a root node, whose first byte (`is_root`) is 1
+/*
+1: first version with a header page. 2: internal nodes carry `max_key`. 3: slotted leaves.
+4: a catalog of tables (see catalog.h), cells carry their body's size. 5: the catalog lists each table's indexes.
+6: page checksums. 7: internal nodes keep their keys and children in separate arrays. 8: the header records the page size.
+9: a table's nodes stop keeping their parent's page number (builds before relied on it).
+*/
+constexpr const uint32_t DB_FORMAT_VERSION = 9;
+
+/* page 0 of every database file, followed by the catalog. the B+ trees live in the pages after it. */
+typedef struct {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t root_page_num; // the one table's root up to format 3, the catalog has every table's since
+    uint32_t freelist_trunk; // first freelist trunk page, `INVALID_PAGE_NUM` if there are no free pages
+    uint32_t num_free_pages; // trunks included
+    uint32_t page_size; // since format 8, 4096 before
+} DbHeader;
+
+/*
+free pages are kept on disk like SQLite does: a chain of trunk pages, each listing a batch of free "leaf" pages.
+trunks are free pages themselves, they're just borrowed to hold the list.
+*/
+typedef struct {
+    uint32_t next_trunk; // `INVALID_PAGE_NUM` on the last trunk
+    uint32_t num_leaves;
+} FreelistTrunkHeader;
+
+#define FREELIST_TRUNK_MAX_LEAVES ((PAGE_USABLE_SIZE - (uint32_t)sizeof(FreelistTrunkHeader)) / (uint32_t)sizeof(uint32_t))
+
+typedef struct {
+    FreelistTrunkHeader;
+    uint32_t leaves[]; // `FREELIST_TRUNK_MAX_LEAVES` fit
+} FreelistTrunk;
+
+typedef struct {
+    uint32_t page_num; // `INVALID_PAGE_NUM` if frame holds no page
+    uint32_t pin_count; // frame may only be evicted when this is 0
+    bool dirty;
+    bool referenced; // CLOCK "second chance" bit, set on every pin
+    bool reading; // `pager_prefetch` is reading the page in: it's pinned until then, and `pager_pin` waits for it
+    Node* page;
+    pthread_rwlock_t latch; // guards the page's contents between threads, see `latch_page`
+} Frame;
+
+/* what a page held before a write replaced it: the contents version `since` wrote, which version `until` replaced */
+typedef struct _PageVersion {
+    uint64_t since;
+    uint64_t until;
+    struct _PageVersion* older;
+    Node page; // only `PAGE_SIZE` of it is allocated
+} PageVersion;
+
+/* a page written while snapshots were open: the version that wrote what it holds now, and what it held before */
+typedef struct {
+    uint32_t page_num; // `INVALID_PAGE_NUM` if the slot is empty
+    uint64_t version;
+    PageVersion* versions; // newest first
+} VersionedPage;
+
 typedef struct {
     int file_descriptor;
-    uint32_t file_length;
+    char* filename; // for `pager_replace_file` to put a copy in its place
+    off_t file_length; // bytes: past 4 GiB, a `uint32_t` would wrap
     uint32_t num_pages;
-    Node* pages[TABLE_MAX_PAGES]; /* NOTE: NEVER use this outside of code dealing stricly with loading pages.*/
+    uint32_t num_frames;
+    uint32_t num_dirty;
+    uint32_t clock_hand;
+    /* never write dirty pages back on eviction, only on checkpoint: the write-ahead log replays whole statements, and
+    a page written halfway through one would leave it to replay onto a half-changed tree. */
+    bool no_steal;
+    /* NOTE: NEVER use these outside of code dealing stricly with loading pages, go through `get_page`/`unpin_page`. */
+    Frame* frames;
+    /* open-addressing hash table (linear probing) of page number -> frame index.
+    capacity is a power of two, at least twice `num_frames` so probe chains stay short. */
+    uint32_t* page_table;
+    uint32_t page_table_capacity;
+    /* reads that can be in flight together go through io_uring (see uring.h and `pager_prefetch`). NULL with `--io sync`,
+    or where the kernel doesn't have it: then it's one read at a time */
+    IoRing* ring;
+    /* the reads are waited on with `mutex` released, by one thread at a time: it completes whichever reads are done, of
+    any thread's, and wakes the others on `read_done` */
+    bool reaping;
+    pthread_cond_t read_done;
+    uint32_t num_reading; // frames being read in, between all the threads: at most a quarter of the pool
+    uint32_t read_ahead_max; // most pages a scan has read ahead of it (see `btree_read_ahead`), 0 for none
+    /* `--mmap` backend: the whole file is mapped at `map` and there are no frames. NULL for the buffer pool. */
+    char* map;
+    uint32_t map_num_pages; // pages mapped, which is also the file's length - it's grown in extents, ahead of `num_pages`
+    uint8_t* map_dirty; // one flag per mapped page
+    pthread_rwlock_t** map_latches; // page latches in chunks of `PAGER_LATCH_CHUNK_PAGES`, allocated as pages are latched
+    /* in-memory copy of page 0; written back on checkpoint if `header_dirty` */
+    DbHeader header;
+    bool header_dirty;
+    /* pages are stamped with their checksum as they're written, and checked as they're read into the pool (see
+    checksum.h). off while an older file, whose pages have none, is upgraded */
+    bool checksums;
+    /* every free page, sorted, so allocation can pick the one nearest to where it's needed.
+    the on-disk trunk chain is only rebuilt from this on checkpoint, and only if `freelist_dirty`. */
+    uint32_t* free_pages;
+    uint32_t num_free_pages;
+    uint32_t free_pages_capacity;
+    bool freelist_dirty;
+    /* free pages kept out of `free_pages` by `pager_hold_free_pages`, until the next checkpoint hands them back */
+    uint32_t* held_pages;
+    uint32_t num_held_pages;
+    uint32_t held_pages_capacity;
+    bool holding_free_pages;
+    /* guards the pool's bookkeeping (page table, pins, CLOCK, dirty counts) and `--mmap`'s growth,
+    so pages can be pinned by several threads. the pages themselves are guarded by their latches.
+    both are skipped unless `threaded`, which has to be set before other threads use the pager. */
+    pthread_mutex_t mutex;
+    bool threaded;
+    /* snapshots (see `snapshot_begin`): `version` counts the writes published so far, and `snapshots` holds the version
+    each open snapshot reads as of, oldest first. while any is open, every page written gets an entry in `versioned_pages`
+    (open addressing, like `page_table`) that keeps its old contents for as long as a snapshot may read them. */
+    uint64_t version;
+    uint64_t* snapshots;
+    uint32_t num_snapshots;
+    uint32_t snapshots_capacity;
+    VersionedPage* versioned_pages;
+    uint32_t num_versioned_pages;
+    uint32_t versioned_pages_capacity;
+    PageVersion* spare_versions; // dropped by `snapshot_end`, for the next copies
+    bool writing; // pages were written since the last `snapshot_publish` (only tracked once `threaded`)
+    uint32_t snapshots_waiting; // for the write in progress to be published
+    pthread_cond_t published;
+    pthread_cond_t opened;
 } Pager;
 
+/* a consistent view of the pager's pages as they were after write `version`, see `snapshot_begin` */
+typedef struct {
+    Pager* pager;
+    uint64_t version;
+} Snapshot;
+
+typedef enum {
+    SYNC_OFF,   // no write-ahead log, statements are durable once checkpointed
+    SYNC_FULL,  // fsync the log after every statement
+    SYNC_GROUP, // fsync the log once per `group_size` statements
+} SyncMode;
+
+/* how `select` writes rows, see output.h */
+typedef enum {
+    OUTPUT_TEXT,   // `id column1 column2 ...`
+    OUTPUT_TSV,
+    OUTPUT_CSV,
+    OUTPUT_BINARY, // rows as stored
+} OutputFormat;
+
+typedef enum {
+    WAL_RECORD_END = 0,
+    WAL_RECORD_INSERT = 1,
+    WAL_RECORD_DELETE = 2,
+    WAL_RECORD_UPDATE = 3,
+    WAL_RECORD_BATCH = 4,
+    WAL_RECORD_TABLE = 5,
+} WalRecordType;
+
+typedef struct {
+    int file_descriptor;
+    char* filename;
+    SyncMode sync_mode;
+    uint32_t group_size;
+    uint32_t pending_statements; // committed but not yet fsynced
+    uint32_t table_id; // the table records go to until the next `WAL_RECORD_TABLE`, 0 at the start of the log
+    // records not yet written to the file
+    uint8_t* buffer;
+    uint32_t buffer_length;
+    uint32_t buffer_capacity;
+} Wal;
+
+/* rows of a multi-row `insert`, or of every `insert` between `begin` and `commit`, serialized back to back */
 typedef struct {
+    uint8_t* cells;
+    uint32_t length;
+    uint32_t capacity;
+    uint32_t* offsets; // where each row starts in `cells`
+    uint32_t num_rows;
+    uint32_t offsets_capacity;
+} RowBatch;
+
+/* a secondary index on one column: a B+ tree of the column's values and the keys of the rows holding them (see index.h) */
+typedef struct {
+    uint32_t column;
     uint32_t root_page_num;
+} Index;
+
+typedef struct {
+    uint32_t id; // never reused, so the log can't replay a dropped table's statements into a new one
+    char name[TABLE_NAME_MAX_SIZE + 1];
+    Schema schema;
+    uint32_t root_page_num;
+    Index indexes[TABLE_MAX_COLUMNS]; // at most one per column, the key's excluded
+    uint32_t num_indexes;
     Pager* pager;
+    Wal* wal; // NULL if statements aren't logged (`--sync off`, or replaying the log)
+    RowBatch* batch; // open `begin` batch, NULL outside of one
 } Table;
 
+/* every table in a file, as listed by its catalog */
+typedef struct {
+    Pager* pager;
+    Wal* wal;
+    Table** tables; // in the order they were created
+    uint32_t num_tables;
+    uint32_t next_table_id;
+    Table* current; // the table statements go to (see `use`), NULL if it was dropped
+} Database;
+
+/* what an aggregate `select` adds up over the rows it reads: a count, and the sum, min and max of one int column */
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint32_t min; // only if `count`
+    uint32_t max;
+} Aggregate;
+
+/* a slice of a parallel scan (see scan.h): the rows with keys `min_key..max_key`, all of them in the subtree at `page_num` */
+typedef struct {
+    uint32_t page_num;
+    uint32_t min_key;
+    uint32_t max_key;
+    // rows formatted by `scan_output_row`, not yet written out
+    char* output;
+    uint32_t output_length;
+    uint32_t output_capacity;
+    Aggregate aggregate; // what `scan_range` adds up, for `parallel_scan` to return
+    bool done;
+} ScanRange;
+
+typedef struct _ParallelScan ParallelScan;
+
+/* a thread of a parallel scan, and the ranges it has left: `ranges[head..tail)`. it takes them from the head, thieves from the tail */
+typedef struct {
+    ParallelScan* scan;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    uint32_t* ranges; // indexes into the scan's
+    uint32_t head;
+    uint32_t tail;
+} ScanWorker;
+
+struct _ParallelScan {
+    Table* table;
+    Snapshot snapshot; // every worker reads through it
+    ScanRange* ranges; // in key order
+    uint32_t num_ranges;
+    ScanWorker* workers; // the first one is the thread that started the scan
+    uint32_t num_workers;
+    // what a worker does with each of its ranges: filter its rows, output them or add them up
+    void (*scan_range)(ParallelScan* scan, ScanRange* range);
+    void* argument; // for `scan_range`
+    bool ordered; // write the ranges out in key order, rather than as they fill up
+    pthread_mutex_t output_mutex; // also guards `aggregate`
+    Aggregate aggregate; // the ranges', added up as they're done
+    uint32_t next_output; // in key order: the range being written out as it fills, the ones after it wait until it's done
+};
+
+/* where a page stands in a `.check` (see check.h) */
+typedef enum { CHECK_PAGE_UNSEEN, CHECK_PAGE_FREE, CHECK_PAGE_IN_TREE } CheckPageState;
+
+/* what `.check` keeps of a page from its sweep through the file, to check the trees against afterwards */
+typedef struct {
+    CheckPageState state;
+    bool zero; // never written
+    bool broken; // failed its checksum, or doesn't hold together as a node (already reported): trees stop there
+    bool is_root;
+    NodeType type;
+    uint32_t num_cells; // leaves
+    uint32_t next_leaf;
+    uint16_t key_disorder; // the first cell of a leaf out of key order, 0 if none is
+    uint16_t entry_disorder; // ...out of index entry order
+    size_t copy; // internal nodes: which of `IntegrityCheck.nodes` is theirs. leaves: where their first and last cells are in `cells`
+} CheckPage;
+
+/* one end of the keys a subtree may hold: a table's key, or an index entry (a pointer into the parent's copy) */
+typedef struct {
+    bool set; // false: no bound on that side
+    uint32_t key;
+    const uint8_t* entry;
+} CheckBound;
+
+/* a `.check` in progress: what the sweep kept of every page, the tree being walked, and what was found so far */
+typedef struct {
+    Pager* pager;
+    CheckPage* pages; // one per page of the file
+    uint8_t* nodes; // copies of the internal nodes, a page each
+    size_t num_nodes;
+    size_t nodes_capacity;
+    uint8_t* cells; // the first and last cell of every leaf, each after its size (2 bytes)
+    size_t cells_length;
+    size_t cells_capacity;
+    uint32_t num_tree_pages;
+    uint32_t num_errors;
+    char tree[2 * TABLE_NAME_MAX_SIZE + 3]; // `table` or `table(column)`, or `file` during the sweep, for messages
+    bool index; // the tree is an index: ordered by entry, and no parent pointers
+    uint32_t leaf_depth; // every leaf of a tree sits at the same depth, `UINT32_MAX` until the first
+    uint32_t last_leaf; // the last leaf visited, `INVALID_PAGE_NUM` before the first
+    uint32_t next_leaf; // ...and the one it points at
+} IntegrityCheck;
+
+/* command line knobs for `db_open` */
+typedef struct {
+    uint32_t num_frames;
+    bool use_mmap;
+    bool use_ring; // `--io uring`: the pool reads ahead through io_uring, if the kernel has it
+    SyncMode sync_mode;
+    uint32_t group_size;
+} DbOptions;
+
+/* one sorted run of `.load` input, either spilled to a temporary file or still in memory */
+typedef struct {
+    FILE* file; // NULL for an in-memory run
+    RowBatch* rows;
+    uint64_t* order; // `key << 32 | index into rows`, sorted
+    uint32_t position;
+    const uint8_t* head; // next serialized row of the run, valid unless `exhausted`
+    uint32_t head_size;
+    uint32_t head_key;
+    uint8_t head_buffer[ROW_MAX_SIZE]; // where a spilled run's head is read into
+    bool exhausted;
+} LoadRun;
+
+/* a finished node, waiting for a parent on the level above */
+typedef struct {
+    uint32_t page_num;
+    uint32_t max_key;
+} LoadNodeRef;
+
+typedef struct {
+    uint32_t num_rows; // rows in the table after loading
+    uint32_t num_duplicates; // rows skipped because their key was already present
+    uint32_t num_leaves;
+} LoadStats;
+
+/*
+what a latched descent (`btree_find_latched`) is for. readers take shared latches, writers exclusive ones,
+and each lets go of the latches above a node once the operation can't change anything above it (see `node_is_safe`).
+*/
+typedef enum {
+    LATCH_READ,
+    LATCH_INSERT,
+    LATCH_UPDATE,
+    LATCH_DELETE,
+    LATCH_WRITE, // anything else: keeps every latch on the path (batches, which may split a leaf many times over)
+} LatchIntent;
+
+/*
+cursors are owned by their caller (usually on its stack): they hold no pins and nothing to free,
+unless they were latched - then `btree_unlatch` releases the pages in `latched`.
+*/
 typedef struct {
     /* table, page num and cell_num together
-    uniquely identify a cell in a B+ tree node in some table. */
+    uniquely identify a cell in a B+ tree node in some table (or in one of its indexes). */
     Table* table;
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;
+    /* the internal pages the descent to `page_num` went through, root first: `path[depth - 1]` is the leaf's parent.
+    splits, merges and max key updates walk back up it - nodes don't point at their parent (and splits keep it pointing at the
+    nodes above the cursor's leaf). */
+    uint32_t path[BTREE_MAX_DEPTH];
+    uint32_t depth;
+    /* pages latched (and pinned) by a latched descent, in the order they were latched: the nodes above the leaf
+    that the operation may still change, and the leaf itself. */
+    uint32_t latched[BTREE_MAX_DEPTH + 1];
+    uint32_t num_latched;
+    /* a scan's sequential read-ahead (see `btree_read_ahead`): the pages up to `read_ahead_end` have been asked for, and
+    the next ask is for `read_ahead_window` more. 0 until the scan's leaves follow each other in the file */
+    uint32_t read_ahead_end;
+    uint32_t read_ahead_window;
 } Cursor;
 
 
 bool use_color = true;
+bool messages_to_stderr = false;
+OutputFormat output_format = OUTPUT_TEXT;
+uint32_t scan_threads = 1; // `--threads`: workers of a `select` that scans the table, see scan.h
+bool scan_ordered = true; // `--unordered` lets them write rows out of key order
 
 
 void indent(uint32_t level) {
@@ -157,60 +658,134 @@ void indent(uint32_t level) {
     }
 }
 
-void serialize_row(Row* source, SerializedRow* destination) {
-    // RESEARCH: could also use strncpy to initialize bits to 0, looks cleaner on xxd
-    /*
-    NOTE: pointer is cast to void to *a*void (get it?) unwanted type pointer sizing,
-    `(void*)` guarantees we are working with byte-sized offsets
-    */
-    memcpy((void*)destination + ID_OFFSET,         &(source->id),      ID_SIZE);
-    memcpy((void*)destination + USERNAME_OFFSET,   &(source->username),USERNAME_SIZE);
-    memcpy((void*)destination + EMAIL_OFFSET,      &(source->email),   EMAIL_SIZE);
+/* LEB128: 7 bits per byte, high bit set on every byte but the last. returns bytes written (1-5). */
+uint32_t varint_encode(uint32_t value, uint8_t* destination) {
+    uint32_t length = 0;
+    while (value >= 0x80) {
+        destination[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    destination[length++] = value;
+    return length;
+}
+
+/* returns bytes read, or 0 if the varint runs past `limit` bytes */
+uint32_t varint_decode(const uint8_t* source, uint32_t limit, uint32_t* value) {
+    *value = 0;
+    for (uint32_t i = 0; i < limit && i < 5; i++) {
+        *value |= (uint32_t)(source[i] & 0x7f) << (7 * i);
+        if (!(source[i] & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+/* returns bytes written, at most `ROW_MAX_SIZE` */
+uint32_t serialize_row(const Row* source, uint8_t* destination) {
+    uint32_t length = varint_encode(source->id, destination);
+    length += varint_encode(source->size, destination + length);
+    memcpy(destination + length, source->body, source->size);
+    return length + source->size;
+}
+
+/* bytes `serialize_row` writes for `source` */
+uint32_t row_serialized_size(const Row* source) {
+    uint8_t varint[5];
+    return varint_encode(source->id, varint) + varint_encode(source->size, varint) + source->size;
+}
+
+/*
+decode the serialized row at `source` in place, without copying it: `view` points into `source`.
+returns bytes read (also `view->size`), or 0 if the row is malformed or runs past `limit` bytes.
+*/
+uint32_t row_view(const uint8_t* source, uint32_t limit, RowView* view) {
+    uint32_t position = varint_decode(source, limit, &(view->id));
+    if (!position) return 0;
+    uint32_t length = varint_decode(source + position, limit - position, &(view->body_size));
+    if (!length) return 0;
+    position += length;
+    if (view->body_size > ROW_MAX_BODY_SIZE || view->body_size > limit - position) return 0;
+    view->body = source + position;
+    view->cell = source;
+    view->size = position + view->body_size;
+    return view->size;
+}
+
+/* returns bytes read, or 0 if the row is malformed or runs past `limit` bytes */
+uint32_t deserialize_row(const uint8_t* source, uint32_t limit, Row* destination) {
+    RowView view;
+    if (!row_view(source, limit, &view)) return 0;
+    destination->id = view.id;
+    destination->size = view.body_size;
+    memcpy(destination->body, view.body, view.body_size);
+    return view.size;
+}
+
+/*
+up to format version 3 there was no body size: a row was the varint id followed by the `users` columns
+(a length byte and the characters, for username and email), which is the same body it has now.
+returns bytes read, or 0 if the row is malformed or runs past `limit` bytes.
+*/
+uint32_t deserialize_legacy_row(const uint8_t* source, uint32_t limit, Row* destination) {
+    uint32_t position = varint_decode(source, limit, &(destination->id));
+    if (!position || position >= limit) return 0;
+    uint32_t username_length = source[position];
+    if (username_length > COLUMN_USERNAME_SIZE || position + 1 + username_length >= limit) return 0;
+    uint32_t email_length = source[position + 1 + username_length];
+    if (email_length > COLUMN_EMAIL_SIZE || position + 2 + username_length + email_length > limit) return 0;
+    destination->size = 2 + username_length + email_length;
+    memcpy(destination->body, source + position, destination->size);
+    return position + destination->size;
+}
+
+/* the key of the serialized row at `source` */
+uint32_t serialized_row_key(const uint8_t* source) {
+    uint32_t key;
+    varint_decode(source, 5, &key);
+    return key;
 }
 
-void deserialize_row(SerializedRow* source, Row* destination) {
-    memcpy(&(destination->id),      (void*)source + ID_OFFSET,        ID_SIZE);
-    memcpy(&(destination->username), (void*)source + USERNAME_OFFSET,  USERNAME_SIZE);
-    memcpy(&(destination->email),    (void*)source + EMAIL_OFFSET,     EMAIL_SIZE);
+/* size of the serialized row at `source`, without decoding its body */
+uint32_t serialized_row_size(const uint8_t* source) {
+    uint32_t position = 1;
+    while (source[position - 1] & 0x80) position++;
+    uint32_t body_size;
+    position += varint_decode(source + position, 5, &body_size);
+    return position + body_size;
 }
 
-Node* get_page(Pager* pager, uint32_t page_num) {
-    if (page_num >= TABLE_MAX_PAGES) {
-        log("tried to fetch a page number larger than max. allowed: %d > %d", page_num, TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
+/* append a row to `batch`, already serialized */
+void row_batch_append_cell(RowBatch* batch, const uint8_t* cell, uint32_t cell_size) {
+    if (batch->num_rows == batch->offsets_capacity) {
+        batch->offsets_capacity = batch->offsets_capacity ? batch->offsets_capacity * 2 : 64;
+        batch->offsets = realloc(batch->offsets, batch->offsets_capacity * sizeof *(batch->offsets));
     }
-    if (pager->pages[page_num] == NULL) {
-        // cache miss; load or create new page
-        void* page = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
-        // there may be an extra, partial page
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
-        }
-        // we're requesting a page that's within num_pages, so it must exist on disk but not in memory. load it.
-        // (reminder that pages are 0 indexed so we check for equality as well)
-        if (page_num < num_pages) {
-            uint32_t offset = page_num * PAGE_SIZE;
-            lseek(pager->file_descriptor, offset, SEEK_SET);
-            // we don't have to check if it crosses file size - implementation should set off-bounds bytes to 0
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                printf("error reading file: %d", errno);
-                exit(EXIT_FAILURE);
-            }
-        }
-        // are we creating a new page? if so, increment page count
-        // we can't use `num_pages` here because it's reliant on filesize. we may not have flushed existing new pages yet.
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
-        }
-        pager->pages[page_num] = page;
+    if (batch->length + cell_size > batch->capacity) {
+        while (batch->length + cell_size > batch->capacity) batch->capacity = batch->capacity ? batch->capacity * 2 : 4096;
+        batch->cells = realloc(batch->cells, batch->capacity);
     }
-    return pager->pages[page_num];
+    batch->offsets[batch->num_rows++] = batch->length;
+    memcpy(batch->cells + batch->length, cell, cell_size);
+    batch->length += cell_size;
 }
 
-uint32_t get_unused_page_num(Pager* pager) {
-    // append new page to end of database file for now
-    return pager->num_pages;
+void row_batch_append(RowBatch* batch, const Row* row) {
+    uint8_t cell[ROW_MAX_SIZE];
+    row_batch_append_cell(batch, cell, serialize_row(row, cell));
 }
 
+/* the serialized row `row_num` of `batch` */
+const uint8_t* row_batch_cell(const RowBatch* batch, uint32_t row_num) {
+    return batch->cells + batch->offsets[row_num];
+}
+
+/* drop every row, keeping the memory */
+void row_batch_clear(RowBatch* batch) {
+    batch->length = 0;
+    batch->num_rows = 0;
+}
+
+void row_batch_free(RowBatch* batch) {
+    free(batch->cells);
+    free(batch->offsets);
+    *batch = (RowBatch){0};
+}
@@ -0,0 +1,458 @@
+#pragma once
+
+
+#include "common.h"
+#include "pager.h"
+#include "btree.h"
+#include "schema.h"
+
+
+/*
+secondary indexes (`create index on <column>`): a B+ tree per indexed column, from the column's value to the keys
+of the rows holding it. it's kept in sync by every insert, update and delete, and `select where <column> = ...`
+(or `like <prefix>%`) reads it instead of scanning the whole table.
+- an entry is a (value, key) pair, ordered by value and then by key. repeated values still make unique entries,
+  so every row's entry can be found exactly when it's removed.
+- values are encoded so they compare as bytes (`index_value`): the characters of a text or char, an int big endian.
+- leaves are ordinary slotted leaves, and entries are stored like rows: the key as the id, the value as the body.
+  the leaf code (compaction, splitting by bytes, the leaf chain) works on them unchanged.
+- internal nodes are slotted too (`IndexInternalNode`), since values vary in length: a cell per child but the last,
+  holding the largest entry under that child - an upper bound, which stays valid as entries are deleted.
+- nodes never merge (like most databases' indexes): deletes only take the entry out of its leaf,
+  and a leaf they empty stays in the chain until the index is rebuilt. nodes don't keep parent pointers either (theirs
+  are 0), descents record their path instead.
+*/
+
+/* encode a column's value (as `row_next_field` returns it) so that values compare with `memcmp`. returns its length */
+uint32_t index_value(const Column* column, const uint8_t* field, uint32_t length, uint8_t* destination) {
+    if (column->type == COLUMN_INT) {
+        uint32_t number;
+        memcpy(&number, field, sizeof number);
+        for (uint32_t i = 0; i < sizeof number; i++) destination[i] = number >> (8 * (sizeof number - 1 - i));
+        return sizeof number;
+    }
+    memcpy(destination, field, length);
+    return length;
+}
+
+/* serialize the entry of a row (`key` and its `body`) for `index`. returns its size */
+uint32_t index_entry(const Schema* schema, const Index* index, uint32_t key, const uint8_t* body, uint8_t* destination) {
+    uint32_t length;
+    const uint8_t* field = row_field(schema, body, index->column, &length);
+    Row entry = {.id = key};
+    entry.size = index_value(&(schema->columns[index->column]), field, length, entry.body);
+    return serialize_row(&entry, destination);
+}
+
+/* compare two serialized entries: by value, then by key */
+int index_entry_compare(const uint8_t* a, const uint8_t* b) {
+    RowView entry_a;
+    RowView entry_b;
+    row_view(a, ROW_MAX_SIZE, &entry_a);
+    row_view(b, ROW_MAX_SIZE, &entry_b);
+    uint32_t length = entry_a.body_size < entry_b.body_size ? entry_a.body_size : entry_b.body_size;
+    int result = memcmp(entry_a.body, entry_b.body, length);
+    if (result) return result;
+    if (entry_a.body_size != entry_b.body_size) return entry_a.body_size < entry_b.body_size ? -1 : 1;
+    return (entry_a.id > entry_b.id) - (entry_a.id < entry_b.id);
+}
+
+/* the entry in an internal node's cell, after the child's page number */
+static const uint8_t* index_internal_node_entry(IndexInternalNode* node, uint32_t cell_num) {
+    return index_internal_node_cell(node, cell_num) + sizeof(uint32_t);
+}
+
+static uint32_t index_internal_cell_size(const uint8_t* cell) {
+    return sizeof(uint32_t) + serialized_row_size(cell + sizeof(uint32_t));
+}
+
+void initialize_index_internal_node(IndexInternalNode* node) {
+    node->is_root = false;
+    node->type = NODE_INDEX_INTERNAL;
+    node->parent = 0;
+    node->num_cells = 0;
+    node->last_child = INVALID_PAGE_NUM;
+    node->content_start = PAGE_USABLE_SIZE;
+}
+
+static void initialize_index_leaf_node(LeafNode* node) {
+    initialize_leaf_node(node);
+}
+
+/* whether a cell of `cell_size` bytes (and its slot) still fits in `node` */
+static bool index_internal_node_fits(IndexInternalNode* node, uint32_t cell_size) {
+    return node->content_start - INDEX_INTERNAL_NODE_HEADER_SIZE - node->num_cells * sizeof(uint16_t) >= cell_size + sizeof(uint16_t);
+}
+
+/* place `cell` so it becomes cell `cell_num`. the caller has checked it fits */
+static void index_internal_node_insert_cell(IndexInternalNode* node, uint32_t cell_num, const uint8_t* cell, uint32_t cell_size) {
+    node->content_start -= cell_size;
+    memcpy((uint8_t*)node + node->content_start, cell, cell_size);
+    memmove(&(node->slots[cell_num + 1]), &(node->slots[cell_num]), (node->num_cells - cell_num) * sizeof(uint16_t));
+    node->slots[cell_num] = node->content_start;
+    node->num_cells++;
+}
+
+/* the child whose range holds `entry`: the first one whose bound is >= `entry`, or the last child */
+static uint32_t index_internal_node_find_child(IndexInternalNode* node, const uint8_t* entry) {
+    uint32_t min_index = 0;
+    uint32_t max_index = node->num_cells;
+    while (min_index < max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (index_entry_compare(index_internal_node_entry(node, index), entry) < 0) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+/* the first cell of an index leaf that is >= `entry`, `num_cells` if there is none */
+static uint32_t index_leaf_node_find_cell(LeafNode* node, const uint8_t* entry) {
+    uint32_t min_index = 0;
+    uint32_t max_index = node->num_cells;
+    while (min_index < max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (index_entry_compare(leaf_node_cell(node, index), entry) < 0) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+/*
+whether an insert (of `entry`) or delete with `intent` stays within `node`, so the latches above it can go
+(like `node_is_safe`): an insert splits a leaf without room for the entry, or an internal node without room for the
+largest entry a split below could push up. a delete only ever touches its leaf.
+*/
+static bool index_node_is_safe(Node* node, LatchIntent intent, const uint8_t* entry) {
+    if (intent != LATCH_INSERT) return true;
+    if (node->common_header.type == NODE_INDEX_INTERNAL) {
+        return index_internal_node_fits((IndexInternalNode*)node, sizeof(uint32_t) + INDEX_ENTRY_MAX_SIZE);
+    }
+    return leaf_node_free_space((LeafNode*)node) >= serialized_row_size(entry) + LEAF_NODE_SLOT_SIZE;
+}
+
+/*
+point `cursor` at `entry` in `index`, or where it would go, recording the internal pages on the way.
+the descent is latched like `btree_find_latched`: release the cursor's latches with `btree_unlatch`.
+*/
+static void index_find(Table* table, Index* index, const uint8_t* entry, LatchIntent intent, Cursor* cursor) {
+    Pager* pager = table->pager;
+    bool exclusive = intent != LATCH_READ;
+    cursor->table = table;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    cursor->read_ahead_end = 0;
+    cursor->read_ahead_window = 0;
+    cursor->num_latched = 0;
+    uint32_t page_num = index->root_page_num;
+    Node* node = latch_page(pager, page_num, exclusive);
+    cursor->latched[cursor->num_latched++] = page_num;
+    while (node->common_header.type == NODE_INDEX_INTERNAL) {
+        if (cursor->depth == BTREE_MAX_DEPTH) {
+            log("index deeper than %d levels", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        cursor->path[cursor->depth++] = page_num;
+        IndexInternalNode* internal_node = (IndexInternalNode*)node;
+        page_num = index_internal_node_child(internal_node, index_internal_node_find_child(internal_node, entry));
+        node = latch_page(pager, page_num, exclusive);
+        cursor->latched[cursor->num_latched++] = page_num;
+        if (index_node_is_safe(node, intent, entry)) btree_unlatch_ancestors(cursor);
+    }
+    cursor->page_num = page_num;
+    cursor->cell_num = index_leaf_node_find_cell((LeafNode*)node, entry);
+}
+
+/*
+the root just split: its page holds the lower half, up to `separator`, and `right_page_num` the rest.
+as in `create_new_root`, the lower half moves to a new page so the root keeps its page number.
+*/
+static void index_new_root(Table* table, Index* index, const uint8_t* separator, uint32_t right_page_num) {
+    Pager* pager = table->pager;
+    uint32_t left_page_num = get_unused_page_num(pager, index->root_page_num);
+    Node* root = get_page(pager, index->root_page_num);
+    Node* left = get_page(pager, left_page_num);
+    mark_page_dirty(pager, left_page_num);
+    memcpy(left, root, PAGE_SIZE);
+    left->common_header.is_root = false;
+    unpin_page(pager, left_page_num);
+
+    mark_page_dirty(pager, index->root_page_num);
+    IndexInternalNode* root_node = (IndexInternalNode*)root;
+    initialize_index_internal_node(root_node);
+    root_node->is_root = true;
+    uint8_t cell[sizeof(uint32_t) + ROW_MAX_SIZE];
+    memcpy(cell, &left_page_num, sizeof left_page_num);
+    uint32_t separator_size = serialized_row_size(separator);
+    memcpy(cell + sizeof(uint32_t), separator, separator_size);
+    index_internal_node_insert_cell(root_node, 0, cell, sizeof(uint32_t) + separator_size);
+    root_node->last_child = right_page_num;
+    unpin_page(pager, index->root_page_num);
+}
+
+/*
+a node `depth` levels below the root on `cursor`'s path split: `left_page_num` (where it was) now ends at `separator`,
+and `right_page_num` holds the rest. the left half gets a cell of its own in the parent, the right half takes over
+the split node's old one. a full parent splits in turn, in the middle by bytes, and pushes its middle entry up.
+*/
+static void index_internal_insert(
+    Table* table, Index* index, Cursor* cursor, uint32_t depth,
+    uint32_t left_page_num, const uint8_t* separator, uint32_t right_page_num
+) {
+    if (depth == 0) {
+        index_new_root(table, index, separator, right_page_num);
+        return;
+    }
+    Pager* pager = table->pager;
+    uint32_t page_num = cursor->path[depth - 1];
+    IndexInternalNode* node = (IndexInternalNode*)get_page(pager, page_num);
+    mark_page_dirty(pager, page_num);
+
+    uint8_t cell[sizeof(uint32_t) + ROW_MAX_SIZE];
+    memcpy(cell, &left_page_num, sizeof left_page_num);
+    uint32_t cell_size = sizeof(uint32_t) + serialized_row_size(separator);
+    memcpy(cell + sizeof(uint32_t), separator, cell_size - sizeof(uint32_t));
+    uint32_t child_idx = index_internal_node_find_child(node, separator);
+    if (index_internal_node_fits(node, cell_size)) {
+        index_internal_node_insert_cell(node, child_idx, cell, cell_size);
+        index_internal_node_set_child(node, child_idx + 1, right_page_num);
+        unpin_page(pager, page_num);
+        return;
+    }
+
+    // list every cell in order, the new one included, from a copy
+    IndexInternalNode* copy = malloc(PAGE_SIZE);
+    memcpy(copy, node, PAGE_SIZE);
+    index_internal_node_set_child(copy, child_idx, right_page_num);
+    uint32_t num_cells = copy->num_cells + 1;
+    const uint8_t* cells[PAGE_SIZE / (sizeof(uint32_t) + LEAF_NODE_MIN_CELL_SIZE) + 1];
+    uint32_t cell_sizes[PAGE_SIZE / (sizeof(uint32_t) + LEAF_NODE_MIN_CELL_SIZE) + 1];
+    uint32_t total_bytes = 0;
+    for (uint32_t i = 0, j = 0; i < num_cells; i++) {
+        cells[i] = i == child_idx ? cell : index_internal_node_cell(copy, j++);
+        cell_sizes[i] = index_internal_cell_size(cells[i]);
+        total_bytes += cell_sizes[i] + sizeof(uint16_t);
+    }
+    // the middle cell goes up: its child becomes the left half's last child, its entry the bound between the halves
+    uint32_t middle = 0;
+    uint32_t left_bytes = 0;
+    while (middle < num_cells - 2 && (middle == 0 || 2 * (left_bytes + cell_sizes[middle]) <= total_bytes)) {
+        left_bytes += cell_sizes[middle++] + sizeof(uint16_t);
+    }
+
+    initialize_index_internal_node(node);
+    node->is_root = copy->is_root;
+    for (uint32_t i = 0; i < middle; i++) index_internal_node_insert_cell(node, i, cells[i], cell_sizes[i]);
+    memcpy(&(node->last_child), cells[middle], sizeof node->last_child);
+
+    uint32_t new_page_num = get_unused_page_num(pager, page_num);
+    IndexInternalNode* new_node = (IndexInternalNode*)get_page(pager, new_page_num);
+    mark_page_dirty(pager, new_page_num);
+    initialize_index_internal_node(new_node);
+    for (uint32_t i = middle + 1; i < num_cells; i++) {
+        index_internal_node_insert_cell(new_node, new_node->num_cells, cells[i], cell_sizes[i]);
+    }
+    new_node->last_child = copy->last_child;
+    unpin_page(pager, new_page_num);
+    unpin_page(pager, page_num);
+
+    uint8_t middle_entry[ROW_MAX_SIZE];
+    memcpy(middle_entry, cells[middle] + sizeof(uint32_t), cell_sizes[middle] - sizeof(uint32_t));
+    free(copy);
+    index_internal_insert(table, index, cursor, depth - 1, page_num, middle_entry, new_page_num);
+}
+
+/* add `entry` to `index`, splitting the leaf it goes into if it's full */
+void index_insert(Table* table, Index* index, const uint8_t* entry, uint32_t entry_size) {
+    Pager* pager = table->pager;
+    Cursor cursor;
+    index_find(table, index, entry, LATCH_INSERT, &cursor);
+    LeafNode* node = (LeafNode*)get_page(pager, cursor.page_num);
+    mark_page_dirty(pager, cursor.page_num);
+    if (leaf_node_free_space(node) >= entry_size + LEAF_NODE_SLOT_SIZE) {
+        leaf_node_insert_cell(node, cursor.cell_num, entry, entry_size);
+        unpin_page(pager, cursor.page_num);
+        btree_unlatch(&cursor);
+        return;
+    }
+
+    // as in `leaf_node_split_and_insert`: list the cells in order from a copy, and spread them over two leaves by size
+    LeafNode* copy = malloc(PAGE_SIZE);
+    memcpy(copy, node, PAGE_SIZE);
+    const uint8_t* cells[LEAF_NODE_MAX_CELLS + 1];
+    uint32_t cell_sizes[LEAF_NODE_MAX_CELLS + 1];
+    uint32_t num_cells = 0;
+    for (uint32_t i = 0; i <= copy->num_cells; i++) {
+        if (i == cursor.cell_num) {
+            cells[num_cells] = entry;
+            cell_sizes[num_cells++] = entry_size;
+        }
+        if (i < copy->num_cells) {
+            cells[num_cells] = leaf_node_cell(copy, i);
+            cell_sizes[num_cells] = serialized_row_size(cells[num_cells]);
+            num_cells++;
+        }
+    }
+    uint32_t new_page_num = get_unused_page_num(pager, cursor.page_num);
+    LeafNode* new_node = (LeafNode*)get_page(pager, new_page_num);
+    mark_page_dirty(pager, new_page_num);
+    initialize_index_leaf_node(new_node);
+    new_node->next_leaf = node->next_leaf;
+    node->next_leaf = new_page_num;
+    leaf_node_clear(node);
+    leaf_nodes_distribute(node, new_node, cells, cell_sizes, num_cells);
+
+    uint8_t separator[ROW_MAX_SIZE];
+    const uint8_t* last = leaf_node_cell(node, node->num_cells - 1);
+    memcpy(separator, last, serialized_row_size(last));
+    unpin_page(pager, new_page_num);
+    unpin_page(pager, cursor.page_num);
+    free(copy);
+    index_internal_insert(table, index, &cursor, cursor.depth, cursor.page_num, separator, new_page_num);
+    btree_unlatch(&cursor);
+}
+
+/* take `entry` out of `index`. returns false if it isn't there */
+bool index_delete(Table* table, Index* index, const uint8_t* entry) {
+    Cursor cursor;
+    index_find(table, index, entry, LATCH_DELETE, &cursor);
+    LeafNode* node = (LeafNode*)get_page(table->pager, cursor.page_num);
+    bool found = cursor.cell_num < node->num_cells && index_entry_compare(leaf_node_cell(node, cursor.cell_num), entry) == 0;
+    if (found) {
+        mark_page_dirty(table->pager, cursor.page_num);
+        leaf_node_remove_cell(node, cursor.cell_num);
+    }
+    unpin_page(table->pager, cursor.page_num);
+    btree_unlatch(&cursor);
+    return found;
+}
+
+/* add the entries of a new row (`key` and its `body`) to every index of `table` */
+void index_insert_row(Table* table, uint32_t key, const uint8_t* body) {
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        uint8_t entry[ROW_MAX_SIZE];
+        uint32_t entry_size = index_entry(&(table->schema), &(table->indexes[i]), key, body, entry);
+        index_insert(table, &(table->indexes[i]), entry, entry_size);
+    }
+}
+
+/* the row `key` changed from `old_body` to `new_body`: move its entries in the indexes whose column changed */
+void index_update_row(Table* table, uint32_t key, const uint8_t* old_body, const uint8_t* new_body) {
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        Index* index = &(table->indexes[i]);
+        uint8_t old_entry[ROW_MAX_SIZE];
+        uint8_t new_entry[ROW_MAX_SIZE];
+        index_entry(&(table->schema), index, key, old_body, old_entry);
+        uint32_t new_entry_size = index_entry(&(table->schema), index, key, new_body, new_entry);
+        if (index_entry_compare(old_entry, new_entry) == 0) continue;
+        index_delete(table, index, old_entry);
+        index_insert(table, index, new_entry, new_entry_size);
+    }
+}
+
+void index_delete_row(Table* table, uint32_t key, const uint8_t* body) {
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        uint8_t entry[ROW_MAX_SIZE];
+        index_entry(&(table->schema), &(table->indexes[i]), key, body, entry);
+        index_delete(table, &(table->indexes[i]), entry);
+    }
+}
+
+/* the index of `table` on `column`, NULL if there's none */
+Index* table_find_index(Table* table, uint32_t column) {
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        if (table->indexes[i].column == column) return &(table->indexes[i]);
+    }
+    return NULL;
+}
+
+/*
+point `cursor` at the first entry of `index` whose value is >= `value`, or at the end of the index.
+entries with that value (or starting with it) follow along the leaf chain (see `index_next_leaf`).
+the cursor holds its leaf's latch, release it with `btree_unlatch`.
+*/
+void index_seek(Table* table, Index* index, const uint8_t* value, uint32_t value_length, Cursor* cursor) {
+    // the smallest entry with `value`: it has the smallest key
+    Row probe = {.id = 0, .size = value_length};
+    memcpy(probe.body, value, value_length);
+    uint8_t entry[ROW_MAX_SIZE];
+    serialize_row(&probe, entry);
+    index_find(table, index, entry, LATCH_READ, cursor);
+}
+
+/*
+move a cursor from `index_seek` on to the next leaf, or the end of the index.
+unlike a table's (`btree_next_leaf`), an index's pages are never freed while it's in use - nodes don't merge - so the
+next leaf can be latched after this one is let go. a split in between only moves entries this cursor has already seen
+(to a leaf it skips), along with the entry being inserted.
+*/
+void index_next_leaf(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    LeafNode* node = (LeafNode*)get_page(pager, cursor->page_num);
+    uint32_t next_page_num = node->next_leaf;
+    unpin_page(pager, cursor->page_num);
+    btree_unlatch(cursor);
+    if (next_page_num == 0) {
+        cursor->end_of_table = true;
+        return;
+    }
+    btree_read_ahead(cursor, next_page_num);
+    latch_page(pager, next_page_num, false);
+    cursor->latched[cursor->num_latched++] = next_page_num;
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+}
+
+static int compare_index_entries(const void* a, const void* b) {
+    return index_entry_compare(*(const uint8_t* const*)a, *(const uint8_t* const*)b);
+}
+
+/* (re)build `index` from every row of `table`, into a fresh tree. the old one (if any) is freed */
+void index_build(Table* table, Index* index, bool free_old) {
+    Pager* pager = table->pager;
+    if (free_old) btree_free_pages(pager, index->root_page_num);
+    index->root_page_num = get_unused_page_num(pager, table->root_page_num);
+    LeafNode* root = (LeafNode*)get_page(pager, index->root_page_num);
+    initialize_index_leaf_node(root);
+    root->is_root = true;
+    mark_page_dirty(pager, index->root_page_num);
+    unpin_page(pager, index->root_page_num);
+
+    RowBatch entries = {0};
+    uint32_t page_num = table->root_page_num;
+    Node* node = get_page(pager, page_num);
+    while (node->common_header.type == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child((InternalNode*)node, 0);
+        unpin_page(pager, page_num);
+        page_num = child_page_num;
+        node = get_page(pager, page_num);
+    }
+    unpin_page(pager, page_num);
+    while (page_num) {
+        LeafNode* leaf = (LeafNode*)get_page(pager, page_num);
+        for (uint32_t i = 0; i < leaf->num_cells; i++) {
+            RowView row;
+            row_view(leaf_node_cell(leaf, i), ROW_MAX_SIZE, &row);
+            uint8_t entry[ROW_MAX_SIZE];
+            row_batch_append_cell(&entries, entry, index_entry(&(table->schema), index, row.id, row.body, entry));
+        }
+        uint32_t next_page_num = leaf->next_leaf;
+        unpin_page(pager, page_num);
+        page_num = next_page_num;
+    }
+
+    // in order, every entry goes to the last leaf
+    const uint8_t** sorted = malloc((entries.num_rows ? entries.num_rows : 1) * sizeof *sorted);
+    for (uint32_t i = 0; i < entries.num_rows; i++) sorted[i] = row_batch_cell(&entries, i);
+    qsort(sorted, entries.num_rows, sizeof *sorted, compare_index_entries);
+    for (uint32_t i = 0; i < entries.num_rows; i++) {
+        index_insert(table, index, sorted[i], serialized_row_size(sorted[i]));
+    }
+    free(sorted);
+    row_batch_free(&entries);
+}
@@ -0,0 +1,383 @@
+#pragma once
+
+
+#include "common.h"
+#include "pager.h"
+#include "btree.h"
+#include "schema.h"
+
+
+/*
+bulk loading (`.load <file>`): instead of descending from the root and splitting for every row,
+sort the rows and build the tree bottom-up in one pass.
+1. sort: the file is read in chunks of `LOAD_SORT_BUFFER_ROWS` rows, encoded per the table's schema, each chunk is
+   sorted and spilled to a temporary file (as `[size: u32][serialized row]`), except the last one which stays in memory.
+   rows already in the table are one more (already sorted) run.
+2. merge the runs with a min-heap and pack the rows into fresh leaves, left to right, up to the fill factor.
+3. build each internal level from the one below it, spreading children evenly so no node ends up nearly empty.
+the old tree is only freed once the new one is complete, and the header only points at the new root after the
+checkpoint that follows, so a crash mid-load leaves the table as it was.
+*/
+
+static int compare_sort_keys(const void* a, const void* b) {
+    uint64_t key_a = *(const uint64_t*)a;
+    uint64_t key_b = *(const uint64_t*)b;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+static void load_run_advance(LoadRun* run) {
+    if (run->file) {
+        uint32_t size;
+        run->exhausted = fread(&size, sizeof size, 1, run->file) != 1
+            || size > ROW_MAX_SIZE
+            || fread(run->head_buffer, size, 1, run->file) != 1;
+        run->head = run->head_buffer;
+        run->head_size = size;
+    } else if (run->position == run->rows->num_rows) {
+        run->exhausted = true;
+    } else {
+        run->head = row_batch_cell(run->rows, run->order[run->position++] & UINT32_MAX);
+        run->head_size = serialized_row_size(run->head);
+    }
+    if (!run->exhausted) run->head_key = serialized_row_key(run->head);
+}
+
+/* NOTE: moves the runs, so run heads (which may point into their run) are only read once every run is added */
+static LoadRun* load_add_run(LoadRun** runs, uint32_t* num_runs) {
+    *runs = realloc(*runs, (*num_runs + 1) * sizeof **runs);
+    LoadRun* run = &((*runs)[(*num_runs)++]);
+    memset(run, 0, sizeof *run);
+    return run;
+}
+
+static FILE* load_temporary_file(void) {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        print_error("load: failed to create a temporary file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+static void load_spill_row(FILE* file, const uint8_t* cell, uint32_t size) {
+    fwrite(&size, sizeof size, 1, file);
+    fwrite(cell, size, 1, file);
+}
+
+static void load_finish_spill(FILE* file) {
+    if (fflush(file) != 0) {
+        print_error("load: failed to write a sorted run: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    rewind(file);
+}
+
+/* sort the rows in `rows` into a run. spilled runs are written out, so `rows` can be reused. */
+static void load_sort_chunk(LoadRun** runs, uint32_t* num_runs, RowBatch* rows, uint64_t* order, bool spill) {
+    // sort keys instead of whole rows; the index in the low bits keeps equal keys in input order
+    for (uint32_t i = 0; i < rows->num_rows; i++) {
+        order[i] = (uint64_t)serialized_row_key(row_batch_cell(rows, i)) << 32 | i;
+    }
+    qsort(order, rows->num_rows, sizeof *order, compare_sort_keys);
+
+    LoadRun* run = load_add_run(runs, num_runs);
+    if (!spill) {
+        run->rows = rows;
+        run->order = order;
+        return;
+    }
+    run->file = load_temporary_file();
+    for (uint32_t i = 0; i < rows->num_rows; i++) {
+        const uint8_t* cell = row_batch_cell(rows, order[i] & UINT32_MAX);
+        load_spill_row(run->file, cell, serialized_row_size(cell));
+    }
+    load_finish_spill(run->file);
+}
+
+/*
+rows already in the table, in key order, as a run of their own.
+`legacy_rows`: the leaves still hold rows in the layout before format version 4 (see `deserialize_legacy_row`)
+*/
+static void load_spill_table(Table* table, LoadRun** runs, uint32_t* num_runs, bool legacy_rows) {
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    Node* node = get_page(pager, page_num);
+    // a tree being upgraded may still have legacy internal nodes
+    while (node->common_header.type != NODE_LEAF) {
+        uint32_t child_page_num = node_child(node, 0);
+        unpin_page(pager, page_num);
+        page_num = child_page_num;
+        node = get_page(pager, page_num);
+    }
+
+    LoadRun* run = load_add_run(runs, num_runs);
+    run->file = load_temporary_file();
+    Row row;
+    uint8_t cell[ROW_MAX_SIZE];
+    while (true) {
+        LeafNode* leaf = (LeafNode*)node;
+        for (uint32_t i = 0; i < leaf->num_cells; i++) {
+            uint16_t offset = leaf->slots[i];
+            if (legacy_rows) {
+                deserialize_legacy_row((uint8_t*)leaf + offset, PAGE_SIZE - offset, &row);
+                load_spill_row(run->file, cell, serialize_row(&row, cell));
+            } else {
+                load_spill_row(run->file, leaf_node_cell(leaf, i), serialized_row_size(leaf_node_cell(leaf, i)));
+            }
+        }
+        uint32_t next_page_num = leaf->next_leaf;
+        unpin_page(pager, page_num);
+        if (!next_page_num) break;
+        page_num = next_page_num;
+        node = get_page(pager, page_num);
+    }
+    load_finish_spill(run->file);
+}
+
+/* parse `<id> <column> ...`, one field per column of `schema` - the same fields `insert` takes */
+static bool load_parse_line(const Schema* schema, char* line, Row* row) {
+    char* id_string = strtok(line, " \t\r\n");
+    char* values[TABLE_MAX_COLUMNS];
+    for (uint32_t i = 1; i < schema->num_columns; i++) {
+        values[i - 1] = strtok(NULL, " \t\r\n");
+        if (values[i - 1] == NULL) return false;
+    }
+    uint32_t id;
+    if (strtok(NULL, " \t\r\n") != NULL || !parse_u32(id_string, &id)) return false;
+    return row_encode(schema, id, values, row) == PREPARE_SUCCESS;
+}
+
+/* phase 1. on a malformed line, prints an error and returns false (before the table is touched). */
+static bool load_sort_input(const Schema* schema, FILE* input, LoadRun** runs, uint32_t* num_runs, RowBatch* rows, uint64_t* order) {
+    char* line = NULL;
+    size_t line_capacity = 0;
+    uint32_t line_num = 0;
+    Row row;
+    while (getline(&line, &line_capacity, input) != -1) {
+        line_num++;
+        if (strspn(line, " \t\r\n") == strlen(line)) continue;
+        if (rows->num_rows == LOAD_SORT_BUFFER_ROWS) {
+            load_sort_chunk(runs, num_runs, rows, order, true);
+            row_batch_clear(rows);
+        }
+        if (!load_parse_line(schema, line, &row)) {
+            print_error("load: malformed row on line %d (expected `<id>` and %d more columns)", line_num, schema->num_columns - 1);
+            free(line);
+            return false;
+        }
+        row_batch_append(rows, &row);
+    }
+    free(line);
+    load_sort_chunk(runs, num_runs, rows, order, false);
+    return true;
+}
+
+/* min-heap of run indices by head key. ties go to the earlier run, so the first copy of a key is the one kept. */
+static bool load_run_precedes(LoadRun* runs, uint32_t a, uint32_t b) {
+    if (runs[a].head_key != runs[b].head_key) return runs[a].head_key < runs[b].head_key;
+    return a < b;
+}
+
+static void load_heap_sift_down(LoadRun* runs, uint32_t* heap, uint32_t heap_size, uint32_t i) {
+    while (true) {
+        uint32_t smallest = i;
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        if (left < heap_size && load_run_precedes(runs, heap[left], heap[smallest])) smallest = left;
+        if (right < heap_size && load_run_precedes(runs, heap[right], heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        uint32_t swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+static void load_push_ref(LoadNodeRef** level, uint32_t* level_length, uint32_t* level_capacity, uint32_t page_num, uint32_t max_key) {
+    if (*level_length == *level_capacity) {
+        *level_capacity = *level_capacity ? *level_capacity * 2 : 64;
+        *level = realloc(*level, *level_capacity * sizeof **level);
+    }
+    (*level)[*level_length].page_num = page_num;
+    (*level)[*level_length].max_key = max_key;
+    (*level_length)++;
+}
+
+/*
+phase 2: merge every run into a chain of leaves, each filled up to `bytes_per_leaf` (of `LEAF_NODE_SPACE_FOR_CELLS`).
+returns the leaves, left to right, for the level above.
+*/
+static LoadNodeRef* load_build_leaves(
+    Pager* pager, LoadRun* runs, uint32_t num_runs, uint32_t bytes_per_leaf, uint32_t* num_leaves, LoadStats* stats
+) {
+    uint32_t* heap = malloc((num_runs ? num_runs : 1) * sizeof *heap);
+    uint32_t heap_size = 0;
+    for (uint32_t i = 0; i < num_runs; i++) {
+        load_run_advance(&(runs[i]));
+        if (!runs[i].exhausted) heap[heap_size++] = i;
+    }
+    for (uint32_t i = heap_size / 2; i > 0; i--) load_heap_sift_down(runs, heap, heap_size, i - 1);
+
+    LoadNodeRef* leaves = NULL;
+    uint32_t leaves_capacity = 0;
+    *num_leaves = 0;
+    LeafNode* leaf = NULL;
+    uint32_t leaf_page_num = 0;
+    while (heap_size > 0) {
+        LoadRun* run = &(runs[heap[0]]);
+        if (leaf && leaf->num_cells && leaf_node_key(leaf, leaf->num_cells - 1) == run->head_key) {
+            stats->num_duplicates++;
+        } else {
+            uint32_t cell_size = run->head_size;
+            // a leaf always takes its first row, however small the fill factor
+            if (leaf == NULL || (leaf->num_cells && leaf_node_used_bytes(leaf) + cell_size + LEAF_NODE_SLOT_SIZE > bytes_per_leaf)) {
+                // consecutive leaves get consecutive pages (unless there are free pages to fill), so scans read sequentially
+                uint32_t new_page_num = get_unused_page_num(pager, leaf_page_num);
+                LeafNode* new_leaf = (LeafNode*)get_page(pager, new_page_num);
+                mark_page_dirty(pager, new_page_num);
+                initialize_leaf_node(new_leaf);
+                if (leaf) {
+                    leaf->next_leaf = new_page_num;
+                    load_push_ref(&leaves, num_leaves, &leaves_capacity, leaf_page_num, leaf_node_key(leaf, leaf->num_cells - 1));
+                    unpin_page(pager, leaf_page_num);
+                }
+                leaf = new_leaf;
+                leaf_page_num = new_page_num;
+            }
+            leaf_node_insert_cell(leaf, leaf->num_cells, run->head, cell_size);
+            stats->num_rows++;
+        }
+        load_run_advance(run);
+        if (run->exhausted) heap[0] = heap[--heap_size];
+        load_heap_sift_down(runs, heap, heap_size, 0);
+    }
+    free(heap);
+
+    if (leaf == NULL) {
+        // nothing to load into an empty table: still needs a root
+        leaf_page_num = get_unused_page_num(pager, 0);
+        leaf = (LeafNode*)get_page(pager, leaf_page_num);
+        mark_page_dirty(pager, leaf_page_num);
+        initialize_leaf_node(leaf);
+        load_push_ref(&leaves, num_leaves, &leaves_capacity, leaf_page_num, 0);
+        unpin_page(pager, leaf_page_num);
+        return leaves;
+    }
+
+    // don't leave a nearly empty leaf at the end: even it out with the one before
+    if (*num_leaves > 0 && leaf_node_used_bytes(leaf) < bytes_per_leaf / 2) {
+        LoadNodeRef* previous_ref = &(leaves[*num_leaves - 1]);
+        LeafNode* previous = (LeafNode*)get_page(pager, previous_ref->page_num);
+        mark_page_dirty(pager, previous_ref->page_num);
+        leaf_nodes_redistribute(previous, leaf);
+        previous_ref->max_key = leaf_node_key(previous, previous->num_cells - 1);
+        unpin_page(pager, previous_ref->page_num);
+    }
+    load_push_ref(&leaves, num_leaves, &leaves_capacity, leaf_page_num, leaf_node_key(leaf, leaf->num_cells - 1));
+    unpin_page(pager, leaf_page_num);
+    return leaves;
+}
+
+/* phase 3: replace `level` with its parents, in place. children are spread evenly, at most `children_per_node` each. */
+static void load_build_internal_level(Pager* pager, LoadNodeRef* level, uint32_t* level_length, uint32_t children_per_node) {
+    uint32_t num_children = *level_length;
+    uint32_t num_nodes = (num_children + children_per_node - 1) / children_per_node;
+    uint32_t page_num = level[0].page_num;
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        uint32_t first = (uint64_t)num_children * i / num_nodes;
+        uint32_t end = (uint64_t)num_children * (i + 1) / num_nodes;
+        page_num = get_unused_page_num(pager, page_num);
+        InternalNode* node = (InternalNode*)get_page(pager, page_num);
+        mark_page_dirty(pager, page_num);
+        initialize_internal_node(node);
+        for (uint32_t child = first; child < end; child++) {
+            if (child + 1 < end) {
+                node->num_keys++;
+                *internal_node_child(node, node->num_keys - 1) = level[child].page_num;
+                *internal_node_key(node, node->num_keys - 1) = level[child].max_key;
+            } else {
+                node->last_child = level[child].page_num;
+                node->max_key = level[child].max_key;
+            }
+        }
+        unpin_page(pager, page_num);
+        // `i <= first`, so this never overwrites a child that hasn't been read yet
+        level[i].page_num = page_num;
+        level[i].max_key = level[end - 1].max_key;
+    }
+    *level_length = num_nodes;
+}
+
+/* phases 2 and 3: build a tree out of `runs` and swap it in for the table's */
+static void load_build_tree(Table* table, LoadRun* runs, uint32_t num_runs, uint32_t fill_factor, LoadStats* stats) {
+    Pager* pager = table->pager;
+    uint32_t bytes_per_leaf = LEAF_NODE_SPACE_FOR_CELLS * fill_factor / 100;
+    uint32_t children_per_node = INTERNAL_NODE_MAX_KEYS * fill_factor / 100 + 1;
+    if (children_per_node < 2) children_per_node = 2;
+
+    uint32_t level_length;
+    LoadNodeRef* level = load_build_leaves(pager, runs, num_runs, bytes_per_leaf, &level_length, stats);
+    stats->num_leaves = level_length;
+    while (level_length > 1) {
+        load_build_internal_level(pager, level, &level_length, children_per_node);
+    }
+
+    uint32_t old_root_page_num = table->root_page_num;
+    table->root_page_num = level[0].page_num;
+    Node* root = get_page(pager, table->root_page_num);
+    root->common_header.is_root = true;
+    mark_page_dirty(pager, table->root_page_num);
+    unpin_page(pager, table->root_page_num);
+    btree_free_pages(pager, old_root_page_num);
+    free(level);
+}
+
+static void load_close_runs(LoadRun* runs, uint32_t num_runs) {
+    for (uint32_t i = 0; i < num_runs; i++) {
+        if (runs[i].file) fclose(runs[i].file);
+    }
+    free(runs);
+}
+
+/*
+load every row of `filename` into `table`, keeping the existing row on duplicate keys.
+nodes are filled to `fill_factor` percent - below 100 leaves room for later inserts before nodes split.
+returns false (having changed nothing) if the file can't be read or has a malformed line.
+*/
+bool table_load(Table* table, const char* filename, uint32_t fill_factor, LoadStats* stats) {
+    memset(stats, 0, sizeof *stats);
+    FILE* input = fopen(filename, "r");
+    if (input == NULL) {
+        print_error("load: could not open %s", filename);
+        return false;
+    }
+
+    LoadRun* runs = NULL;
+    uint32_t num_runs = 0;
+    RowBatch rows = {0};
+    uint64_t* order = malloc(LOAD_SORT_BUFFER_ROWS * sizeof *order);
+    // the table's own rows come first, so they win over duplicates from the file
+    load_spill_table(table, &runs, &num_runs, false);
+    bool parsed = load_sort_input(&(table->schema), input, &runs, &num_runs, &rows, order);
+    fclose(input);
+    if (parsed) load_build_tree(table, runs, num_runs, fill_factor, stats);
+
+    load_close_runs(runs, num_runs);
+    free(order);
+    row_batch_free(&rows);
+    return parsed;
+}
+
+/*
+format version 4 added the body size to every cell, so cells of version 3 (`legacy`) no longer fit where they were,
+and 6 took the end of every page for its checksum, where full nodes kept cells.
+rebuild the table from its rows instead (they're already sorted), the way `.load` would.
+*/
+void table_upgrade_rows(Table* table, bool legacy) {
+    LoadRun* runs = NULL;
+    uint32_t num_runs = 0;
+    LoadStats stats = {0};
+    load_spill_table(table, &runs, &num_runs, legacy);
+    load_build_tree(table, runs, num_runs, 100, &stats);
+    load_close_runs(runs, num_runs);
+}
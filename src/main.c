@@ -1,5 +1,14 @@
 #include "common.h"
+#include "pager.h"
 #include "btree.h"
+#include "wal.h"
+#include "schema.h"
+#include "catalog.h"
+#include "index.h"
+#include "load.h"
+#include "output.h"
+#include "scan.h"
+#include "check.h"
 
 
 typedef enum {
@@ -7,28 +16,64 @@ typedef enum {
     META_COMMAND_UNRECOGNIZED_COMMAND,
 } MetaCommandResult;
 
-typedef enum {
-    PREPARE_SUCCESS,
-    PREPARE_UNRECOGNIZED_STATEMENT,
-    PREPARE_SYNTAX_ERROR,
-    PREPARE_STRING_TOO_LONG,
-} PrepareResult;
-
 typedef enum {
     EXECUTE_TABLE_FULL,
     EXECUTE_SUCCESS,
     EXECUTE_FAILURE,
     EXECUTE_DUPLICATE_KEY,
+    EXECUTE_KEY_NOT_FOUND,
+    EXECUTE_BATCH_OPEN,
+    EXECUTE_NO_BATCH,
+    EXECUTE_TABLE_EXISTS,
+    EXECUTE_NO_SUCH_TABLE,
+    EXECUTE_CATALOG_FULL,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_NO_SUCH_INDEX,
 } ExecuteResult;
 
 typedef enum {
     STATEMENT_INSERT,
-    STATEMENT_SELECT
+    STATEMENT_SELECT,
+    STATEMENT_UPDATE,
+    STATEMENT_DELETE,
+    STATEMENT_INSERT_MANY,
+    STATEMENT_BEGIN,
+    STATEMENT_COMMIT,
+    STATEMENT_ROLLBACK,
+    STATEMENT_CREATE_TABLE,
+    STATEMENT_DROP_TABLE,
+    STATEMENT_USE,
+    STATEMENT_CREATE_INDEX,
+    STATEMENT_DROP_INDEX,
 } StatementType;
 
+/* `select count(*)`, `min(<column>)`, `max(<column>)` or `sum(<column>)` of an int column, rather than the rows */
+typedef enum {
+    AGGREGATE_NONE,
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_SUM,
+} AggregateFunction;
+
 typedef struct {
     StatementType type;
-    Row row_to_insert;
+    Row row_to_insert; // also the new values for `update`
+    // `select` returns the rows with `min_id <= id <= max_id`, all of them unless narrowed by `where`.
+    // `update` and `delete` take a single id (`min_id == max_id`)
+    uint32_t min_id;
+    uint32_t max_id;
+    /* `select where <column> = <value>` (or `like <value>%`, if `prefix`) for a column other than the key, which is 0 otherwise.
+    `value` is encoded as indexes store it (see `index_value`). also the column of `create index` and `drop index` */
+    uint32_t column;
+    bool prefix;
+    uint8_t value[INDEX_VALUE_MAX_SIZE];
+    uint32_t value_length;
+    AggregateFunction aggregate;
+    uint32_t aggregate_column; // the column `min`, `max` and `sum` are of
+    RowBatch rows; // the rows of a multi-row `insert`
+    char table_name[TABLE_NAME_MAX_SIZE + 1]; // `create table`, `drop table` and `use`
+    Schema schema; // `create table`
 } Statement;
 
 typedef struct {
@@ -38,131 +83,432 @@ typedef struct {
 } InputBuffer;
 
 
-Pager* pager_open(const char* filename) {
-    int fd = open(filename,
-            O_RDWR | O_CREAT,
-            S_IWUSR | S_IRUSR
-    );
-    if (fd == -1) {
-        print_error("file could not be opened: %s", filename);
-        exit(EXIT_FAILURE);
+/*
+points the caller's `cursor` at the cell with matching key,
+or if key wasn't found, the cell we could insert into.
+*/
+void table_find(Table* table, uint32_t key, Cursor* cursor) {
+    btree_find(table, key, cursor);
+}
+
+/*
+points the caller's `cursor` at the first row with a key >= `key`, or at the end of the table if there is none.
+the cursor is read-latched (see `btree_find_latched`): move it along with `btree_next_leaf`, and release it with `btree_unlatch`.
+*/
+void table_seek(Table* table, uint32_t key, Cursor* cursor) {
+    btree_find_latched(table, key, LATCH_READ, 0, cursor);
+    LeafNode* node = (LeafNode*)get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = node->num_cells;
+    unpin_page(table->pager, cursor->page_num);
+    // `key` is past this leaf's last row (only in the last leaf), the next leaf starts with the row after it
+    if (cursor->cell_num >= num_cells) btree_next_leaf(cursor);
+}
+
+void table_start(Table* table, Cursor* cursor) {
+    table_seek(table, 0, cursor);
+}
+
+/*
+points `cursor` at the row with `key`, latched for `intent` (`cell_size` being the new row's for an update).
+returns false if there is none. either way, release the cursor with `btree_unlatch`.
+*/
+static bool table_find_row(Table* table, uint32_t key, LatchIntent intent, uint32_t cell_size, Cursor* cursor) {
+    btree_find_latched(table, key, intent, cell_size, cursor);
+    LeafNode* node = (LeafNode*)get_page(table->pager, cursor->page_num);
+    bool found = cursor->cell_num < node->num_cells && leaf_node_key(node, cursor->cell_num) == key;
+    unpin_page(table->pager, cursor->page_num);
+    return found;
+}
+
+/* copy the row under `cursor` out, e.g. before it's replaced or deleted */
+static void table_read_row(Table* table, Cursor* cursor, Row* row) {
+    LeafNode* node = (LeafNode*)get_page(table->pager, cursor->page_num);
+    deserialize_row(leaf_node_cell(node, cursor->cell_num), ROW_MAX_SIZE, row);
+    unpin_page(table->pager, cursor->page_num);
+}
+
+/*
+insert `row` unless its key already exists, and add it to the table's indexes. does not log it.
+like every write below, it lets go of the table's latches before it goes on to the indexes,
+so it never holds both - a reader going through an index holds both, the other way around.
+and like every write below, it's published once the indexes are done (see `snapshot_publish`).
+*/
+ExecuteResult table_insert(Table* table, Row* row) {
+    Cursor cursor;
+    if (table_find_row(table, row->id, LATCH_INSERT, row_serialized_size(row), &cursor)) {
+        btree_unlatch(&cursor);
+        return EXECUTE_DUPLICATE_KEY;
     }
+    leaf_node_insert(&cursor, row->id, row);
+    btree_unlatch(&cursor);
+    index_insert_row(table, row->id, row->body);
+    snapshot_publish(table->pager);
 
-    off_t file_length = lseek(fd, 0, SEEK_END);
-    Pager* pager = malloc(sizeof *pager);
-    pager->file_descriptor = fd;
-    pager->file_length = file_length;
-    pager->num_pages = file_length / PAGE_SIZE;
-    if (file_length % PAGE_SIZE != 0) {
-        print_error("database file is not a whole number of pages - corrupt file");
-        exit(EXIT_FAILURE);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+insert `rows` unless their keys already exist (or repeat within `rows`: the first one wins). does not log them.
+rather than descending once per row, the rows are sorted and each leaf they land in takes all of its rows in one pass
+(see `leaf_node_insert_many`). with indexes, rows whose key exists are dropped up front, so every row left goes into
+the indexes too. returns the number of rows inserted.
+a batch may be larger than the pool, which can't evict dirty pages with a log open (see `Pager.no_steal`): the rows
+go in a group at a time, each dirtying a bounded number of pages and leaving the trees whole, and the pool is
+checkpointed between groups once half of it is dirty. the file then holds some of the batch, which the log holds whole
+(synced first, for `--sync group`): replaying it skips the rows already in.
+*/
+uint32_t table_insert_batch(Table* table, RowBatch* rows) {
+    uint32_t num_rows = rows->num_rows;
+    // sort on (id, position), like `.load` does, so repeats keep their order
+    uint64_t* order = malloc(num_rows * sizeof *order);
+    for (uint32_t i = 0; i < num_rows; i++) {
+        order[i] = (uint64_t)serialized_row_key(row_batch_cell(rows, i)) << 32 | i;
     }
+    qsort(order, num_rows, sizeof *order, compare_sort_keys);
+    const uint8_t** sorted = malloc(num_rows * sizeof *sorted);
+    uint32_t num_sorted = 0;
+    for (uint32_t i = 0; i < num_rows; i++) {
+        if (num_sorted && order[i] >> 32 == order[i - 1] >> 32) continue;
+        if (table->num_indexes) {
+            Cursor cursor;
+            bool found = table_find_row(table, order[i] >> 32, LATCH_READ, 0, &cursor);
+            btree_unlatch(&cursor);
+            if (found) continue;
+        }
+        sorted[num_sorted++] = row_batch_cell(rows, (uint32_t)order[i]);
+    }
+    free(order);
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL; // initially, no pages are loaded
+    Pager* pager = table->pager;
+    // pages a group may dirty: a leaf per run of rows, the leaves they spill into, and an index leaf per row and index.
+    // a mapped file has no pool to fill, the whole batch is one group
+    uint32_t group_pages = pager->map ? UINT32_MAX : pager->num_frames / BATCH_GROUP_POOL_FRACTION;
+    uint32_t num_inserted = 0;
+    for (uint32_t group_start = 0; group_start < num_sorted;) {
+        uint32_t i = group_start;
+        uint32_t num_group_pages = 0;
+        while (i < num_sorted && num_group_pages < group_pages) {
+            Cursor cursor;
+            btree_find_latched(table, serialized_row_key(sorted[i]), LATCH_WRITE, 0, &cursor);
+            LeafNode* node = (LeafNode*)get_page(pager, cursor.page_num);
+            // the last leaf takes every key past it, any other one the keys up to its max - as many as the group has room for
+            uint32_t max_key = node->next_leaf && node->num_cells ? leaf_node_key(node, node->num_cells - 1) : UINT32_MAX;
+            uint32_t num_leaf_rows = 0;
+            uint32_t num_leaf_bytes = 0;
+            num_group_pages++;
+            do {
+                num_leaf_bytes += serialized_row_size(sorted[i + num_leaf_rows]) + LEAF_NODE_SLOT_SIZE;
+                num_group_pages += table->num_indexes;
+                num_leaf_rows++;
+            } while (i + num_leaf_rows < num_sorted && serialized_row_key(sorted[i + num_leaf_rows]) <= max_key
+                && num_group_pages + num_leaf_bytes / LEAF_NODE_SPACE_FOR_CELLS < group_pages);
+            num_group_pages += num_leaf_bytes / LEAF_NODE_SPACE_FOR_CELLS;
+            unpin_page(pager, cursor.page_num);
+            num_inserted += leaf_node_insert_many(&cursor, &(sorted[i]), num_leaf_rows);
+            btree_unlatch(&cursor);
+            i += num_leaf_rows;
+        }
+        for (uint32_t j = group_start; j < i && table->num_indexes; j++) {
+            RowView row;
+            row_view(sorted[j], ROW_MAX_SIZE, &row);
+            index_insert_row(table, row.id, row.body);
+        }
+        group_start = i;
+        if (group_start < num_sorted && pager->no_steal && pager_should_checkpoint(pager)) {
+            if (table->wal) wal_sync(table->wal);
+            pager_checkpoint(pager);
+        }
     }
-    return pager;
+    snapshot_publish(pager);
+    free(sorted);
+    return num_inserted;
 }
 
-void pager_flush(Pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        // program may follow this branch if flushing a page that hasn't been loaded to cache yet, but is stored no disk
-        // (this happens because we measure how many pages to flush based on filesize, not )
-        print_error("tried to flush null page: %d", page_num);
-        // exit(EXIT_FAILURE);
+/* replace the row with `row->id`, and its entries in the table's indexes. does not log it. */
+ExecuteResult table_update(Table* table, Row* row) {
+    Cursor cursor;
+    if (!table_find_row(table, row->id, LATCH_UPDATE, row_serialized_size(row), &cursor)) {
+        btree_unlatch(&cursor);
+        return EXECUTE_KEY_NOT_FOUND;
     }
+    Row old_row;
+    if (table->num_indexes) table_read_row(table, &cursor, &old_row);
+    leaf_node_update(&cursor, row);
+    btree_unlatch(&cursor);
+    if (table->num_indexes) index_update_row(table, row->id, old_row.body, row->body);
+    snapshot_publish(table->pager);
+    return EXECUTE_SUCCESS;
+}
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        print_error("error seeking; %d", errno);
-        exit(EXIT_FAILURE);
+/* delete the row with `key`, and its entries in the table's indexes. does not log it. */
+ExecuteResult table_delete(Table* table, uint32_t key) {
+    Cursor cursor;
+    if (!table_find_row(table, key, LATCH_DELETE, 0, &cursor)) {
+        btree_unlatch(&cursor);
+        return EXECUTE_KEY_NOT_FOUND;
     }
+    Row old_row;
+    if (table->num_indexes) table_read_row(table, &cursor, &old_row);
+    leaf_node_delete(&cursor);
+    btree_unlatch(&cursor);
+    if (table->num_indexes) index_delete_row(table, key, old_row.body);
+    snapshot_publish(table->pager);
+    return EXECUTE_SUCCESS;
+}
 
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1) {
-        print_error("failed writing to file: %d", errno);
-        exit(EXIT_FAILURE);
+/*
+write all dirty pages (and the catalog, if it changed), and since the database file now contains every logged statement,
+drop the log. returns the number of pages written.
+*/
+uint32_t db_checkpoint(Database* db) {
+    catalog_write(db);
+    uint32_t pages_written = pager_checkpoint(db->pager);
+    if (db->wal) wal_reset(db->wal);
+    return pages_written;
+}
+
+/*
+compact every table and index into a copy of the file, each tree in key order and no free pages (see `btree_vacuum`),
+then rename the copy over the file: a crash leaves either the old file or the new one, and at most a stray copy.
+starts from a checkpoint, so both hold every logged statement and the log stays empty. returns the number of pages released.
+*/
+uint32_t db_vacuum(Database* db) {
+    db_checkpoint(db);
+    // every table's tree, then its indexes'
+    uint32_t num_roots = 0;
+    for (uint32_t i = 0; i < db->num_tables; i++) num_roots += 1 + db->tables[i]->num_indexes;
+    uint32_t* root_page_nums = malloc((num_roots ? num_roots : 1) * sizeof *root_page_nums);
+    num_roots = 0;
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        root_page_nums[num_roots++] = db->tables[i]->root_page_num;
+        for (uint32_t j = 0; j < db->tables[i]->num_indexes; j++) {
+            root_page_nums[num_roots++] = db->tables[i]->indexes[j].root_page_num;
+        }
     }
+    int fd = pager_open_copy(db->pager);
+    uint32_t num_pages = btree_vacuum(db->pager, root_page_nums, num_roots, fd);
+    num_roots = 0;
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        db->tables[i]->root_page_num = root_page_nums[num_roots++];
+        for (uint32_t j = 0; j < db->tables[i]->num_indexes; j++) {
+            db->tables[i]->indexes[j].root_page_num = root_page_nums[num_roots++];
+        }
+    }
+    free(root_page_nums);
+
+    // page 0 of the copy: the catalog with the new roots, the pager adds its header
+    uint32_t old_num_pages = db->pager->num_pages;
+    Node* page = calloc(1, PAGE_SIZE);
+    catalog_serialize(db, (uint8_t*)page + CATALOG_OFFSET);
+    pager_replace_file(db->pager, fd, num_pages, page);
+    free(page);
+    return old_num_pages - num_pages;
 }
 
 /*
-returns a cursor pointing to a cell with matching key,
-or if key wasn't found, the cell we could insert into.
+replay statements logged after the last checkpoint of a session that didn't exit cleanly.
+`legacy_rows`: the log was written before format version 4 (see `wal_next_record`).
 */
-Cursor* table_find(Table* table, uint32_t key) {
-    uint32_t root_page_num = table->root_page_num;
-    Node* root_node = get_page(table->pager, root_page_num);
-    if (root_node->common_header.type == NODE_INTERNAL) {
-        return internal_node_find_leaf(table, root_page_num, key);
-    } else {
-        return leaf_node_find(table, root_page_num, key);
+static void db_recover(Database* db, Wal* wal, bool legacy_rows) {
+    uint32_t log_length;
+    uint8_t* log = wal_read_all(wal, &log_length);
+    if (log_length == 0) {
+        free(log);
+        return;
     }
+
+    uint32_t offset = 0;
+    uint32_t num_recovered = 0;
+    Row row;
+    WalRecordType type;
+    RowBatch batch = {0};
+    // statements of a table that has since been dropped have nowhere to go
+    Table* table = catalog_find_id(db, 0);
+    /* a half-replayed statement must not reach the file (see `Pager.no_steal`), whole ones may: checkpointing between
+    them keeps the pool from filling up, and should this crash too, replaying the log again still ends up the same */
+    db->pager->no_steal = true;
+    while ((type = wal_next_record(log, log_length, &offset, &row, legacy_rows)) != WAL_RECORD_END) {
+        if (pager_should_checkpoint(db->pager)) pager_checkpoint(db->pager);
+        if (type == WAL_RECORD_TABLE) {
+            table = catalog_find_id(db, row.id);
+            continue;
+        }
+        if (type == WAL_RECORD_BATCH) {
+            // a batch that didn't make it to the log whole was never committed: it's the end of the log
+            uint32_t num_rows = row.id;
+            row_batch_clear(&batch);
+            while (batch.num_rows < num_rows && wal_next_record(log, log_length, &offset, &row, legacy_rows) == WAL_RECORD_INSERT) {
+                row_batch_append(&batch, &row);
+            }
+            if (batch.num_rows < num_rows) break;
+            if (table) table_insert_batch(table, &batch);
+            num_recovered++;
+            continue;
+        }
+        /* a crash between a checkpoint and truncating the log replays statements that are already applied.
+        replaying all of them in order still ends up in the same state, the ones that no longer apply just fail */
+        switch (table ? type : WAL_RECORD_END) {
+        case WAL_RECORD_INSERT:
+            table_insert(table, &row);
+            break;
+        case WAL_RECORD_UPDATE:
+            table_update(table, &row);
+            break;
+        case WAL_RECORD_DELETE:
+            table_delete(table, row.id);
+            break;
+        default:
+            break;
+        }
+        num_recovered++;
+    }
+    row_batch_free(&batch);
+    free(log);
+
+    catalog_write(db);
+    pager_checkpoint(db->pager);
+    db->pager->no_steal = false;
+    wal_reset(wal);
+    if (num_recovered) print_success("recovered %d statements from log", num_recovered);
 }
 
-Cursor* table_start(Table* table) {
-    Cursor* cursor = table_find(table, 0);
-    // NOTE: should probably place this code inside leaf_node_find
-    LeafNode* first_leaf = (LeafNode*)get_page(table->pager, cursor->page_num);
-    uint32_t num_cells = first_leaf->num_cells;
-    cursor->end_of_table = (num_cells == 0);
-    return cursor;
+/* files from before the header page keep their root in page 0. move it out of the way and put a header there. */
+static void db_upgrade(Pager* pager) {
+    uint32_t root_page_num = get_unused_page_num(pager, 0);
+    Node* old_root = get_page(pager, 0);
+    Node* root = get_page(pager, root_page_num);
+    memcpy(root, old_root, PAGE_SIZE);
+    mark_page_dirty(pager, root_page_num);
+    unpin_page(pager, 0);
+    unpin_page(pager, root_page_num);
+    pager_init_header(pager, root_page_num);
+    // the tree itself is still laid out the way version 1 had it
+    pager->header.format_version = 1;
+    pager->checksums = false;
 }
 
-Cursor* table_end(Table* table) {
-    // remember that `table_end` takes us to one step *past* the end of the table (where it's safe to insert).
-    // this means that, for example, if current page has a limit number of cells, we'll be at limit+1
-    Cursor* cursor = malloc(sizeof *cursor);
-    cursor->table = table;
-    cursor->page_num = table->root_page_num;
-    LeafNode* last_leaf = (LeafNode*)get_page(table->pager, table->root_page_num);
-    cursor->cell_num = last_leaf->num_cells;
-    cursor->end_of_table = true;
+/*
+bring an older file's tree up to `DB_FORMAT_VERSION`, one version at a time.
+before the catalog, a file held a single table: it becomes `users`, with the columns `Row` used to have.
+*/
+static void db_upgrade_format(Database* db) {
+    Pager* pager = db->pager;
+    uint32_t version = pager->header.format_version;
+    if (version >= 4) {
+        // the catalog changed since (4 has no indexes yet), full nodes keep cells where checksums go now (6),
+        // and internal nodes keep keys apart from children (7). indexes only need rebuilding for the first two.
+        // from 7 on, only the header changed: the catalog moves behind it when it's next written.
+        // parents left behind by 8 are just never read again
+        catalog_read(db);
+        for (uint32_t i = 0; i < db->num_tables && version < 7; i++) {
+            Table* table = db->tables[i];
+            btree_mark_legacy_internal_nodes(pager, table->root_page_num);
+            table_upgrade_rows(table, false);
+            if (version >= 6) continue;
+            for (uint32_t j = 0; j < table->num_indexes; j++) index_build(table, &(table->indexes[j]), true);
+        }
+    } else {
+        if (version < 2) {
+            btree_upgrade_internal_nodes(pager, pager->header.root_page_num);
+        }
+        btree_mark_legacy_internal_nodes(pager, pager->header.root_page_num);
+        Schema schema;
+        schema_default(&schema);
+        Table* table = catalog_add(db, 0, "users", &schema, pager->header.root_page_num);
+        if (version < 3) {
+            // fixed-width leaves are rewritten in place, straight into the current layout. internal nodes aren't
+            btree_upgrade_leaves(pager, table->root_page_num);
+            table_upgrade_rows(table, false);
+        } else {
+            table_upgrade_rows(table, true);
+        }
+    }
+    if (version < 6) pager_stamp_checksums(pager);
+    pager->header.format_version = DB_FORMAT_VERSION;
+    pager->header.page_size = PAGE_SIZE;
+    pager->header_dirty = true;
+}
 
-    return cursor;
+/* a table with an empty root leaf */
+static Table* db_create_table(Database* db, const char* name, const Schema* schema) {
+    uint32_t root_page_num = get_unused_page_num(db->pager, 0);
+    LeafNode* root_node = (LeafNode*)get_page(db->pager, root_page_num);
+    initialize_leaf_node(root_node);
+    root_node->is_root = true;
+    mark_page_dirty(db->pager, root_page_num);
+    unpin_page(db->pager, root_page_num);
+    return catalog_add(db, db->next_table_id, name, schema, root_page_num);
 }
 
-Table* db_open(const char* filename) {
-    Pager* pager = pager_open(filename);
+Database* db_open(const char* filename, DbOptions* options) {
+    Pager* pager = pager_open(filename, options->num_frames, options->use_mmap);
+    // without one (an older kernel, or `--io sync`), the pool reads a page at a time, the way it always has
+    if (options->use_ring && !options->use_mmap) pager->ring = io_ring_open(PAGER_RING_ENTRIES);
 
-    Table* table = (Table*)malloc(sizeof *table);
-    table->pager = pager;
-    table->root_page_num = 0;
+    Database* db = calloc(1, sizeof *db);
+    db->pager = pager;
 
+    bool legacy_rows = false;
     if (pager->num_pages == 0) {
-        // new file - initialize page 0 as leaf node
-        LeafNode* root_node = (LeafNode*)get_page(table->pager, 0);
-        initialize_leaf_node(root_node);
-        root_node->is_root = true;
+        // new file - page 0 is the header, the `users` table's root starts out as a leaf right after it
+        pager_init_header(pager, 1);
+        Schema schema;
+        schema_default(&schema);
+        db_create_table(db, "users", &schema);
+    } else {
+        if (!pager_read_header(pager)) db_upgrade(pager);
+        if (pager->header.format_version < DB_FORMAT_VERSION) {
+            // the log too, if a version before the row format changed left one behind
+            legacy_rows = pager->header.format_version < 4;
+            db_upgrade_format(db);
+        } else {
+            catalog_read(db);
+        }
     }
-    return table;
-}
-
-void db_close(Table* table) {
-    Pager* pager = table->pager;
-    // first, we flush full pages, then a partial page.
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) continue;
+    // statements go to the first table until `use` picks another
+    db->current = db->num_tables ? db->tables[0] : NULL;
 
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+    Wal* wal = wal_open(filename, options->sync_mode, options->group_size);
+    db_recover(db, wal, legacy_rows);
+    if (options->sync_mode == SYNC_OFF) {
+        wal_close(wal);
+    } else {
+        db->wal = wal;
+        for (uint32_t i = 0; i < db->num_tables; i++) db->tables[i]->wal = wal;
+        pager->no_steal = true;
     }
+    return db;
+}
 
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
-        print_error("failed to close db file");
-        exit(EXIT_FAILURE);
+void db_close(Database* db) {
+    for (uint32_t i = 0; i < db->num_tables; i++) {
+        // an open batch was never committed
+        if (db->tables[i]->batch) {
+            row_batch_free(db->tables[i]->batch);
+            free(db->tables[i]->batch);
+        }
     }
-    // I don't get why we free all pages *again* on this part of the tutorial, so I'll just ignore it
-    free(pager);
-    free(table);
+    db_checkpoint(db);
+    if (db->wal) wal_close(db->wal);
+    pager_close(db->pager);
+    for (uint32_t i = 0; i < db->num_tables; i++) free(db->tables[i]);
+    free(db->tables);
+    free(db);
 }
 
-// get pointer to current row, create new page if needed.
-SerializedRow* cursor_value(Cursor* cursor){
+// get pointer to current (serialized) row, create new page if needed.
+// NOTE: this pins the cursor's page - `unpin_page(pager, cursor->page_num)` once done with the row.
+uint8_t* cursor_value(Cursor* cursor){
     uint32_t page_num = cursor->page_num;
     LeafNode* page = (LeafNode*)get_page(cursor->table->pager, page_num);
-    return &(page->cells[cursor->cell_num]);
+    return leaf_node_cell(page, cursor->cell_num);
+}
+
+/* view the current row in place. pins the cursor's page like `cursor_value`: `view` is valid until it's unpinned */
+void cursor_row_view(Cursor* cursor, RowView* view) {
+    LeafNode* page = (LeafNode*)get_page(cursor->table->pager, cursor->page_num);
+    uint16_t offset = page->slots[cursor->cell_num];
+    row_view((uint8_t*)page + offset, PAGE_USABLE_SIZE - offset, view);
 }
 
 /* 
@@ -173,14 +519,12 @@ otherwise, goes to the next cell of the same node.
 void cursor_advance(Cursor* cursor){
     uint32_t page_num = cursor->page_num;
     LeafNode* node = (LeafNode*)get_page(cursor->table->pager, page_num);
+    uint32_t num_cells = node->num_cells;
+    uint32_t next_page = node->next_leaf;
+    unpin_page(cursor->table->pager, page_num);
     cursor->cell_num += 1;
-    if (cursor->cell_num >= node->num_cells) {
-        uint32_t next_page = node->next_leaf;
-        /* NOTE: 
-        an uninitialized `next_page` being set to 0 is only safe IFF `root_page_num == 0` always.
-        if so, it's safe because `cursor_advance` navigates leaf pages. if there is more than one
-        page, `root_node` is not a leaf node, so we can use it as an initializer.
-        */
+    if (cursor->cell_num >= num_cells) {
+        // page 0 is the file header, so a `next_page` of 0 (what a fresh leaf starts with) means there is none
         if (next_page) {
             cursor->page_num = next_page;
             cursor->cell_num = 0;
@@ -190,17 +534,12 @@ void cursor_advance(Cursor* cursor){
     }
 }
 
-void print_row(Row* row){
-    printf("%d %s %s\n",row->id, row->username, row->email);
-    // RESEARCH: WHY DOES THIS WORK?? // printf("%*d %*s %*s\n", row->id,  row->username, 25, row->email, 255);
-}
-
 void print_constants(void) {
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
+    printf("PAGE_SIZE: %d\n", PAGE_SIZE);
+    printf("ROW_MAX_SIZE: %d\n", ROW_MAX_SIZE);
     printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
     printf("INTERNAL_NODE_MAX_KEYS: %d\n", INTERNAL_NODE_MAX_KEYS);
     printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
     printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
     printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
 }
@@ -210,7 +549,7 @@ void print_tree(Pager* pager, uint32_t page_num, uint32_t indent_level) {
     Node* _node = get_page(pager, page_num);
 
     // indent(indent_level);
-    printf("page %d/%d; ", page_num, TABLE_MAX_PAGES);
+    printf("page %d; ", page_num);
     if (_node->common_header.is_root) printf("root; ");
     switch (_node->common_header.type) {
     case NODE_INTERNAL: {
@@ -219,8 +558,8 @@ void print_tree(Pager* pager, uint32_t page_num, uint32_t indent_level) {
         // N keys == N+1 children
         for (uint32_t i = 0; i < node->num_keys; i++) {
             indent(indent_level+1);
-            printf("+ key %d; ", node->_cells[i].key);
-            print_tree(pager, node->_cells[i].child, indent_level+1);
+            printf("+ key %d; ", *internal_node_key(node, i));
+            print_tree(pager, *internal_node_child(node, i), indent_level+1);
         }
         indent(indent_level+1);
         printf("+ ");
@@ -228,20 +567,73 @@ void print_tree(Pager* pager, uint32_t page_num, uint32_t indent_level) {
         break;
     } case NODE_LEAF: {
         LeafNode* node = (LeafNode*)_node;
-        printf("leaf; %d/%d keys\n", node->num_cells, LEAF_NODE_MAX_CELLS);
+        printf("leaf; %d keys, %d bytes free\n", node->num_cells, leaf_node_free_space(node));
         for (uint32_t i = 0; i < node->num_cells; i++) {
             indent(indent_level+1);
-            printf("- key %d\n", node->cells[i].key);
+            printf("- key %d\n", leaf_node_key(node, i));
         }
         break;
-    }}
+    } case NODE_INDEX_INTERNAL:
+        // only indexes have these, see `print_index_tree`
+        break;
+    case NODE_LEGACY_INTERNAL:
+        // only while a file is upgraded
+        break;
+    }
+    unpin_page(pager, page_num);
+}
+
+/* an index's value the way `select` prints it: an int in decimal, a text or char as its characters */
+static void print_index_value(const Column* column, const uint8_t* value, uint32_t length) {
+    if (column->type == COLUMN_INT) {
+        uint32_t number = 0;
+        for (uint32_t i = 0; i < length; i++) number = number << 8 | value[i];
+        printf("%u", number);
+    } else {
+        printf("%.*s", length, (const char*)value);
+    }
+}
+
+/* like `print_tree`, for an index on `column`: entries are printed as their value and key */
+void print_index_tree(Pager* pager, uint32_t page_num, uint32_t indent_level, const Column* column) {
+    Node* _node = get_page(pager, page_num);
+    printf("page %d; ", page_num);
+    if (_node->common_header.is_root) printf("root; ");
+    RowView entry;
+    if (_node->common_header.type == NODE_INDEX_INTERNAL) {
+        IndexInternalNode* node = (IndexInternalNode*)_node;
+        printf("internal; %d keys, %d bytes free\n", node->num_cells,
+            node->content_start - INDEX_INTERNAL_NODE_HEADER_SIZE - node->num_cells * (uint32_t)sizeof(uint16_t));
+        for (uint32_t i = 0; i < node->num_cells; i++) {
+            row_view(index_internal_node_cell(node, i) + sizeof(uint32_t), ROW_MAX_SIZE, &entry);
+            indent(indent_level+1);
+            printf("+ key ");
+            print_index_value(column, entry.body, entry.body_size);
+            printf(", id %d; ", entry.id);
+            print_index_tree(pager, index_internal_node_child(node, i), indent_level+1, column);
+        }
+        indent(indent_level+1);
+        printf("+ ");
+        print_index_tree(pager, node->last_child, indent_level+1, column);
+    } else {
+        LeafNode* node = (LeafNode*)_node;
+        printf("leaf; %d keys, %d bytes free\n", node->num_cells, leaf_node_free_space(node));
+        for (uint32_t i = 0; i < node->num_cells; i++) {
+            row_view(leaf_node_cell(node, i), ROW_MAX_SIZE, &entry);
+            indent(indent_level+1);
+            printf("- key ");
+            print_index_value(column, entry.body, entry.body_size);
+            printf(", id %d\n", entry.id);
+        }
+    }
+    unpin_page(pager, page_num);
 }
 
 // void viz_tree(Pager* pager, uint32_t page_num, uint32_t indent_level) {
     
 // }
 
-void print_prompt(void) { printf("db > ");}
+void print_prompt(void) { fprintf(message_stream, "db > ");}
 
 InputBuffer* new_input_buffer(void){
     InputBuffer* input_buffer = malloc(sizeof *input_buffer);
@@ -269,101 +661,758 @@ void read_input(InputBuffer* input_buffer){
     input_buffer->buffer[bytes_read-1] = '\0';
 }
 
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, Database* db) {
+    Table* table = db->current;
     // only using `strncmp` rather than `strcmp` here because I don't like that the commands won't execute if there is a space at the end. that's all.
     if (strncmp(input_buffer->buffer, ".exit", 5) == 0) {
         print_success("%s", "exiting");
         close_input_buffer(input_buffer);
-        db_close(table);
+        db_close(db);
         exit(EXIT_SUCCESS);
         return META_COMMAND_SUCCESS;
     } else if (strncmp(input_buffer->buffer, ".print", 6) == 0) {
         printf("constants:\n");
         print_constants();
         return META_COMMAND_SUCCESS;
-} else if (strncmp(input_buffer->buffer, ".btree", 6) == 0) {
-        print_tree(table->pager, table->root_page_num, 0);
+    } else if (strncmp(input_buffer->buffer, ".tables", 7) == 0) {
+        for (uint32_t i = 0; i < db->num_tables; i++) {
+            Table* listed = db->tables[i];
+            printf("%s ", listed->name);
+            schema_print(&(listed->schema));
+            for (uint32_t j = 0; j < listed->num_indexes; j++) {
+                printf("%s%s", j ? ", " : " indexed on ", listed->schema.columns[listed->indexes[j].column].name);
+            }
+            printf("\n");
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (table == NULL && (strncmp(input_buffer->buffer, ".btree", 6) == 0 || strncmp(input_buffer->buffer, ".load", 5) == 0)) {
+        print_error("no table in use, `use` one first");
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".btree", 6) == 0) {
+        // `.btree <column>` prints the index on that column instead
+        strtok(input_buffer->buffer, " ");
+        char* column_name = strtok(NULL, " ");
+        if (column_name == NULL) {
+            print_tree(table->pager, table->root_page_num, 0);
+            return META_COMMAND_SUCCESS;
+        }
+        int32_t column = schema_find_column(&(table->schema), column_name);
+        Index* index = column > 0 ? table_find_index(table, column) : NULL;
+        if (index == NULL) {
+            print_error("no index on %s", column_name);
+            return META_COMMAND_SUCCESS;
+        }
+        print_index_tree(table->pager, index->root_page_num, 0, &(table->schema.columns[column]));
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".vacuum", 7) == 0) {
+        uint32_t pages_freed = db_vacuum(db);
+        print_success("vacuum: released %d pages", pages_freed);
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".load", 5) == 0) {
+        strtok(input_buffer->buffer, " ");
+        char* filename = strtok(NULL, " ");
+        char* fill_factor_string = strtok(NULL, " ");
+        int fill_factor = fill_factor_string ? atoi(fill_factor_string) : LOAD_DEFAULT_FILL_FACTOR;
+        if (filename == NULL || fill_factor < 1 || fill_factor > 100) {
+            print_error("usage: .load <file> [fill factor in percent, 1-100]");
+            return META_COMMAND_SUCCESS;
+        }
+        /* the load isn't logged: it builds a new tree next to the old one (and rebuilds the indexes, rather than
+        loading into them), and the checkpoint after it switches over. until then it only takes pages that are free in
+        the file, so nothing the old trees (or the catalog) depend on is written, and evicting dirty pages is fine. */
+        db_checkpoint(db);
+        bool no_steal = table->pager->no_steal;
+        table->pager->no_steal = false;
+        pager_hold_free_pages(table->pager);
+        LoadStats stats;
+        bool loaded = table_load(table, filename, fill_factor, &stats);
+        if (loaded) {
+            for (uint32_t i = 0; i < table->num_indexes; i++) index_build(table, &(table->indexes[i]), true);
+        }
+        // the pool may be all dirty pages by now, and the checkpoint needs frames for the catalog and the freelist
+        db_checkpoint(db);
+        table->pager->no_steal = no_steal;
+        if (loaded) {
+            print_success("load: %d rows in %d leaves, %d duplicates skipped", stats.num_rows, stats.num_leaves, stats.num_duplicates);
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".checkpoint", 11) == 0) {
+        uint32_t pages_written = db_checkpoint(db);
+        print_success("checkpoint: wrote %d dirty pages", pages_written);
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".check", 6) == 0) {
+        // read back what's on disk, with everything written
+        db_checkpoint(db);
+        check_database(db->pager, db->tables, db->num_tables);
         return META_COMMAND_SUCCESS;
     }
 
     return META_COMMAND_UNRECOGNIZED_COMMAND;
 }
 
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
+/* strip the spaces around `string` in place */
+static char* trim_spaces(char* string) {
+    while (*string == ' ') string++;
+    char* end = string + strlen(string);
+    while (end > string && end[-1] == ' ') end--;
+    *end = '\0';
+    return string;
+}
+
+/* `insert (id,column,...),(id,column,...),...`, from the first `(` on. spaces are allowed around fields and rows */
+static PrepareResult prepare_insert_many(char* values, Statement* statement, const Schema* schema) {
+    statement->type = STATEMENT_INSERT_MANY;
+    statement->rows = (RowBatch){0};
+
+    PrepareResult result = PREPARE_SUCCESS;
+    char* position = values;
+    while (result == PREPARE_SUCCESS) {
+        while (*position == ' ') position++;
+        char* close = strchr(position, ')');
+        if (*position != '(' || close == NULL) {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+        *close = '\0';
+        char* id_string = strtok(position + 1, ",");
+        char* fields[TABLE_MAX_COLUMNS];
+        for (uint32_t i = 1; i < schema->num_columns && result == PREPARE_SUCCESS; i++) {
+            fields[i - 1] = strtok(NULL, ",");
+            if (fields[i - 1] == NULL || *(fields[i - 1] = trim_spaces(fields[i - 1])) == '\0') result = PREPARE_SYNTAX_ERROR;
+        }
+        Row row;
+        if (result != PREPARE_SUCCESS || id_string == NULL || strtok(NULL, ",") != NULL
+                || !parse_u32(trim_spaces(id_string), &(row.id))) {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+        result = row_encode(schema, row.id, fields, &row);
+        if (result == PREPARE_SUCCESS) row_batch_append(&(statement->rows), &row);
+
+        position = close + 1;
+        while (*position == ' ') position++;
+        if (*position == '\0') break;
+        if (*position++ != ',') result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result != PREPARE_SUCCESS) row_batch_free(&(statement->rows));
+    return result;
+}
+
+/* `insert <id> <column> ...`, one value per column of the table in use */
+PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement, const Schema* schema) {
     // int n_args_assigned = sscanf(input_buffer->buffer, "insert %d %33s %256s", &(statement->row_to_insert.id), &(statement->row_to_insert.username), &(statement->row_to_insert.email));
         statement->type = STATEMENT_INSERT;
 
+        char* values = input_buffer->buffer + 6;
+        while (*values == ' ') values++;
+        if (*values == '(') return prepare_insert_many(values, statement, schema);
+
         strtok(input_buffer->buffer, " ");
         char* id_string = strtok(NULL, " ");
-        char* username = strtok(NULL, " ");
-        char* email = strtok(NULL, " ");
+        char* fields[TABLE_MAX_COLUMNS];
+        for (uint32_t i = 1; i < schema->num_columns; i++) {
+            fields[i - 1] = strtok(NULL, " ");
+            if (fields[i - 1] == NULL) return PREPARE_SYNTAX_ERROR;
+        }
 
-        if (id_string == NULL || username == NULL || email == NULL) {
+        if (id_string == NULL) {
             return PREPARE_SYNTAX_ERROR;
         }
 
         int id = atoi(id_string);
-        if (strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
-            return PREPARE_STRING_TOO_LONG;
+        return row_encode(schema, id, fields, &(statement->row_to_insert));
+}
+
+/* position of the column called `name` in `schema`. `id` always names the key, unless a column is called that */
+static int32_t prepare_column(const Schema* schema, const char* name) {
+    int32_t column = schema_find_column(schema, name);
+    if (column < 0 && strcmp(name, "id") == 0) column = 0;
+    return column;
+}
+
+/* `where <column> = <value>` or `where <column> like <prefix>%`, for a column other than the key */
+static PrepareResult prepare_where_column(Statement* statement, const Schema* schema, const char* operator) {
+    const Column* column = &(schema->columns[statement->column]);
+    char* value = strtok(NULL, " ");
+    if (value == NULL || strtok(NULL, " ") != NULL) return PREPARE_SYNTAX_ERROR;
+    if (strcmp(operator, "like") == 0) {
+        // only prefixes: a single `%`, at the end
+        size_t length = strlen(value);
+        if (column->type == COLUMN_INT || length == 0 || value[length - 1] != '%' || strchr(value, '%') != value + length - 1) {
+            return PREPARE_SYNTAX_ERROR;
         }
+        value[length - 1] = '\0';
+        statement->prefix = true;
+    } else if (strcmp(operator, "=") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (column->type == COLUMN_INT) {
+        uint32_t number;
+        if (!parse_u32(value, &number)) return PREPARE_SYNTAX_ERROR;
+        statement->value_length = index_value(column, (uint8_t*)&number, sizeof number, statement->value);
+        return PREPARE_SUCCESS;
+    }
+    if (strlen(value) > column->size) return PREPARE_STRING_TOO_LONG;
+    statement->value_length = index_value(column, (uint8_t*)value, strlen(value), statement->value);
+    return PREPARE_SUCCESS;
+}
 
-        statement->row_to_insert.id = id;
-        strcpy(statement->row_to_insert.username, username);
-        strcpy(statement->row_to_insert.email, email);
+/*
+parse the rest of a statement, from `where` (already read) on: `where id = N`, or `where id between A and B`
+(inclusive) if `allow_columns`, which also allows conditions on the other columns (see `prepare_where_column`).
+sets `min_id` and `max_id`, or `column` and `value`.
+*/
+static PrepareResult prepare_where(char* where, Statement* statement, const Schema* schema, bool allow_columns) {
+    char* column_name = strtok(NULL, " ");
+    char* operator = strtok(NULL, " ");
+    if (where == NULL || strcmp(where, "where") != 0 || column_name == NULL || operator == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    int32_t column = prepare_column(schema, column_name);
+    if (column < 0) return PREPARE_NO_SUCH_COLUMN;
+    if (column > 0) {
+        if (!allow_columns) return PREPARE_SYNTAX_ERROR;
+        statement->column = column;
+        return prepare_where_column(statement, schema, operator);
+    }
+
+    if (strcmp(operator, "=") == 0) {
+        if (!parse_u32(strtok(NULL, " "), &(statement->min_id))) return PREPARE_SYNTAX_ERROR;
+        statement->max_id = statement->min_id;
+    } else if (allow_columns && strcmp(operator, "between") == 0) {
+        if (!parse_u32(strtok(NULL, " "), &(statement->min_id))) return PREPARE_SYNTAX_ERROR;
+        char* and = strtok(NULL, " ");
+        if (and == NULL || strcmp(and, "and") != 0) return PREPARE_SYNTAX_ERROR;
+        if (!parse_u32(strtok(NULL, " "), &(statement->max_id))) return PREPARE_SYNTAX_ERROR;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (strtok(NULL, " ") != NULL) return PREPARE_SYNTAX_ERROR;
+    return PREPARE_SUCCESS;
+}
 
+/* `count(*)`, or `min(<column>)`, `max(<column>)` or `sum(<column>)` of an int column */
+static PrepareResult prepare_aggregate(char* function, Statement* statement, const Schema* schema) {
+    static const char* names[] = {
+        [AGGREGATE_COUNT] = "count", [AGGREGATE_MIN] = "min", [AGGREGATE_MAX] = "max", [AGGREGATE_SUM] = "sum",
+    };
+    char* column_name = strchr(function, '(');
+    char* end = column_name ? strchr(column_name, ')') : NULL;
+    if (end == NULL || end[1] != '\0') return PREPARE_SYNTAX_ERROR;
+    *column_name++ = '\0';
+    *end = '\0';
+    for (AggregateFunction aggregate = AGGREGATE_COUNT; aggregate <= AGGREGATE_SUM; aggregate++) {
+        if (strcmp(function, names[aggregate]) != 0) continue;
+        statement->aggregate = aggregate;
+        if (aggregate == AGGREGATE_COUNT) return strcmp(column_name, "*") == 0 ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+        int32_t column = prepare_column(schema, column_name);
+        if (column < 0) return PREPARE_NO_SUCH_COLUMN;
+        if (schema->columns[column].type != COLUMN_INT) return PREPARE_SYNTAX_ERROR;
+        statement->aggregate_column = column;
         return PREPARE_SUCCESS;
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+/*
+`select`, `select where id = N`, `select where id between A and B`, `select where <column> = <value>` or `like <prefix>%`,
+any of them with an aggregate (`select count(*) where ...`, see `prepare_aggregate`)
+*/
+PrepareResult prepare_select(InputBuffer* input_buffer, Statement* statement, const Schema* schema) {
+    statement->type = STATEMENT_SELECT;
+    statement->min_id = 0;
+    statement->max_id = UINT32_MAX;
+    statement->column = 0;
+    statement->prefix = false;
+    statement->aggregate = AGGREGATE_NONE;
+    statement->aggregate_column = 0;
+
+    strtok(input_buffer->buffer, " ");
+    char* where = strtok(NULL, " ");
+    if (where != NULL && strcmp(where, "where") != 0) {
+        PrepareResult result = prepare_aggregate(where, statement, schema);
+        if (result != PREPARE_SUCCESS) return result;
+        where = strtok(NULL, " ");
+    }
+    if (where == NULL) return PREPARE_SUCCESS;
+    return prepare_where(where, statement, schema, true);
+}
+
+/* `update <column> ... where id = N`, with a new value for every column but the key */
+PrepareResult prepare_update(InputBuffer* input_buffer, Statement* statement, const Schema* schema) {
+    statement->type = STATEMENT_UPDATE;
+
+    strtok(input_buffer->buffer, " ");
+    char* fields[TABLE_MAX_COLUMNS];
+    for (uint32_t i = 1; i < schema->num_columns; i++) {
+        fields[i - 1] = strtok(NULL, " ");
+        if (fields[i - 1] == NULL) return PREPARE_SYNTAX_ERROR;
+    }
+    PrepareResult result = prepare_where(strtok(NULL, " "), statement, schema, false);
+    if (result != PREPARE_SUCCESS) return result;
+    return row_encode(schema, statement->min_id, fields, &(statement->row_to_insert));
+}
+
+/* `delete where id = N` */
+PrepareResult prepare_delete(InputBuffer* input_buffer, Statement* statement, const Schema* schema) {
+    statement->type = STATEMENT_DELETE;
+
+    strtok(input_buffer->buffer, " ");
+    return prepare_where(strtok(NULL, " "), statement, schema, false);
+}
+
+/* `create index on <column>` or `drop index on <column>`, a column of the table in use */
+static PrepareResult prepare_index(InputBuffer* input_buffer, Statement* statement, const Schema* schema) {
+    strtok(input_buffer->buffer, " "); // create/drop
+    strtok(NULL, " "); // index
+    char* on = strtok(NULL, " ");
+    char* column_name = strtok(NULL, " ");
+    if (on == NULL || strcmp(on, "on") != 0 || column_name == NULL || strtok(NULL, " ") != NULL) return PREPARE_SYNTAX_ERROR;
+    int32_t column = prepare_column(schema, column_name);
+    if (column < 0) return PREPARE_NO_SUCH_COLUMN;
+    statement->column = column;
+    return PREPARE_SUCCESS;
+}
+
+/* `create table <name> (<column> <type>, ...)`: the first column is the key, and must be an int */
+PrepareResult prepare_create_table(InputBuffer* input_buffer, Statement* statement) {
+    statement->type = STATEMENT_CREATE_TABLE;
+
+    char* columns = strchr(input_buffer->buffer, '(');
+    if (columns == NULL) return PREPARE_SYNTAX_ERROR;
+    PrepareResult result = schema_parse(trim_spaces(columns), &(statement->schema));
+    if (result != PREPARE_SUCCESS) return result;
+    *columns = '\0';
+
+    strtok(input_buffer->buffer, " "); // create
+    strtok(NULL, " "); // table
+    char* name = strtok(NULL, " ");
+    if (name == NULL || strtok(NULL, " ") != NULL) return PREPARE_SYNTAX_ERROR;
+    if (!schema_valid_name(name)) return PREPARE_INVALID_SCHEMA;
+    strcpy(statement->table_name, name);
+    return PREPARE_SUCCESS;
 }
 
-PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement) {
+/* `drop table <name>` or `use <name>`: `num_words` words, then the name */
+static PrepareResult prepare_table_name(InputBuffer* input_buffer, Statement* statement, uint32_t num_words) {
+    strtok(input_buffer->buffer, " ");
+    for (uint32_t i = 1; i < num_words; i++) strtok(NULL, " ");
+    char* name = strtok(NULL, " ");
+    if (name == NULL || strtok(NULL, " ") != NULL || strlen(name) > TABLE_NAME_MAX_SIZE) return PREPARE_SYNTAX_ERROR;
+    strcpy(statement->table_name, name);
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement, Database* db) {
+    if (strncmp(input_buffer->buffer, "create table ", 13) == 0) {
+        return prepare_create_table(input_buffer, statement);
+    }
+    if (strncmp(input_buffer->buffer, "drop table ", 11) == 0) {
+        statement->type = STATEMENT_DROP_TABLE;
+        return prepare_table_name(input_buffer, statement, 2);
+    }
+    if (strncmp(input_buffer->buffer, "use ", 4) == 0) {
+        statement->type = STATEMENT_USE;
+        return prepare_table_name(input_buffer, statement, 1);
+    }
+
+    // everything else works on the table in use, and inserts and updates need its columns
+    if (db->current == NULL) return PREPARE_NO_TABLE;
+    const Schema* schema = &(db->current->schema);
+
     if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
         statement->type = STATEMENT_INSERT;
-        return prepare_insert(input_buffer, statement);
+        return prepare_insert(input_buffer, statement, schema);
     }
     if (strncmp(input_buffer->buffer, "select", 6) == 0) {
-        statement->type = STATEMENT_SELECT;
+        return prepare_select(input_buffer, statement, schema);
+    }
+    if (strncmp(input_buffer->buffer, "update", 6) == 0) {
+        return prepare_update(input_buffer, statement, schema);
+    }
+    if (strncmp(input_buffer->buffer, "delete", 6) == 0) {
+        return prepare_delete(input_buffer, statement, schema);
+    }
+    if (strncmp(input_buffer->buffer, "create index ", 13) == 0) {
+        statement->type = STATEMENT_CREATE_INDEX;
+        return prepare_index(input_buffer, statement, schema);
+    }
+    if (strncmp(input_buffer->buffer, "drop index ", 11) == 0) {
+        statement->type = STATEMENT_DROP_INDEX;
+        return prepare_index(input_buffer, statement, schema);
+    }
+    if (strcmp(input_buffer->buffer, "begin") == 0) {
+        statement->type = STATEMENT_BEGIN;
+        return PREPARE_SUCCESS;
+    }
+    if (strcmp(input_buffer->buffer, "commit") == 0) {
+        statement->type = STATEMENT_COMMIT;
+        return PREPARE_SUCCESS;
+    }
+    if (strcmp(input_buffer->buffer, "rollback") == 0) {
+        statement->type = STATEMENT_ROLLBACK;
         return PREPARE_SUCCESS;
     }
 
     return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-parameter"
+/* whether an (encoded) value matches the `where` of a select on a column: equal to its value, or starting with it */
+static bool select_matches(Statement* statement, const uint8_t* value, uint32_t value_length) {
+    if (statement->prefix ? value_length < statement->value_length : value_length != statement->value_length) return false;
+    return memcmp(value, statement->value, statement->value_length) == 0;
+}
+
+/* the value an aggregate is of (`aggregate_column`) in `row`: its key, or an int column */
+static uint32_t aggregate_value(Statement* statement, const Schema* schema, const uint8_t* body, uint32_t id) {
+    if (statement->aggregate_column == 0) return id;
+    uint32_t length;
+    const uint8_t* field = row_field(schema, body, statement->aggregate_column, &length);
+    uint32_t value;
+    memcpy(&value, field, sizeof value);
+    return value;
+}
+
+static void aggregate_add(Aggregate* aggregate, uint32_t value) {
+    if (aggregate->count == 0 || value < aggregate->min) aggregate->min = value;
+    if (aggregate->count == 0 || value > aggregate->max) aggregate->max = value;
+    aggregate->count++;
+    aggregate->sum += value;
+}
+
+/*
+`where <column> ...` on an indexed column: seek to the first entry with the value (or prefix), and look up the row
+of every entry from there on that matches. rows come out in the index's order, by value and then by key.
+an aggregate (into `aggregate`) only looks rows up if it's of a column other than the key, which entries carry.
+*/
+static void execute_select_index(Statement* statement, Table* table, Index* index, Aggregate* aggregate) {
+    Pager* pager = table->pager;
+    Cursor cursor;
+    index_seek(table, index, statement->value, statement->value_length, &cursor);
+    while (!cursor.end_of_table) {
+        LeafNode* node = (LeafNode*)get_page(pager, cursor.page_num);
+        for (; cursor.cell_num < node->num_cells; cursor.cell_num++) {
+            RowView entry;
+            row_view(leaf_node_cell(node, cursor.cell_num), ROW_MAX_SIZE, &entry);
+            if (!select_matches(statement, entry.body, entry.body_size)) break;
+            if (aggregate && statement->aggregate_column == 0) {
+                aggregate_add(aggregate, entry.id);
+                continue;
+            }
+            Cursor row_cursor;
+            if (table_find_row(table, entry.id, LATCH_READ, 0, &row_cursor)) {
+                RowView row;
+                cursor_row_view(&row_cursor, &row);
+                if (aggregate) {
+                    aggregate_add(aggregate, aggregate_value(statement, &(table->schema), row.body, row.id));
+                } else {
+                    output_row(&(table->schema), &row);
+                }
+                unpin_page(pager, row_cursor.page_num);
+            }
+            btree_unlatch(&row_cursor);
+        }
+        // leaves emptied by deletes stay in the chain, step over them
+        bool done = cursor.cell_num < node->num_cells;
+        unpin_page(pager, cursor.page_num);
+        if (done) break;
+        index_next_leaf(&cursor);
+    }
+    btree_unlatch(&cursor);
+}
+
+/*
+the rows of `range` that match the `where` of a select (`scan->argument`), a leaf at a time, see `execute_select`.
+they're output, or added up into the range's aggregate. a `count(*)` of a range of keys doesn't look at rows:
+it adds up how many each leaf has, and only searches the leaf the range ends in.
+*/
+static void select_scan_range(ParallelScan* scan, ScanRange* range) {
+    Statement* statement = scan->argument;
+    const Schema* schema = &(scan->table->schema);
+    bool count_cells = statement->aggregate == AGGREGATE_COUNT && statement->column == 0;
+    Cursor cursor;
+    scan_seek(scan, range, &cursor);
+    while (!cursor.end_of_table) {
+        LeafNode* node = (LeafNode*)snapshot_get_page(&(scan->snapshot), cursor.page_num);
+        if (count_cells) {
+            uint32_t end = node->num_cells;
+            // keys past the range are past the end of the leaf's, so this takes one look at the leaves before the last
+            if (end && leaf_node_key(node, end - 1) > range->max_key) end = leaf_node_find_cell(node, range->max_key + 1);
+            if (end > cursor.cell_num) range->aggregate.count += end - cursor.cell_num;
+            cursor.cell_num = end;
+        }
+        RowView row;
+        for (; cursor.cell_num < node->num_cells; cursor.cell_num++) {
+            uint16_t offset = node->slots[cursor.cell_num];
+            row_view((uint8_t*)node + offset, PAGE_USABLE_SIZE - offset, &row);
+            if (row.id > range->max_key) break;
+            if (statement->column) {
+                uint32_t length;
+                const uint8_t* field = row_field(schema, row.body, statement->column, &length);
+                uint8_t value[INDEX_VALUE_MAX_SIZE];
+                length = index_value(&(schema->columns[statement->column]), field, length, value);
+                if (!select_matches(statement, value, length)) continue;
+            }
+            if (statement->aggregate) {
+                aggregate_add(&(range->aggregate), aggregate_value(statement, schema, row.body, row.id));
+            } else {
+                scan_output_row(scan, range, schema, &row);
+            }
+            // the last id in range: stop before reading the next row (possibly from the next leaf)
+            if (row.id == range->max_key) break;
+        }
+        bool done = cursor.cell_num < node->num_cells;
+        snapshot_put_page(&(scan->snapshot), cursor.page_num, (Node*)node);
+        if (done) break;
+        btree_next_leaf_snapshot(&(scan->snapshot), &cursor);
+    }
+}
+
+/* `min` or `max` of the key over a range of keys: a descent to its first or last row */
+static void execute_select_min_max(Statement* statement, Table* table, Aggregate* aggregate) {
+    Snapshot snapshot = snapshot_begin(table->pager);
+    uint32_t key;
+    bool found = false;
+    if (statement->aggregate == AGGREGATE_MAX) {
+        found = btree_last_key_snapshot(table, &snapshot, statement->max_id, &key) && key >= statement->min_id;
+    } else {
+        Cursor cursor;
+        btree_seek_snapshot(table, &snapshot, statement->min_id, &cursor);
+        while (!cursor.end_of_table && !found) {
+            LeafNode* node = (LeafNode*)snapshot_get_page(&snapshot, cursor.page_num);
+            found = cursor.cell_num < node->num_cells;
+            if (found) key = leaf_node_key(node, cursor.cell_num);
+            snapshot_put_page(&snapshot, cursor.page_num, (Node*)node);
+            if (!found) btree_next_leaf_snapshot(&snapshot, &cursor);
+        }
+        found = found && key <= statement->max_id;
+    }
+    snapshot_end(&snapshot);
+    if (found) aggregate_add(aggregate, key);
+}
+
+/*
+the planner, such as it is: the key's range is a seek into the table, a column with an index is a seek into that,
+and any other column is a scan of the whole table, filtering rows by the column's value.
+each leaf is pinned once for all of its rows, which are viewed in place (see `row_view`) rather than copied out.
+a seek into the table reads through a snapshot, so however long it runs, it sees the table as it was when it began.
+with `--threads`, it's split over that many threads by subtree (see `parallel_scan`), each filtering its own rows.
+aggregates are added up where the rows are read (by each thread), and never formatted: the `min` or `max` of the key
+is a single descent, and a `count(*)` of a range of keys only reads the number of rows in each leaf.
+*/
 ExecuteResult execute_select(Statement* statement, Table* table){
-#pragma GCC diagnostic pop    // NOTE: selecting all rows, for now
-    Row row;
-    Cursor* cursor = table_start(table);
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+    Index* index = statement->column ? table_find_index(table, statement->column) : NULL;
+    Aggregate aggregate = {0};
+    bool aggregated = statement->aggregate != AGGREGATE_NONE;
+    if (aggregated && statement->column == 0 && statement->aggregate_column == 0
+            && (statement->aggregate == AGGREGATE_MIN || statement->aggregate == AGGREGATE_MAX)) {
+        execute_select_min_max(statement, table, &aggregate);
+    } else if (index) {
+        execute_select_index(statement, table, index, aggregated ? &aggregate : NULL);
+    } else {
+        // a single id is one descent, there's nothing to split
+        uint32_t num_threads = statement->min_id == statement->max_id ? 1 : scan_threads;
+        aggregate = parallel_scan(
+            table, statement->min_id, statement->max_id, num_threads, scan_ordered, select_scan_range, statement
+        );
+    }
+    if (aggregated) {
+        uint64_t value = statement->aggregate == AGGREGATE_COUNT ? aggregate.count
+            : statement->aggregate == AGGREGATE_SUM ? aggregate.sum
+            : statement->aggregate == AGGREGATE_MIN ? aggregate.min : aggregate.max;
+        bool has_value = aggregate.count || statement->aggregate == AGGREGATE_COUNT || statement->aggregate == AGGREGATE_SUM;
+        output_value(has_value ? &value : NULL);
     }
+    output_flush();
     return EXECUTE_SUCCESS;
 }
 
 ExecuteResult execute_insert(Statement* statement, Table* table){
     Row* row_to_insert = &(statement->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
-    Cursor* cursor = table_find(table, key_to_insert);
+    ExecuteResult result = table_insert(table, row_to_insert);
+    if (result == EXECUTE_SUCCESS && table->wal) {
+        wal_log_insert(table->wal, table->id, row_to_insert);
+        wal_commit(table->wal);
+    }
+    return result;
+}
 
-    LeafNode* node = (LeafNode*)get_page(table->pager, cursor->page_num);
+/* log the whole batch before touching the tree, then insert it. prints how many rows made it in */
+static void execute_batch(Table* table, RowBatch* rows) {
+    if (table->wal) {
+        wal_log_batch(table->wal, table->id, rows);
+        wal_commit(table->wal);
+    }
+    uint32_t num_inserted = table_insert_batch(table, rows);
+    print_success("inserted %d rows, %d duplicates skipped", num_inserted, rows->num_rows - num_inserted);
+}
 
-    if (cursor->cell_num < node->num_cells) { // inserting between
-        uint32_t key_at_index = node->cells[cursor->cell_num].key;
-        if (key_at_index == key_to_insert) return EXECUTE_DUPLICATE_KEY;
+/* a multi-row `insert` goes in at once, or joins the open batch */
+ExecuteResult execute_insert_many(Statement* statement, Table* table){
+    RowBatch* rows = &(statement->rows);
+    if (table->batch) {
+        for (uint32_t i = 0; i < rows->num_rows; i++) {
+            const uint8_t* cell = row_batch_cell(rows, i);
+            row_batch_append_cell(table->batch, cell, serialized_row_size(cell));
+        }
+    } else {
+        execute_batch(table, rows);
+    }
+    row_batch_free(rows);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+`begin` collects the inserts that follow in memory, `commit` applies them all at once (see `table_insert_batch`)
+and `rollback` drops them. nothing but inserts can run in between.
+*/
+ExecuteResult execute_begin(Table* table){
+    table->batch = calloc(1, sizeof *(table->batch));
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_commit(Table* table, bool apply){
+    if (table->batch == NULL) return EXECUTE_NO_BATCH;
+    if (apply) execute_batch(table, table->batch);
+    row_batch_free(table->batch);
+    free(table->batch);
+    table->batch = NULL;
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_update(Statement* statement, Table* table){
+    Row* row = &(statement->row_to_insert);
+    ExecuteResult result = table_update(table, row);
+    if (result == EXECUTE_SUCCESS && table->wal) {
+        wal_log_update(table->wal, table->id, row);
+        wal_commit(table->wal);
+    }
+    return result;
+}
+
+ExecuteResult execute_delete(Statement* statement, Table* table){
+    ExecuteResult result = table_delete(table, statement->min_id);
+    if (result == EXECUTE_SUCCESS && table->wal) {
+        wal_log_delete(table->wal, table->id, statement->min_id);
+        wal_commit(table->wal);
+    }
+    return result;
+}
+
+/*
+`create table` and `drop table` aren't logged: they start from a checkpoint and end with one.
+a new table is empty, and only gets rows once something `use`s it.
+*/
+ExecuteResult execute_create_table(Statement* statement, Database* db){
+    if (catalog_find(db, statement->table_name)) return EXECUTE_TABLE_EXISTS;
+    db_checkpoint(db);
+    Table* table = db_create_table(db, statement->table_name, &(statement->schema));
+    if (!catalog_fits(db)) {
+        btree_free_pages(db->pager, table->root_page_num);
+        catalog_remove(db, table);
+        return EXECUTE_CATALOG_FULL;
+    }
+    db_checkpoint(db);
+    return EXECUTE_SUCCESS;
+}
+
+/* frees the table's pages. dropping the table in use leaves none in use */
+ExecuteResult execute_drop_table(Statement* statement, Database* db){
+    Table* table = catalog_find(db, statement->table_name);
+    if (table == NULL) return EXECUTE_NO_SUCH_TABLE;
+    db_checkpoint(db);
+    btree_free_pages(db->pager, table->root_page_num);
+    for (uint32_t i = 0; i < table->num_indexes; i++) btree_free_pages(db->pager, table->indexes[i].root_page_num);
+    catalog_remove(db, table);
+    db_checkpoint(db);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+`create index` builds the index from the table's rows, and like `create table` isn't logged but checkpointed around.
+like `.load`'s, the new tree only takes pages that are free in the file, so its dirty pages may be evicted.
+the key needs no index: the table's own tree is one.
+*/
+ExecuteResult execute_create_index(Statement* statement, Database* db){
+    Table* table = db->current;
+    if (statement->column == 0 || table_find_index(table, statement->column)) return EXECUTE_INDEX_EXISTS;
+    db_checkpoint(db);
+    Index* index = &(table->indexes[table->num_indexes++]);
+    index->column = statement->column;
+    bool no_steal = db->pager->no_steal;
+    db->pager->no_steal = false;
+    pager_hold_free_pages(db->pager);
+    index_build(table, index, false);
+    bool fits = catalog_fits(db);
+    if (!fits) {
+        btree_free_pages(db->pager, index->root_page_num);
+        table->num_indexes--;
     }
+    db_checkpoint(db);
+    db->pager->no_steal = no_steal;
+    return fits ? EXECUTE_SUCCESS : EXECUTE_CATALOG_FULL;
+}
 
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
+ExecuteResult execute_drop_index(Statement* statement, Database* db){
+    Table* table = db->current;
+    Index* index = table_find_index(table, statement->column);
+    if (index == NULL) return EXECUTE_NO_SUCH_INDEX;
+    db_checkpoint(db);
+    btree_free_pages(db->pager, index->root_page_num);
+    *index = table->indexes[--table->num_indexes];
+    db_checkpoint(db);
+    return EXECUTE_SUCCESS;
+}
 
+ExecuteResult execute_use(Statement* statement, Database* db){
+    Table* table = catalog_find(db, statement->table_name);
+    if (table == NULL) return EXECUTE_NO_SUCH_TABLE;
+    db->current = table;
     return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_statement(Statement* statement, Table* table){
+ExecuteResult execute_statement(Statement* statement, Database* db){
+    Table* table = db->current;
+    if (table && table->batch) {
+        switch (statement->type){
+            case STATEMENT_INSERT:
+                row_batch_append(table->batch, &(statement->row_to_insert));
+                return EXECUTE_SUCCESS;
+            case STATEMENT_INSERT_MANY:
+            case STATEMENT_COMMIT:
+            case STATEMENT_ROLLBACK:
+                break;
+            default:
+                return EXECUTE_BATCH_OPEN;
+        }
+    }
     switch (statement->type){
         case STATEMENT_INSERT:
             return execute_insert(statement, table);
+        case STATEMENT_INSERT_MANY:
+            return execute_insert_many(statement, table);
+        case STATEMENT_BEGIN:
+            return execute_begin(table);
+        case STATEMENT_COMMIT:
+            return execute_commit(table, true);
+        case STATEMENT_ROLLBACK:
+            return execute_commit(table, false);
         case STATEMENT_SELECT:
             return execute_select(statement, table);
+        case STATEMENT_UPDATE:
+            return execute_update(statement, table);
+        case STATEMENT_DELETE:
+            return execute_delete(statement, table);
+        case STATEMENT_CREATE_TABLE:
+            return execute_create_table(statement, db);
+        case STATEMENT_DROP_TABLE:
+            return execute_drop_table(statement, db);
+        case STATEMENT_USE:
+            return execute_use(statement, db);
+        case STATEMENT_CREATE_INDEX:
+            return execute_create_index(statement, db);
+        case STATEMENT_DROP_INDEX:
+            return execute_drop_index(statement, db);
         default:
             log("no case match");
             exit(EXIT_FAILURE);
@@ -371,29 +1420,131 @@ ExecuteResult execute_statement(Statement* statement, Table* table){
     // gcc complains about this because https://stackoverflow.com/a/33607345
 }
 
+/* the number a numeric option was given, from `min` to `max` - anything else stops the process */
+static uint32_t parse_option(const char* name, const char* string, uint32_t min, uint32_t max) {
+    uint32_t value;
+    if (!parse_u32(string, &value) || value < min || value > max) {
+        print_error("--%s takes a number from %u to %u: %s", name, min, max, string);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         print_error("must provide a database filename");
         exit(EXIT_FAILURE);
     }
+    DbOptions db_options = {
+        .num_frames = PAGER_DEFAULT_FRAMES,
+        .use_mmap = false,
+        .use_ring = true,
+        .sync_mode = SYNC_FULL,
+        .group_size = DEFAULT_GROUP_COMMIT_SIZE,
+    };
+    uint32_t checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
     struct option options[] = {
         {"no-color", no_argument, (int*)&use_color, false},
+        {"frames", required_argument, NULL, 'f'},
+        {"page-size", required_argument, NULL, 'p'},
+        {"mmap", no_argument, NULL, 'm'},
+        {"io", required_argument, NULL, 'i'},
+        {"checkpoint-interval", required_argument, NULL, 'c'},
+        {"sync", required_argument, NULL, 's'},
+        {"group-size", required_argument, NULL, 'g'},
+        {"output", required_argument, NULL, 'o'},
+        {"threads", required_argument, NULL, 't'},
+        {"unordered", no_argument, NULL, 'u'},
         {0, 0, 0, 0}
     };
     int opt_idx = 0;
-    getopt_long(argc-1, &argv[1], "", options, &opt_idx);
+    int opt;
+    while ((opt = getopt_long(argc-1, &argv[1], "", options, &opt_idx)) != -1) {
+        switch (opt) {
+            case 'f':
+                db_options.num_frames = parse_option("frames", optarg, PAGER_MIN_FRAMES, PAGER_MAX_FRAMES);
+                break;
+            case 'm':
+                db_options.use_mmap = true;
+                break;
+            case 'i':
+                if (strcmp(optarg, "uring") == 0) {
+                    db_options.use_ring = true;
+                } else if (strcmp(optarg, "sync") == 0) {
+                    db_options.use_ring = false;
+                } else {
+                    print_error("unknown I/O mode: %s (expected uring or sync)", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                // only for a new file: an existing one keeps the page size it was created with
+                if (!parse_u32(optarg, &page_size) || !page_size_valid(page_size)) {
+                    print_error("--page-size takes a power of two from %d to %d", PAGE_MIN_SIZE, PAGE_MAX_SIZE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                if (strcmp(optarg, "off") == 0) {
+                    db_options.sync_mode = SYNC_OFF;
+                } else if (strcmp(optarg, "full") == 0) {
+                    db_options.sync_mode = SYNC_FULL;
+                } else if (strcmp(optarg, "group") == 0) {
+                    db_options.sync_mode = SYNC_GROUP;
+                } else {
+                    print_error("unknown sync mode: %s (expected off, full or group)", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                db_options.group_size = parse_option("group-size", optarg, 1, UINT32_MAX);
+                break;
+            case 'c':
+                checkpoint_interval = parse_option("checkpoint-interval", optarg, 0, UINT32_MAX);
+                break;
+            case 'o':
+                if (strcmp(optarg, "text") == 0) {
+                    output_format = OUTPUT_TEXT;
+                } else if (strcmp(optarg, "tsv") == 0) {
+                    output_format = OUTPUT_TSV;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    output_format = OUTPUT_CSV;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    output_format = OUTPUT_BINARY;
+                } else {
+                    print_error("unknown output format: %s (expected text, tsv, csv or binary)", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                scan_threads = parse_option("threads", optarg, 1, SCAN_MAX_THREADS);
+                break;
+            case 'u':
+                scan_ordered = false;
+                break;
+            case '?':
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // keep stdout for the rows alone when they're meant for another program
+    messages_to_stderr = output_format != OUTPUT_TEXT;
+    // escape codes only mean something to a terminal
+    if (!isatty(fileno(message_stream))) use_color = false;
 
     char* filename = argv[1];
-    Table* table = db_open(filename);
+    Database* db = db_open(filename, &db_options);
     InputBuffer* input_buffer = new_input_buffer();
+    // writes since the last checkpoint; dirty pages are written back periodically rather than only on `.exit`
+    uint32_t writes_since_checkpoint = 0;
     while (true) {
         print_prompt();
         read_input(input_buffer); // read into the buffer
 
         // we'll handle meta-commands (`.`) separately, so `continue` after processing
         if (input_buffer->buffer[0] == '.') {
-            switch (do_meta_command(input_buffer, table)) {
+            switch (do_meta_command(input_buffer, db)) {
                 case META_COMMAND_SUCCESS:
                     continue;
                 case META_COMMAND_UNRECOGNIZED_COMMAND:
@@ -404,7 +1555,7 @@ int main(int argc, char* argv[]) {
         }
 
         Statement statement;
-        switch (prepare_statement(input_buffer, &statement))
+        switch (prepare_statement(input_buffer, &statement, db))
         {
             case PREPARE_SUCCESS:
                 break;
@@ -417,14 +1568,32 @@ int main(int argc, char* argv[]) {
             case PREPARE_STRING_TOO_LONG:
                 print_error("string too long for command: %s", input_buffer->buffer);
                 continue;
+            case PREPARE_INVALID_SCHEMA:
+                print_error("invalid table definition for command: %s", input_buffer->buffer);
+                continue;
+            case PREPARE_NO_TABLE:
+                print_error("no table in use, `use` one first: %s", input_buffer->buffer);
+                continue;
+            case PREPARE_NO_SUCH_COLUMN:
+                print_error("no such column for command: %s", input_buffer->buffer);
+                continue;
             default:
                 print_error("undocumented prepare error");
                 continue;
         }
 
-        switch (execute_statement(&statement, table)){
+        switch (execute_statement(&statement, db)){
             case EXECUTE_SUCCESS:
                 print_success("executed");
+                // batched inserts only write on `commit`
+                if (statement.type != STATEMENT_SELECT && (db->current == NULL || db->current->batch == NULL)) writes_since_checkpoint++;
+                /* also checkpoint once half the pool is dirty - with a log, dirty pages can't be evicted
+                (see `Pager.no_steal`), so the pool would otherwise fill up with them */
+                if ((checkpoint_interval && writes_since_checkpoint >= checkpoint_interval)
+                        || pager_should_checkpoint(db->pager)) {
+                    db_checkpoint(db);
+                    writes_since_checkpoint = 0;
+                }
                 break;
             case EXECUTE_FAILURE:
                 print_error("failed to execute statement: undocumented");
@@ -435,6 +1604,30 @@ int main(int argc, char* argv[]) {
             case EXECUTE_DUPLICATE_KEY:
                 print_error("failed to execute statement: duplicate key: %d", statement.row_to_insert.id);
                 continue;
+            case EXECUTE_KEY_NOT_FOUND:
+                print_error("failed to execute statement: key not found: %d", statement.min_id);
+                continue;
+            case EXECUTE_BATCH_OPEN:
+                print_error("failed to execute statement: only inserts can be batched, `commit` or `rollback` first");
+                continue;
+            case EXECUTE_NO_BATCH:
+                print_error("failed to execute statement: no batch to end, `begin` one first");
+                continue;
+            case EXECUTE_TABLE_EXISTS:
+                print_error("failed to execute statement: table already exists: %s", statement.table_name);
+                continue;
+            case EXECUTE_NO_SUCH_TABLE:
+                print_error("failed to execute statement: no such table: %s", statement.table_name);
+                continue;
+            case EXECUTE_CATALOG_FULL:
+                print_error("failed to execute statement: the catalog is full");
+                continue;
+            case EXECUTE_INDEX_EXISTS:
+                print_error("failed to execute statement: index already exists: %s", db->current->schema.columns[statement.column].name);
+                continue;
+            case EXECUTE_NO_SUCH_INDEX:
+                print_error("failed to execute statement: no such index: %s", db->current->schema.columns[statement.column].name);
+                continue;
         }
     }
 
@@ -0,0 +1,108 @@
+#pragma once
+#include "common.h"
+#include "schema.h"
+
+/*
+`select` formats rows straight from their leaf cells into one large buffer, written out with a single `fwrite`
+whenever it fills up and once at the end of the statement, rather than going through `printf` row by row.
+- text: the columns separated by spaces (`id username email` for `users`), what the REPL has always printed
+- tsv: tab-separated, with `\`, tab and newline escaped as `\\`, `\t` and `\n`
+- csv: comma-separated, a field with a `,`, `"` or newline is quoted (and its quotes doubled)
+- binary: each row exactly as stored (see `serialize_row`): a varint id, the body's size as a varint, then the body
+ints are printed in decimal, chars without their NUL padding.
+in every mode but text, stdout only carries rows: the prompt and messages go to stderr.
+*/
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static uint32_t output_length = 0;
+
+void output_flush(void) {
+    fwrite(output_buffer, 1, output_length, stdout);
+    output_length = 0;
+}
+
+/* writes the decimal digits of `value` to `destination`, returns how many */
+static uint32_t output_u32(uint32_t value, char* destination) {
+    char digits[10];
+    uint32_t num_digits = 0;
+    do {
+        digits[num_digits++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    for (uint32_t i = 0; i < num_digits; i++) destination[i] = digits[num_digits - 1 - i];
+    return num_digits;
+}
+
+static char* output_field(char* destination, const uint8_t* field, uint32_t length) {
+    switch (output_format) {
+    case OUTPUT_TSV:
+        for (uint32_t i = 0; i < length; i++) {
+            char c = field[i];
+            if (c == '\\' || c == '\t' || c == '\n') {
+                *destination++ = '\\';
+                c = c == '\t' ? 't' : c == '\n' ? 'n' : c;
+            }
+            *destination++ = c;
+        }
+        return destination;
+    case OUTPUT_CSV:
+        if (memchr(field, ',', length) || memchr(field, '"', length) || memchr(field, '\n', length)) {
+            *destination++ = '"';
+            for (uint32_t i = 0; i < length; i++) {
+                if (field[i] == '"') *destination++ = '"';
+                *destination++ = field[i];
+            }
+            *destination++ = '"';
+            return destination;
+        }
+        // nothing to quote
+        [[fallthrough]];
+    default:
+        memcpy(destination, field, length);
+        return destination + length;
+    }
+}
+
+/*
+format `row`, a row of a table with `schema`, into `start` (with room for `OUTPUT_ROW_MAX_SIZE` bytes),
+straight from the page it points into. returns the bytes written
+*/
+uint32_t output_format_row(char* start, const Schema* schema, const RowView* row) {
+    if (output_format == OUTPUT_BINARY) {
+        memcpy(start, row->cell, row->size);
+        return row->size;
+    }
+
+    char separator = output_format == OUTPUT_TSV ? '\t' : output_format == OUTPUT_CSV ? ',' : ' ';
+    char* destination = start + output_u32(row->id, start);
+    const uint8_t* position = row->body;
+    for (uint32_t i = 1; i < schema->num_columns; i++) {
+        const Column* column = &(schema->columns[i]);
+        // no need to walk the columns before this one
+        if (schema->fixed_width) position = row->body + column->offset;
+        uint32_t length;
+        const uint8_t* value = row_next_field(column, &position, &length);
+        *destination++ = separator;
+        if (column->type == COLUMN_INT) {
+            uint32_t number;
+            memcpy(&number, value, sizeof number);
+            destination += output_u32(number, destination);
+        } else {
+            destination = output_field(destination, value, length);
+        }
+    }
+    *destination++ = '\n';
+    return destination - start;
+}
+
+/* `output_format_row` into the output buffer */
+void output_row(const Schema* schema, const RowView* row) {
+    if (output_length + OUTPUT_ROW_MAX_SIZE > OUTPUT_BUFFER_SIZE) output_flush();
+    output_length += output_format_row(output_buffer + output_length, schema, row);
+}
+
+/* the value of an aggregate `select`, on a line of its own (in every format), or `null` if it has none (the min of no rows) */
+void output_value(const uint64_t* value) {
+    if (output_length + 21 > OUTPUT_BUFFER_SIZE) output_flush();
+    output_length += value ? sprintf(output_buffer + output_length, "%lu\n", *value) : sprintf(output_buffer + output_length, "null\n");
+}
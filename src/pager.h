@@ -0,0 +1,1289 @@
+#pragma once
+
+
+#include "common.h"
+#include "checksum.h"
+#include "uring.h"
+
+
+/*
+the pager is a buffer pool: a fixed number of page-sized frames, a page number -> frame hash table,
+and CLOCK eviction. `get_page` pins a page into a frame and `unpin_page` releases it.
+a pinned page's pointer stays valid until it is unpinned - after that the frame may be reused for another page.
+every `get_page` MUST be paired with an `unpin_page`.
+a page that is written to MUST be marked with `mark_page_dirty` while pinned, or the change may never reach disk.
+
+alternatively (`--mmap`), the pager maps the whole file and `get_page` returns pointers straight into the mapping.
+a large range of address space is reserved up front and the file is mapped into it in extents as it grows,
+so page pointers never move. pinning is a no-op, and the kernel decides what stays in memory.
+the mapping is private: a page that's changed becomes a copy of its own, which the kernel never writes back to the file.
+checkpoints write the dirty pages with `pwrite`, then drop the copies, so the pages are read from the OS page cache
+again. the file only changes at checkpoints, as with the pool (see `Pager.no_steal`), and the log holds the same.
+
+pages can be pinned from several threads at once (the pool's bookkeeping is under `Pager.mutex`), and each page has a
+reader-writer latch: `latch_page` pins a page and latches it shared or exclusive, `unlatch_page` undoes both.
+neither is taken unless `Pager.threaded` is set (before a second thread starts), so a single thread pays for none of it.
+latches are what let readers walk a tree while a writer changes it (see `btree_find_latched`), and they're the only
+thing that does: everything else - checkpoints, the freelist, truncation - belongs to whichever thread writes.
+
+latches only keep a reader from seeing a page halfway through a change. a scan that should see the whole tree as it was
+at one point reads through a snapshot instead (`snapshot_begin`): pages are copied on write, before their first change in
+each write (which is why a page MUST be marked dirty *before* it's changed), for as long as an open snapshot may still
+read what they held. writers never wait for a snapshot to end, and its reader only holds one page's latch at a time.
+
+every page ends in a checksum (see checksum.h), stamped whenever the page is written and checked whenever the pool reads
+it back, so a torn or damaged page stops the database rather than being read as a node. `--mmap` pages are read by
+the kernel, not the pager: only `.check` verifies those.
+
+page 0 is the file header (`DbHeader`): it records the file's format and where the freelist starts.
+the rest of it holds the catalog of tables (see catalog.h).
+pages freed by the tree go on the freelist and are handed out again by `get_unused_page_num` before the file grows.
+*/
+
+static uint32_t page_table_slot(Pager* pager, uint32_t page_num) {
+    // fibonacci hashing - page numbers are mostly sequential, spread them out
+    return (page_num * 2654435761u) & (pager->page_table_capacity - 1);
+}
+
+static uint32_t page_table_lookup(Pager* pager, uint32_t page_num) {
+    uint32_t slot = page_table_slot(pager, page_num);
+    while (pager->page_table[slot] != INVALID_FRAME) {
+        uint32_t frame_idx = pager->page_table[slot];
+        if (pager->frames[frame_idx].page_num == page_num) return frame_idx;
+        slot = (slot + 1) & (pager->page_table_capacity - 1);
+    }
+    return INVALID_FRAME;
+}
+
+static void page_table_insert(Pager* pager, uint32_t page_num, uint32_t frame_idx) {
+    uint32_t slot = page_table_slot(pager, page_num);
+    while (pager->page_table[slot] != INVALID_FRAME) {
+        slot = (slot + 1) & (pager->page_table_capacity - 1);
+    }
+    pager->page_table[slot] = frame_idx;
+}
+
+static void page_table_remove(Pager* pager, uint32_t page_num) {
+    uint32_t mask = pager->page_table_capacity - 1;
+    uint32_t slot = page_table_slot(pager, page_num);
+    while (pager->frames[pager->page_table[slot]].page_num != page_num) {
+        slot = (slot + 1) & mask;
+    }
+    /*
+    backward shift deletion: we can't just empty the slot, entries further down the probe chain would become unreachable.
+    pull every following entry that isn't already at (or past) its home slot back into the hole.
+    */
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & mask; pager->page_table[next] != INVALID_FRAME; next = (next + 1) & mask) {
+        uint32_t home = page_table_slot(pager, pager->frames[pager->page_table[next]].page_num);
+        // is `home` cyclically outside of (hole, next]? then the entry may move into the hole
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            pager->page_table[hole] = pager->page_table[next];
+            hole = next;
+        }
+    }
+    pager->page_table[hole] = INVALID_FRAME;
+}
+
+/*
+latches prefer writers: once a writer waits for a page, new readers queue up behind it. otherwise a steady stream of
+readers through the root would keep the writer out for good.
+*/
+static void latch_init(pthread_rwlock_t* latch) {
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(latch, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+}
+
+static void pager_map_grow(Pager* pager, uint32_t min_pages) {
+    uint32_t growth = pager->map_num_pages / 4;
+    if (growth < PAGER_MMAP_EXTENT_PAGES) growth = PAGER_MMAP_EXTENT_PAGES;
+    uint32_t new_num_pages = pager->map_num_pages + growth;
+    if (new_num_pages < min_pages) new_num_pages = min_pages;
+    if ((uint64_t)new_num_pages * PAGE_SIZE > PAGER_MMAP_RESERVE) {
+        log("database file would outgrow the reserved mapping: %d pages", new_num_pages);
+        exit(EXIT_FAILURE);
+    }
+
+    off_t old_length = (off_t)pager->map_num_pages * PAGE_SIZE;
+    off_t new_length = (off_t)new_num_pages * PAGE_SIZE;
+    // new pages read as zeroes, same as a fresh frame
+    if (ftruncate(pager->file_descriptor, new_length) == -1) {
+        print_error("failed to grow db file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    void* extent = mmap(
+        pager->map + old_length, new_length - old_length,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+        pager->file_descriptor, old_length
+    );
+    if (extent == MAP_FAILED) {
+        print_error("failed to map db file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->map_dirty = realloc(pager->map_dirty, new_num_pages);
+    memset(pager->map_dirty + pager->map_num_pages, 0, new_num_pages - pager->map_num_pages);
+    pager->map_num_pages = new_num_pages;
+    pager->file_length = new_length;
+}
+
+static void pager_map_open(Pager* pager) {
+    // reserve address space only; extents of the file get mapped over it with MAP_FIXED
+    pager->map = mmap(NULL, PAGER_MMAP_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pager->map == MAP_FAILED) {
+        print_error("failed to reserve address space for mmap: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->map_num_pages = 0;
+    pager->map_dirty = NULL;
+    if (pager->num_pages > 0) {
+        // map exactly what's there, no point in growing the file before anything is appended
+        uint32_t num_pages = pager->num_pages;
+        off_t length = (off_t)num_pages * PAGE_SIZE;
+        if (mmap(pager->map, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, pager->file_descriptor, 0) == MAP_FAILED) {
+            print_error("failed to map db file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->map_dirty = calloc(num_pages, 1);
+        pager->map_num_pages = num_pages;
+    }
+    pager->map_latches = calloc(PAGER_MMAP_RESERVE / PAGE_SIZE / PAGER_LATCH_CHUNK_PAGES, sizeof *pager->map_latches);
+}
+
+Pager* pager_open(const char* filename, uint32_t num_frames, bool use_mmap) {
+    int fd = open(filename,
+            O_RDWR | O_CREAT,
+            S_IWUSR | S_IRUSR
+    );
+    if (fd == -1) {
+        print_error("file could not be opened: %s", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    off_t file_length = lseek(fd, 0, SEEK_END);
+    if (file_length > 0) {
+        // an existing file has its own page size, which everything else here depends on: peek at its header first
+        DbHeader header;
+        page_size = LEGACY_PAGE_SIZE;
+        if (pread(fd, &header, sizeof header, 0) == sizeof header
+                && memcmp(header.magic, DB_FILE_MAGIC, sizeof DB_FILE_MAGIC) == 0 && header.format_version >= 8) {
+            if (!page_size_valid(header.page_size)) {
+                print_error("page size %u in the header is not a power of two from %d to %d - corrupt file", header.page_size, PAGE_MIN_SIZE, PAGE_MAX_SIZE);
+                exit(EXIT_FAILURE);
+            }
+            page_size = header.page_size;
+        }
+    }
+    Pager* pager = malloc(sizeof *pager);
+    pager->file_descriptor = fd;
+    pager->filename = strdup(filename);
+    pager->file_length = file_length;
+    pager->num_pages = file_length / PAGE_SIZE;
+    if (file_length % PAGE_SIZE != 0) {
+        print_error("database file is not a whole number of pages - corrupt file");
+        exit(EXIT_FAILURE);
+    }
+
+    pager->num_dirty = 0;
+    pager->clock_hand = 0;
+    pager->no_steal = false;
+    pager->ring = NULL;
+    pager->reaping = false;
+    pager->num_reading = 0;
+    pthread_cond_init(&(pager->read_done), NULL);
+    pager->read_ahead_max = READ_AHEAD_MAX_BYTES / PAGE_SIZE;
+    pager->map = NULL;
+    pager->map_latches = NULL;
+    pager->header_dirty = false;
+    pager->checksums = false; // until the header says the file has them
+    pager->free_pages = NULL;
+    pager->num_free_pages = 0;
+    pager->free_pages_capacity = 0;
+    pager->freelist_dirty = false;
+    pager->held_pages = NULL;
+    pager->num_held_pages = 0;
+    pager->held_pages_capacity = 0;
+    pager->holding_free_pages = false;
+    pager->threaded = false;
+    pthread_mutex_init(&(pager->mutex), NULL);
+    pager->version = 0;
+    pager->snapshots = NULL;
+    pager->num_snapshots = 0;
+    pager->snapshots_capacity = 0;
+    pager->versioned_pages = NULL;
+    pager->num_versioned_pages = 0;
+    pager->versioned_pages_capacity = 0;
+    pager->spare_versions = NULL;
+    pager->writing = false;
+    pager->snapshots_waiting = 0;
+    pthread_cond_init(&(pager->published), NULL);
+    pthread_cond_init(&(pager->opened), NULL);
+    if (use_mmap) {
+        pager->num_frames = 0;
+        pager->frames = NULL;
+        pager->page_table = NULL;
+        pager->page_table_capacity = 0;
+        pager_map_open(pager);
+        return pager;
+    }
+
+    if (num_frames < PAGER_MIN_FRAMES) num_frames = PAGER_MIN_FRAMES;
+    pager->num_frames = num_frames;
+    pager->frames = malloc(num_frames * sizeof *pager->frames);
+    // one contiguous allocation for all frames
+    char* pool = aligned_alloc(PAGE_SIZE, (size_t)num_frames * PAGE_SIZE);
+    if (pager->frames == NULL || pool == NULL) {
+        print_error("not enough memory for a pool of %u frames of %u bytes", num_frames, PAGE_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < num_frames; i++) {
+        pager->frames[i].page_num = INVALID_PAGE_NUM; // initially, no pages are loaded
+        pager->frames[i].pin_count = 0;
+        pager->frames[i].dirty = false;
+        pager->frames[i].referenced = false;
+        pager->frames[i].reading = false;
+        pager->frames[i].page = (Node*)(pool + (size_t)i * PAGE_SIZE);
+        latch_init(&(pager->frames[i].latch));
+    }
+
+    pager->page_table_capacity = 1;
+    while (pager->page_table_capacity < num_frames * 2) pager->page_table_capacity <<= 1;
+    pager->page_table = malloc(pager->page_table_capacity * sizeof *pager->page_table);
+    if (pager->page_table == NULL) {
+        print_error("not enough memory for a pool of %u frames of %u bytes", num_frames, PAGE_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < pager->page_table_capacity; i++) {
+        pager->page_table[i] = INVALID_FRAME;
+    }
+    return pager;
+}
+
+static void pager_write_frame(Pager* pager, Frame* frame) {
+    if (pager->checksums) page_stamp_checksum(frame->page, frame->page_num);
+    off_t offset = (off_t)frame->page_num * PAGE_SIZE;
+    ssize_t bytes_written = pwrite(pager->file_descriptor, frame->page, PAGE_SIZE, offset);
+    if (bytes_written == -1) {
+        print_error("failed writing to file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    // page may have been appended past EOF; a later cache miss has to read it back instead of zero-filling it
+    if (offset + PAGE_SIZE > pager->file_length) {
+        pager->file_length = offset + PAGE_SIZE;
+    }
+    frame->dirty = false;
+    pager->num_dirty--;
+}
+
+/*
+write `num_pages` mapped pages from `first_page_num` on to the file, and drop their private copies: the file holds the
+same now, so they're read from the OS page cache again
+*/
+static void pager_map_write(Pager* pager, uint32_t first_page_num, uint32_t num_pages) {
+    size_t offset = (size_t)first_page_num * PAGE_SIZE;
+    size_t length = (size_t)num_pages * PAGE_SIZE;
+    for (size_t written = 0; written < length;) {
+        ssize_t bytes_written = pwrite(pager->file_descriptor, pager->map + offset + written, length - written, offset + written);
+        if (bytes_written <= 0) {
+            print_error("failed writing to file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+        written += bytes_written;
+    }
+    madvise(pager->map + offset, length, MADV_DONTNEED);
+}
+
+void pager_flush(Pager* pager, uint32_t page_num) {
+    if (pager->map) {
+        if (page_num < pager->map_num_pages && pager->map_dirty[page_num]) {
+            if (pager->checksums) page_stamp_checksum((Node*)(pager->map + (size_t)page_num * PAGE_SIZE), page_num);
+            pager_map_write(pager, page_num, 1);
+            pager->map_dirty[page_num] = false;
+            pager->num_dirty--;
+        }
+        return;
+    }
+    uint32_t frame_idx = page_table_lookup(pager, page_num);
+    if (frame_idx == INVALID_FRAME) {
+        // page isn't cached, so whatever is on disk is already up to date
+        return;
+    }
+    Frame* frame = &(pager->frames[frame_idx]);
+    if (frame->dirty) pager_write_frame(pager, frame);
+}
+
+static void frame_mark_dirty(Pager* pager, Frame* frame) {
+    if (!frame->dirty) {
+        frame->dirty = true;
+        pager->num_dirty++;
+    }
+}
+
+/*
+CLOCK: sweep frames in a circle, giving each referenced frame a second chance (clearing its bit).
+the first unpinned, unreferenced frame is the victim. two full sweeps without a victim means everything is pinned.
+with `no_steal`, dirty frames are never victims, and a pool with nothing else left is as stuck as one that's all pinned.
+*/
+static uint32_t pager_evict(Pager* pager) {
+    for (uint32_t i = 0; i < pager->num_frames * 2; i++) {
+        uint32_t frame_idx = pager->clock_hand;
+        pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+        Frame* frame = &(pager->frames[frame_idx]);
+        if (frame->page_num == INVALID_PAGE_NUM) return frame_idx;
+        if (frame->pin_count > 0) continue;
+        if (frame->dirty && pager->no_steal) continue;
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        if (frame->dirty) pager_write_frame(pager, frame);
+        page_table_remove(pager, frame->page_num);
+        frame->page_num = INVALID_PAGE_NUM;
+        return frame_idx;
+    }
+    if (pager->no_steal && pager->num_dirty > 0) {
+        // whatever was logged is still in the log, and the file is still the last checkpoint's: reopening recovers
+        log("buffer pool is full of dirty pages (%d frames), none can be written before a checkpoint", pager->num_frames);
+        exit(EXIT_FAILURE);
+    }
+    log("buffer pool exhausted: all %d frames are pinned", pager->num_frames);
+    exit(EXIT_FAILURE);
+}
+
+/* `pager->mutex`, if other threads may be using the pool (`Pager.threaded`) */
+static void pager_lock(Pager* pager) {
+    if (pager->threaded) pthread_mutex_lock(&(pager->mutex));
+}
+
+static void pager_unlock(Pager* pager) {
+    if (pager->threaded) pthread_mutex_unlock(&(pager->mutex));
+}
+
+/* the latch of `page_num`, which is pinned. `--mmap` allocates them a chunk at a time */
+static pthread_rwlock_t* pager_latch(Pager* pager, uint32_t page_num) {
+    if (pager->map) {
+        pthread_rwlock_t** chunk = &(pager->map_latches[page_num / PAGER_LATCH_CHUNK_PAGES]);
+        if (*chunk == NULL) {
+            *chunk = malloc(PAGER_LATCH_CHUNK_PAGES * sizeof **chunk);
+            for (uint32_t i = 0; i < PAGER_LATCH_CHUNK_PAGES; i++) latch_init(&((*chunk)[i]));
+        }
+        return &((*chunk)[page_num % PAGER_LATCH_CHUNK_PAGES]);
+    }
+    return &(pager->frames[page_table_lookup(pager, page_num)].latch);
+}
+
+/* `get_page`, with `pager->mutex` held */
+static Node* pager_pin(Pager* pager, uint32_t page_num) {
+    if (pager->map) {
+        if (page_num >= pager->map_num_pages) pager_map_grow(pager, page_num + 1);
+        if (page_num >= pager->num_pages) pager->num_pages = page_num + 1;
+        return (Node*)(pager->map + (size_t)page_num * PAGE_SIZE);
+    }
+    uint32_t frame_idx = page_table_lookup(pager, page_num);
+    // another thread's prefetch is reading it in: wait for that read only. by then it may have been evicted again
+    while (frame_idx != INVALID_FRAME && pager->frames[frame_idx].reading) {
+        pthread_cond_wait(&(pager->read_done), &(pager->mutex));
+        frame_idx = page_table_lookup(pager, page_num);
+    }
+    if (frame_idx == INVALID_FRAME) {
+        // cache miss; load or create new page
+        frame_idx = pager_evict(pager);
+        Frame* frame = &(pager->frames[frame_idx]);
+        void* page = frame->page;
+        uint32_t num_pages = pager->file_length / PAGE_SIZE;
+        // there may be an extra, partial page
+        if (pager->file_length % PAGE_SIZE) {
+            num_pages += 1;
+        }
+        // we're requesting a page that's within num_pages, so it must exist on disk but not in memory. load it.
+        // (reminder that pages are 0 indexed so we check for equality as well)
+        bool on_disk = page_num < num_pages;
+        if (on_disk) {
+            off_t offset = (off_t)page_num * PAGE_SIZE;
+            // we don't have to check if it crosses file size - implementation should set off-bounds bytes to 0
+            ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE, offset);
+            if (bytes_read == -1) {
+                printf("error reading file: %d", errno);
+                exit(EXIT_FAILURE);
+            }
+            if (pager->checksums && !page_checksum_valid(page, page_num)) {
+                print_error("page %d fails its checksum - the database file is corrupt", page_num);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            // frames are reused, don't leak an evicted page's bytes into a new one
+            memset(page, 0, PAGE_SIZE);
+        }
+        // are we creating a new page? if so, increment page count
+        // we can't use `num_pages` here because it's reliant on filesize. we may not have flushed existing new pages yet.
+        if (page_num >= pager->num_pages) {
+            pager->num_pages = page_num + 1;
+        }
+        frame->page_num = page_num;
+        frame->pin_count = 0;
+        frame->dirty = false;
+        // a page that only exists in memory has to be written at some point, even if the caller forgets to dirty it
+        if (!on_disk) frame_mark_dirty(pager, frame);
+        page_table_insert(pager, page_num, frame_idx);
+    }
+    Frame* frame = &(pager->frames[frame_idx]);
+    frame->pin_count++;
+    frame->referenced = true;
+    return frame->page;
+}
+
+/* pin `page_num` into the buffer pool, loading it from disk if needed. pair with `unpin_page`. */
+Node* get_page(Pager* pager, uint32_t page_num) {
+    pager_lock(pager);
+    Node* page = pager_pin(pager, page_num);
+    pager_unlock(pager);
+    return page;
+}
+
+/* true if `get_page` would have to read `page_num` from the file, and `pager_prefetch` can read it ahead */
+bool pager_can_prefetch(Pager* pager, uint32_t page_num) {
+    if (pager->ring == NULL || pager->map) return false;
+    pager_lock(pager);
+    bool missing = page_table_lookup(pager, page_num) == INVALID_FRAME;
+    pager_unlock(pager);
+    return missing;
+}
+
+/*
+ask the OS to read `count` pages from `first_page_num` on into its cache, and carry on: it reads them in the background,
+in requests as large as the device takes, so a scan finds them there by the time it gets to them. `--mmap` asks for the
+same through the mapping.
+*/
+void pager_read_ahead(Pager* pager, uint32_t first_page_num, uint32_t count) {
+    uint32_t num_pages = pager->map ? pager->map_num_pages : pager->file_length / PAGE_SIZE;
+    if (first_page_num >= num_pages) return;
+    if (count > num_pages - first_page_num) count = num_pages - first_page_num;
+    if (pager->map) {
+        madvise(pager->map + (size_t)first_page_num * PAGE_SIZE, (size_t)count * PAGE_SIZE, MADV_WILLNEED);
+    } else {
+        posix_fadvise(pager->file_descriptor, (off_t)first_page_num * PAGE_SIZE, (off_t)count * PAGE_SIZE, POSIX_FADV_WILLNEED);
+    }
+}
+
+/* finish the reads `pager_prefetch` has in flight that are done, whichever thread asked for them, and wake `pager_pin` */
+static void pager_complete_reads(Pager* pager) {
+    uint64_t frame_idx;
+    int32_t result;
+    while (io_ring_poll(pager->ring, &frame_idx, &result)) {
+        Frame* frame = &(pager->frames[frame_idx]);
+        if (result != (int32_t)PAGE_SIZE) {
+            print_error("error reading file: %d", result < 0 ? -result : 0);
+            exit(EXIT_FAILURE);
+        }
+        if (pager->checksums && !page_checksum_valid(frame->page, frame->page_num)) {
+            print_error("page %d fails its checksum - the database file is corrupt", frame->page_num);
+            exit(EXIT_FAILURE);
+        }
+        frame->reading = false;
+        pager->num_reading--;
+        frame->pin_count--;
+        frame->referenced = true;
+    }
+    if (pager->threaded) pthread_cond_broadcast(&(pager->read_done));
+}
+
+/*
+read `page_nums` into the pool ahead of `get_page`, all at once: a scan that knows which pages come next keeps the
+device busy with all of them, rather than waiting on each in turn. pages already cached (or not yet in the file) are
+skipped, and no more than a quarter of the pool is read into at once (by all threads' prefetches together), so the
+pages the callers hold on to aren't pushed out.
+the pool isn't locked while the reads are in flight: other threads pin other pages meanwhile, and only wait for these.
+only a hint: without a ring (`--io sync`, `--mmap`), it does nothing.
+*/
+void pager_prefetch(Pager* pager, const uint32_t* page_nums, uint32_t count) {
+    if (pager->ring == NULL || pager->map) return;
+    if (count > PAGER_RING_ENTRIES) count = PAGER_RING_ENTRIES;
+    // frames of the reads this call asks for, and their pages
+    uint32_t reading[PAGER_RING_ENTRIES];
+    uint32_t reading_page_nums[PAGER_RING_ENTRIES];
+    uint32_t num_reading = 0;
+    pager_lock(pager);
+    uint32_t pages_on_disk = pager->file_length / PAGE_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page_num = page_nums[i];
+        if (page_num >= pages_on_disk || page_table_lookup(pager, page_num) != INVALID_FRAME) continue;
+        if (io_ring_space(pager->ring) == 0 || pager->num_reading >= pager->num_frames / 4) break;
+        uint32_t frame_idx = pager_evict(pager);
+        Frame* frame = &(pager->frames[frame_idx]);
+        frame->page_num = page_num;
+        // pinned until the read is done, so the next eviction doesn't take it back
+        frame->pin_count = 1;
+        frame->dirty = false;
+        frame->reading = true;
+        pager->num_reading++;
+        page_table_insert(pager, page_num, frame_idx);
+        io_ring_read(pager->ring, pager->file_descriptor, frame->page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE, frame_idx);
+        reading[num_reading] = frame_idx;
+        reading_page_nums[num_reading++] = page_num;
+    }
+    io_ring_submit(pager->ring);
+
+    /* wait for every read of ours, on the ring with the pool unlocked - or on the thread that already is. a frame whose
+    read is done may be evicted and reused before we look at it again, that's done too */
+    for (uint32_t i = 0; i < num_reading; i++) {
+        Frame* frame = &(pager->frames[reading[i]]);
+        while (frame->reading && frame->page_num == reading_page_nums[i]) {
+            if (pager->reaping) {
+                pthread_cond_wait(&(pager->read_done), &(pager->mutex));
+                continue;
+            }
+            pager->reaping = true;
+            pager_unlock(pager);
+            io_ring_await(pager->ring);
+            pager_lock(pager);
+            pager->reaping = false;
+            pager_complete_reads(pager);
+        }
+    }
+    pager_unlock(pager);
+}
+
+static VersionedPage* versioned_page_lookup(Pager* pager, uint32_t page_num) {
+    if (pager->num_versioned_pages == 0) return NULL;
+    uint32_t mask = pager->versioned_pages_capacity - 1;
+    for (uint32_t slot = (page_num * 2654435761u) & mask; pager->versioned_pages[slot].page_num != INVALID_PAGE_NUM; slot = (slot + 1) & mask) {
+        if (pager->versioned_pages[slot].page_num == page_num) return &(pager->versioned_pages[slot]);
+    }
+    return NULL;
+}
+
+/* a new entry for `page_num`, as old as any snapshot. the table grows to stay at most half full */
+static VersionedPage* versioned_page_insert(Pager* pager, uint32_t page_num) {
+    if ((pager->num_versioned_pages + 1) * 2 > pager->versioned_pages_capacity) {
+        VersionedPage* old_pages = pager->versioned_pages;
+        uint32_t old_capacity = pager->versioned_pages_capacity;
+        pager->versioned_pages_capacity = old_capacity ? old_capacity * 2 : 64;
+        pager->versioned_pages = malloc(pager->versioned_pages_capacity * sizeof *(pager->versioned_pages));
+        for (uint32_t i = 0; i < pager->versioned_pages_capacity; i++) pager->versioned_pages[i].page_num = INVALID_PAGE_NUM;
+        pager->num_versioned_pages = 0;
+        for (uint32_t i = 0; i < old_capacity; i++) {
+            if (old_pages[i].page_num != INVALID_PAGE_NUM) *versioned_page_insert(pager, old_pages[i].page_num) = old_pages[i];
+        }
+        free(old_pages);
+    }
+    uint32_t mask = pager->versioned_pages_capacity - 1;
+    uint32_t slot = (page_num * 2654435761u) & mask;
+    while (pager->versioned_pages[slot].page_num != INVALID_PAGE_NUM) slot = (slot + 1) & mask;
+    pager->versioned_pages[slot] = (VersionedPage){ .page_num = page_num, .version = 0, .versions = NULL };
+    pager->num_versioned_pages++;
+    return &(pager->versioned_pages[slot]);
+}
+
+/*
+`page_num` (pinned, at `page`) is about to be changed by the write that will be published as `version + 1`.
+if an open snapshot reads what it holds now, copy that first. the page is copied at most once per write.
+*/
+static void pager_keep_version(Pager* pager, uint32_t page_num, const Node* page) {
+    if (pager->threaded && !pager->writing) {
+        // a write starts: snapshots waiting for the last one to be published go first (see `snapshot_begin`)
+        while (pager->snapshots_waiting) pthread_cond_wait(&(pager->opened), &(pager->mutex));
+        pager->writing = true;
+    }
+    if (pager->num_snapshots == 0) return;
+    uint64_t version = pager->version + 1;
+    VersionedPage* versioned_page = versioned_page_lookup(pager, page_num);
+    if (versioned_page == NULL) versioned_page = versioned_page_insert(pager, page_num);
+    if (versioned_page->version == version) return;
+    // snapshots are oldest first: the newest one decides whether anything still reads the current contents
+    if (pager->snapshots[pager->num_snapshots - 1] >= versioned_page->version) {
+        PageVersion* kept = pager->spare_versions;
+        if (kept) {
+            pager->spare_versions = kept->older;
+        } else {
+            kept = malloc(offsetof(PageVersion, page) + PAGE_SIZE);
+        }
+        kept->since = versioned_page->version;
+        kept->until = version;
+        kept->older = versioned_page->versions;
+        memcpy(&(kept->page), page, PAGE_SIZE);
+        versioned_page->versions = kept;
+    }
+    versioned_page->version = version;
+}
+
+/*
+record that a pinned page is modified, so it's written back on eviction or checkpoint.
+call it BEFORE changing the page: open snapshots may need a copy of what it holds now.
+*/
+void mark_page_dirty(Pager* pager, uint32_t page_num) {
+    pager_lock(pager);
+    if (pager->map) {
+        pager_keep_version(pager, page_num, (Node*)(pager->map + (size_t)page_num * PAGE_SIZE));
+        if (!pager->map_dirty[page_num]) {
+            pager->map_dirty[page_num] = true;
+            pager->num_dirty++;
+        }
+        pager_unlock(pager);
+        return;
+    }
+    uint32_t frame_idx = page_table_lookup(pager, page_num);
+    if (frame_idx == INVALID_FRAME || pager->frames[frame_idx].pin_count == 0) {
+        log("tried to dirty page %d, which isn't pinned", page_num);
+        exit(EXIT_FAILURE);
+    }
+    pager_keep_version(pager, page_num, pager->frames[frame_idx].page);
+    frame_mark_dirty(pager, &(pager->frames[frame_idx]));
+    pager_unlock(pager);
+}
+
+/* `unpin_page`, with `pager->mutex` held */
+static void pager_unpin(Pager* pager, uint32_t page_num) {
+    if (pager->map) return;
+    uint32_t frame_idx = page_table_lookup(pager, page_num);
+    if (frame_idx == INVALID_FRAME || pager->frames[frame_idx].pin_count == 0) {
+        log("tried to unpin page %d, which isn't pinned", page_num);
+        exit(EXIT_FAILURE);
+    }
+    pager->frames[frame_idx].pin_count--;
+}
+
+void unpin_page(Pager* pager, uint32_t page_num) {
+    if (pager->map) return;
+    pager_lock(pager);
+    pager_unpin(pager, page_num);
+    pager_unlock(pager);
+}
+
+/*
+pin `page_num` and latch it: shared to read it, exclusive to change it. pair with `unlatch_page`.
+waiting on a latch never holds up the rest of the pool, only the threads after the same page.
+*/
+Node* latch_page(Pager* pager, uint32_t page_num, bool exclusive) {
+    if (!pager->threaded) return get_page(pager, page_num);
+    pager_lock(pager);
+    Node* page = pager_pin(pager, page_num);
+    pthread_rwlock_t* latch = pager_latch(pager, page_num);
+    pager_unlock(pager);
+    if (exclusive) {
+        pthread_rwlock_wrlock(latch);
+    } else {
+        pthread_rwlock_rdlock(latch);
+    }
+    return page;
+}
+
+/* `latch_page` shared, unless that means waiting: then the page isn't pinned or latched, and this returns NULL */
+Node* try_latch_page(Pager* pager, uint32_t page_num) {
+    if (!pager->threaded) return get_page(pager, page_num);
+    pager_lock(pager);
+    Node* page = pager_pin(pager, page_num);
+    if (pthread_rwlock_tryrdlock(pager_latch(pager, page_num)) != 0) {
+        pager_unpin(pager, page_num);
+        page = NULL;
+    }
+    pager_unlock(pager);
+    return page;
+}
+
+void unlatch_page(Pager* pager, uint32_t page_num) {
+    if (!pager->threaded) {
+        unpin_page(pager, page_num);
+        return;
+    }
+    pager_lock(pager);
+    pthread_rwlock_unlock(pager_latch(pager, page_num));
+    pager_unpin(pager, page_num);
+    pager_unlock(pager);
+}
+
+/*
+open a snapshot: until `snapshot_end`, `snapshot_get_page` reads pages as they were after the last published write
+(`snapshot_publish`), whatever is written after it. a write only keeps copies for the snapshots open when it starts,
+so a snapshot waits for the write in progress to be published, and the next write waits for it to open.
+*/
+Snapshot snapshot_begin(Pager* pager) {
+    pager_lock(pager);
+    pager->snapshots_waiting++;
+    while (pager->writing) pthread_cond_wait(&(pager->published), &(pager->mutex));
+    pager->snapshots_waiting--;
+    if (pager->threaded && pager->snapshots_waiting == 0) pthread_cond_broadcast(&(pager->opened));
+    if (pager->num_snapshots == pager->snapshots_capacity) {
+        pager->snapshots_capacity = pager->snapshots_capacity ? pager->snapshots_capacity * 2 : 8;
+        pager->snapshots = realloc(pager->snapshots, pager->snapshots_capacity * sizeof *(pager->snapshots));
+    }
+    // versions only go up, so appending keeps the snapshots oldest first
+    Snapshot snapshot = { .pager = pager, .version = pager->version };
+    pager->snapshots[pager->num_snapshots++] = snapshot.version;
+    pager_unlock(pager);
+    return snapshot;
+}
+
+/* whether an open snapshot reads a page's contents from `since` until `until` */
+static bool snapshot_reads(Pager* pager, uint64_t since, uint64_t until) {
+    for (uint32_t i = 0; i < pager->num_snapshots; i++) {
+        if (pager->snapshots[i] >= since && pager->snapshots[i] < until) return true;
+    }
+    return false;
+}
+
+/*
+close `snapshot`, and drop the page versions no open snapshot reads any more.
+they're kept around for the next copies: freeing them would hand the memory back, and faulting it in again is most of
+what a copy costs.
+*/
+void snapshot_end(Snapshot* snapshot) {
+    Pager* pager = snapshot->pager;
+    pager_lock(pager);
+    uint32_t i = 0;
+    while (pager->snapshots[i] != snapshot->version) i++;
+    memmove(&(pager->snapshots[i]), &(pager->snapshots[i + 1]), (pager->num_snapshots - i - 1) * sizeof *(pager->snapshots));
+    pager->num_snapshots--;
+    for (uint32_t slot = 0; slot < pager->versioned_pages_capacity; slot++) {
+        VersionedPage* versioned_page = &(pager->versioned_pages[slot]);
+        if (versioned_page->page_num == INVALID_PAGE_NUM) continue;
+        PageVersion** link = &(versioned_page->versions);
+        while (*link) {
+            PageVersion* kept = *link;
+            if (pager->num_snapshots && snapshot_reads(pager, kept->since, kept->until)) {
+                link = &(kept->older);
+            } else {
+                *link = kept->older;
+                kept->older = pager->spare_versions;
+                pager->spare_versions = kept;
+            }
+        }
+    }
+    // with no snapshot left, nothing needs to know which pages were written: the next one starts from a clean slate
+    if (pager->num_snapshots == 0) {
+        free(pager->versioned_pages);
+        pager->versioned_pages = NULL;
+        pager->num_versioned_pages = 0;
+        pager->versioned_pages_capacity = 0;
+    }
+    pager_unlock(pager);
+}
+
+/*
+a write (everything a statement changes) is done: snapshots opened from now on read it. with other threads reading,
+every write has to end with this - it's what lets a reader tell the changes it may see from those it may not.
+*/
+void snapshot_publish(Pager* pager) {
+    pager_lock(pager);
+    pager->version++;
+    pager->writing = false;
+    if (pager->threaded) pthread_cond_broadcast(&(pager->published));
+    pager_unlock(pager);
+}
+
+/* the copy of `page_num` that `version` reads, or NULL if that's what the page holds now */
+static Node* pager_version_as_of(Pager* pager, uint32_t page_num, uint64_t version) {
+    VersionedPage* versioned_page = versioned_page_lookup(pager, page_num);
+    if (versioned_page == NULL || versioned_page->version <= version) return NULL;
+    for (PageVersion* kept = versioned_page->versions; kept; kept = kept->older) {
+        if (kept->since <= version && version < kept->until) return &(kept->page);
+    }
+    log("page %d has no version for snapshot %lu", page_num, version);
+    exit(EXIT_FAILURE);
+}
+
+/*
+`page_num` as `snapshot` sees it, to read only. pair with `snapshot_put_page`.
+that's either the page itself, pinned and latched shared (if nothing changed it since), or a copy from before the
+write that did, which stays put until the snapshot ends.
+*/
+Node* snapshot_get_page(Snapshot* snapshot, uint32_t page_num) {
+    Pager* pager = snapshot->pager;
+    pager_lock(pager);
+    Node* page = pager_version_as_of(pager, page_num, snapshot->version);
+    pager_unlock(pager);
+    if (page) return page;
+    Node* current = latch_page(pager, page_num, false);
+    // a write may have got to it before the latch did
+    pager_lock(pager);
+    page = pager_version_as_of(pager, page_num, snapshot->version);
+    pager_unlock(pager);
+    if (page == NULL) return current;
+    unlatch_page(pager, page_num);
+    return page;
+}
+
+void snapshot_put_page(Snapshot* snapshot, uint32_t page_num, const Node* page) {
+    Pager* pager = snapshot->pager;
+    // copies live outside the pool (or the mapping), and need nothing undone
+    uintptr_t start = (uintptr_t)(pager->map ? pager->map : (char*)pager->frames[0].page);
+    uintptr_t length = pager->map ? PAGER_MMAP_RESERVE : (uintptr_t)pager->num_frames * PAGE_SIZE;
+    if ((uintptr_t)page - start < length) unlatch_page(pager, page_num);
+}
+
+/* true once enough of the pool is dirty that it's time to write some back (between statements) */
+bool pager_should_checkpoint(Pager* pager) {
+    // a mapped file has no pool to fill: its dirty pages are copies of their own until they're written
+    if (pager->map) return false;
+    return pager->num_dirty > pager->num_frames / 2;
+}
+
+static int compare_page_nums(const void* a, const void* b) {
+    uint32_t page_a = *(const uint32_t*)a;
+    uint32_t page_b = *(const uint32_t*)b;
+    return (page_a > page_b) - (page_a < page_b);
+}
+
+/* index of the first free page >= `page_num` */
+static uint32_t free_pages_lower_bound(Pager* pager, uint32_t page_num) {
+    uint32_t min_index = 0;
+    uint32_t max_index = pager->num_free_pages;
+    while (min_index < max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (pager->free_pages[index] < page_num) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index;
+}
+
+static void free_pages_append(Pager* pager, uint32_t page_num) {
+    if (pager->num_free_pages == pager->free_pages_capacity) {
+        pager->free_pages_capacity = pager->free_pages_capacity ? pager->free_pages_capacity * 2 : 64;
+        pager->free_pages = realloc(pager->free_pages, pager->free_pages_capacity * sizeof *pager->free_pages);
+    }
+    pager->free_pages[pager->num_free_pages++] = page_num;
+}
+
+static void held_pages_append(Pager* pager, uint32_t page_num) {
+    if (pager->num_held_pages == pager->held_pages_capacity) {
+        pager->held_pages_capacity = pager->held_pages_capacity ? pager->held_pages_capacity * 2 : 64;
+        pager->held_pages = realloc(pager->held_pages, pager->held_pages_capacity * sizeof *pager->held_pages);
+    }
+    pager->held_pages[pager->num_held_pages++] = page_num;
+}
+
+/* each trunk accounts for itself plus a full page of leaves */
+static uint32_t freelist_num_trunks(uint32_t num_free_pages) {
+    return (num_free_pages + FREELIST_TRUNK_MAX_LEAVES) / (FREELIST_TRUNK_MAX_LEAVES + 1);
+}
+
+/* give `page_num` back. it must not be referenced by the tree anymore. */
+void pager_free_page(Pager* pager, uint32_t page_num) {
+    if (pager->holding_free_pages) {
+        held_pages_append(pager, page_num);
+        return;
+    }
+    uint32_t index = free_pages_lower_bound(pager, page_num);
+    if (index < pager->num_free_pages && pager->free_pages[index] == page_num) {
+        log("page %d freed twice", page_num);
+        exit(EXIT_FAILURE);
+    }
+    free_pages_append(pager, page_num);
+    memmove(
+        &(pager->free_pages[index + 1]),
+        &(pager->free_pages[index]),
+        (pager->num_free_pages - 1 - index) * sizeof *pager->free_pages
+    );
+    pager->free_pages[index] = page_num;
+    pager->freelist_dirty = true;
+}
+
+/*
+allocate a page for a new node. reuses the free page closest to `near_page_num` (pass a sibling or the parent,
+nodes that are read together should sit together on disk), and only appends to the file if there are none.
+*/
+uint32_t get_unused_page_num(Pager* pager, uint32_t near_page_num) {
+    if (pager->num_free_pages == 0) return pager->num_pages;
+
+    uint32_t index = free_pages_lower_bound(pager, near_page_num);
+    if (index == pager->num_free_pages
+            || (index > 0 && near_page_num - pager->free_pages[index - 1] < pager->free_pages[index] - near_page_num)) {
+        index--;
+    }
+    uint32_t page_num = pager->free_pages[index];
+    memmove(
+        &(pager->free_pages[index]),
+        &(pager->free_pages[index + 1]),
+        (pager->num_free_pages - 1 - index) * sizeof *pager->free_pages
+    );
+    pager->num_free_pages--;
+    pager->freelist_dirty = true;
+    return page_num;
+}
+
+/*
+until the next checkpoint, only hand out pages that are free in the file as well: pages freed from now on are held back,
+and so are the freelist's trunks, which the file's freelist is read back from. that's for a change that isn't logged,
+and so may write dirty pages before its checkpoint (with `no_steal` off): all it writes then are pages the file doesn't
+use, and a crash leaves the file as the last checkpoint had it. call it right after one, `free_pages` is the file's then.
+*/
+void pager_hold_free_pages(Pager* pager) {
+    uint32_t num_trunks = freelist_num_trunks(pager->num_free_pages);
+    for (uint32_t i = 0; i < num_trunks; i++) held_pages_append(pager, pager->free_pages[i]);
+    pager->num_free_pages -= num_trunks;
+    memmove(pager->free_pages, &(pager->free_pages[num_trunks]), pager->num_free_pages * sizeof *pager->free_pages);
+    pager->holding_free_pages = true;
+}
+
+static void pager_release_free_pages(Pager* pager) {
+    for (uint32_t i = 0; i < pager->num_held_pages; i++) free_pages_append(pager, pager->held_pages[i]);
+    qsort(pager->free_pages, pager->num_free_pages, sizeof *pager->free_pages, compare_page_nums);
+    if (pager->num_held_pages) pager->freelist_dirty = true;
+    pager->num_held_pages = 0;
+    pager->holding_free_pages = false;
+}
+
+/* the rest of page 0 is the catalog's, see catalog.h */
+static void pager_write_header(Pager* pager) {
+    Node* page = get_page(pager, 0);
+    memcpy(page, &(pager->header), sizeof pager->header);
+    mark_page_dirty(pager, 0);
+    unpin_page(pager, 0);
+    pager->header_dirty = false;
+}
+
+/* turn page 0 into a fresh header (and an empty catalog). the tree must not be using it. */
+void pager_init_header(Pager* pager, uint32_t root_page_num) {
+    Node* page = get_page(pager, 0);
+    memset(page, 0, PAGE_SIZE);
+    unpin_page(pager, 0);
+    memset(&(pager->header), 0, sizeof pager->header);
+    memcpy(pager->header.magic, DB_FILE_MAGIC, sizeof DB_FILE_MAGIC);
+    pager->header.format_version = DB_FORMAT_VERSION;
+    pager->header.root_page_num = root_page_num;
+    pager->header.freelist_trunk = INVALID_PAGE_NUM;
+    pager->header.num_free_pages = 0;
+    pager->header.page_size = PAGE_SIZE;
+    pager->checksums = true;
+    pager_write_header(pager);
+}
+
+/*
+load the header and the freelist from an existing file.
+returns false if page 0 isn't a header, i.e. the file was written before there was one and page 0 is the root.
+*/
+bool pager_read_header(Pager* pager) {
+    Node* page = get_page(pager, 0);
+    memcpy(&(pager->header), page, sizeof pager->header);
+    bool valid = page_checksum_valid(page, 0);
+    unpin_page(pager, 0);
+    if (memcmp(pager->header.magic, DB_FILE_MAGIC, sizeof DB_FILE_MAGIC) != 0) return false;
+    if (pager->header.format_version > DB_FORMAT_VERSION) {
+        print_error("database file format %d is newer than this build supports (%d)", pager->header.format_version, DB_FORMAT_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    // page 0 was read before we knew whether to check it
+    pager->checksums = pager->header.format_version >= 6;
+    if (pager->checksums && !valid) {
+        print_error("page 0 fails its checksum - the database file is corrupt");
+        exit(EXIT_FAILURE);
+    }
+    // before checksums, trunks had room for one more leaf
+    uint32_t max_leaves = pager->checksums ? FREELIST_TRUNK_MAX_LEAVES : (PAGE_SIZE - sizeof(FreelistTrunkHeader)) / sizeof(uint32_t);
+
+    uint32_t trunk_page_num = pager->header.freelist_trunk;
+    while (trunk_page_num != INVALID_PAGE_NUM) {
+        if (trunk_page_num == 0 || trunk_page_num >= pager->num_pages) {
+            log("freelist trunk %d is out of bounds - ignoring the rest of the freelist", trunk_page_num);
+            break;
+        }
+        FreelistTrunk* trunk = (FreelistTrunk*)get_page(pager, trunk_page_num);
+        free_pages_append(pager, trunk_page_num);
+        const uint32_t* leaves = trunk->leaves;
+        for (uint32_t i = 0; i < trunk->num_leaves && i < max_leaves; i++) {
+            if (leaves[i] != 0 && leaves[i] < pager->num_pages) free_pages_append(pager, leaves[i]);
+        }
+        uint32_t next_trunk = trunk->next_trunk;
+        unpin_page(pager, trunk_page_num);
+        trunk_page_num = next_trunk;
+    }
+    qsort(pager->free_pages, pager->num_free_pages, sizeof *pager->free_pages, compare_page_nums);
+    if (pager->num_free_pages != pager->header.num_free_pages) {
+        log("freelist holds %d pages, header says %d", pager->num_free_pages, pager->header.num_free_pages);
+    }
+    return true;
+}
+
+/* rebuild the on-disk trunk chain from `free_pages`. the lowest free pages become the trunks. */
+static void pager_write_freelist(Pager* pager) {
+    uint32_t num_free_pages = pager->num_free_pages;
+    uint32_t num_trunks = freelist_num_trunks(num_free_pages);
+    uint32_t leaf_idx = num_trunks;
+    for (uint32_t i = 0; i < num_trunks; i++) {
+        uint32_t trunk_page_num = pager->free_pages[i];
+        FreelistTrunk* trunk = (FreelistTrunk*)get_page(pager, trunk_page_num);
+        mark_page_dirty(pager, trunk_page_num);
+        trunk->next_trunk = (i + 1 < num_trunks) ? pager->free_pages[i + 1] : INVALID_PAGE_NUM;
+        trunk->num_leaves = num_free_pages - leaf_idx;
+        if (trunk->num_leaves > FREELIST_TRUNK_MAX_LEAVES) trunk->num_leaves = FREELIST_TRUNK_MAX_LEAVES;
+        memcpy(trunk->leaves, &(pager->free_pages[leaf_idx]), trunk->num_leaves * sizeof *trunk->leaves);
+        leaf_idx += trunk->num_leaves;
+        unpin_page(pager, trunk_page_num);
+    }
+    pager->header.freelist_trunk = num_trunks ? pager->free_pages[0] : INVALID_PAGE_NUM;
+    pager->header.num_free_pages = num_free_pages;
+    pager->header_dirty = true;
+    pager->freelist_dirty = false;
+}
+
+/* `<file>-vacuum`, where a rewritten copy of the file is put together (see `pager_replace_file`) */
+static char* pager_copy_filename(Pager* pager) {
+    char* filename = malloc(strlen(pager->filename) + sizeof("-vacuum"));
+    strcpy(filename, pager->filename);
+    strcat(filename, "-vacuum");
+    return filename;
+}
+
+/* open an empty copy of the file, to write the pages of a rewritten one to. a copy a crash left behind is overwritten. */
+int pager_open_copy(Pager* pager) {
+    char* filename = pager_copy_filename(pager);
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        print_error("file could not be opened: %s", filename);
+        exit(EXIT_FAILURE);
+    }
+    free(filename);
+    return fd;
+}
+
+/* a rename is only durable once the directory holding the file is synced */
+static void pager_sync_directory(Pager* pager) {
+    const char* slash = strrchr(pager->filename, '/');
+    char* directory = slash ? strndup(pager->filename, slash - pager->filename + 1) : strdup(".");
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd == -1 || fsync(fd) == -1) {
+        print_error("failed to sync directory %s: %d", directory, errno);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    free(directory);
+}
+
+/*
+make the copy from `pager_open_copy` the database file. it holds `num_pages` pages, and `page` is its page 0 with only
+the catalog filled in: the header is added here, with an empty freelist. the copy is synced and renamed over the file,
+so the file is either the old one or the copy whatever happens. nothing may be dirty or pinned: the pool is dropped,
+and the pages are read from the copy from then on.
+*/
+void pager_replace_file(Pager* pager, int fd, uint32_t num_pages, Node* page) {
+    DbHeader header = pager->header;
+    header.freelist_trunk = INVALID_PAGE_NUM;
+    header.num_free_pages = 0;
+    memcpy(page, &header, sizeof header);
+    if (pager->checksums) page_stamp_checksum(page, 0);
+    if (pwrite(fd, page, PAGE_SIZE, 0) != (ssize_t)PAGE_SIZE) {
+        print_error("failed writing to file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (fsync(fd) == -1) {
+        print_error("failed to sync db file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    char* filename = pager_copy_filename(pager);
+    if (rename(filename, pager->filename) == -1) {
+        print_error("failed to rename %s to %s: %d", filename, pager->filename, errno);
+        exit(EXIT_FAILURE);
+    }
+    free(filename);
+    pager_sync_directory(pager);
+    close(pager->file_descriptor);
+    pager->file_descriptor = fd;
+    pager->file_length = (off_t)num_pages * PAGE_SIZE;
+    pager->num_pages = num_pages;
+
+    if (pager->map) {
+        // unmap the old file back to reserved address space, then map the copy over it
+        off_t old_length = (off_t)pager->map_num_pages * PAGE_SIZE;
+        if (mmap(pager->map, old_length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED
+                || mmap(pager->map, pager->file_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            print_error("failed to map db file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->map_dirty = realloc(pager->map_dirty, num_pages);
+        memset(pager->map_dirty, 0, num_pages);
+        pager->map_num_pages = num_pages;
+    } else {
+        for (uint32_t i = 0; i < pager->num_frames; i++) {
+            Frame* frame = &(pager->frames[i]);
+            if (frame->page_num == INVALID_PAGE_NUM) continue;
+            if (frame->pin_count > 0 || frame->dirty) {
+                log("can't replace the file, page %d is still in use", frame->page_num);
+                exit(EXIT_FAILURE);
+            }
+            page_table_remove(pager, frame->page_num);
+            frame->page_num = INVALID_PAGE_NUM;
+            frame->referenced = false;
+        }
+    }
+
+    pager->header = header;
+    pager->header_dirty = false;
+    pager->num_free_pages = 0;
+    pager->freelist_dirty = false;
+}
+
+static int compare_frames_by_page_num(const void* a, const void* b) {
+    uint32_t page_a = (*(Frame* const*)a)->page_num;
+    uint32_t page_b = (*(Frame* const*)b)->page_num;
+    return (page_a > page_b) - (page_a < page_b);
+}
+
+static uint32_t pager_map_checkpoint(Pager* pager) {
+    uint32_t num_written = 0;
+    uint32_t page_num = 0;
+    while (page_num < pager->map_num_pages) {
+        if (!pager->map_dirty[page_num]) {
+            page_num++;
+            continue;
+        }
+        uint32_t run_start = page_num;
+        while (page_num < pager->map_num_pages && pager->map_dirty[page_num]) {
+            if (pager->checksums) page_stamp_checksum((Node*)(pager->map + (size_t)page_num * PAGE_SIZE), page_num);
+            pager->map_dirty[page_num] = false;
+            page_num++;
+        }
+        pager_map_write(pager, run_start, page_num - run_start);
+        num_written += page_num - run_start;
+    }
+    pager->num_dirty = 0;
+    if (num_written && fsync(pager->file_descriptor) == -1) {
+        print_error("failed to sync db file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    return num_written;
+}
+
+/*
+write every dirty page (and only those) back to disk, then fsync.
+dirty frames are sorted by page number, and runs of adjacent pages are coalesced into a single `pwritev`.
+returns the number of pages written.
+*/
+uint32_t pager_checkpoint(Pager* pager) {
+    if (pager->holding_free_pages) pager_release_free_pages(pager);
+    if (pager->freelist_dirty) pager_write_freelist(pager);
+    if (pager->header_dirty) pager_write_header(pager);
+    if (pager->num_dirty == 0) return 0;
+    if (pager->map) return pager_map_checkpoint(pager);
+
+    Frame** dirty_frames = malloc(pager->num_dirty * sizeof *dirty_frames);
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+        Frame* frame = &(pager->frames[i]);
+        if (frame->page_num != INVALID_PAGE_NUM && frame->dirty) {
+            dirty_frames[num_dirty++] = frame;
+        }
+    }
+    qsort(dirty_frames, num_dirty, sizeof *dirty_frames, compare_frames_by_page_num);
+
+    struct iovec iov[PAGER_MAX_IOVECS];
+    uint32_t run_start = 0;
+    while (run_start < num_dirty) {
+        uint32_t run_length = 1;
+        while (run_start + run_length < num_dirty
+                && run_length < PAGER_MAX_IOVECS
+                && dirty_frames[run_start + run_length]->page_num == dirty_frames[run_start]->page_num + run_length) {
+            run_length++;
+        }
+        for (uint32_t i = 0; i < run_length; i++) {
+            if (pager->checksums) page_stamp_checksum(dirty_frames[run_start + i]->page, dirty_frames[run_start + i]->page_num);
+            iov[i].iov_base = dirty_frames[run_start + i]->page;
+            iov[i].iov_len = PAGE_SIZE;
+        }
+        off_t offset = (off_t)dirty_frames[run_start]->page_num * PAGE_SIZE;
+        ssize_t bytes_written = pwritev(pager->file_descriptor, iov, run_length, offset);
+        if (bytes_written != (ssize_t)run_length * PAGE_SIZE) {
+            print_error("failed writing to file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+        if (offset + bytes_written > pager->file_length) {
+            pager->file_length = offset + bytes_written;
+        }
+        for (uint32_t i = 0; i < run_length; i++) {
+            dirty_frames[run_start + i]->dirty = false;
+        }
+        run_start += run_length;
+    }
+    pager->num_dirty = 0;
+    free(dirty_frames);
+
+    if (fsync(pager->file_descriptor) == -1) {
+        print_error("failed to sync db file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    return num_dirty;
+}
+
+/*
+stamp every page in the file with the checksum of what it holds, and check them from now on: for a file from before
+checksums, once its nodes leave the end of the page free (see `db_upgrade_format`). whatever is dirty is written back
+first, then the file is stamped on disk, a batch of pages at a time - pages cached clean keep no checksum of their own,
+they get one when they're written again.
+*/
+void pager_stamp_checksums(Pager* pager) {
+    pager_checkpoint(pager);
+    pager->checksums = true;
+    const uint32_t batch_pages = 64;
+    Node* pages = aligned_alloc(PAGE_SIZE, (size_t)batch_pages * PAGE_SIZE);
+    for (uint32_t first = 0; first < pager->num_pages; first += batch_pages) {
+        off_t offset = (off_t)first * PAGE_SIZE;
+        ssize_t bytes_read = pread(pager->file_descriptor, pages, (size_t)batch_pages * PAGE_SIZE, offset);
+        if (bytes_read == -1) {
+            print_error("error reading file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t num_pages = bytes_read / PAGE_SIZE;
+        for (uint32_t i = 0; i < num_pages; i++) {
+            // pages never written stay that way
+            if (!page_is_zero(page_at(pages, i))) page_stamp_checksum(page_at(pages, i), first + i);
+        }
+        if (pwrite(pager->file_descriptor, pages, (size_t)num_pages * PAGE_SIZE, offset) != (ssize_t)num_pages * PAGE_SIZE) {
+            print_error("failed writing to file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(pages);
+    if (fsync(pager->file_descriptor) == -1) {
+        print_error("failed to sync db file: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* write back every dirty frame, release the pool and close the file */
+void pager_close(Pager* pager) {
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+        Frame* frame = &(pager->frames[i]);
+        if (frame->page_num != INVALID_PAGE_NUM && frame->pin_count > 0) {
+            log("page %d is still pinned (%d) on close", frame->page_num, frame->pin_count);
+        }
+    }
+    pager_checkpoint(pager);
+
+    if (pager->map) {
+        // drop the part of the last extent that was never used
+        if (ftruncate(pager->file_descriptor, (off_t)pager->num_pages * PAGE_SIZE) == -1) {
+            print_error("failed to truncate db file: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+        munmap(pager->map, PAGER_MMAP_RESERVE);
+        free(pager->map_dirty);
+        for (uint32_t i = 0; i < PAGER_MMAP_RESERVE / PAGE_SIZE / PAGER_LATCH_CHUNK_PAGES; i++) free(pager->map_latches[i]);
+        free(pager->map_latches);
+    } else {
+        // all frame pages live in the single allocation starting at frame 0
+        free(pager->frames[0].page);
+        free(pager->frames);
+        free(pager->page_table);
+    }
+
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        print_error("failed to close db file");
+        exit(EXIT_FAILURE);
+    }
+    if (pager->ring) io_ring_close(pager->ring);
+    free(pager->filename);
+    free(pager->free_pages);
+    free(pager->held_pages);
+    free(pager->snapshots);
+    free(pager->versioned_pages);
+    while (pager->spare_versions) {
+        PageVersion* spare = pager->spare_versions;
+        pager->spare_versions = spare->older;
+        free(spare);
+    }
+    free(pager);
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include "common.h"
+#include "pager.h"
+#include "btree.h"
+#include "output.h"
+
+/*
+a parallel scan cuts a range of a table's keys along the tree: each child of the root holds the keys up to its key in the
+root (and above the previous child's), each of their children a slice of that, and so on. the range is cut into those
+slices (`ScanRange`s, each a whole subtree) a level at a time, until there are `SCAN_RANGES_PER_WORKER` per worker.
+workers are dealt the ranges round-robin, take their own from the front and, once out of them, steal from the back of
+whoever has the most left - so a worker stuck with slow ranges (rows to filter, pages to read from disk) doesn't hold up
+the scan. they all read through one snapshot, so together they see the table as of one point, like a serial scan does.
+what a worker does with a range is up to `ParallelScan.scan_range`: filters and aggregates run there, in the worker,
+rows go to the range's own buffer (`scan_output_row`) and counts and sums into its `aggregate`, merged as it's done. ranges are written out in key order - the first range not yet
+written goes out as it fills, the ones after it wait in memory until it's done - or, unless `ordered`, whenever they fill.
+the thread that starts a scan is its first worker. nothing else in the REPL runs on other threads, so the pager is only
+switched to `threaded` while a scan's other workers run (see `Pager.threaded`).
+*/
+
+/* the children of `node` that hold keys of `range`, as ranges of their own, appended to `ranges` */
+static uint32_t scan_split_range(InternalNode* node, const ScanRange* range, ScanRange* ranges) {
+    InternalCell children[INTERNAL_NODE_MAX_CHILDREN];
+    uint32_t num_children = internal_node_get_children(node, children);
+    uint32_t num_ranges = 0;
+    uint64_t min_key = range->min_key;
+    for (uint32_t i = 0; i < num_children && min_key <= range->max_key; i++) {
+        // the last child also holds every key above the node's max
+        uint32_t max_key = i == num_children - 1 || children[i].key > range->max_key ? range->max_key : children[i].key;
+        if (min_key <= max_key) {
+            ranges[num_ranges++] = (ScanRange){ .page_num = children[i].child, .min_key = min_key, .max_key = max_key };
+        }
+        if (children[i].key >= min_key) min_key = (uint64_t)children[i].key + 1;
+    }
+    return num_ranges;
+}
+
+/* cut `min_key..max_key` into about `num_ranges` subtrees: one level of the tree at a time, down to the leaves at most */
+static void scan_partition(ParallelScan* scan, uint32_t min_key, uint32_t max_key, uint32_t num_ranges) {
+    uint32_t capacity = 1;
+    scan->ranges = malloc(capacity * sizeof *(scan->ranges));
+    scan->ranges[0] = (ScanRange){ .page_num = scan->table->root_page_num, .min_key = min_key, .max_key = max_key };
+    scan->num_ranges = 1;
+    bool split = true;
+    while (scan->num_ranges < num_ranges && split) {
+        split = false;
+        ScanRange* ranges = scan->ranges;
+        uint32_t num_level_ranges = scan->num_ranges;
+        capacity = 0;
+        scan->ranges = NULL;
+        scan->num_ranges = 0;
+        for (uint32_t i = 0; i < num_level_ranges; i++) {
+            if (scan->num_ranges + INTERNAL_NODE_MAX_CHILDREN > capacity) {
+                capacity = capacity * 2 + INTERNAL_NODE_MAX_CHILDREN;
+                scan->ranges = realloc(scan->ranges, capacity * sizeof *(scan->ranges));
+            }
+            Node* node = snapshot_get_page(&(scan->snapshot), ranges[i].page_num);
+            if (node->common_header.type == NODE_INTERNAL) {
+                scan->num_ranges += scan_split_range((InternalNode*)node, &(ranges[i]), &(scan->ranges[scan->num_ranges]));
+                split = true;
+            } else {
+                scan->ranges[scan->num_ranges++] = ranges[i];
+            }
+            snapshot_put_page(&(scan->snapshot), ranges[i].page_num, node);
+        }
+        free(ranges);
+    }
+}
+
+/* point `cursor` at the first row of `range`, see `btree_seek_snapshot` */
+void scan_seek(ParallelScan* scan, const ScanRange* range, Cursor* cursor) {
+    btree_seek_subtree_snapshot(scan->table, &(scan->snapshot), range->page_num, range->min_key, cursor);
+}
+
+static void scan_write(ScanRange* range) {
+    fwrite(range->output, 1, range->output_length, stdout);
+    range->output_length = 0;
+}
+
+/* `range`'s buffer is full: write it out if that keeps the rows in order, grow it otherwise */
+static void scan_output_full(ParallelScan* scan, ScanRange* range) {
+    pthread_mutex_lock(&(scan->output_mutex));
+    bool write = !scan->ordered || &(scan->ranges[scan->next_output]) == range;
+    if (write) scan_write(range);
+    pthread_mutex_unlock(&(scan->output_mutex));
+    if (!write) {
+        range->output_capacity *= 2;
+        range->output = realloc(range->output, range->output_capacity);
+    }
+}
+
+/* format `row` into `range`'s buffer, see `output_format_row` */
+void scan_output_row(ParallelScan* scan, ScanRange* range, const Schema* schema, const RowView* row) {
+    if (range->output == NULL) {
+        range->output_capacity = SCAN_OUTPUT_BUFFER_SIZE;
+        range->output = malloc(range->output_capacity);
+    }
+    if (range->output_length + OUTPUT_ROW_MAX_SIZE > range->output_capacity) scan_output_full(scan, range);
+    range->output_length += output_format_row(range->output + range->output_length, schema, row);
+}
+
+/* add what `other` counted to `aggregate` */
+void aggregate_merge(Aggregate* aggregate, const Aggregate* other) {
+    if (other->count == 0) return;
+    if (aggregate->count == 0 || other->min < aggregate->min) aggregate->min = other->min;
+    if (aggregate->count == 0 || other->max > aggregate->max) aggregate->max = other->max;
+    aggregate->count += other->count;
+    aggregate->sum += other->sum;
+}
+
+/* `range` is scanned: write out what it holds, if it's its turn, and the ranges after it that were waiting for it */
+static void scan_range_done(ParallelScan* scan, ScanRange* range) {
+    pthread_mutex_lock(&(scan->output_mutex));
+    range->done = true;
+    aggregate_merge(&(scan->aggregate), &(range->aggregate));
+    if (!scan->ordered) {
+        scan_write(range);
+        free(range->output);
+    }
+    while (scan->ordered && scan->next_output < scan->num_ranges && scan->ranges[scan->next_output].done) {
+        ScanRange* next = &(scan->ranges[scan->next_output++]);
+        scan_write(next);
+        free(next->output);
+    }
+    pthread_mutex_unlock(&(scan->output_mutex));
+}
+
+/* the next range `worker` scans: its own first, then the last of whoever has the most left. false once there's none */
+static bool scan_next_range(ScanWorker* worker, uint32_t* range_index) {
+    pthread_mutex_lock(&(worker->mutex));
+    bool found = worker->head < worker->tail;
+    if (found) *range_index = worker->ranges[worker->head++];
+    pthread_mutex_unlock(&(worker->mutex));
+    while (!found) {
+        ParallelScan* scan = worker->scan;
+        ScanWorker* victim = NULL;
+        uint32_t most_left = 0;
+        for (uint32_t i = 0; i < scan->num_workers; i++) {
+            ScanWorker* other = &(scan->workers[i]);
+            pthread_mutex_lock(&(other->mutex));
+            uint32_t left = other->tail - other->head;
+            pthread_mutex_unlock(&(other->mutex));
+            if (left > most_left) {
+                victim = other;
+                most_left = left;
+            }
+        }
+        if (victim == NULL) return false;
+        // it may have run out since, then look again
+        pthread_mutex_lock(&(victim->mutex));
+        found = victim->head < victim->tail;
+        if (found) *range_index = victim->ranges[--victim->tail];
+        pthread_mutex_unlock(&(victim->mutex));
+    }
+    return true;
+}
+
+static void* scan_worker_run(void* argument) {
+    ScanWorker* worker = argument;
+    ParallelScan* scan = worker->scan;
+    uint32_t range_index;
+    while (scan_next_range(worker, &range_index)) {
+        ScanRange* range = &(scan->ranges[range_index]);
+        scan->scan_range(scan, range);
+        scan_range_done(scan, range);
+    }
+    return NULL;
+}
+
+/*
+scan the rows of `table` with keys `min_key..max_key` on `num_workers` threads, calling `scan_range` (with `argument`)
+for every range it's cut into, and write out what they output - in key order, if `ordered`.
+returns what they added up.
+*/
+Aggregate parallel_scan(
+    Table* table, uint32_t min_key, uint32_t max_key, uint32_t num_workers, bool ordered,
+    void (*scan_range)(ParallelScan* scan, ScanRange* range), void* argument
+) {
+    Pager* pager = table->pager;
+    // every worker keeps a page pinned
+    if (!pager->map && num_workers > pager->num_frames / 2) num_workers = pager->num_frames / 2;
+    ParallelScan scan = {
+        .table = table, .snapshot = snapshot_begin(pager), .scan_range = scan_range, .argument = argument, .ordered = ordered,
+    };
+    scan_partition(&scan, min_key, max_key, num_workers > 1 ? num_workers * SCAN_RANGES_PER_WORKER : 1);
+    // not enough of the tree to go around (a root leaf, or a short range)
+    if (scan.num_ranges < num_workers) num_workers = scan.num_ranges ? scan.num_ranges : 1;
+    scan.num_workers = num_workers;
+    scan.workers = calloc(num_workers, sizeof *(scan.workers));
+    pthread_mutex_init(&(scan.output_mutex), NULL);
+    for (uint32_t i = 0; i < num_workers; i++) {
+        ScanWorker* worker = &(scan.workers[i]);
+        worker->scan = &scan;
+        pthread_mutex_init(&(worker->mutex), NULL);
+        // dealt round-robin, so in key order the ranges finish about in turn, and few wait to be written out
+        worker->ranges = malloc((scan.num_ranges / num_workers + 1) * sizeof *(worker->ranges));
+        for (uint32_t j = i; j < scan.num_ranges; j += num_workers) worker->ranges[worker->tail++] = j;
+    }
+
+    bool threaded = pager->threaded;
+    if (num_workers > 1) pager->threaded = true;
+    for (uint32_t i = 1; i < num_workers; i++) {
+        if (pthread_create(&(scan.workers[i].thread), NULL, scan_worker_run, &(scan.workers[i])) != 0) {
+            log("could not start a scan thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    scan_worker_run(&(scan.workers[0]));
+    for (uint32_t i = 1; i < num_workers; i++) pthread_join(scan.workers[i].thread, NULL);
+    pager->threaded = threaded;
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        pthread_mutex_destroy(&(scan.workers[i].mutex));
+        free(scan.workers[i].ranges);
+    }
+    pthread_mutex_destroy(&(scan.output_mutex));
+    free(scan.workers);
+    free(scan.ranges);
+    snapshot_end(&(scan.snapshot));
+    return scan.aggregate;
+}
@@ -0,0 +1,216 @@
+#pragma once
+#include "common.h"
+
+/*
+rows are encoded and decoded from their table's schema at runtime.
+the key (the first column) is the cell's varint id, every other column goes into the row's body, in order
+(see `ColumnType` for how each type is laid out).
+a schema without text columns is fixed width: every body has the same size and every column sits at the same offset,
+so encoding writes the columns in place, and decoding reads any of them without walking the ones before it.
+*/
+
+static const char* column_type_names[] = {
+    [COLUMN_INT] = "int",
+    [COLUMN_TEXT] = "text",
+    [COLUMN_CHAR] = "char",
+};
+
+/* parse a whole token as an unsigned 32-bit number: a key, or an int column */
+bool parse_u32(const char* string, uint32_t* value) {
+    if (string == NULL || *string < '0' || *string > '9') return false;
+    char* end;
+    errno = 0;
+    unsigned long parsed = strtoul(string, &end, 10);
+    if (*end != '\0' || errno || parsed > UINT32_MAX) return false;
+    *value = parsed;
+    return true;
+}
+
+/* table and column names: letters, digits and `_`, not starting with a digit */
+bool schema_valid_name(const char* name) {
+    size_t length = strlen(name);
+    if (length == 0 || length > TABLE_NAME_MAX_SIZE || (*name >= '0' && *name <= '9')) return false;
+    for (size_t i = 0; i < length; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) return false;
+    }
+    return true;
+}
+
+/*
+fill in what follows from the columns: offsets, the largest body and whether it's fixed width.
+returns false if the schema is invalid: no key, a key that isn't an int, repeated names or rows that could be too large.
+*/
+bool schema_finish(Schema* schema) {
+    if (schema->num_columns < 1 || schema->num_columns > TABLE_MAX_COLUMNS || schema->columns[0].type != COLUMN_INT) {
+        return false;
+    }
+    schema->fixed_width = true;
+    schema->max_body_size = 0;
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        Column* column = &(schema->columns[i]);
+        if (!schema_valid_name(column->name)) return false;
+        for (uint32_t j = 0; j < i; j++) {
+            if (strcmp(schema->columns[j].name, column->name) == 0) return false;
+        }
+        if (i == 0) continue;
+        column->offset = schema->max_body_size;
+        if (column->type == COLUMN_TEXT) {
+            schema->fixed_width = false;
+            schema->max_body_size += 1 + column->size;
+        } else {
+            schema->max_body_size += column->size;
+        }
+    }
+    return schema->max_body_size <= ROW_MAX_BODY_SIZE;
+}
+
+/* the `users` table: the one table there was before the catalog, and the one every new database starts with */
+void schema_default(Schema* schema) {
+    *schema = (Schema){
+        .num_columns = 3,
+        .columns = {
+            {.name = "id", .type = COLUMN_INT, .size = sizeof(uint32_t)},
+            {.name = "username", .type = COLUMN_TEXT, .size = COLUMN_USERNAME_SIZE},
+            {.name = "email", .type = COLUMN_TEXT, .size = COLUMN_EMAIL_SIZE},
+        },
+    };
+    schema_finish(schema);
+}
+
+/* `int`, `text(N)` or `char(N)`, with N from 1 to 255 */
+static bool schema_parse_type(char* type, Column* column) {
+    if (strcmp(type, "int") == 0) {
+        column->type = COLUMN_INT;
+        column->size = sizeof(uint32_t);
+        return true;
+    }
+    char* open = strchr(type, '(');
+    size_t length = strlen(type);
+    if (open == NULL || type[length - 1] != ')') return false;
+    *open = '\0';
+    type[length - 1] = '\0';
+    if (strcmp(type, "text") == 0) {
+        column->type = COLUMN_TEXT;
+    } else if (strcmp(type, "char") == 0) {
+        column->type = COLUMN_CHAR;
+    } else {
+        return false;
+    }
+    return parse_u32(open + 1, &(column->size)) && column->size >= 1 && column->size <= UINT8_MAX;
+}
+
+/* the column list of `create table`: `(name type, name type, ...)` */
+PrepareResult schema_parse(char* columns, Schema* schema) {
+    size_t length = strlen(columns);
+    if (*columns != '(' || length < 2 || columns[length - 1] != ')') return PREPARE_SYNTAX_ERROR;
+    columns[length - 1] = '\0';
+
+    memset(schema, 0, sizeof *schema);
+    char* save;
+    for (char* definition = strtok_r(columns + 1, ",", &save); definition; definition = strtok_r(NULL, ",", &save)) {
+        if (schema->num_columns == TABLE_MAX_COLUMNS) return PREPARE_INVALID_SCHEMA;
+        char* name = strtok(definition, " ");
+        char* type = strtok(NULL, " ");
+        if (name == NULL || type == NULL || strtok(NULL, " ") != NULL) return PREPARE_SYNTAX_ERROR;
+        Column* column = &(schema->columns[schema->num_columns++]);
+        if (strlen(name) > TABLE_NAME_MAX_SIZE) return PREPARE_INVALID_SCHEMA;
+        strcpy(column->name, name);
+        if (!schema_parse_type(type, column)) return PREPARE_SYNTAX_ERROR;
+    }
+    return schema_finish(schema) ? PREPARE_SUCCESS : PREPARE_INVALID_SCHEMA;
+}
+
+/* position of the column called `name`, or -1 if there's none */
+int32_t schema_find_column(const Schema* schema, const char* name) {
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        if (strcmp(schema->columns[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+/* the column list, the way `create table` takes it */
+void schema_print(const Schema* schema) {
+    printf("(");
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        const Column* column = &(schema->columns[i]);
+        printf("%s%s %s", i ? ", " : "", column->name, column_type_names[column->type]);
+        if (column->type != COLUMN_INT) printf("(%d)", column->size);
+    }
+    printf(")");
+}
+
+/*
+encode a row from the strings `values`, one per column after the key.
+fails on an int that doesn't parse or a string longer than its column.
+*/
+PrepareResult row_encode(const Schema* schema, uint32_t id, char** values, Row* row) {
+    row->id = id;
+    if (schema->fixed_width) {
+        // NUL padding for the chars
+        memset(row->body, 0, schema->max_body_size);
+        row->size = schema->max_body_size;
+    } else {
+        row->size = 0;
+    }
+    for (uint32_t i = 1; i < schema->num_columns; i++) {
+        const Column* column = &(schema->columns[i]);
+        const char* value = values[i - 1];
+        uint8_t* destination = row->body + (schema->fixed_width ? column->offset : row->size);
+        uint32_t length = column->type == COLUMN_INT ? sizeof(uint32_t) : strlen(value);
+        switch (column->type) {
+        case COLUMN_INT: {
+            uint32_t number;
+            if (!parse_u32(value, &number)) return PREPARE_SYNTAX_ERROR;
+            memcpy(destination, &number, sizeof number);
+            break;
+        } case COLUMN_TEXT:
+            if (length > column->size) return PREPARE_STRING_TOO_LONG;
+            *destination++ = length;
+            memcpy(destination, value, length);
+            length += 1;
+            break;
+        case COLUMN_CHAR:
+            if (length > column->size) return PREPARE_STRING_TOO_LONG;
+            memcpy(destination, value, length);
+            if (!schema->fixed_width) memset(destination + length, 0, column->size - length);
+            length = column->size;
+            break;
+        }
+        if (!schema->fixed_width) row->size += length;
+    }
+    return PREPARE_SUCCESS;
+}
+
+/*
+the value of `column`, which starts at `*position` in a row's body, and moves `*position` past it.
+returns the value's bytes, `*length` of them: an int's 4, or the characters of a text or char (without padding).
+*/
+const uint8_t* row_next_field(const Column* column, const uint8_t** position, uint32_t* length) {
+    const uint8_t* value = *position;
+    switch (column->type) {
+    case COLUMN_TEXT:
+        *length = *value++;
+        *position = value + *length;
+        return value;
+    case COLUMN_CHAR:
+        *length = strnlen((const char*)value, column->size);
+        *position = value + column->size;
+        return value;
+    default:
+        *length = sizeof(uint32_t);
+        *position = value + sizeof(uint32_t);
+        return value;
+    }
+}
+
+/* the value of column `column_idx` (not the key) in a row's `body`, like `row_next_field` */
+const uint8_t* row_field(const Schema* schema, const uint8_t* body, uint32_t column_idx, uint32_t* length) {
+    const uint8_t* position = body;
+    if (schema->fixed_width) {
+        position += schema->columns[column_idx].offset;
+    } else {
+        for (uint32_t i = 1; i < column_idx; i++) row_next_field(&(schema->columns[i]), &position, length);
+    }
+    return row_next_field(&(schema->columns[column_idx]), &position, length);
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "common.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+searching the sorted keys of an internal node (`InternalNode._keys`) without branching on them: a few halvings, each
+picking a half with a conditional move rather than a jump, narrow the keys down to a block, then a kernel counts the keys
+in the block below the one searched for. AVX2 compares 8 keys at once and SSE 4, turning each compare into a bitmask and
+counting its bits (POPCNT, which came with SSE 4.2); the portable kernel adds up one compare per key. blocks fit the
+kernel: whatever is cheaper to compare than to halve. which kernel runs is picked at startup, from what the CPU supports.
+*/
+
+typedef uint32_t (*KeyCountKernel)(const uint32_t* keys, uint32_t count, uint32_t key);
+
+static uint32_t keys_count_less_scalar(const uint32_t* keys, uint32_t count, uint32_t key) {
+    uint32_t less = 0;
+    for (uint32_t i = 0; i < count; i++) less += keys[i] < key;
+    return less;
+}
+
+#if defined(__x86_64__)
+/*
+the vector kernels load whole vectors, up to 7 keys past the block: they are masked out of the count. an internal node
+always has that much room after its keys (its children follow them).
+compares are signed, so keys and the key have their top bit flipped first, which orders them as if they were unsigned
+*/
+__attribute__((target("sse4.2,popcnt")))
+static uint32_t keys_count_less_sse4(const uint32_t* keys, uint32_t count, uint32_t key) {
+    const __m128i flip = _mm_set1_epi32(INT32_MIN);
+    const __m128i needle = _mm_xor_si128(_mm_set1_epi32(key), flip);
+    uint32_t less = 0;
+    for (uint32_t i = 0; i < count; i += 4) {
+        __m128i vector = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), flip);
+        uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(needle, vector)));
+        if (count - i < 4) mask &= (1u << (count - i)) - 1;
+        less += __builtin_popcount(mask);
+    }
+    return less;
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint32_t keys_count_less_avx2(const uint32_t* keys, uint32_t count, uint32_t key) {
+    const __m256i flip = _mm256_set1_epi32(INT32_MIN);
+    const __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(key), flip);
+    uint32_t less = 0;
+    for (uint32_t i = 0; i < count; i += 8) {
+        __m256i vector = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), flip);
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, vector)));
+        if (count - i < 8) mask &= (1u << (count - i)) - 1;
+        less += __builtin_popcount(mask);
+    }
+    return less;
+}
+#endif
+
+static KeyCountKernel key_count_kernel = keys_count_less_scalar;
+static uint32_t key_search_block = 8; // keys left for the kernel to count
+
+/* use `kernel` for every search from now on, counting blocks of up to `block` keys. `key_search_init` picks one */
+void key_search_use(KeyCountKernel kernel, uint32_t block) {
+    key_count_kernel = kernel;
+    key_search_block = block;
+}
+
+/* the kernel in use, for messages */
+const char* key_search_kernel_name(void) {
+#if defined(__x86_64__)
+    if (key_count_kernel == keys_count_less_avx2) return "avx2";
+    if (key_count_kernel == keys_count_less_sse4) return "sse4.2";
+#endif
+    return "scalar";
+}
+
+__attribute__((constructor))
+static void key_search_init(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init(); // before anything else runs, so it has to be asked to look
+    if (!__builtin_cpu_supports("popcnt")) return;
+    if (__builtin_cpu_supports("avx2")) {
+        key_search_use(keys_count_less_avx2, 32);
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        key_search_use(keys_count_less_sse4, 16);
+    }
+#endif
+}
+
+/* how many of the `num_keys` sorted `keys` are less than `key`: the position of `key`, or of the first key above it */
+static inline uint32_t keys_lower_bound(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    uint32_t base = 0;
+    uint32_t remaining = num_keys;
+    // the answer is always between `base` and `base + remaining`: every key before `base` is less than `key`
+    while (remaining > key_search_block) {
+        uint32_t half = remaining / 2;
+        base = keys[base + half - 1] < key ? base + half : base;
+        remaining -= half;
+    }
+    return base + key_count_kernel(keys + base, remaining, key);
+}
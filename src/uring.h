@@ -0,0 +1,160 @@
+#pragma once
+#include "common.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+/*
+asynchronous reads through io_uring, straight on the system calls (there's no liburing to link). the kernel shares two
+rings with us: requests go in the submission ring (`io_ring_read`), and results come back in the completion ring
+(`io_ring_poll`), so any number of reads can be in flight at once - the device works through them together instead of
+one after the other. `io_ring_open` returns NULL where the kernel doesn't have it (or doesn't allow it), and the pager
+reads with plain system calls instead.
+only reads: writes to the file are buffered, they're over once the OS has a copy, and it's the `fsync` after them that
+waits on the device (with all of them in flight at once already). through the ring they only took longer, handed off to
+the kernel's worker threads.
+the ring has no lock: the pager only uses it with `Pager.mutex` held, but for `io_ring_await`, which only waits.
+*/
+
+struct _IoRing {
+    int fd;
+    uint32_t entries;
+    uint32_t queued; // requests in the submission ring, not yet submitted
+    uint32_t in_flight; // submitted, not yet completed
+    // the submission ring: indexes into `sqes`, the kernel takes them from `sq_head` up to `sq_tail`
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t sq_mask;
+    uint32_t* sq_array;
+    struct io_uring_sqe* sqes;
+    // the completion ring: the kernel adds them up to `cq_tail`, we take them from `cq_head`
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+/* a ring for up to `entries` requests at once (a power of two), or NULL if io_uring can't be used */
+IoRing* io_ring_open(uint32_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd == -1) return NULL;
+
+    IoRing* ring = calloc(1, sizeof *ring);
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        log("could not map the io_uring rings: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    uint8_t* sq = ring->sq_ring;
+    ring->sq_head = (uint32_t*)(sq + params.sq_off.head);
+    ring->sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(sq + params.sq_off.array);
+    uint8_t* cq = ring->cq_ring;
+    ring->cq_head = (uint32_t*)(cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+void io_ring_close(IoRing* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    free(ring);
+}
+
+/* how many more requests fit before some have to complete: completions have room for twice `entries`, this keeps it at that */
+uint32_t io_ring_space(IoRing* ring) {
+    return ring->entries - ring->queued - ring->in_flight;
+}
+
+/* hand what's queued to the kernel, and wait until at least `min_complete` requests are done */
+static void io_ring_enter(IoRing* ring, uint32_t min_complete) {
+    uint32_t to_submit = ring->queued;
+    while (true) {
+        int submitted = syscall(
+            __NR_io_uring_enter, ring->fd, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0
+        );
+        if (submitted >= 0) {
+            ring->queued -= submitted;
+            ring->in_flight += submitted;
+            return;
+        }
+        if (errno != EINTR) {
+            log("io_uring_enter failed: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* the next free request in the submission ring. the caller checked `io_ring_space` */
+static struct io_uring_sqe* io_ring_request(IoRing* ring, uint8_t opcode, int fd, uint64_t tag) {
+    uint32_t tail = *(ring->sq_tail);
+    uint32_t index = tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &(ring->sqes[index]);
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = tag;
+    ring->sq_array[index] = index;
+    // the request has to be all there before the kernel can see the new tail
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return sqe;
+}
+
+/* queue a read of `length` bytes at `offset` into `buffer`, which has to stay put until it completes */
+void io_ring_read(IoRing* ring, int fd, void* buffer, uint32_t length, off_t offset, uint64_t tag) {
+    struct io_uring_sqe* sqe = io_ring_request(ring, IORING_OP_READ, fd, tag);
+    sqe->addr = (uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = offset;
+}
+
+/* hand everything queued to the kernel, without waiting for any of it */
+void io_ring_submit(IoRing* ring) {
+    while (ring->queued) io_ring_enter(ring, 0);
+}
+
+/*
+wait until a completion is there to take, or was already. only the kernel's side of the ring is touched, so it can be
+waited on while other threads queue and take requests - as long as something is in flight
+*/
+void io_ring_await(IoRing* ring) {
+    while (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1) {
+        if (errno != EINTR) {
+            log("io_uring_enter failed: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* take a completed request, if there is one: its `tag`, and its `result` (bytes read, or -errno) */
+bool io_ring_poll(IoRing* ring, uint64_t* tag, int32_t* result) {
+    uint32_t head = *(ring->cq_head);
+    // the completion has to be all there once we see the tail past it
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return false;
+    struct io_uring_cqe* cqe = &(ring->cqes[head & ring->cq_mask]);
+    *tag = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->in_flight--;
+    return true;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+
+#include "common.h"
+
+
+/*
+write-ahead log, stored next to the database file as `<file>-wal`.
+each statement appends a compact logical redo record:
+    [type: u8][payload length: u16][payload][checksum: u32]
+where an insert's or update's payload is the serialized row, same as a leaf cell (see `serialize_row`):
+    [key: varint][body size: varint][body]
+and a delete's is just the key. a batch of inserts (`commit`, or a multi-row `insert`) starts with a batch record
+holding the number of inserts that follow: replay skips the whole batch unless all of them made it to the log.
+records go to table 0 until a table record (holding a table id) switches to another one.
+records are buffered and written + fsynced once per statement (`SYNC_FULL`) or once per `group_size` statements
+(`SYNC_GROUP`). on open, records are replayed on top of the database file, which holds no page written between
+checkpoints (see `Pager.no_steal`), so no statement is in it halfway. it may hold some of the log already (see
+`db_recover`), replaying all of it again still ends up in the same state. checkpointing truncates the log.
+*/
+
+constexpr const uint32_t WAL_RECORD_HEADER_SIZE = sizeof(uint8_t) + sizeof(uint16_t);
+constexpr const uint32_t WAL_RECORD_CHECKSUM_SIZE = sizeof(uint32_t);
+
+static uint32_t wal_checksum(const uint8_t* data, uint32_t length) {
+    // FNV-1a; only needs to catch a torn tail, not adversaries
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+char* wal_filename(const char* db_filename) {
+    char* filename = malloc(strlen(db_filename) + sizeof("-wal"));
+    strcpy(filename, db_filename);
+    strcat(filename, "-wal");
+    return filename;
+}
+
+Wal* wal_open(const char* db_filename, SyncMode sync_mode, uint32_t group_size) {
+    char* filename = wal_filename(db_filename);
+    int fd = open(filename,
+            O_RDWR | O_CREAT | O_APPEND,
+            S_IWUSR | S_IRUSR
+    );
+    if (fd == -1) {
+        print_error("log file could not be opened: %s", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    Wal* wal = malloc(sizeof *wal);
+    wal->file_descriptor = fd;
+    wal->filename = filename;
+    wal->sync_mode = sync_mode;
+    wal->group_size = group_size ? group_size : 1;
+    wal->pending_statements = 0;
+    wal->table_id = 0;
+    wal->buffer_capacity = PAGE_SIZE;
+    wal->buffer = malloc(wal->buffer_capacity);
+    wal->buffer_length = 0;
+    return wal;
+}
+
+static uint8_t* wal_reserve(Wal* wal, uint32_t length) {
+    if (wal->buffer_length + length > wal->buffer_capacity) {
+        while (wal->buffer_length + length > wal->buffer_capacity) wal->buffer_capacity *= 2;
+        wal->buffer = realloc(wal->buffer, wal->buffer_capacity);
+    }
+    uint8_t* record = wal->buffer + wal->buffer_length;
+    wal->buffer_length += length;
+    return record;
+}
+
+static void wal_log_record(Wal* wal, WalRecordType type, const uint8_t* payload, uint32_t payload_length) {
+    uint8_t* record = wal_reserve(wal, WAL_RECORD_HEADER_SIZE + payload_length + WAL_RECORD_CHECKSUM_SIZE);
+    record[0] = type;
+    uint16_t length_field = payload_length;
+    memcpy(record + 1, &length_field, sizeof length_field);
+    memcpy(record + WAL_RECORD_HEADER_SIZE, payload, payload_length);
+    uint32_t checksum = wal_checksum(record, WAL_RECORD_HEADER_SIZE + payload_length);
+    memcpy(record + WAL_RECORD_HEADER_SIZE + payload_length, &checksum, sizeof checksum);
+}
+
+/* a record whose whole payload is a varint: a delete's key, a batch's number of rows, a table id */
+static void wal_log_number(Wal* wal, WalRecordType type, uint32_t value) {
+    uint8_t payload[5];
+    wal_log_record(wal, type, payload, varint_encode(value, payload));
+}
+
+static void wal_log_row(Wal* wal, WalRecordType type, Row* row) {
+    uint8_t payload[ROW_MAX_SIZE];
+    wal_log_record(wal, type, payload, serialize_row(row, payload));
+}
+
+/* point the records that follow at `table_id`, unless they already go there */
+static void wal_use_table(Wal* wal, uint32_t table_id) {
+    if (wal->table_id == table_id) return;
+    wal_log_number(wal, WAL_RECORD_TABLE, table_id);
+    wal->table_id = table_id;
+}
+
+void wal_log_insert(Wal* wal, uint32_t table_id, Row* row) {
+    wal_use_table(wal, table_id);
+    wal_log_row(wal, WAL_RECORD_INSERT, row);
+}
+
+void wal_log_update(Wal* wal, uint32_t table_id, Row* row) {
+    wal_use_table(wal, table_id);
+    wal_log_row(wal, WAL_RECORD_UPDATE, row);
+}
+
+void wal_log_delete(Wal* wal, uint32_t table_id, uint32_t id) {
+    wal_use_table(wal, table_id);
+    wal_log_number(wal, WAL_RECORD_DELETE, id);
+}
+
+void wal_log_batch(Wal* wal, uint32_t table_id, RowBatch* rows) {
+    wal_use_table(wal, table_id);
+    wal_log_number(wal, WAL_RECORD_BATCH, rows->num_rows);
+    for (uint32_t i = 0; i < rows->num_rows; i++) {
+        const uint8_t* cell = row_batch_cell(rows, i);
+        wal_log_record(wal, WAL_RECORD_INSERT, cell, serialized_row_size(cell));
+    }
+}
+
+/* write out buffered records and fsync, making every committed statement durable */
+void wal_sync(Wal* wal) {
+    if (wal->buffer_length > 0) {
+        ssize_t bytes_written = write(wal->file_descriptor, wal->buffer, wal->buffer_length);
+        if (bytes_written != (ssize_t)wal->buffer_length) {
+            print_error("failed writing to log: %d", errno);
+            exit(EXIT_FAILURE);
+        }
+        wal->buffer_length = 0;
+    }
+    if (fdatasync(wal->file_descriptor) == -1) {
+        print_error("failed to sync log: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    wal->pending_statements = 0;
+}
+
+/* mark the end of a statement. depending on the sync mode, this makes it (and any before it) durable. */
+void wal_commit(Wal* wal) {
+    wal->pending_statements++;
+    if (wal->sync_mode == SYNC_FULL || wal->pending_statements >= wal->group_size) {
+        wal_sync(wal);
+    }
+}
+
+/* drop the whole log. only valid once every logged change is in the (synced) database file. */
+void wal_reset(Wal* wal) {
+    wal->buffer_length = 0;
+    wal->pending_statements = 0;
+    wal->table_id = 0;
+    if (ftruncate(wal->file_descriptor, 0) == -1 || fsync(wal->file_descriptor) == -1) {
+        print_error("failed to truncate log: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* read the on-disk log into memory for `wal_next_record`. caller frees the returned buffer. */
+uint8_t* wal_read_all(Wal* wal, uint32_t* length) {
+    off_t file_length = lseek(wal->file_descriptor, 0, SEEK_END);
+    uint8_t* contents = malloc(file_length > 0 ? file_length : 1);
+    ssize_t bytes_read = pread(wal->file_descriptor, contents, file_length, 0);
+    if (bytes_read == -1) {
+        print_error("error reading log: %d", errno);
+        exit(EXIT_FAILURE);
+    }
+    *length = bytes_read;
+    return contents;
+}
+
+/*
+decode the record at `*offset` into `row` (only its id for a delete, the number of rows for a batch, the table id for
+a table record) and advance `*offset` past it. `legacy_rows`: the log was written before format version 4,
+with rows in the old layout (see `deserialize_legacy_row`).
+returns `WAL_RECORD_END` at the end of the log, or where the log stops making sense - a record torn by a crash mid-write
+fails its checksum, and nothing after it was ever acknowledged.
+*/
+WalRecordType wal_next_record(const uint8_t* log, uint32_t length, uint32_t* offset, Row* row, bool legacy_rows) {
+    if (*offset + WAL_RECORD_HEADER_SIZE > length) return WAL_RECORD_END;
+    const uint8_t* record = log + *offset;
+    uint16_t payload_length;
+    memcpy(&payload_length, record + 1, sizeof payload_length);
+    uint32_t record_length = WAL_RECORD_HEADER_SIZE + payload_length + WAL_RECORD_CHECKSUM_SIZE;
+    if (*offset + record_length > length) return WAL_RECORD_END;
+    uint32_t checksum;
+    memcpy(&checksum, record + WAL_RECORD_HEADER_SIZE + payload_length, sizeof checksum);
+    if (checksum != wal_checksum(record, WAL_RECORD_HEADER_SIZE + payload_length)) return WAL_RECORD_END;
+    WalRecordType type = record[0];
+    if (type < WAL_RECORD_INSERT || type > WAL_RECORD_TABLE) return WAL_RECORD_END;
+
+    const uint8_t* payload = record + WAL_RECORD_HEADER_SIZE;
+    if (type != WAL_RECORD_INSERT && type != WAL_RECORD_UPDATE) {
+        if (varint_decode(payload, payload_length, &(row->id)) != payload_length) return WAL_RECORD_END;
+    } else if (legacy_rows) {
+        if (deserialize_legacy_row(payload, payload_length, row) != payload_length) return WAL_RECORD_END;
+    } else if (deserialize_row(payload, payload_length, row) != payload_length) {
+        return WAL_RECORD_END;
+    }
+
+    *offset += record_length;
+    return type;
+}
+
+/* close and delete the log. only valid once it has been reset, i.e. everything is checkpointed. */
+void wal_close(Wal* wal) {
+    if (close(wal->file_descriptor) == -1) {
+        print_error("failed to close log file");
+        exit(EXIT_FAILURE);
+    }
+    unlink(wal->filename);
+    free(wal->filename);
+    free(wal->buffer);
+    free(wal);
+}